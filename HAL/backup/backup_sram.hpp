@@ -0,0 +1,281 @@
+#ifndef BACKUP_SRAM_HPP
+#define BACKUP_SRAM_HPP
+
+#include "../peripheral.hpp"
+#include "../crc/crc_software.hpp"
+
+#include <cstring>
+
+namespace HAL {
+    namespace Backup {
+        typedef PWR_TypeDef raw_pwr_t;
+
+        constexpr __pointer sram_base = BKPSRAM_BASE;
+        constexpr uint32_t sram_size = 0x1000;
+
+        /**
+         * Cause of the last reset, from the RCC_CSR flags. A power-on reset also sets the
+         * brownout and pin flags, and every internal reset sets the pin flag, so they are
+         * checked in this order.
+         */
+        enum class ResetCause {
+            POWER_ON,
+            BROWNOUT,
+            INDEPENDENT_WATCHDOG,
+            WINDOW_WATCHDOG,
+            LOW_POWER,
+            SOFTWARE,
+            PIN
+        };
+
+        /**
+         * Domain (type)
+         *
+         * Backup domain: backup SRAM (4 KB), RTC and backup registers. They survive every
+         * reset but power-on, and keep their content on VBAT when VDD is off if the backup
+         * regulator is on.
+         *
+         * NOTE: these functions are thread-safe ONLY inside miosix environment,
+         *       in other environments you have to ensure it other ways.
+         */
+        class Domain {
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_pwr_t* const pwr_base = (raw_pwr_t*) Peripheral::p_PWR::periph_base;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        private:
+#ifdef _MIOSIX
+            static void modify(volatile uint32_t& reg, uint32_t clear_mask, uint32_t value) {
+                miosix::FastInterruptDisableLock dLock;
+                reg = (reg & ~clear_mask) | value;
+            }
+#else
+            static void modify(volatile uint32_t& reg, uint32_t clear_mask, uint32_t value) {
+                reg = (reg & ~clear_mask) | value;
+            }
+#endif
+
+        public:
+            /**
+             * Enables write access to the backup domain and the backup SRAM clock.
+             *
+             * @param retain_on_vbat: turns on the backup regulator (and waits for it), so
+             *        that the backup SRAM keeps its content on VBAT
+             */
+            static void enable(bool retain_on_vbat = true) {
+                Peripheral::p_PWR::enable();
+                enableWrites();
+                Peripheral::p_BKPSRAM::enable();
+
+                if (retain_on_vbat) {
+                    modify(pwr_base->CSR, 0, PWR_CSR_BRE);
+                    while (!(pwr_base->CSR & PWR_CSR_BRR));
+                }
+            }
+
+            /**
+             * Write access (PWR_CR DBP) is also needed by the RTC and the backup registers.
+             */
+            static void enableWrites() {
+                modify(pwr_base->CR, 0, PWR_CR_DBP);
+            }
+
+            static void disableWrites() {
+                modify(pwr_base->CR, PWR_CR_DBP, 0);
+            }
+
+            static bool retainsOnVbat() {
+                return (pwr_base->CSR & PWR_CSR_BRR) != 0;
+            }
+
+            /**
+             * @param clear: clears the flags, so that the next reset is told apart
+             */
+            static ResetCause resetCause(bool clear = true) {
+                uint32_t csr = RCC->CSR;
+                ResetCause cause = csr & RCC_CSR_PORRSTF ? ResetCause::POWER_ON :
+                                   csr & RCC_CSR_BORRSTF ? ResetCause::BROWNOUT :
+                                   csr & RCC_CSR_WDGRSTF ? ResetCause::INDEPENDENT_WATCHDOG :
+                                   csr & RCC_CSR_WWDGRSTF ? ResetCause::WINDOW_WATCHDOG :
+                                   csr & RCC_CSR_LPWRRSTF ? ResetCause::LOW_POWER :
+                                   csr & RCC_CSR_SFTRSTF ? ResetCause::SOFTWARE : ResetCause::PIN;
+
+                if (clear)
+                    modify(RCC->CSR, 0, RCC_CSR_RMVF);
+                return cause;
+            }
+        };
+
+        namespace detail {
+            template<typename T>
+            struct Slot {
+                uint32_t sequence;
+                uint32_t crc;
+                T value;
+            };
+
+            template<typename T>
+            constexpr uint32_t recordSize() {
+                return (2 * sizeof(Slot<T>) + 3) & ~3u;
+            }
+
+            template<unsigned I, typename... T>
+            struct TypeAt;
+
+            template<typename H, typename... T>
+            struct TypeAt<0, H, T...> {
+                typedef H type;
+            };
+
+            template<unsigned I, typename H, typename... T>
+            struct TypeAt<I, H, T...> : TypeAt<I - 1, T...> {};
+
+            // Bytes taken by the first I records
+            template<unsigned I, typename... T>
+            struct OffsetOf {
+                static constexpr uint32_t value = 0;
+            };
+
+            template<unsigned I, typename H, typename... T>
+            struct OffsetOf<I, H, T...> {
+                static constexpr uint32_t value = I == 0 ? 0 : recordSize<H>() + OffsetOf<I - 1, T...>::value;
+            };
+        }
+
+        /**
+         * Record (type)
+         *
+         * A T kept in backup SRAM at OFFSET, in two slots written alternately. Each slot
+         * holds a sequence number and a CRC-32 of it and of the value: load() returns the
+         * newest slot whose CRC matches, so a store() cut by a reset leaves the previous
+         * value readable, and garbage after a power loss is never mistaken for data.
+         *
+         * store() costs a copy of T and a software CRC of it (a few cycles per byte): a
+         * state of some tens of bytes can be saved every control loop period.
+         *
+         * T must be trivially copyable. Domain::enable() must have been called.
+         */
+        template<typename T, uint32_t OFFSET>
+        class Record {
+            static_assert(OFFSET % 4 == 0, "records must be word aligned");
+            static_assert(OFFSET + detail::recordSize<T>() <= sram_size, "the record doesn't fit the backup SRAM");
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr uint32_t offset = OFFSET;
+            static constexpr uint32_t size = detail::recordSize<T>();
+
+        private:
+            // Slot holding the newest value, -1 if unknown or none
+            int current = -1;
+            uint32_t sequence = 0;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        private:
+            static detail::Slot<T> *slots() {
+                return (detail::Slot<T> *) (sram_base + OFFSET);
+            }
+
+            static uint32_t checksum(uint32_t sequence, const T& value) {
+                const uint8_t prefix[4] = {(uint8_t) sequence, (uint8_t) (sequence >> 8),
+                                           (uint8_t) (sequence >> 16), (uint8_t) (sequence >> 24)};
+
+                uint32_t crc = Crc::Software::update(Crc::Mode::ZLIB, Crc::initial_value, prefix, 4);
+                crc = Crc::Software::update(Crc::Mode::ZLIB, crc, (const uint8_t *) &value, sizeof(T));
+                return Crc::Software::finalize(Crc::Mode::ZLIB, crc);
+            }
+
+            static bool validSlot(unsigned i) {
+                const detail::Slot<T>& slot = slots()[i];
+                return slot.crc == checksum(slot.sequence, slot.value);
+            }
+
+        public:
+            /**
+             * Reads the newest valid value.
+             *
+             * @return false if no valid value is stored (value is unchanged)
+             */
+            bool load(T& value) {
+                bool valid0 = validSlot(0);
+                bool valid1 = validSlot(1);
+
+                if (!valid0 && !valid1) {
+                    current = -1;
+                    return false;
+                }
+
+                if (valid0 && valid1)
+                    current = (int32_t) (slots()[1].sequence - slots()[0].sequence) > 0 ? 1 : 0;
+                else
+                    current = valid1 ? 1 : 0;
+
+                sequence = slots()[current].sequence;
+                memcpy(&value, &slots()[current].value, sizeof(T));
+                return true;
+            }
+
+            /**
+             * Saves value in the slot not holding the newest one.
+             */
+            void store(const T& value) {
+                if (current < 0) {
+                    // Don't overwrite a valid value that was never loaded
+                    T previous;
+                    load(previous);
+                }
+
+                unsigned target = current == 0 ? 1 : 0;
+                detail::Slot<T>& slot = slots()[target];
+                uint32_t next = sequence + 1;
+
+                memcpy(&slot.value, &value, sizeof(T));
+                slot.sequence = next;
+                slot.crc = checksum(next, value);
+
+                current = target;
+                sequence = next;
+            }
+
+            /**
+             * Discards the stored value.
+             */
+            void invalidate() {
+                slots()[0].crc = ~checksum(slots()[0].sequence, slots()[0].value);
+                slots()[1].crc = ~checksum(slots()[1].sequence, slots()[1].value);
+                current = -1;
+            }
+        };
+
+        /**
+         * Layout (type)
+         *
+         * Packs records of the given types one after the other from the start of the
+         * backup SRAM, and checks at compile time that they fit.
+         *
+         * Example:
+         *     typedef Backup::Layout<Calibration, LoopState> layout;
+         *     layout::record<1> state;
+         *     if (!state.load(loop_state)) ...
+         */
+        template<typename... T>
+        struct Layout {
+            template<unsigned I>
+            using record = Record<typename detail::TypeAt<I, T...>::type, detail::OffsetOf<I, T...>::value>;
+
+            static constexpr uint32_t size = detail::OffsetOf<sizeof...(T), T...>::value;
+            static_assert(size <= sram_size, "the records don't fit the backup SRAM");
+        };
+    }
+}
+
+#endif //BACKUP_SRAM_HPP
@@ -21,14 +21,28 @@ namespace HAL {
             static constexpr __pointer enable_register = _enable_register;
             static constexpr __mask prescaler_mask = _prescaler_mask;
 
+            /**
+             * @return the bus prescaler as a power of two: 0 for AHB buses, whose clock is
+             * HCLK (SystemCoreClock already includes the AHB prescaler), 0 to 4 for APB
+             */
+            static uint32_t prescaler_shift() {
+                uint32_t bits = (RCC->CFGR & prescaler_mask) / (prescaler_mask & (~prescaler_mask + 1));
+
+                if (prescaler_mask == RCC_CFGR_HPRE || !(bits & 0x4))
+                    return 0;
+                return (bits & 0x3) + 1;
+            }
+
             static uint32_t bus_freq() {
-                uint32_t base_freq = SystemCoreClock;
-                uint32_t prescaler_bits = (RCC->CFGR & prescaler_mask);
+                return SystemCoreClock >> prescaler_shift();
+            }
 
-                uint32_t active_bit = prescaler_bits & ((prescaler_mask + 1) >> 1);
-                if (active_bit)
-                    base_freq /= ((base_freq - active_bit) / (base_freq & (-base_freq)));
-                return base_freq;
+            /**
+             * @return the kernel clock of the timers on this bus: twice the bus clock when
+             * the APB prescaler is not 1
+             */
+            static uint32_t timer_freq() {
+                return prescaler_shift() ? bus_freq() * 2 : bus_freq();
             }
         };
 
@@ -58,6 +72,11 @@ namespace HAL {
                 (__pointer) &(RCC->AHB2ENR),
                 (__mask) RCC_CFGR_HPRE
         > b_AHB2;
+        typedef Bus<
+                (__pointer) (FSMC_R_BASE),
+                (__pointer) &(RCC->AHB3ENR),
+                (__mask) RCC_CFGR_HPRE
+        > b_AHB3;
     }
 }
 
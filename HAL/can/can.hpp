@@ -0,0 +1,412 @@
+#ifndef CAN_HPP
+#define CAN_HPP
+
+#include "can_filter.hpp"
+#include "../clock/clock.hpp"
+
+namespace HAL {
+    namespace Can {
+
+        enum class Mode : uint32_t {
+            NORMAL = 0,
+            LOOPBACK = CAN_BTR_LBKM,
+            SILENT = CAN_BTR_SILM,
+            SILENT_LOOPBACK = CAN_BTR_LBKM | CAN_BTR_SILM
+        };
+
+        /**
+         * Options for Controller::start(), to be OR-ed together. Values are the
+         * corresponding CAN_MCR bits.
+         *
+         * AUTO_BUS_OFF: leaves bus-off by itself after 128 x 11 recessive bits
+         * AUTO_WAKEUP: leaves sleep on bus activity
+         * NO_RETRANSMISSION: a frame is sent once, even if it fails
+         * RX_FIFO_LOCKED: a full FIFO drops new frames rather than the oldest
+         * TX_FIFO_ORDER: mailboxes sent in request order, not by identifier
+         */
+        enum Option : uint32_t {
+            AUTO_BUS_OFF = CAN_MCR_ABOM,
+            AUTO_WAKEUP = CAN_MCR_AWUM,
+            NO_RETRANSMISSION = CAN_MCR_NART,
+            RX_FIFO_LOCKED = CAN_MCR_RFLM,
+            TX_FIFO_ORDER = CAN_MCR_TXFP
+        };
+
+        /**
+         * A CAN frame. On reception, filter is the filter number that accepted it (FMI)
+         * and timestamp the bit time counter at its start of frame.
+         */
+        struct Frame {
+            uint32_t id;
+            bool extended;
+            bool remote;
+            uint8_t length;
+            uint8_t filter;
+            uint16_t timestamp;
+            uint8_t data[8];
+        };
+
+        //***************************
+        //* Bit timing solver       *
+        //***************************
+
+        /**
+         * Bit timing, in time quanta of prescaler PCLK1 periods: one quantum of
+         * synchronisation, segment1 before the sample point, segment2 after it.
+         */
+        struct BitTiming {
+            uint32_t prescaler;
+            uint32_t segment1;
+            uint32_t segment2;
+            bool feasible;
+
+            /**
+             * @return the CAN_BTR timing fields
+             */
+            constexpr uint32_t value(uint32_t jump_width = 1) const {
+                return ((jump_width - 1) << 24) | ((segment2 - 1) << 20) | ((segment1 - 1) << 16) | (prescaler - 1);
+            }
+        };
+
+        namespace detail {
+            constexpr uint32_t segment1(uint32_t quanta, uint32_t sample_permille) {
+                return (quanta * sample_permille + 500) / 1000 - 1;
+            }
+
+            constexpr bool fits(uint32_t pclk, uint32_t bitrate, uint32_t quanta, uint32_t sample_permille) {
+                return pclk % (bitrate * quanta) == 0 && pclk / (bitrate * quanta) <= 1024 &&
+                       segment1(quanta, sample_permille) >= 1 && segment1(quanta, sample_permille) <= 16 &&
+                       quanta - 1 - segment1(quanta, sample_permille) >= 1 &&
+                       quanta - 1 - segment1(quanta, sample_permille) <= 8;
+            }
+
+            constexpr BitTiming bitTiming(uint32_t pclk, uint32_t bitrate, uint32_t sample_permille,
+                                          uint32_t quanta) {
+                return quanta < 8 ? BitTiming{1, 1, 1, false} :
+                       fits(pclk, bitrate, quanta, sample_permille) ?
+                       BitTiming{pclk / (bitrate * quanta), segment1(quanta, sample_permille),
+                                 quanta - 1 - segment1(quanta, sample_permille), true} :
+                       bitTiming(pclk, bitrate, sample_permille, quanta - 1);
+            }
+        }
+
+        /**
+         * Finds the bit timing with the most time quanta (25 down to 8) that divides
+         * PCLK1 exactly and puts the sample point nearest to sample_permille of the bit.
+         *
+         * Example:
+         *     static_assert(Can::bitTiming(42000000, 1000000).feasible, "no exact 1 Mbit/s timing");
+         */
+        constexpr BitTiming bitTiming(uint32_t pclk, uint32_t bitrate, uint32_t sample_permille = 875) {
+            return detail::bitTiming(pclk, bitrate, sample_permille, 25);
+        }
+
+        /**
+         * @return the interrupts of a controller: transmit, FIFO 0, FIFO 1, status change
+         */
+        constexpr IRQn_Type txIrq(__pointer base) {
+            return base == CAN1_BASE ? CAN1_TX_IRQn : CAN2_TX_IRQn;
+        }
+
+        constexpr IRQn_Type rxIrq(__pointer base, uint8_t fifo) {
+            return base == CAN1_BASE ? (fifo ? CAN1_RX1_IRQn : CAN1_RX0_IRQn) : (fifo ? CAN2_RX1_IRQn : CAN2_RX0_IRQn);
+        }
+
+        constexpr IRQn_Type sceIrq(__pointer base) {
+            return base == CAN1_BASE ? CAN1_SCE_IRQn : CAN2_SCE_IRQn;
+        }
+
+        /**
+         * Controller (type)
+         *
+         * bxCAN controller (P is p_CAN1 or p_CAN2): bit timing, three transmit mailboxes,
+         * two receive FIFOs of three frames. Frames are filtered by the banks loaded with
+         * Filters::configure(), which must be called before start() to receive anything.
+         *
+         * The bit timing follows PCLK1 changes (Clock::Control::apply()): the controller
+         * goes back to initialization mode, off the bus, for the time of the rewrite. If
+         * the new PCLK1 has no exact timing for the bitrate it stays there, rather than
+         * rejoin at a wrong bitrate, and retimeFailed() tells; start() recovers.
+         *
+         * NOTE: these functions are thread-safe ONLY inside miosix environment,
+         *       in other environments you have to ensure it other ways.
+         */
+        template<typename P>
+        class Controller : private Clock::Listener {
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_can_t* const periph_base = (raw_can_t*) P::periph_base;
+
+            static constexpr unsigned mailboxes = 3;
+
+            // Polling iterations before initialization mode is declared stuck
+            static constexpr uint32_t timeout = 0x100000;
+
+        private:
+            uint32_t bitrate = 0;
+            uint32_t sample_permille = 875;
+            uint32_t mode = 0;
+            bool retime_failed = false;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        private:
+#ifdef _MIOSIX
+            static void modify(volatile uint32_t& reg, uint32_t clear_mask, uint32_t value) {
+                miosix::FastInterruptDisableLock dLock;
+                reg = (reg & ~clear_mask) | value;
+            }
+#else
+            static void modify(volatile uint32_t& reg, uint32_t clear_mask, uint32_t value) {
+                reg = (reg & ~clear_mask) | value;
+            }
+#endif
+
+            static bool waitFor(uint32_t mask, uint32_t value) {
+                for (uint32_t i = 0; i < timeout; i++)
+                    if ((periph_base->MSR & mask) == value)
+                        return true;
+                return false;
+            }
+
+            static bool enterInit() {
+                periph_base->MCR = (periph_base->MCR & ~CAN_MCR_SLEEP) | CAN_MCR_INRQ;
+                return waitFor(CAN_MSR_INAK | CAN_MSR_SLAK, CAN_MSR_INAK);
+            }
+
+            // Leaves initialization mode once 11 recessive bits are seen on the bus
+            static bool exitInit() {
+                periph_base->MCR &= ~CAN_MCR_INRQ;
+                return waitFor(CAN_MSR_INAK, 0);
+            }
+
+            bool program() {
+                BitTiming timing = bitTiming(P::bus::bus_freq(), bitrate, sample_permille);
+                if (!timing.feasible)
+                    return false;
+
+                periph_base->BTR = timing.value() | mode;
+                return true;
+            }
+
+            static void retime(Clock::Listener& listener) {
+                Controller& controller = static_cast<Controller&>(listener);
+                if (!controller.bitrate || !enterInit())
+                    return;
+
+                // Off the bus until start(): a wrong bitrate would disturb every node
+                controller.retime_failed = !controller.program();
+                if (!controller.retime_failed)
+                    exitInit();
+            }
+
+        public:
+            Controller() : Clock::Listener(retime) {}
+
+            /**
+             * Joins the bus.
+             *
+             * @param options: Option values OR-ed together
+             * @return false if PCLK1 has no exact timing for bitrate, or if the bus
+             *         stays dominant
+             */
+            bool start(uint32_t bitrate, uint32_t options = AUTO_BUS_OFF, Mode mode = Mode::NORMAL,
+                       uint32_t sample_permille = 875) {
+                // The filters, and the CAN2 receive path, need the CAN1 clock
+                Peripheral::p_CAN1::enable();
+                P::enable();
+
+                if (!enterInit())
+                    return false;
+
+                this->bitrate = bitrate;
+                this->sample_permille = sample_permille;
+                this->mode = (uint32_t) mode;
+                retime_failed = false;
+
+                periph_base->MCR = CAN_MCR_INRQ | options;
+                if (!program())
+                    return false;
+
+                return exitInit();
+            }
+
+            /**
+             * Back to initialization mode, off the bus.
+             */
+            void stop() {
+                bitrate = 0;
+                retime_failed = false;
+                enterInit();
+            }
+
+            /**
+             * @return true if a clock change left the controller off the bus, PCLK1
+             * having no exact timing for the bitrate
+             */
+            bool retimeFailed() const {
+                return retime_failed;
+            }
+
+            /**
+             * Enables the interrupts of the events OR-ed in ier (CAN_IER bits), and their
+             * vectors in the NVIC.
+             */
+            void enableInterrupts(uint32_t ier) {
+                modify(periph_base->IER, 0, ier);
+
+                if (ier & CAN_IER_TMEIE)
+                    NVIC_EnableIRQ(txIrq(P::periph_base));
+                if (ier & (CAN_IER_FMPIE0 | CAN_IER_FFIE0 | CAN_IER_FOVIE0))
+                    NVIC_EnableIRQ(rxIrq(P::periph_base, 0));
+                if (ier & (CAN_IER_FMPIE1 | CAN_IER_FFIE1 | CAN_IER_FOVIE1))
+                    NVIC_EnableIRQ(rxIrq(P::periph_base, 1));
+                if (ier & (CAN_IER_ERRIE | CAN_IER_WKUIE | CAN_IER_SLKIE))
+                    NVIC_EnableIRQ(sceIrq(P::periph_base));
+            }
+
+            void disableInterrupts(uint32_t ier) {
+                modify(periph_base->IER, ier, 0);
+            }
+
+            /**
+             * @return a free transmit mailbox, -1 if all are busy
+             */
+            static int freeMailbox() {
+                uint32_t tsr = periph_base->TSR;
+                return tsr & CAN_TSR_TME0 ? 0 : tsr & CAN_TSR_TME1 ? 1 : tsr & CAN_TSR_TME2 ? 2 : -1;
+            }
+
+            /**
+             * Queues frame in a mailbox.
+             *
+             * @return the mailbox used, -1 if all are busy
+             */
+            static int send(const Frame& frame) {
+                int mailbox = freeMailbox();
+                if (mailbox >= 0)
+                    send(mailbox, frame);
+                return mailbox;
+            }
+
+            /**
+             * Queues frame in mailbox, which must be free.
+             */
+            static void send(int mailbox, const Frame& frame) {
+                CAN_TxMailBox_TypeDef& box = periph_base->sTxMailBox[mailbox];
+
+                box.TIR = (frame.extended ? (frame.id << 3) | CAN_TI0R_IDE : frame.id << 21) |
+                          (frame.remote ? CAN_TI0R_RTR : 0);
+                box.TDTR = frame.length & CAN_TDT0R_DLC;
+                box.TDLR = frame.data[0] | (frame.data[1] << 8) | (frame.data[2] << 16) | ((uint32_t) frame.data[3] << 24);
+                box.TDHR = frame.data[4] | (frame.data[5] << 8) | (frame.data[6] << 16) | ((uint32_t) frame.data[7] << 24);
+                box.TIR |= CAN_TI0R_TXRQ;
+            }
+
+            /**
+             * Requests the abort of a pending transmission: the mailbox is freed unless
+             * the frame is already on the bus.
+             */
+            static void abort(int mailbox) {
+                periph_base->TSR = CAN_TSR_ABRQ0 << (8 * mailbox);
+            }
+
+            static bool mailboxFree(int mailbox) {
+                return (periph_base->TSR & (CAN_TSR_TME0 << mailbox)) != 0;
+            }
+
+            /**
+             * @return the identifier register (CAN_TIxR) of a mailbox
+             */
+            static uint32_t mailboxId(int mailbox) {
+                return periph_base->sTxMailBox[mailbox].TIR;
+            }
+
+            /**
+             * Acknowledges the completion flags of a mailbox.
+             *
+             * @return true if its last frame was sent, false if it failed or was aborted
+             */
+            static bool complete(int mailbox) {
+                uint32_t tsr = periph_base->TSR;
+                periph_base->TSR = CAN_TSR_RQCP0 << (8 * mailbox);
+                return (tsr & (CAN_TSR_TXOK0 << (8 * mailbox))) != 0;
+            }
+
+            /**
+             * @return the frames waiting in a receive FIFO (0-3)
+             */
+            static uint32_t pending(uint8_t fifo) {
+                return (fifo ? periph_base->RF1R : periph_base->RF0R) & CAN_RF0R_FMP0;
+            }
+
+            /**
+             * Reads and releases the oldest frame of a receive FIFO.
+             *
+             * @return false if the FIFO is empty
+             */
+            static bool receive(uint8_t fifo, Frame& frame) {
+                volatile uint32_t& rfr = fifo ? periph_base->RF1R : periph_base->RF0R;
+                if (!(rfr & CAN_RF0R_FMP0))
+                    return false;
+
+                CAN_FIFOMailBox_TypeDef& box = periph_base->sFIFOMailBox[fifo];
+                uint32_t rir = box.RIR;
+                uint32_t rdtr = box.RDTR;
+                uint32_t rdlr = box.RDLR;
+                uint32_t rdhr = box.RDHR;
+                rfr = CAN_RF0R_RFOM0;
+
+                frame.extended = rir & CAN_RI0R_IDE;
+                frame.id = frame.extended ? rir >> 3 : rir >> 21;
+                frame.remote = rir & CAN_RI0R_RTR;
+                frame.length = rdtr & CAN_RDT0R_DLC;
+                frame.filter = (rdtr & CAN_RDT0R_FMI) >> 8;
+                frame.timestamp = rdtr >> 16;
+                for (unsigned i = 0; i < 4; i++) {
+                    frame.data[i] = rdlr >> (8 * i);
+                    frame.data[i + 4] = rdhr >> (8 * i);
+                }
+                return true;
+            }
+
+            /**
+             * @return the filter number (FMI) of the oldest frame of a non-empty FIFO,
+             * without releasing it
+             */
+            static uint8_t peekFilter(uint8_t fifo) {
+                return (periph_base->sFIFOMailBox[fifo].RDTR & CAN_RDT0R_FMI) >> 8;
+            }
+
+            /**
+             * Drops the oldest frame of a receive FIFO.
+             */
+            static void release(uint8_t fifo) {
+                (fifo ? periph_base->RF1R : periph_base->RF0R) = CAN_RF0R_RFOM0;
+            }
+
+            /**
+             * @return true if frames were lost because the FIFO was full; clears the flag
+             */
+            static bool overrun(uint8_t fifo) {
+                volatile uint32_t& rfr = fifo ? periph_base->RF1R : periph_base->RF0R;
+                bool lost = rfr & CAN_RF0R_FOVR0;
+                rfr = CAN_RF0R_FOVR0;
+                return lost;
+            }
+
+            /**
+             * @return the error status register: last error code, error counters, warning,
+             * passive and bus-off flags
+             */
+            static uint32_t errors() {
+                return periph_base->ESR;
+            }
+        };
+    }
+}
+
+#endif //CAN_HPP
@@ -0,0 +1,380 @@
+#ifndef CAN_FILTER_HPP
+#define CAN_FILTER_HPP
+
+#include "../peripheral.hpp"
+
+namespace HAL {
+    namespace Can {
+        typedef CAN_TypeDef raw_can_t;
+
+        // Filter banks shared by CAN1 and CAN2
+        constexpr unsigned filter_banks = 28;
+
+        constexpr uint32_t standard_mask = 0x7FF;
+        constexpr uint32_t extended_mask = 0x1FFFFFFF;
+
+        /**
+         * Identifiers an application subscribes to: first to last (inclusive), standard
+         * or extended, delivered to receive FIFO 0 or 1. Build them with standard() and
+         * extended().
+         */
+        struct Filter {
+            uint32_t first;
+            uint32_t last;
+            bool extended;
+            uint8_t fifo;
+        };
+
+        constexpr Filter standard(uint32_t first, uint32_t last, uint8_t fifo = 0) {
+            return Filter{first & standard_mask, last & standard_mask, false, fifo};
+        }
+
+        constexpr Filter standard(uint32_t id) {
+            return standard(id, id);
+        }
+
+        constexpr Filter extended(uint32_t first, uint32_t last, uint8_t fifo = 0) {
+            return Filter{first & extended_mask, last & extended_mask, true, fifo};
+        }
+
+        constexpr Filter extended(uint32_t id) {
+            return extended(id, id);
+        }
+
+        /**
+         * One filter bank: mode (identifier list or mask), scale (two 32 bit or four 16
+         * bit registers), FIFO and register values. entries holds, for each filter number
+         * of the bank (4, 2 or 1), the index of the Filter it comes from.
+         */
+        struct Bank {
+            bool active;
+            bool list;
+            bool wide;
+            uint8_t fifo;
+            uint32_t fr1;
+            uint32_t fr2;
+            uint8_t entries[4];
+        };
+
+        /**
+         * Filter banks generated by plan(): banks[0] to banks[count - 1] are used.
+         */
+        struct FilterPlan {
+            Bank banks[filter_banks];
+            unsigned count;
+        };
+
+        namespace detail {
+            /*
+             * A range is split into aligned power of two blocks: blocks of one identifier are
+             * exact matches (list mode), the others identifier/mask pairs (mask mode).
+             * Each FIFO gets, in this order:
+             * - 16 bit list banks, 4 standard identifiers each;
+             * - 16 bit mask banks, 2 standard blocks each, plus the standard identifiers
+             *   left over from the lists when that saves a bank;
+             * - 32 bit list banks, 2 extended identifiers each;
+             * - 32 bit mask banks, 1 extended block each.
+             * Free filter numbers repeat one of the bank, never accepting anything more.
+             */
+            enum Kind {
+                STANDARD_EXACT,
+                STANDARD_MASK,
+                EXTENDED_EXACT,
+                EXTENDED_MASK
+            };
+
+            struct Item {
+                uint32_t id;
+                uint32_t mask;
+                uint8_t entry;
+            };
+
+            template<unsigned... I>
+            struct Indices {};
+
+            template<unsigned N, unsigned... I>
+            struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+
+            template<unsigned... I>
+            struct MakeIndices<0, I...> {
+                typedef Indices<I...> type;
+            };
+
+            constexpr bool exact(Kind kind) {
+                return kind == STANDARD_EXACT || kind == EXTENDED_EXACT;
+            }
+
+            constexpr bool extended(Kind kind) {
+                return kind == EXTENDED_EXACT || kind == EXTENDED_MASK;
+            }
+
+            constexpr uint32_t idMask(bool extended) {
+                return extended ? extended_mask : standard_mask;
+            }
+
+            constexpr uint32_t ceilDiv(uint32_t a, uint32_t b) {
+                return (a + b - 1) / b;
+            }
+
+            // Largest aligned block starting at first and ending within last
+            constexpr uint32_t blockSize(uint32_t first, uint32_t last, uint32_t size = 1) {
+                return size < 0x20000000 && first % (2 * size) == 0 && last - first >= 2 * size - 1 ?
+                       blockSize(first, last, 2 * size) : size;
+            }
+
+            constexpr uint32_t blocks(uint32_t first, uint32_t last, bool exact) {
+                return first > last ? 0 :
+                       ((blockSize(first, last) == 1) == exact ? 1 : 0) +
+                       (last - first < blockSize(first, last) ? 0 : blocks(first + blockSize(first, last), last, exact));
+            }
+
+            // First identifier of the k-th block of the given kind
+            constexpr uint32_t block(uint32_t first, uint32_t last, bool exact, uint32_t k) {
+                return (blockSize(first, last) == 1) == exact && k == 0 ? first :
+                       block(first + blockSize(first, last), last, exact,
+                             (blockSize(first, last) == 1) == exact ? k - 1 : k);
+            }
+
+            constexpr bool matches(const Filter& filter, Kind kind, uint8_t fifo) {
+                return filter.extended == extended(kind) && filter.fifo == fifo;
+            }
+
+            constexpr uint32_t count(const Filter *filters, unsigned n, Kind kind, uint8_t fifo, unsigned i = 0) {
+                return i == n ? 0 :
+                       (matches(filters[i], kind, fifo) ? blocks(filters[i].first, filters[i].last, exact(kind)) : 0) +
+                       count(filters, n, kind, fifo, i + 1);
+            }
+
+            constexpr Item item(const Filter& filter, uint32_t id, unsigned entry) {
+                return Item{id, ~(blockSize(id, filter.last) - 1) & idMask(filter.extended), (uint8_t) entry};
+            }
+
+            // The k-th item of the given kind
+            constexpr Item nth(const Filter *filters, unsigned n, Kind kind, uint8_t fifo, uint32_t k,
+                               unsigned i = 0) {
+                return i == n ? Item{0, 0, 0} :
+                       !matches(filters[i], kind, fifo) ? nth(filters, n, kind, fifo, k, i + 1) :
+                       k < blocks(filters[i].first, filters[i].last, exact(kind)) ?
+                       item(filters[i], block(filters[i].first, filters[i].last, exact(kind), k), i) :
+                       nth(filters, n, kind, fifo, k - blocks(filters[i].first, filters[i].last, exact(kind)), i + 1);
+            }
+
+            // Standard identifiers in 16 bit mask banks rather than a last, partial list bank
+            constexpr bool leftoverInMasks(uint32_t exact, uint32_t masks) {
+                return exact / 4 + ceilDiv(masks + exact % 4, 2) < ceilDiv(exact, 4) + ceilDiv(masks, 2);
+            }
+
+            constexpr uint32_t listBanks16(const Filter *filters, unsigned n, uint8_t fifo) {
+                return leftoverInMasks(count(filters, n, STANDARD_EXACT, fifo), count(filters, n, STANDARD_MASK, fifo)) ?
+                       count(filters, n, STANDARD_EXACT, fifo) / 4 : ceilDiv(count(filters, n, STANDARD_EXACT, fifo), 4);
+            }
+
+            // Items in the 16 bit mask banks: the standard blocks, then the leftovers
+            constexpr uint32_t maskItems16(const Filter *filters, unsigned n, uint8_t fifo) {
+                return count(filters, n, STANDARD_MASK, fifo) +
+                       (leftoverInMasks(count(filters, n, STANDARD_EXACT, fifo), count(filters, n, STANDARD_MASK, fifo)) ?
+                        count(filters, n, STANDARD_EXACT, fifo) % 4 : 0);
+            }
+
+            constexpr uint32_t maskBanks16(const Filter *filters, unsigned n, uint8_t fifo) {
+                return ceilDiv(maskItems16(filters, n, fifo), 2);
+            }
+
+            constexpr uint32_t listBanks32(const Filter *filters, unsigned n, uint8_t fifo) {
+                return ceilDiv(count(filters, n, EXTENDED_EXACT, fifo), 2);
+            }
+
+            constexpr uint32_t banks(const Filter *filters, unsigned n, uint8_t fifo) {
+                return listBanks16(filters, n, fifo) + maskBanks16(filters, n, fifo) +
+                       listBanks32(filters, n, fifo) + count(filters, n, EXTENDED_MASK, fifo);
+            }
+
+            constexpr Item standardMaskItem(const Filter *filters, unsigned n, uint8_t fifo, uint32_t k) {
+                return k < count(filters, n, STANDARD_MASK, fifo) ? nth(filters, n, STANDARD_MASK, fifo, k) :
+                       nth(filters, n, STANDARD_EXACT, fifo,
+                           4 * listBanks16(filters, n, fifo) + k - count(filters, n, STANDARD_MASK, fifo));
+            }
+
+            // Register layouts, data frames only (RTR compared)
+            constexpr uint32_t reg16(uint32_t id) {
+                return id << 5;
+            }
+
+            constexpr uint32_t mask16(uint32_t mask) {
+                return (mask << 5) | 0x18;
+            }
+
+            constexpr uint32_t reg32(uint32_t id, bool extended) {
+                return extended ? (id << 3) | CAN_RI0R_IDE : id << 21;
+            }
+
+            constexpr uint32_t mask32(uint32_t mask, bool extended) {
+                return (extended ? mask << 3 : mask << 21) | CAN_RI0R_IDE | CAN_RI0R_RTR;
+            }
+
+            constexpr Bank list16(const Item& a, const Item& b, const Item& c, const Item& d, uint8_t fifo) {
+                return Bank{true, true, false, fifo, reg16(a.id) | (reg16(b.id) << 16), reg16(c.id) | (reg16(d.id) << 16),
+                            {a.entry, b.entry, c.entry, d.entry}};
+            }
+
+            constexpr Bank masks16(const Item& a, const Item& b, uint8_t fifo) {
+                return Bank{true, false, false, fifo, reg16(a.id) | (mask16(a.mask) << 16),
+                            reg16(b.id) | (mask16(b.mask) << 16), {a.entry, b.entry, b.entry, b.entry}};
+            }
+
+            constexpr Bank list32(const Item& a, const Item& b, uint8_t fifo) {
+                return Bank{true, true, true, fifo, reg32(a.id, true), reg32(b.id, true),
+                            {a.entry, b.entry, b.entry, b.entry}};
+            }
+
+            constexpr Bank mask32(const Item& a, uint8_t fifo) {
+                return Bank{true, false, true, fifo, reg32(a.id, true), mask32(a.mask, true),
+                            {a.entry, a.entry, a.entry, a.entry}};
+            }
+
+            // Index of the k-th item, or of the last one of the bank if there are fewer
+            constexpr uint32_t slot(uint32_t k, uint32_t first, uint32_t items) {
+                return k < items ? k : (first < items ? items - 1 : first);
+            }
+
+            constexpr Bank listBank16(const Filter *f, unsigned n, uint8_t fifo, uint32_t j) {
+                return list16(nth(f, n, STANDARD_EXACT, fifo, slot(4 * j, 4 * j, count(f, n, STANDARD_EXACT, fifo))),
+                              nth(f, n, STANDARD_EXACT, fifo, slot(4 * j + 1, 4 * j, count(f, n, STANDARD_EXACT, fifo))),
+                              nth(f, n, STANDARD_EXACT, fifo, slot(4 * j + 2, 4 * j, count(f, n, STANDARD_EXACT, fifo))),
+                              nth(f, n, STANDARD_EXACT, fifo, slot(4 * j + 3, 4 * j, count(f, n, STANDARD_EXACT, fifo))),
+                              fifo);
+            }
+
+            constexpr Bank maskBank16(const Filter *f, unsigned n, uint8_t fifo, uint32_t j) {
+                return masks16(standardMaskItem(f, n, fifo, 2 * j),
+                               standardMaskItem(f, n, fifo, slot(2 * j + 1, 2 * j, maskItems16(f, n, fifo))), fifo);
+            }
+
+            constexpr Bank listBank32(const Filter *f, unsigned n, uint8_t fifo, uint32_t j) {
+                return list32(nth(f, n, EXTENDED_EXACT, fifo, 2 * j),
+                              nth(f, n, EXTENDED_EXACT, fifo, slot(2 * j + 1, 2 * j, count(f, n, EXTENDED_EXACT, fifo))),
+                              fifo);
+            }
+
+            constexpr Bank fifoBank(const Filter *f, unsigned n, uint8_t fifo, uint32_t j) {
+                return j < listBanks16(f, n, fifo) ? listBank16(f, n, fifo, j) :
+                       j < listBanks16(f, n, fifo) + maskBanks16(f, n, fifo) ?
+                       maskBank16(f, n, fifo, j - listBanks16(f, n, fifo)) :
+                       j < listBanks16(f, n, fifo) + maskBanks16(f, n, fifo) + listBanks32(f, n, fifo) ?
+                       listBank32(f, n, fifo, j - listBanks16(f, n, fifo) - maskBanks16(f, n, fifo)) :
+                       mask32(nth(f, n, EXTENDED_MASK, fifo, j - listBanks16(f, n, fifo) - maskBanks16(f, n, fifo) -
+                                                             listBanks32(f, n, fifo)), fifo);
+            }
+
+            constexpr Bank bank(const Filter *f, unsigned n, uint32_t i) {
+                return i < banks(f, n, 0) ? fifoBank(f, n, 0, i) :
+                       i < banks(f, n, 0) + banks(f, n, 1) ? fifoBank(f, n, 1, i - banks(f, n, 0)) :
+                       Bank{false, false, false, 0, 0, 0, {0, 0, 0, 0}};
+            }
+
+            template<unsigned... I>
+            constexpr FilterPlan plan(const Filter *filters, unsigned n, Indices<I...>) {
+                return FilterPlan{{bank(filters, n, I)...}, banks(filters, n, 0) + banks(filters, n, 1)};
+            }
+        }
+
+        /**
+         * Packs the filters into the fewest banks, at compile time: frames outside them
+         * are dropped by the hardware and never raise an interrupt.
+         *
+         * Example:
+         *     constexpr Can::Filter filters[] = {Can::standard(0x100), Can::standard(0x200, 0x27F),
+         *             Can::extended(0x18FF0000, 0x18FFFFFF, 1)};
+         *     constexpr Can::FilterPlan plan = Can::plan(filters);
+         *     static_assert(plan.count <= 14, "too many filter banks for CAN1");
+         */
+        template<unsigned N>
+        constexpr FilterPlan plan(const Filter (&filters)[N]) {
+            return detail::plan(filters, N, typename detail::MakeIndices<filter_banks>::type());
+        }
+
+        /**
+         * @return the filter numbers of a bank, which the receive FIFOs report (FMI)
+         */
+        constexpr unsigned filterNumbers(const Bank& bank) {
+            return !bank.active ? 0 : bank.wide ? (bank.list ? 2 : 1) : (bank.list ? 4 : 2);
+        }
+
+        /**
+         * Filters (type)
+         *
+         * The filter banks, in CAN1 but shared with CAN2: banks from 0 to CAN2SB - 1
+         * belong to CAN1, the rest to CAN2. configure() splits them between the two plans.
+         *
+         * NOTE: these functions are thread-safe ONLY inside miosix environment,
+         *       in other environments you have to ensure it other ways.
+         */
+        class Filters {
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_can_t* const periph_base = (raw_can_t*) Peripheral::p_CAN1::periph_base;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        private:
+#ifdef _MIOSIX
+            static void modify(volatile uint32_t& reg, uint32_t clear_mask, uint32_t value) {
+                miosix::FastInterruptDisableLock dLock;
+                reg = (reg & ~clear_mask) | value;
+            }
+#else
+            static void modify(volatile uint32_t& reg, uint32_t clear_mask, uint32_t value) {
+                reg = (reg & ~clear_mask) | value;
+            }
+#endif
+
+            static void write(unsigned index, const Bank& bank) {
+                uint32_t bit = 1u << index;
+                modify(periph_base->FA1R, bit, 0);
+                if (!bank.active)
+                    return;
+
+                modify(periph_base->FM1R, bit, bank.list ? bit : 0);
+                modify(periph_base->FS1R, bit, bank.wide ? bit : 0);
+                modify(periph_base->FFA1R, bit, bank.fifo ? bit : 0);
+                periph_base->sFilterRegister[index].FR1 = bank.fr1;
+                periph_base->sFilterRegister[index].FR2 = bank.fr2;
+                modify(periph_base->FA1R, 0, bit);
+            }
+
+        public:
+            /**
+             * Loads the plans, CAN1 from bank 0 and CAN2 right after. CAN1 clock must be
+             * enabled, also when only CAN2 is used.
+             *
+             * @return false if they need more than 28 banks together
+             */
+            static bool configure(const FilterPlan& can1, const FilterPlan& can2 = FilterPlan{}) {
+                if (can1.count + can2.count > filter_banks)
+                    return false;
+
+                modify(periph_base->FMR, 0, CAN_FMR_FINIT);
+                modify(periph_base->FMR, 0x3F00, can1.count << 8);
+
+                for (unsigned i = 0; i < filter_banks; i++)
+                    write(i, i < can1.count ? can1.banks[i] :
+                             i < can1.count + can2.count ? can2.banks[i - can1.count] : Bank{});
+
+                modify(periph_base->FMR, CAN_FMR_FINIT, 0);
+                return true;
+            }
+
+            /**
+             * @return the first bank of CAN2
+             */
+            static unsigned can2Start() {
+                return (periph_base->FMR >> 8) & 0x3F;
+            }
+        };
+    }
+}
+
+#endif //CAN_FILTER_HPP
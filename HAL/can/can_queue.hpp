@@ -0,0 +1,439 @@
+#ifndef CAN_QUEUE_HPP
+#define CAN_QUEUE_HPP
+
+#include "can.hpp"
+
+#include <atomic>
+
+namespace HAL {
+    namespace Can {
+
+        /**
+         * FrameQueue (type)
+         *
+         * Lock-free ring of N frames with one producer and one consumer. Frames are
+         * written and read in place: the producer fills the slot claim() returns and
+         * publishes it with commit(), the consumer reads front() by reference and frees
+         * it with pop(), so a frame is copied once, from the receive FIFO into the ring.
+         */
+        template<unsigned N>
+        class FrameQueue {
+            static_assert(N >= 2 && (N & (N - 1)) == 0, "queue size must be a power of two");
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr unsigned size = N;
+
+        private:
+            Frame frames[N];
+
+            // Free running indexes: the queue holds head - tail frames
+            std::atomic<uint32_t> head;
+            std::atomic<uint32_t> tail;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            FrameQueue() : head(0), tail(0) {}
+
+            /**
+             * Producer: the slot to fill next.
+             *
+             * @return nullptr if the queue is full
+             */
+            Frame *claim() {
+                uint32_t h = head.load(std::memory_order_relaxed);
+                if (h - tail.load(std::memory_order_acquire) >= N)
+                    return nullptr;
+                return &frames[h % N];
+            }
+
+            /**
+             * Producer: publishes the slot returned by claim().
+             */
+            void commit() {
+                head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            }
+
+            /**
+             * Consumer: the oldest frame, valid until pop().
+             *
+             * @return nullptr if the queue is empty
+             */
+            const Frame *front() const {
+                uint32_t t = tail.load(std::memory_order_relaxed);
+                if (head.load(std::memory_order_acquire) == t)
+                    return nullptr;
+                return &frames[t % N];
+            }
+
+            /**
+             * Consumer: frees the frame returned by front().
+             */
+            void pop() {
+                tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            }
+
+            uint32_t available() const {
+                return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+            }
+        };
+
+        /**
+         * Receiver (type)
+         *
+         * Drains the receive FIFOs of a controller, in their interrupts, into one
+         * FrameQueue per subscriber. The subscriber of a frame comes from the filter
+         * number that accepted it: each Filter of the plan belongs to a subscriber, by
+         * default its own index, so frames are routed without comparing identifiers.
+         * Frames for a full (or missing) subscriber queue are dropped and counted.
+         *
+         * The interrupts must be forwarded:
+         *     void CAN1_RX0_IRQHandler() { receiver.onInterrupt(0); }
+         *     void CAN1_RX1_IRQHandler() { receiver.onInterrupt(1); }
+         *
+         * Each subscriber reads its queue from one context:
+         *     while (const Can::Frame *frame = receiver.queue(1).front()) { ...; receiver.queue(1).pop(); }
+         *
+         * NOTE: filter numbers are counted from the first bank of the controller's plan,
+         *       per FIFO, as Filters::configure() loads it.
+         */
+        template<typename P, unsigned SUBSCRIBERS, unsigned DEPTH = 16>
+        class Receiver {
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            // Filter numbers of a FIFO: up to 4 per bank
+            static constexpr unsigned max_filters = 4 * filter_banks;
+            static constexpr uint8_t nobody = 0xFF;
+
+        private:
+            FrameQueue<DEPTH> queues[SUBSCRIBERS];
+            uint8_t owners[2][max_filters];
+            volatile uint32_t dropped[SUBSCRIBERS + 1];
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            /**
+             * @param plan: the plan of this controller, loaded by Filters::configure()
+             * @param subscribers: the subscriber of each Filter plan was built from, nullptr
+             *        for the Filter index
+             */
+            Receiver(const FilterPlan& plan, const uint8_t *subscribers = nullptr) {
+                for (unsigned fifo = 0; fifo < 2; fifo++)
+                    for (unsigned i = 0; i < max_filters; i++)
+                        owners[fifo][i] = nobody;
+                for (unsigned i = 0; i <= SUBSCRIBERS; i++)
+                    dropped[i] = 0;
+
+                unsigned numbers[2] = {0, 0};
+                for (unsigned i = 0; i < plan.count; i++) {
+                    const Bank& bank = plan.banks[i];
+                    for (unsigned k = 0; k < filterNumbers(bank); k++) {
+                        uint8_t entry = bank.entries[k];
+                        owners[bank.fifo][numbers[bank.fifo]++] = subscribers ? subscribers[entry] : entry;
+                    }
+                }
+            }
+
+            /**
+             * Enables the FIFO message pending interrupts.
+             */
+            void start(Controller<P>& controller) {
+                controller.enableInterrupts(CAN_IER_FMPIE0 | CAN_IER_FMPIE1);
+            }
+
+            /**
+             * Receive FIFO interrupt: moves every pending frame to its subscriber.
+             */
+            void onInterrupt(uint8_t fifo) {
+                while (Controller<P>::pending(fifo)) {
+                    uint8_t filter = Controller<P>::peekFilter(fifo);
+                    uint8_t owner = filter < max_filters ? owners[fifo][filter] : nobody;
+                    Frame *slot = owner < SUBSCRIBERS ? queues[owner].claim() : nullptr;
+
+                    if (!slot) {
+                        unsigned counter = owner < SUBSCRIBERS ? owner : SUBSCRIBERS;
+                        dropped[counter] = dropped[counter] + 1;
+                        Controller<P>::release(fifo);
+                        continue;
+                    }
+
+                    Controller<P>::receive(fifo, *slot);
+                    queues[owner].commit();
+                }
+            }
+
+            FrameQueue<DEPTH>& queue(unsigned subscriber) {
+                return queues[subscriber];
+            }
+
+            /**
+             * @return the frames dropped for a subscriber (SUBSCRIBERS: frames without one)
+             */
+            uint32_t drops(unsigned subscriber) const {
+                return dropped[subscriber];
+            }
+        };
+
+        /**
+         * @return the arbitration field of a frame as sent on the bus, left aligned:
+         * the lower, the higher the priority (standard before extended frames with the
+         * same base identifier, data before remote frames)
+         */
+        constexpr uint32_t arbitration(const Frame& frame) {
+            return frame.extended ?
+                   ((frame.id >> 18) << 21) | (1u << 20) | (1u << 19) | ((frame.id & 0x3FFFF) << 1) |
+                   (frame.remote ? 1 : 0) :
+                   (frame.id << 21) | (frame.remote ? 1u << 20 : 0);
+        }
+
+        /**
+         * Transmitter (type)
+         *
+         * Software priority queue of up to N frames in front of the three transmit
+         * mailboxes. The mailboxes always hold the highest priority frames pending: free
+         * mailboxes are refilled from the queue, and when all are busy and the queue
+         * holds a frame that outranks one of them, the lowest priority mailbox is aborted
+         * and its frame goes back to the queue. The controller sends the mailboxes by
+         * identifier (TX_FIFO_ORDER not set), so a frame never waits behind a lower
+         * priority one. Among equal identifiers it sends by mailbox number instead, so
+         * a frame is not loaded while another with its identifier is in a mailbox: they
+         * stay first in, first out, and the next frames with other identifiers take the
+         * free mailboxes meanwhile.
+         *
+         * The heap keeps a slot per mailbox beyond N for preempted frames, so a frame
+         * going back to the queue is never lost to a queue filled by send().
+         *
+         * The transmit interrupt must be forwarded:
+         *     void CAN1_TX_IRQHandler() { transmitter.onInterrupt(); }
+         *
+         * send() masks the transmit interrupt while it runs, so it can be used from
+         * threads and from other interrupts.
+         */
+        template<typename P, unsigned N = 32>
+        class Transmitter {
+            //***************************
+            //* Subtypes                *
+            //***************************
+        private:
+            struct Entry {
+                uint32_t key;
+                uint32_t sequence;
+                Frame frame;
+            };
+
+            struct Mailbox {
+                Entry entry;
+                bool busy;
+                bool aborting;
+            };
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr IRQn_Type irq = txIrq(P::periph_base);
+
+        private:
+            // Binary heap on (key, sequence): frames with the same identifier keep their order.
+            // send() fills N entries, the rest is for preempted frames
+            Entry heap[N + Controller<P>::mailboxes];
+            unsigned count = 0;
+            uint32_t sequence = 0;
+            Mailbox mailboxes[Controller<P>::mailboxes];
+
+            uint32_t sent_count = 0;
+            uint32_t abort_count = 0;
+            uint32_t failure_count = 0;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            Transmitter() {
+                for (unsigned i = 0; i < Controller<P>::mailboxes; i++)
+                    mailboxes[i].busy = false;
+            }
+
+            /**
+             * Enables the transmit interrupt.
+             */
+            void start(Controller<P>& controller) {
+                controller.enableInterrupts(CAN_IER_TMEIE);
+            }
+
+            /**
+             * Queues a frame.
+             *
+             * @return false if the queue is full
+             */
+            bool send(const Frame& frame) {
+                NVIC_DisableIRQ(irq);
+                bool queued = count < N && push(Entry{arbitration(frame), sequence++, frame});
+                if (queued)
+                    schedule();
+                NVIC_EnableIRQ(irq);
+                return queued;
+            }
+
+            /**
+             * Transmit interrupt: collects the completed mailboxes and refills them.
+             */
+            void onInterrupt() {
+                for (unsigned i = 0; i < Controller<P>::mailboxes; i++) {
+                    if (!(Controller<P>::periph_base->TSR & (CAN_TSR_RQCP0 << (8 * i))))
+                        continue;
+
+                    Mailbox& mailbox = mailboxes[i];
+                    bool ok = Controller<P>::complete(i);
+                    if (!mailbox.busy)
+                        continue;
+
+                    mailbox.busy = false;
+                    if (ok) {
+                        sent_count++;
+                    } else if (mailbox.aborting) {
+                        // Preempted: back in the queue, ahead of later frames
+                        if (!push(mailbox.entry))
+                            failure_count++;
+                    } else {
+                        failure_count++;
+                    }
+                }
+
+                schedule();
+            }
+
+            /**
+             * @return the frames waiting in the software queue
+             */
+            unsigned queued() const {
+                return count;
+            }
+
+            uint32_t sent() const {
+                return sent_count;
+            }
+
+            /**
+             * @return the aborts requested to let a higher priority frame through (the
+             * frame may have won the bus all the same)
+             */
+            uint32_t aborts() const {
+                return abort_count;
+            }
+
+            /**
+             * @return the frames given up (NO_RETRANSMISSION, bus-off, preempted with no room)
+             */
+            uint32_t failures() const {
+                return failure_count;
+            }
+
+        private:
+            static bool before(const Entry& a, const Entry& b) {
+                return a.key != b.key ? a.key < b.key : (int32_t) (a.sequence - b.sequence) < 0;
+            }
+
+            bool push(const Entry& entry) {
+                if (count == N + Controller<P>::mailboxes)
+                    return false;
+
+                unsigned i = count++;
+                while (i > 0 && before(entry, heap[(i - 1) / 2])) {
+                    heap[i] = heap[(i - 1) / 2];
+                    i = (i - 1) / 2;
+                }
+                heap[i] = entry;
+                return true;
+            }
+
+            // Removes the i-th entry of the heap
+            Entry take(unsigned i) {
+                Entry taken = heap[i];
+                Entry last = heap[--count];
+                if (i == count)
+                    return taken;
+
+                while (i > 0 && before(last, heap[(i - 1) / 2])) {
+                    heap[i] = heap[(i - 1) / 2];
+                    i = (i - 1) / 2;
+                }
+                for (;;) {
+                    unsigned child = 2 * i + 1;
+                    if (child >= count)
+                        break;
+                    if (child + 1 < count && before(heap[child + 1], heap[child]))
+                        child++;
+                    if (!before(heap[child], last))
+                        break;
+                    heap[i] = heap[child];
+                    i = child;
+                }
+                heap[i] = last;
+                return taken;
+            }
+
+            bool inMailbox(uint32_t key) const {
+                for (unsigned i = 0; i < Controller<P>::mailboxes; i++)
+                    if (mailboxes[i].busy && mailboxes[i].entry.key == key)
+                        return true;
+                return false;
+            }
+
+            // Heap index of the first frame that can be loaded, -1 if none: a frame whose
+            // identifier is in a mailbox waits, since the controller could send it first
+            int next() const {
+                if (count > 0 && !inMailbox(heap[0].key))
+                    return 0;
+
+                int best = -1;
+                for (unsigned i = 1; i < count; i++)
+                    if (!inMailbox(heap[i].key) && (best < 0 || before(heap[i], heap[best])))
+                        best = i;
+                return best;
+            }
+
+            // Fills the free mailboxes, or preempts the lowest priority busy one
+            void schedule() {
+                for (;;) {
+                    int candidate = next();
+                    if (candidate < 0)
+                        return;
+
+                    int free = Controller<P>::freeMailbox();
+                    if (free >= 0) {
+                        Mailbox& mailbox = mailboxes[free];
+                        mailbox.entry = take(candidate);
+                        mailbox.busy = true;
+                        mailbox.aborting = false;
+                        Controller<P>::send(free, mailbox.entry.frame);
+                        continue;
+                    }
+
+                    int lowest = -1;
+                    for (unsigned i = 0; i < Controller<P>::mailboxes; i++)
+                        if (mailboxes[i].busy && !mailboxes[i].aborting &&
+                            (lowest < 0 || before(mailboxes[lowest].entry, mailboxes[i].entry)))
+                            lowest = i;
+
+                    if (lowest >= 0 && before(heap[candidate], mailboxes[lowest].entry)) {
+                        mailboxes[lowest].aborting = true;
+                        Controller<P>::abort(lowest);
+                        abort_count++;
+                    }
+                    return;
+                }
+            }
+        };
+    }
+}
+
+#endif //CAN_QUEUE_HPP
@@ -0,0 +1,333 @@
+#ifndef CALIBRATION_HPP
+#define CALIBRATION_HPP
+
+#include "clock.hpp"
+#include "../rtc/rtc.hpp"
+#include "../timers/timer.hpp"
+
+namespace HAL {
+    namespace Clock {
+
+        /**
+         * Reference the timer clock is measured against. LSE and LSI reach TIM5 channel 4,
+         * HSE / RTCPRE (HSE_RTC, about 1 MHz) reaches TIM11 channel 1, through the timer
+         * option registers.
+         */
+        enum class Reference {
+            LSE,
+            LSI,
+            HSE_RTC
+        };
+
+        /**
+         * Outcome of Calibration::trimHsi().
+         *
+         * trim: HSITRIM value left in RCC_CR (0-31, 16 is the factory centre)
+         * error_ppm: residual HSI error measured with it
+         * step_ppm: measured effect of one trim step
+         */
+        struct HsiTrim {
+            uint32_t trim;
+            int32_t error_ppm;
+            int32_t step_ppm;
+            bool valid;
+        };
+
+        namespace detail {
+            // TIM5_OR TI4_RMP and TIM11_OR TI1_RMP values
+            constexpr uint32_t remap(Reference reference) {
+                return reference == Reference::LSI ? TIM_OR_TI4_RMP_0 :
+                       reference == Reference::LSE ? TIM_OR_TI4_RMP_1 : 0x2;
+            }
+
+            constexpr int32_t ppm(uint64_t measured, uint64_t nominal) {
+                return (int32_t) (((int64_t) measured - (int64_t) nominal) * 1000000 / (int64_t) nominal);
+            }
+        }
+
+        /**
+         * Calibration (type)
+         *
+         * Measures an on-chip oscillator against another clock by input capture, averaging
+         * many periods, and corrects it:
+         * - LSI (about 32 kHz, +-50%) against the timer clock, when that comes from the
+         *   HSE: measureLsi(); calibrateLsi() also tells the RTC its real frequency;
+         * - HSI (16 MHz, 1% over temperature) when SYSCLK comes from it, against the LSE
+         *   or HSE_RTC: the timer clock is HSI-derived, the reference is exact;
+         *   trimHsi() moves RCC_CR HSITRIM to the value with the smallest error.
+         *
+         * The input capture prescaler takes one capture every 8 reference periods: every
+         * 244 us against the LSE, about 250 us against the LSI, but every 8 us against
+         * HSE_RTC. A capture missed because the polling loop was held up longer than that
+         * (an interrupt handler) is detected by overcapture, and the measurement restarts,
+         * up to max_retries times: against HSE_RTC keep the interrupts quiet. TIM5 (for
+         * LSE/LSI) or TIM11 (for HSE_RTC) must not be in use meanwhile.
+         *
+         * NOTE: these functions are thread-safe ONLY inside miosix environment,
+         *       in other environments you have to ensure it other ways.
+         */
+        class Calibration {
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            // Reference periods per capture (input capture prescaler)
+            static constexpr uint32_t capture_prescaler = 8;
+
+            // Polling iterations before a capture is declared lost
+            static constexpr uint32_t timeout = 0x100000;
+
+            // Measurements restarted after an overcapture before giving up
+            static constexpr uint32_t max_retries = 4;
+
+            static constexpr uint32_t hse_rtc_freq = 1000000;
+            static constexpr uint32_t max_trim = 31;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        private:
+#ifdef _MIOSIX
+            static void modify(volatile uint32_t& reg, uint32_t clear_mask, uint32_t value) {
+                miosix::FastInterruptDisableLock dLock;
+                reg = (reg & ~clear_mask) | value;
+            }
+#else
+            static void modify(volatile uint32_t& reg, uint32_t clear_mask, uint32_t value) {
+                reg = (reg & ~clear_mask) | value;
+            }
+#endif
+
+            /**
+             * Counts the timer ticks over captures * capture_prescaler reference periods.
+             *
+             * @return 0 if a capture doesn't come, or captures keep being missed
+             */
+            template<typename P>
+            static uint64_t capture(Reference reference, uint32_t captures) {
+                Timer::raw_timer_t *timer = (Timer::raw_timer_t *) P::periph_base;
+                bool channel4 = reference != Reference::HSE_RTC;
+                uint32_t mask = channel4 ? 0xFFFFFFFF : 0xFFFF;
+                uint32_t flag = channel4 ? TIM_SR_CC4IF : TIM_SR_CC1IF;
+                uint32_t overcapture = channel4 ? TIM_SR_CC4OF : TIM_SR_CC1OF;
+                volatile uint32_t& ccr = channel4 ? timer->CCR4 : timer->CCR1;
+
+                bool was_enabled = *((volatile uint32_t *) P::bus::enable_register) & P::enable_bit;
+                P::enable();
+
+                timer->CR1 = 0;
+                timer->PSC = 0;
+                timer->ARR = mask;
+                timer->EGR = TIM_EGR_UG;
+                timer->OR = detail::remap(reference);
+
+                // Input capture on the remapped input, one capture every 8 edges
+                if (channel4) {
+                    timer->CCMR2 = TIM_CCMR2_CC4S_0 | TIM_CCMR2_IC4PSC;
+                    timer->CCER = TIM_CCER_CC4E;
+                } else {
+                    timer->CCMR1 = TIM_CCMR1_CC1S_0 | TIM_CCMR1_IC1PSC;
+                    timer->CCER = TIM_CCER_CC1E;
+                }
+                timer->SR = 0;
+                timer->CR1 = TIM_CR1_CEN;
+
+                uint64_t ticks = 0;
+                uint32_t previous = 0;
+                uint32_t retries = 0;
+                for (uint32_t i = 0; i <= captures; i++) {
+                    uint32_t wait = 0;
+                    while (!(timer->SR & flag) && ++wait < timeout);
+                    if (wait >= timeout) {
+                        ticks = 0;
+                        break;
+                    }
+
+                    // Reading the capture clears the flag, not the overcapture one
+                    uint32_t value = ccr;
+                    if (timer->SR & overcapture) {
+                        // Two periods would count as one: start over from this capture
+                        timer->SR = ~overcapture;
+                        ticks = 0;
+                        if (++retries > max_retries)
+                            break;
+                        i = 0;
+                        previous = value;
+                        continue;
+                    }
+
+                    if (i > 0)
+                        ticks += (value - previous) & mask;
+                    previous = value;
+                }
+
+                timer->CR1 = 0;
+                timer->CCER = 0;
+                timer->OR = 0;
+                if (!was_enabled)
+                    P::disable();
+
+                return ticks;
+            }
+
+            /**
+             * @return the timer kernel clock frequency measured against the reference,
+             * 0 if the reference doesn't run
+             */
+            static uint64_t measureTimerClock(Reference reference, uint32_t reference_freq, uint32_t captures) {
+                uint64_t ticks = reference == Reference::HSE_RTC ?
+                                 capture<Peripheral::p_TIM11>(reference, captures) :
+                                 capture<Peripheral::p_TIM5>(reference, captures);
+                return ticks * reference_freq / ((uint64_t) captures * capture_prescaler);
+            }
+
+            static uint32_t nominalTimerClock(Reference reference) {
+                return reference == Reference::HSE_RTC ? Peripheral::p_TIM11::bus::timer_freq() :
+                       Peripheral::p_TIM5::bus::timer_freq();
+            }
+
+            static bool runsOnHsi() {
+                Source source = Control::getSource();
+                return source == Source::HSI ||
+                       (source == Source::PLL && !(RCC->PLLCFGR & RCC_PLLCFGR_PLLSRC_HSE));
+            }
+
+            // Enables HSE_RTC = HSE / RTCPRE at 1 MHz, unless the RTC runs on the HSE
+            static bool enableHseRtc(uint32_t hse_freq) {
+                uint32_t rtcpre = hse_freq / hse_rtc_freq;
+                if (!(RCC->CR & RCC_CR_HSERDY) || rtcpre < 2 || rtcpre > 31 || hse_freq % hse_rtc_freq)
+                    return false;
+
+                if ((RCC->BDCR & RCC_BDCR_RTCSEL) == RCC_BDCR_RTCSEL &&
+                    (RCC->CFGR & RCC_CFGR_RTCPRE) != rtcpre * (RCC_CFGR_RTCPRE & ~(RCC_CFGR_RTCPRE << 1)))
+                    return false;
+
+                modify(RCC->CFGR, RCC_CFGR_RTCPRE, rtcpre << 16);
+                return true;
+            }
+
+            static void setTrim(uint32_t trim) {
+                modify(RCC->CR, RCC_CR_HSITRIM, trim * RCC_CR_HSITRIM_0);
+            }
+
+            static int32_t hsiError(Reference reference, uint32_t reference_freq, uint32_t captures) {
+                uint64_t measured = measureTimerClock(reference, reference_freq, captures);
+                return measured ? detail::ppm(measured, nominalTimerClock(reference)) : INT32_MAX;
+            }
+
+            static int32_t magnitude(int32_t value) {
+                return value < 0 ? -value : value;
+            }
+
+        public:
+            /**
+             * Measures the LSI against the timer clock, which must come from the HSE.
+             *
+             * @param captures: averaged captures (each one 8 LSI periods, 250 us)
+             * @return the LSI frequency in Hz, 0 if it doesn't run or SYSCLK comes from
+             *         the HSI
+             */
+            static uint32_t measureLsi(uint32_t captures = 64) {
+                if (runsOnHsi())
+                    return 0;
+
+                modify(RCC->CSR, 0, RCC_CSR_LSION);
+                uint32_t wait = 0;
+                while (!(RCC->CSR & RCC_CSR_LSIRDY) && ++wait < timeout);
+                if (wait >= timeout)
+                    return 0;
+
+                uint64_t ticks = capture<Peripheral::p_TIM5>(Reference::LSI, captures);
+                return ticks ? (uint32_t) ((uint64_t) nominalTimerClock(Reference::LSI) * captures * capture_prescaler /
+                                           ticks) : 0;
+            }
+
+            /**
+             * Measures the LSI and, when the RTC runs on it, makes Rtc::Controller use
+             * the measured frequency for its wakeup timer and tick conversions.
+             */
+            static uint32_t calibrateLsi(uint32_t captures = 64) {
+                uint32_t frequency = measureLsi(captures);
+                if (frequency && (RCC->BDCR & RCC_BDCR_RTCSEL) == RCC_BDCR_RTCSEL_1)
+                    Rtc::Controller::setSourceFrequency(frequency);
+                return frequency;
+            }
+
+            /**
+             * Measures the HSI error, SYSCLK must come from the HSI.
+             *
+             * @param reference: LSE (must be running) or HSE_RTC
+             * @param hse_freq: for HSE_RTC, the HSE frequency (a multiple of 1 MHz)
+             * @return the error in ppm, INT32_MAX if it can't be measured
+             */
+            static int32_t measureHsi(Reference reference, uint32_t hse_freq = 0, uint32_t captures = 64) {
+                if (!runsOnHsi() || reference == Reference::LSI)
+                    return INT32_MAX;
+                if (reference == Reference::HSE_RTC && !enableHseRtc(hse_freq))
+                    return INT32_MAX;
+
+                return hsiError(reference, reference == Reference::LSE ? Rtc::lse_freq : hse_rtc_freq, captures);
+            }
+
+            /**
+             * Trims the HSI to the smallest error against the reference: measures the
+             * effect of one trim step, jumps to the estimated best value, then checks its
+             * neighbours. SYSCLK must come from the HSI.
+             *
+             * @param correct_timebase: also sets SystemCoreClock to the measured HCLK and
+             *        notifies the Clock listeners, which absorb the residual error
+             */
+            static HsiTrim trimHsi(Reference reference, uint32_t hse_freq = 0, uint32_t captures = 64,
+                                   bool correct_timebase = false) {
+                HsiTrim result = {(RCC->CR & RCC_CR_HSITRIM) / RCC_CR_HSITRIM_0, INT32_MAX, 0, false};
+
+                int32_t error = measureHsi(reference, hse_freq, captures);
+                if (error == INT32_MAX)
+                    return result;
+
+                uint32_t reference_freq = reference == Reference::LSE ? Rtc::lse_freq : hse_rtc_freq;
+                uint32_t trim = result.trim;
+
+                // One step up (down at the top of the range) measures the size of a step
+                uint32_t probe = trim < max_trim ? trim + 1 : trim - 1;
+                setTrim(probe);
+                int32_t probe_error = hsiError(reference, reference_freq, captures);
+                int32_t step = probe > trim ? probe_error - error : error - probe_error;
+                if (probe_error == INT32_MAX || step <= 0) {
+                    setTrim(trim);
+                    return result;
+                }
+
+                // Jump to the estimate, then walk to the best neighbour
+                int32_t estimate = (int32_t) trim - (error + (error >= 0 ? step / 2 : -step / 2)) / step;
+                uint32_t best = estimate < 0 ? 0 : estimate > (int32_t) max_trim ? max_trim : estimate;
+                setTrim(best);
+                int32_t best_error = hsiError(reference, reference_freq, captures);
+
+                for (int direction = -1; direction <= 1; direction += 2) {
+                    while ((direction < 0 && best > 0) || (direction > 0 && best < max_trim)) {
+                        uint32_t next = best + direction;
+                        setTrim(next);
+                        int32_t next_error = hsiError(reference, reference_freq, captures);
+                        if (magnitude(next_error) >= magnitude(best_error))
+                            break;
+                        best = next;
+                        best_error = next_error;
+                    }
+                }
+
+                setTrim(best);
+                result = HsiTrim{best, best_error, step, best_error != INT32_MAX};
+
+                if (correct_timebase && result.valid) {
+                    SystemCoreClock = (uint32_t) ((int64_t) SystemCoreClock +
+                                                  (int64_t) SystemCoreClock * best_error / 1000000);
+                    Control::notify();
+                }
+                return result;
+            }
+        };
+    }
+}
+
+#endif //CALIBRATION_HPP
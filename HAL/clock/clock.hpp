@@ -0,0 +1,555 @@
+#ifndef CLOCK_HPP
+#define CLOCK_HPP
+
+#include "../peripheral.hpp"
+#include "../flash/flash_acr.hpp"
+
+namespace HAL {
+    namespace Clock {
+        typedef RCC_TypeDef raw_rcc_t;
+        typedef PWR_TypeDef raw_pwr_t;
+
+        constexpr uint32_t hsi_freq = 16000000;
+
+        // RM0090 limits for the STM32F405/407
+        constexpr uint32_t max_sysclk = 168000000;
+        constexpr uint32_t max_pclk1 = 42000000;
+        constexpr uint32_t max_pclk2 = 84000000;
+        constexpr uint32_t max_scale2_hclk = 144000000;
+        constexpr uint32_t usb_freq = 48000000;
+
+        enum class Oscillator : uint8_t {
+            HSI,
+            HSE
+        };
+
+        /**
+         * SYSCLK source.
+         */
+        enum class Source : uint8_t {
+            HSI,
+            HSE,
+            PLL
+        };
+
+        /**
+         * A complete clock tree: SYSCLK source, PLL (when used) and bus dividers. Build it
+         * with hsi(), hse(), pll() or pllFor(), check it with valid(), apply it with
+         * Control::apply(). All the functions on it are constexpr, so configurations can
+         * be computed and checked at compile time.
+         *
+         * pll_input: PLL (and PLLI2S) input oscillator
+         * hse_freq: HSE crystal or clock frequency, 0 if there is none
+         * hse_bypass: HSE is an external clock rather than a crystal
+         * ahb_divider: 1, 2, 4, 8, 16, 64, 128, 256 or 512
+         * apb1_divider, apb2_divider: 1, 2, 4, 8 or 16
+         */
+        struct Config {
+            Source source;
+            Oscillator pll_input;
+            uint32_t hse_freq;
+            bool hse_bypass;
+            uint16_t pll_m;
+            uint16_t pll_n;
+            uint8_t pll_p;
+            uint8_t pll_q;
+            uint16_t ahb_divider;
+            uint8_t apb1_divider;
+            uint8_t apb2_divider;
+        };
+
+        constexpr Config hsi(uint16_t ahb_divider = 1, uint8_t apb1_divider = 1, uint8_t apb2_divider = 1) {
+            return Config{Source::HSI, Oscillator::HSI, 0, false, 0, 0, 0, 0, ahb_divider, apb1_divider, apb2_divider};
+        }
+
+        constexpr Config hse(uint32_t hse_freq, uint16_t ahb_divider = 1, uint8_t apb1_divider = 1,
+                             uint8_t apb2_divider = 1, bool bypass = false) {
+            return Config{Source::HSE, Oscillator::HSE, hse_freq, bypass, 0, 0, 0, 0,
+                          ahb_divider, apb1_divider, apb2_divider};
+        }
+
+        /**
+         * SYSCLK = input / m * n / p, USB/SDIO/RNG clock = input / m * n / q.
+         *
+         * @param hse_freq: the HSE frequency, also when the input is HSI (0 if none)
+         */
+        constexpr Config pll(Oscillator input, uint32_t hse_freq, uint16_t m, uint16_t n, uint8_t p, uint8_t q,
+                             uint16_t ahb_divider, uint8_t apb1_divider, uint8_t apb2_divider,
+                             bool bypass = false) {
+            return Config{Source::PLL, input, hse_freq, bypass, m, n, p, q, ahb_divider, apb1_divider, apb2_divider};
+        }
+
+        namespace detail {
+            constexpr uint32_t inputFreq(Oscillator input, uint32_t hse_freq) {
+                return input == Oscillator::HSE ? hse_freq : hsi_freq;
+            }
+
+            // VCO input of 2 MHz (less jitter) when the input allows it, else 1 MHz
+            constexpr uint16_t pllM(uint32_t input_freq) {
+                return input_freq % 2000000 == 0 ? input_freq / 2000000 : input_freq / 1000000;
+            }
+
+            // Smallest P keeping the VCO output at least 100 MHz
+            constexpr uint8_t pllP(uint32_t sysclk, uint8_t p = 2) {
+                return p >= 8 || (uint64_t) sysclk * p >= 100000000 ? p : pllP(sysclk, p + 2);
+            }
+
+            // Smallest Q keeping the 48 MHz domain at or below 48 MHz
+            constexpr uint8_t pllQ(uint64_t vco) {
+                return (vco + usb_freq - 1) / usb_freq < 2 ? 2 : (vco + usb_freq - 1) / usb_freq;
+            }
+
+            constexpr uint16_t pllN(uint32_t input_freq, uint32_t sysclk) {
+                return (uint16_t) ((uint64_t) sysclk * pllP(sysclk) * pllM(input_freq) / input_freq);
+            }
+
+            constexpr uint32_t log2(uint32_t value) {
+                return value <= 1 ? 0 : 1 + log2(value >> 1);
+            }
+
+            constexpr bool isPowerOfTwo(uint32_t value) {
+                return value && !(value & (value - 1));
+            }
+        }
+
+        /**
+         * PLL configuration for SYSCLK = sysclk: VCO input of 2 MHz (or 1 MHz), smallest P
+         * and Q. Check the result with valid(): not every sysclk can be reached exactly.
+         */
+        constexpr Config pllFor(Oscillator input, uint32_t hse_freq, uint32_t sysclk, uint16_t ahb_divider,
+                                uint8_t apb1_divider, uint8_t apb2_divider, bool bypass = false) {
+            return pll(input, hse_freq, detail::pllM(detail::inputFreq(input, hse_freq)),
+                       detail::pllN(detail::inputFreq(input, hse_freq), sysclk), detail::pllP(sysclk),
+                       detail::pllQ((uint64_t) sysclk * detail::pllP(sysclk)),
+                       ahb_divider, apb1_divider, apb2_divider, bypass);
+        }
+
+        //***************************
+        //* Frequencies             *
+        //***************************
+
+        constexpr uint32_t vcoInput(const Config& config) {
+            return config.pll_m ? detail::inputFreq(config.pll_input, config.hse_freq) / config.pll_m : 0;
+        }
+
+        constexpr uint32_t vcoOutput(const Config& config) {
+            return vcoInput(config) * config.pll_n;
+        }
+
+        constexpr uint32_t sysclk(const Config& config) {
+            return config.source == Source::HSI ? hsi_freq :
+                   config.source == Source::HSE ? config.hse_freq :
+                   config.pll_p ? vcoOutput(config) / config.pll_p : 0;
+        }
+
+        constexpr uint32_t hclk(const Config& config) {
+            return sysclk(config) / config.ahb_divider;
+        }
+
+        constexpr uint32_t pclk1(const Config& config) {
+            return hclk(config) / config.apb1_divider;
+        }
+
+        constexpr uint32_t pclk2(const Config& config) {
+            return hclk(config) / config.apb2_divider;
+        }
+
+        /**
+         * Kernel clock of the timers on APB1 (TIM2-7, TIM12-14) and APB2 (TIM1, TIM8-11).
+         */
+        constexpr uint32_t timerClock1(const Config& config) {
+            return config.apb1_divider == 1 ? pclk1(config) : 2 * pclk1(config);
+        }
+
+        constexpr uint32_t timerClock2(const Config& config) {
+            return config.apb2_divider == 1 ? pclk2(config) : 2 * pclk2(config);
+        }
+
+        /**
+         * @return the USB OTG FS, SDIO and RNG clock, 0 if the PLL is off
+         */
+        constexpr uint32_t pll48Clock(const Config& config) {
+            return config.source == Source::PLL && config.pll_q ? vcoOutput(config) / config.pll_q : 0;
+        }
+
+        /**
+         * @return true if HCLK needs the regulator in scale 1 mode (PWR_CR VOS set)
+         */
+        constexpr bool needsScale1(const Config& config) {
+            return hclk(config) > max_scale2_hclk;
+        }
+
+        constexpr bool validDividers(const Config& config) {
+            return detail::isPowerOfTwo(config.ahb_divider) && config.ahb_divider <= 512 && config.ahb_divider != 32 &&
+                   detail::isPowerOfTwo(config.apb1_divider) && config.apb1_divider <= 16 &&
+                   detail::isPowerOfTwo(config.apb2_divider) && config.apb2_divider <= 16;
+        }
+
+        constexpr bool validPll(const Config& config) {
+            return config.source != Source::PLL ||
+                   (config.pll_m >= 2 && config.pll_m <= 63 && config.pll_n >= 50 && config.pll_n <= 432 &&
+                    (config.pll_p == 2 || config.pll_p == 4 || config.pll_p == 6 || config.pll_p == 8) &&
+                    config.pll_q >= 2 && config.pll_q <= 15 &&
+                    vcoInput(config) >= 950000 && vcoInput(config) <= 2100000 &&
+                    vcoOutput(config) >= 100000000 && vcoOutput(config) <= 432000000);
+        }
+
+        constexpr bool validHse(const Config& config) {
+            return !(config.source == Source::HSE || (config.source == Source::PLL && config.pll_input == Oscillator::HSE)) ||
+                   (config.hse_bypass ? config.hse_freq >= 1000000 && config.hse_freq <= 50000000 :
+                    config.hse_freq >= 4000000 && config.hse_freq <= 26000000);
+        }
+
+        /**
+         * @return true if config respects the oscillator, PLL and bus limits
+         */
+        constexpr bool valid(const Config& config) {
+            return validDividers(config) && validPll(config) && validHse(config) &&
+                   sysclk(config) <= max_sysclk && pclk1(config) <= max_pclk1 && pclk2(config) <= max_pclk2 &&
+                   pll48Clock(config) <= usb_freq;
+        }
+
+        namespace detail {
+            constexpr uint32_t hpreBits(uint16_t divider) {
+                return divider == 1 ? 0 : divider <= 16 ? 0x7 + log2(divider) : 0x6 + log2(divider);
+            }
+
+            constexpr uint32_t ppreBits(uint8_t divider) {
+                return divider == 1 ? 0 : 0x3 + log2(divider);
+            }
+
+            constexpr uint32_t cfgr(const Config& config) {
+                return hpreBits(config.ahb_divider) * RCC_CFGR_HPRE_0 | ppreBits(config.apb1_divider) * RCC_CFGR_PPRE1_0 |
+                       ppreBits(config.apb2_divider) * RCC_CFGR_PPRE2_0;
+            }
+
+            constexpr uint32_t pllcfgr(const Config& config) {
+                return config.pll_m * RCC_PLLCFGR_PLLM_0 | config.pll_n * RCC_PLLCFGR_PLLN_0 |
+                       (config.pll_p / 2u - 1) * RCC_PLLCFGR_PLLP_0 | config.pll_q * RCC_PLLCFGR_PLLQ_0 |
+                       (config.pll_input == Oscillator::HSE ? RCC_PLLCFGR_PLLSRC_HSE : 0);
+            }
+        }
+
+        /**
+         * @return true if switching from one configuration to the other only rewrites the
+         * bus prescalers (see Control), without a PLL relock
+         */
+        constexpr bool sharesPll(const Config& from, const Config& to) {
+            return from.source == Source::PLL && to.source == Source::PLL &&
+                   detail::pllcfgr(from) == detail::pllcfgr(to) && (!needsScale1(to) || needsScale1(from));
+        }
+
+        /**
+         * Oscillator and SYSCLK state, saved by Control::snapshot().
+         */
+        struct Snapshot {
+            uint32_t cr;
+            uint32_t cfgr;
+        };
+
+        class Control;
+
+        /**
+         * Listener (type)
+         *
+         * Base of the drivers whose timing depends on a bus clock (timer prescalers, baud
+         * rates, ...). A listener registers itself on construction and unregisters on
+         * destruction; after every clock change Control calls its handler, which recomputes
+         * the driver's dividers from the new bus frequencies so that its output frequency
+         * stays the same.
+         *
+         * The handler runs with SystemCoreClock and the bus prescalers already updated,
+         * inside Control::apply() (with interrupts disabled in miosix environment): it
+         * should only rewrite a few registers.
+         */
+        class Listener {
+            friend class Control;
+
+            //***************************
+            //* Subtypes                *
+            //***************************
+        public:
+            typedef void (*Handler)(Listener&);
+
+            //***************************
+            //* Members                 *
+            //***************************
+        private:
+            Handler handler;
+            Listener *next = nullptr;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        protected:
+            explicit Listener(Handler handler);
+            ~Listener();
+
+        public:
+            Listener(const Listener&) = delete;
+            Listener& operator=(const Listener&) = delete;
+        };
+
+        /**
+         * Control (type)
+         *
+         * Switches the clock tree at run time, e.g. down to a low clock when idle and back
+         * to full speed for bursts, then notifies the registered listeners.
+         *
+         * apply() follows the safe sequence: flash wait states raised for the new HCLK,
+         * oscillator started, SYSCLK moved to HSI while the PLL and the prescalers are
+         * rewritten (regulator scale included), SYSCLK moved to the target, wait states
+         * lowered, unused oscillators stopped, listeners notified.
+         *
+         * When the PLL already runs with the configuration requested and the regulator
+         * scale covers the new HCLK, only the bus prescalers are rewritten: no relock, so
+         * the change costs little more than the listeners. Levels sharing a PLL setting
+         * and differing by the AHB divider switch this way.
+         *
+         * NOTE: apply() is thread-safe ONLY inside miosix environment, where it runs with
+         *       interrupts disabled: the kernel tick source must be a Listener as well,
+         *       or the OS time drifts with the clock.
+         */
+        class Control {
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_rcc_t* const periph_base = (raw_rcc_t*) RCC_BASE;
+            static constexpr raw_pwr_t* const pwr_base = (raw_pwr_t*) Peripheral::p_PWR::periph_base;
+
+            // Polling iterations before an oscillator or the PLL is declared dead
+            static constexpr uint32_t startup_timeout = 0x20000;
+
+        private:
+            static constexpr uint32_t pll_fields = RCC_PLLCFGR_PLLM | RCC_PLLCFGR_PLLN | RCC_PLLCFGR_PLLP |
+                                                   RCC_PLLCFGR_PLLQ | RCC_PLLCFGR_PLLSRC;
+
+            static Listener *& listeners() {
+                static Listener *head = nullptr;
+                return head;
+            }
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+#ifdef _MIOSIX
+            static void add(Listener& listener) {
+                miosix::FastInterruptDisableLock dLock;
+                link(listener);
+            }
+
+            static void remove(Listener& listener) {
+                miosix::FastInterruptDisableLock dLock;
+                unlink(listener);
+            }
+
+            /**
+             * Switches to config and notifies the listeners.
+             *
+             * @return false if config is invalid, too fast for the flash supply range or
+             * its oscillator doesn't start (nothing changes), or if the PLL doesn't lock
+             * (the system is left on HSI, and the listeners are notified)
+             */
+            static bool apply(const Config& config) {
+                miosix::FastInterruptDisableLock dLock;
+                return reconfigure(config);
+            }
+#else
+            static void add(Listener& listener) {
+                link(listener);
+            }
+
+            static void remove(Listener& listener) {
+                unlink(listener);
+            }
+
+            /**
+             * Switches to config and notifies the listeners.
+             *
+             * @return false if config is invalid, too fast for the flash supply range or
+             * its oscillator doesn't start (nothing changes), or if the PLL doesn't lock
+             * (the system is left on HSI, and the listeners are notified)
+             */
+            static bool apply(const Config& config) {
+                return reconfigure(config);
+            }
+#endif
+
+            /**
+             * Calls every listener, for clock changes made outside apply(). SystemCoreClock
+             * must be up to date (e.g. through SystemCoreClockUpdate()).
+             */
+            static void notify() {
+                for (Listener *listener = listeners(); listener; listener = listener->next)
+                    listener->handler(*listener);
+            }
+
+            static uint32_t listenerCount() {
+                uint32_t count = 0;
+                for (Listener *listener = listeners(); listener; listener = listener->next)
+                    count++;
+                return count;
+            }
+
+            static Source getSource() {
+                uint32_t sws = periph_base->CFGR & RCC_CFGR_SWS;
+                return sws == RCC_CFGR_SWS_PLL ? Source::PLL : sws == RCC_CFGR_SWS_HSE ? Source::HSE : Source::HSI;
+            }
+
+            /**
+             * Saves the oscillators and the SYSCLK source, before STOP mode: it stops HSE
+             * and PLL, and wakes up on HSI with the bus prescalers unchanged.
+             */
+            static Snapshot snapshot() {
+                return Snapshot{periph_base->CR, periph_base->CFGR};
+            }
+
+            /**
+             * Restarts the oscillators and the SYSCLK source of snapshot, after STOP mode.
+             * HCLK is the same as before STOP: the listeners are not notified.
+             *
+             * @return false if an oscillator didn't start (the system is left on HSI)
+             */
+            static bool restore(const Snapshot& snapshot) {
+                if (snapshot.cr & RCC_CR_HSEON) {
+                    periph_base->CR |= RCC_CR_HSEON;
+                    if (!waitFor(periph_base->CR, RCC_CR_HSERDY, RCC_CR_HSERDY))
+                        return false;
+                }
+
+                if (snapshot.cr & RCC_CR_PLLON) {
+                    periph_base->CR |= RCC_CR_PLLON;
+                    if (!waitFor(periph_base->CR, RCC_CR_PLLRDY, RCC_CR_PLLRDY))
+                        return false;
+                }
+
+                uint32_t sw = snapshot.cfgr & RCC_CFGR_SW;
+                return select(sw, sw * RCC_CFGR_SWS_0);
+            }
+
+        private:
+            static void link(Listener& listener) {
+                listener.next = listeners();
+                listeners() = &listener;
+            }
+
+            static void unlink(Listener& listener) {
+                for (Listener **link = &listeners(); *link; link = &(*link)->next) {
+                    if (*link == &listener) {
+                        *link = listener.next;
+                        listener.next = nullptr;
+                        return;
+                    }
+                }
+            }
+
+            static bool waitFor(volatile uint32_t& reg, uint32_t mask, uint32_t value) {
+                for (uint32_t i = 0; i < startup_timeout; i++)
+                    if ((reg & mask) == value)
+                        return true;
+                return false;
+            }
+
+            static bool select(uint32_t sw, uint32_t sws) {
+                periph_base->CFGR = (periph_base->CFGR & ~RCC_CFGR_SW) | sw;
+                return waitFor(periph_base->CFGR, RCC_CFGR_SWS, sws);
+            }
+
+            static bool usesHse(const Config& config) {
+                return config.source == Source::HSE ||
+                       (config.source == Source::PLL && config.pll_input == Oscillator::HSE);
+            }
+
+            static void settle(uint32_t hclk) {
+                SystemCoreClock = hclk;
+                Flash::Acr::afterClockChange(hclk);
+            }
+
+            static bool pllReusable(const Config& config) {
+                Peripheral::p_PWR::enable();
+                return config.source == Source::PLL && getSource() == Source::PLL &&
+                       (periph_base->PLLCFGR & pll_fields) == detail::pllcfgr(config) &&
+                       (!needsScale1(config) || (pwr_base->CR & PWR_CR_VOS));
+            }
+
+            static bool reconfigure(const Config& config) {
+                if (!valid(config) || !Flash::Acr::beforeClockChange(hclk(config)))
+                    return false;
+
+                if (pllReusable(config)) {
+                    periph_base->CFGR = (periph_base->CFGR & ~(RCC_CFGR_HPRE | RCC_CFGR_PPRE1 | RCC_CFGR_PPRE2)) |
+                                        detail::cfgr(config);
+                    settle(hclk(config));
+                    notify();
+                    return true;
+                }
+
+                // The HSI is the safe harbour while the PLL is rewritten
+                periph_base->CR |= RCC_CR_HSION;
+                if (!waitFor(periph_base->CR, RCC_CR_HSIRDY, RCC_CR_HSIRDY)) {
+                    Flash::Acr::afterClockChange(SystemCoreClock);
+                    return false;
+                }
+
+                if (usesHse(config) && !(periph_base->CR & RCC_CR_HSERDY)) {
+                    periph_base->CR = (periph_base->CR & ~RCC_CR_HSEBYP) | (config.hse_bypass ? RCC_CR_HSEBYP : 0);
+                    periph_base->CR |= RCC_CR_HSEON;
+                    if (!waitFor(periph_base->CR, RCC_CR_HSERDY, RCC_CR_HSERDY)) {
+                        periph_base->CR &= ~RCC_CR_HSEON;
+                        Flash::Acr::afterClockChange(SystemCoreClock);
+                        return false;
+                    }
+                }
+
+                select(RCC_CFGR_SW_HSI, RCC_CFGR_SWS_HSI);
+                periph_base->CFGR = (periph_base->CFGR & ~(RCC_CFGR_HPRE | RCC_CFGR_PPRE1 | RCC_CFGR_PPRE2)) |
+                                    detail::cfgr(config);
+                SystemCoreClock = hsi_freq / config.ahb_divider;
+
+                // PLL off: its configuration and VOS can be written
+                periph_base->CR &= ~RCC_CR_PLLON;
+                waitFor(periph_base->CR, RCC_CR_PLLRDY, 0);
+
+                Peripheral::p_PWR::enable();
+                if (needsScale1(config))
+                    pwr_base->CR |= PWR_CR_VOS;
+                else
+                    pwr_base->CR &= ~PWR_CR_VOS;
+
+                bool locked = true;
+                if (config.source == Source::PLL) {
+                    periph_base->PLLCFGR = (periph_base->PLLCFGR & ~pll_fields) | detail::pllcfgr(config);
+                    periph_base->CR |= RCC_CR_PLLON;
+                    locked = waitFor(periph_base->CR, RCC_CR_PLLRDY, RCC_CR_PLLRDY) &&
+                             select(RCC_CFGR_SW_PLL, RCC_CFGR_SWS_PLL);
+                } else if (config.source == Source::HSE) {
+                    select(RCC_CFGR_SW_HSE, RCC_CFGR_SWS_HSE);
+                }
+
+                if (locked) {
+                    settle(hclk(config));
+                    if (!usesHse(config))
+                        periph_base->CR &= ~RCC_CR_HSEON;
+                } else {
+                    periph_base->CR &= ~RCC_CR_PLLON;
+                    settle(hsi_freq / config.ahb_divider);
+                }
+
+                notify();
+                return locked;
+            }
+        };
+
+        inline Listener::Listener(Handler handler) : handler(handler) {
+            Control::add(*this);
+        }
+
+        inline Listener::~Listener() {
+            Control::remove(*this);
+        }
+    }
+}
+
+#endif //CLOCK_HPP
@@ -0,0 +1,312 @@
+#ifndef GOVERNOR_HPP
+#define GOVERNOR_HPP
+
+#include "clock.hpp"
+#include "../debug/cycle_counter.hpp"
+
+namespace HAL {
+    namespace Clock {
+
+        /**
+         * A clock configuration the governor may choose, with what it costs in flash wait
+         * states. Build the table with level() at compile time.
+         */
+        struct Level {
+            Config config;
+            uint32_t hclk;
+            uint32_t wait_states;
+        };
+
+        constexpr Level level(const Config& config, Flash::Supply supply = Flash::Supply::V2_7) {
+            return Level{config, hclk(config), Flash::waitStates(hclk(config), supply)};
+        }
+
+        /**
+         * Governor tuning.
+         *
+         * sample_period_us: how often Governor::update() is called
+         * up_permille: load above which the governor scales up at once
+         * target_permille: projected load a level must stay under to be chosen
+         * down_samples: consecutive samples a lower level must fit before scaling down
+         * latency_budget_us: down-moves estimated (or measured) longer than this are
+         *        never made; the core is stalled for the whole transition. Up-moves are
+         *        made whatever they cost, as the load can't wait
+         * wait_state_penalty_permille: throughput lost per flash wait state, with the
+         *        ART accelerator on (a few percent on typical code)
+         */
+        struct Policy {
+            uint32_t sample_period_us;
+            uint16_t up_permille;
+            uint16_t target_permille;
+            uint16_t down_samples;
+            uint32_t latency_budget_us;
+            uint16_t wait_state_penalty_permille;
+        };
+
+        constexpr Policy default_policy = {10000, 850, 600, 20, 500, 30};
+
+        // Worst case oscillator start-up times (STM32F405/407 datasheet)
+        constexpr uint32_t pll_lock_us = 200;
+        constexpr uint32_t hse_startup_us = 2000;
+
+        namespace detail {
+            constexpr bool needsHse(const Config& config) {
+                return config.source == Source::HSE ||
+                       (config.source == Source::PLL && config.pll_input == Oscillator::HSE);
+            }
+        }
+
+        /**
+         * @return the estimated stall of a transition, in us, without the listeners
+         */
+        constexpr uint32_t transitionEstimate(const Config& from, const Config& to) {
+            return sharesPll(from, to) ? 1 :
+                   (to.source == Source::PLL ? pll_lock_us : 0) +
+                   (detail::needsHse(to) && !detail::needsHse(from) ? hse_startup_us : 0) + 10;
+        }
+
+        /**
+         * LoadMeter (type)
+         *
+         * Measures the busy fraction of the core. The idle loop calls idleEnter() before
+         * sleeping and idleExit() after waking up; the cycles spent between idleExit() and
+         * the next idleEnter() are the busy time (DWT CYCCNT). It works whether or not
+         * the counter runs during sleep, as the window is measured apart, in wall time.
+         *
+         * Interrupt handlers that run while the core sleeps count as idle.
+         */
+        class LoadMeter {
+            //***************************
+            //* Members                 *
+            //***************************
+        private:
+            uint32_t busy = 0;
+            uint32_t stamp = 0;
+            bool idle = false;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            LoadMeter() {
+                Debug::CycleCounter::enable();
+                stamp = Debug::CycleCounter::now();
+            }
+
+            void idleEnter() {
+                uint32_t now = Debug::CycleCounter::now();
+                if (!idle) {
+                    busy += now - stamp;
+                    idle = true;
+                }
+            }
+
+            void idleExit() {
+                stamp = Debug::CycleCounter::now();
+                idle = false;
+            }
+
+            /**
+             * @return the busy cycles since the previous sample, and restarts counting
+             */
+            uint32_t sample() {
+                uint32_t now = Debug::CycleCounter::now();
+                if (!idle) {
+                    busy += now - stamp;
+                    stamp = now;
+                }
+
+                uint32_t result = busy;
+                busy = 0;
+                return result;
+            }
+        };
+
+        /**
+         * Governor (type)
+         *
+         * Dynamic frequency scaling: every sample_period_us, update() measures the load at
+         * the current level and picks one of N precomputed levels, sorted by increasing
+         * HCLK (e.g. 168 MHz, 84 MHz on the same PLL, 24 MHz and 16 MHz from HSI).
+         *
+         * The load is projected on each level by its throughput, HCLK reduced by the flash
+         * wait state penalty. Above up_permille the governor jumps at once to the lowest
+         * level keeping the projected load under target_permille (the top one if none);
+         * it steps down only after down_samples samples in a row fit a lower level, so
+         * that bursts don't make it oscillate.
+         *
+         * Each transition costs the PLL relock and oscillator start-up (none between
+         * levels sharing the PLL, see Control) plus the listeners' re-timing: the cost is
+         * measured on every transition, and the larger of the estimate and the measure
+         * is checked against latency_budget_us before stepping down. Stepping up is never
+         * refused on cost: once down on an HSI level (HSE off), the way back to an HSE PLL
+         * level pays the HSE start-up, well over a typical budget.
+         *
+         * Example (the idle hook and a 10 ms tick):
+         *     static constexpr Clock::Level levels[] = {Clock::level(Clock::hsi()),
+         *             Clock::level(Clock::pllFor(...48 MHz...)), Clock::level(Clock::pllFor(...168 MHz...))};
+         *     Clock::Governor<3> governor(levels, Clock::default_policy, 2);
+         *     void idle() { governor.idleEnter(); __WFI(); governor.idleExit(); }
+         *     void tick() { governor.update(); }
+         *
+         * NOTE: update() must be called from one context only.
+         */
+        template<unsigned N>
+        class Governor {
+            static_assert(N >= 1 && N <= 8, "the governor handles 1 to 8 levels");
+
+            //***************************
+            //* Members                 *
+            //***************************
+        private:
+            const Level *levels;
+            Policy policy;
+            LoadMeter meter;
+            unsigned current;
+            uint16_t below_count = 0;
+            uint16_t load = 0;
+            uint32_t measured_us[N][N];
+            uint32_t transition_count = 0;
+            uint32_t failure_count = 0;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            /**
+             * @param levels: sorted by increasing HCLK, valid for the rest of the program
+             * @param current: the level the system runs at now (not applied here)
+             */
+            Governor(const Level (&levels)[N], const Policy& policy = default_policy, unsigned current = N - 1) :
+                    levels(levels), policy(policy), current(current < N ? current : N - 1) {
+                for (unsigned i = 0; i < N; i++)
+                    for (unsigned j = 0; j < N; j++)
+                        measured_us[i][j] = 0;
+            }
+
+            void idleEnter() {
+                meter.idleEnter();
+            }
+
+            void idleExit() {
+                meter.idleExit();
+            }
+
+            /**
+             * Samples the load and changes level if needed.
+             *
+             * @return true if the level changed
+             */
+            bool update() {
+                uint64_t window = (uint64_t) levels[current].hclk / 1000000 * policy.sample_period_us;
+                uint64_t busy = (uint64_t) meter.sample() * 1000;
+                load = window == 0 ? 1000 : busy >= window * 1000 ? 1000 : busy / window;
+
+                if (load >= policy.up_permille) {
+                    below_count = 0;
+                    for (unsigned i = current + 1; i < N; i++)
+                        if (projected(i) <= policy.target_permille || i == N - 1)
+                            return moveTo(i);
+                    return false;
+                }
+
+                for (unsigned i = 0; i < current; i++) {
+                    if (projected(i) <= policy.target_permille && affordable(i)) {
+                        if (++below_count < policy.down_samples)
+                            return false;
+                        return moveTo(i);
+                    }
+                }
+
+                below_count = 0;
+                return false;
+            }
+
+            /**
+             * Moves to level now, regardless of the load (e.g. full speed before a known
+             * burst). The latency budget is not checked.
+             */
+            bool force(unsigned level) {
+                if (level >= N)
+                    return false;
+                return level == current || moveTo(level);
+            }
+
+            unsigned getLevel() const {
+                return current;
+            }
+
+            /**
+             * @return the load of the last sample, in permille of the level's capacity
+             */
+            uint16_t getLoad() const {
+                return load;
+            }
+
+            /**
+             * @return the longest measured stall moving between two levels, in us (an upper
+             * bound: cycles are converted at the slowest clock in play), 0 if never made
+             */
+            uint32_t measuredCost(unsigned from, unsigned to) const {
+                return measured_us[from][to];
+            }
+
+            uint32_t cost(unsigned from, unsigned to) const {
+                uint32_t estimate = transitionEstimate(levels[from].config, levels[to].config);
+                return measured_us[from][to] > estimate ? measured_us[from][to] : estimate;
+            }
+
+            uint32_t transitions() const {
+                return transition_count;
+            }
+
+            uint32_t failures() const {
+                return failure_count;
+            }
+
+        private:
+            // HCLK discounted by the wait states, in kHz
+            uint32_t capacity(unsigned level) const {
+                return (uint32_t) ((uint64_t) levels[level].hclk / 1000 * 1000 /
+                                   (1000 + policy.wait_state_penalty_permille * levels[level].wait_states));
+            }
+
+            uint32_t projected(unsigned level) const {
+                return (uint32_t) ((uint64_t) load * capacity(current) / capacity(level));
+            }
+
+            // Only checked on down-moves, which are discretionary
+            bool affordable(unsigned level) const {
+                return cost(current, level) <= policy.latency_budget_us;
+            }
+
+            bool moveTo(unsigned level) {
+                uint32_t slowest = levels[current].hclk < levels[level].hclk ? levels[current].hclk : levels[level].hclk;
+                uint32_t harbour = hsi_freq / levels[level].config.ahb_divider;
+                if (!sharesPll(levels[current].config, levels[level].config) && harbour < slowest)
+                    slowest = harbour;
+
+                Debug::CycleCounter counter;
+                counter.start();
+                bool done = Control::apply(levels[level].config);
+                uint32_t us = counter.elapsed() / (slowest / 1000000 ? slowest / 1000000 : 1);
+
+                if (us > measured_us[current][level])
+                    measured_us[current][level] = us;
+
+                below_count = 0;
+                meter.sample();
+                if (!done) {
+                    failure_count++;
+                    return false;
+                }
+
+                current = level;
+                transition_count++;
+                return true;
+            }
+        };
+    }
+}
+
+#endif //GOVERNOR_HPP
@@ -0,0 +1,249 @@
+#ifndef CRC_HPP
+#define CRC_HPP
+
+#include "../peripheral.hpp"
+#include "../dma/dma_stream.hpp"
+#include "crc_software.hpp"
+
+#include <algorithm>
+
+namespace HAL {
+    namespace Crc {
+        typedef CRC_TypeDef raw_crc_t;
+
+        /**
+         * Crc32 (type)
+         *
+         * CRC-32 computed by the CRC unit, fed by the CPU. In MPEG2 and ZLIB modes each word
+         * is byte swapped (__REV) or bit reversed (__RBIT) on its way to the data register,
+         * a single cycle instruction; bytes before the first aligned word and after the
+         * last one go through Software. Data of any alignment and length is accepted.
+         *
+         * The running value is kept in the object and loaded in the CRC unit at every
+         * update(), so more checksums can be computed interleaved, as long as the calls
+         * don't preempt each other.
+         */
+        class Crc32 {
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_crc_t* const periph_base = (raw_crc_t*) Peripheral::p_CRC::periph_base;
+
+            // Below this length the hardware setup costs more than it saves
+            static constexpr uint32_t min_hardware_bytes = 16;
+
+        private:
+            Mode mode;
+            uint32_t crc = initial_value;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            explicit Crc32(Mode mode = Mode::ZLIB) : mode(mode) {
+                Peripheral::p_CRC::enable();
+            }
+
+            /**
+             * Starts a new checksum.
+             */
+            void reset() {
+                crc = initial_value;
+            }
+
+            /**
+             * Adds data to the checksum.
+             */
+            void update(const void *data, uint32_t bytes) {
+                const uint8_t *p = (const uint8_t *) data;
+
+                if (bytes < min_hardware_bytes) {
+                    crc = Software::update(mode, crc, p, bytes);
+                    return;
+                }
+
+                // In WORD mode the grouping is relative to the data start, not to the
+                // address, so there is no head: unaligned words are assembled bytewise
+                if (mode != Mode::WORD) {
+                    uint32_t head = (0u - (__pointer) p) & 3;
+                    crc = Software::update(mode, crc, p, head);
+                    p += head;
+                    bytes -= head;
+                }
+
+                uint32_t words = bytes / 4;
+                if (words)
+                    hardware(p, words);
+
+                crc = Software::update(mode, crc, p + 4 * words, bytes % 4);
+            }
+
+            /**
+             * @return the checksum of the data added since the last reset()
+             */
+            uint32_t value() const {
+                return Software::finalize(mode, crc);
+            }
+
+            /**
+             * @return the checksum of a complete buffer
+             */
+            static uint32_t compute(Mode mode, const void *data, uint32_t bytes) {
+                Crc32 c(mode);
+                c.update(data, bytes);
+                return c.value();
+            }
+
+        private:
+            void hardware(const uint8_t *p, uint32_t words) {
+                const uint32_t *w = (const uint32_t *) p;
+
+                periph_base->CR = CRC_CR_RESET;
+                if (crc != initial_value)
+                    periph_base->DR = Software::loadWord(crc);
+
+                if (mode == Mode::ZLIB) {
+                    for (uint32_t i = 0; i < words; i++)
+                        periph_base->DR = __RBIT(w[i]);
+                } else if (mode == Mode::MPEG2) {
+                    for (uint32_t i = 0; i < words; i++)
+                        periph_base->DR = __REV(w[i]);
+                } else if (((__pointer) p & 3) == 0) {
+                    for (uint32_t i = 0; i < words; i++)
+                        periph_base->DR = w[i];
+                } else {
+                    for (uint32_t i = 0; i < words; i++, p += 4)
+                        periph_base->DR = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+                }
+
+                crc = periph_base->DR;
+            }
+        };
+
+        /**
+         * DmaCrc32 (type)
+         *
+         * WORD mode CRC-32 fed to the CRC unit by a DMA2 stream S (memory-to-memory
+         * transfer towards the data register), leaving the CPU free. Word aligned buffers
+         * are read a word at a time; unaligned ones are read a byte at a time and packed
+         * into words by the stream FIFO, so they need no CPU head handling and give the
+         * same result. Trailing bytes are added by the CPU when the transfer completes.
+         * Buffers longer than a single transfer are split transparently.
+         *
+         * MPEG2 and ZLIB modes need each word to be transformed, which the DMA can't do:
+         * use Crc32 for them.
+         *
+         * The CRC unit is not available to other users while a computation is running.
+         */
+        template<typename S>
+        class DmaCrc32 {
+            static_assert(Dma::DmaStream<S>::is_dma2, "memory-to-memory transfers are supported by DMA2 only");
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_crc_t* const periph_base = (raw_crc_t*) Peripheral::p_CRC::periph_base;
+
+        private:
+            Dma::DmaStream<S> dma;
+
+            const uint8_t *next = nullptr;
+            uint32_t left = 0;
+            uint32_t tail = 0;
+            uint32_t crc = initial_value;
+            bool busy = false;
+            bool error = false;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            DmaCrc32() {
+                Peripheral::p_CRC::enable();
+            }
+
+            /**
+             * Starts the computation of the checksum of data, returns immediately.
+             * data must stay valid until isDone(), and it can't be in CCM RAM.
+             */
+            void start(const void *data, uint32_t bytes) {
+                next = (const uint8_t *) data;
+                left = bytes & ~3u;
+                tail = bytes & 3u;
+                crc = initial_value;
+                error = false;
+                busy = true;
+
+                periph_base->CR = CRC_CR_RESET;
+                transfer();
+            }
+
+            /**
+             * Polls the computation, starting the next transfer of long buffers.
+             *
+             * @return true when the checksum is available
+             */
+            bool isDone() {
+                if (!busy || dma.is_enabled())
+                    return !busy;
+
+                if (dma.flags() & (Dma::TRANSFER_ERROR | Dma::FIFO_ERROR)) {
+                    error = true;
+                    left = 0;
+                }
+
+                if (left) {
+                    transfer();
+                    return false;
+                }
+
+                crc = Software::update(Mode::WORD, periph_base->DR, next, error ? 0 : tail);
+                busy = false;
+                return true;
+            }
+
+            /**
+             * @return true if the last computation was aborted by a bus error
+             */
+            bool failed() const {
+                return error;
+            }
+
+            uint32_t value() const {
+                return crc;
+            }
+
+            /**
+             * Blocking computation of the checksum of data.
+             */
+            uint32_t compute(const void *data, uint32_t bytes) {
+                start(data, bytes);
+                while (!isDone());
+                return value();
+            }
+
+        private:
+            void transfer() {
+                if (left == 0)
+                    return;
+
+                bool aligned = ((__pointer) next & 3) == 0;
+                uint32_t items = aligned ? std::min<uint32_t>(left / 4, 0xFFFF) : std::min<uint32_t>(left, 0xFFFC);
+
+                // Memory-to-memory: the peripheral port is the source
+                dma.configure(0, Dma::Direction::MEMORY_TO_MEMORY, aligned ? Dma::Size::WORD : Dma::Size::BYTE,
+                              Dma::Size::WORD, Dma::Priority::MEDIUM, Dma::PERIPHERAL_INCREMENT);
+                dma.enableFifo(Dma::FifoThreshold::HALF);
+                dma.start(next, &periph_base->DR, items);
+
+                uint32_t consumed = aligned ? 4 * items : items;
+                next += consumed;
+                left -= consumed;
+            }
+        };
+    }
+}
+
+#endif //CRC_HPP
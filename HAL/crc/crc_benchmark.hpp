@@ -0,0 +1,71 @@
+#ifndef CRC_BENCHMARK_HPP
+#define CRC_BENCHMARK_HPP
+
+#include "crc.hpp"
+#include "../debug/cycle_counter.hpp"
+
+namespace HAL {
+    namespace Crc {
+
+        /**
+         * Core cycles spent by each CRC path on the same buffer. For the DMA path the
+         * cycles are wall-clock time: the CPU is free while the transfer runs.
+         * matching is false if any hardware result differs from the software one.
+         */
+        struct BenchmarkResult {
+            uint32_t bytes;
+            uint32_t software_zlib;
+            uint32_t hardware_zlib;
+            uint32_t software_word;
+            uint32_t hardware_word;
+            uint32_t dma_word;
+            bool matching;
+        };
+
+        /**
+         * Computes the checksum of data through every path (software, CRC unit fed by
+         * the CPU, CRC unit fed by DMA2 stream S), measuring each one with the DWT cycle
+         * counter. Run it with interrupts disabled for repeatable figures.
+         *
+         * @param data: buffer to be checksummed, not in CCM RAM (the DMA can't reach it)
+         * @param bytes: buffer length
+         */
+        template<typename S>
+        BenchmarkResult benchmark(const void *data, uint32_t bytes) {
+            Debug::CycleCounter counter;
+            DmaCrc32<S> dma;
+            BenchmarkResult result;
+            uint32_t reference, value;
+
+            result.bytes = bytes;
+            result.matching = true;
+
+            counter.start();
+            reference = Software::compute(Mode::ZLIB, data, bytes);
+            result.software_zlib = counter.elapsed();
+
+            counter.start();
+            value = Crc32::compute(Mode::ZLIB, data, bytes);
+            result.hardware_zlib = counter.elapsed();
+            result.matching &= value == reference;
+
+            counter.start();
+            reference = Software::compute(Mode::WORD, data, bytes);
+            result.software_word = counter.elapsed();
+
+            counter.start();
+            value = Crc32::compute(Mode::WORD, data, bytes);
+            result.hardware_word = counter.elapsed();
+            result.matching &= value == reference;
+
+            counter.start();
+            value = dma.compute(data, bytes);
+            result.dma_word = counter.elapsed();
+            result.matching &= value == reference && !dma.failed();
+
+            return result;
+        }
+    }
+}
+
+#endif //CRC_BENCHMARK_HPP
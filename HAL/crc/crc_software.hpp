@@ -0,0 +1,157 @@
+#ifndef CRC_SOFTWARE_HPP
+#define CRC_SOFTWARE_HPP
+
+#include <cstdint>
+
+namespace HAL {
+    namespace Crc {
+        /**
+         * Checksum definitions.
+         *
+         * WORD:  what the CRC unit computes natively: polynomial 0x04C11DB7, initial value
+         *        0xFFFFFFFF, the data taken as little endian 32 bit words, each one shifted
+         *        in MSB first, no final XOR. It is the only mode the DMA can feed, and the
+         *        result of the ST libraries on word buffers. Trailing bytes (if the length is
+         *        not a multiple of 4) are shifted in one by one, MSB first.
+         * MPEG2: CRC-32/MPEG-2 over the byte stream (check value 0x0376E6E7).
+         * ZLIB:  CRC-32 of zlib, Ethernet, PNG, gzip (check value 0xCBF43926).
+         *
+         * The check value is the checksum of the ASCII string "123456789".
+         */
+        enum class Mode {
+            WORD,
+            MPEG2,
+            ZLIB
+        };
+
+        static constexpr uint32_t polynomial = 0x04C11DB7;
+        static constexpr uint32_t reflected_polynomial = 0xEDB88320;
+        static constexpr uint32_t initial_value = 0xFFFFFFFF;
+
+        namespace detail {
+            constexpr uint32_t msbShift(uint32_t crc, unsigned bits) {
+                return bits == 0 ? crc : msbShift((crc & 0x80000000u) ? (crc << 1) ^ polynomial : crc << 1, bits - 1);
+            }
+
+            constexpr uint32_t lsbShift(uint32_t crc, unsigned bits) {
+                return bits == 0 ? crc : lsbShift((crc & 1u) ? (crc >> 1) ^ reflected_polynomial : crc >> 1, bits - 1);
+            }
+
+            // Nibble tables: 128 bytes in flash, two lookups per byte
+            template<typename T = void>
+            struct Tables {
+                static constexpr uint32_t msb[16] = {
+                        msbShift(0x0u << 28, 4), msbShift(0x1u << 28, 4), msbShift(0x2u << 28, 4), msbShift(0x3u << 28, 4),
+                        msbShift(0x4u << 28, 4), msbShift(0x5u << 28, 4), msbShift(0x6u << 28, 4), msbShift(0x7u << 28, 4),
+                        msbShift(0x8u << 28, 4), msbShift(0x9u << 28, 4), msbShift(0xAu << 28, 4), msbShift(0xBu << 28, 4),
+                        msbShift(0xCu << 28, 4), msbShift(0xDu << 28, 4), msbShift(0xEu << 28, 4), msbShift(0xFu << 28, 4)
+                };
+
+                static constexpr uint32_t lsb[16] = {
+                        lsbShift(0x0, 4), lsbShift(0x1, 4), lsbShift(0x2, 4), lsbShift(0x3, 4),
+                        lsbShift(0x4, 4), lsbShift(0x5, 4), lsbShift(0x6, 4), lsbShift(0x7, 4),
+                        lsbShift(0x8, 4), lsbShift(0x9, 4), lsbShift(0xA, 4), lsbShift(0xB, 4),
+                        lsbShift(0xC, 4), lsbShift(0xD, 4), lsbShift(0xE, 4), lsbShift(0xF, 4)
+                };
+            };
+
+            template<typename T>
+            constexpr uint32_t Tables<T>::msb[16];
+
+            template<typename T>
+            constexpr uint32_t Tables<T>::lsb[16];
+        }
+
+        /**
+         * Software (type)
+         *
+         * Table driven CRC-32 on the CPU. It handles the bytes the CRC unit can't take
+         * (unaligned heads and tails), and it is the fallback and reference of the
+         * hardware paths. Running values are kept in the CRC unit domain (MSB first, no
+         * final XOR), so they can be moved between software and hardware at any point.
+         */
+        class Software {
+            typedef detail::Tables<> tables;
+
+        public:
+            /**
+             * Shifts bytes into crc MSB first (MPEG-2 bit order).
+             */
+            static uint32_t msb(uint32_t crc, const uint8_t *data, uint32_t bytes) {
+                for (uint32_t i = 0; i < bytes; i++) {
+                    crc = (crc << 4) ^ tables::msb[(crc >> 28) ^ (data[i] >> 4)];
+                    crc = (crc << 4) ^ tables::msb[(crc >> 28) ^ (data[i] & 0xF)];
+                }
+                return crc;
+            }
+
+            /**
+             * Shifts bytes into a reflected crc LSB first (zlib bit order).
+             */
+            static uint32_t lsb(uint32_t crc, const uint8_t *data, uint32_t bytes) {
+                for (uint32_t i = 0; i < bytes; i++) {
+                    crc ^= data[i];
+                    crc = (crc >> 4) ^ tables::lsb[crc & 0xF];
+                    crc = (crc >> 4) ^ tables::lsb[crc & 0xF];
+                }
+                return crc;
+            }
+
+            static uint32_t reflect(uint32_t value) {
+                value = ((value >> 1) & 0x55555555) | ((value & 0x55555555) << 1);
+                value = ((value >> 2) & 0x33333333) | ((value & 0x33333333) << 2);
+                value = ((value >> 4) & 0x0F0F0F0F) | ((value & 0x0F0F0F0F) << 4);
+                value = ((value >> 8) & 0x00FF00FF) | ((value & 0x00FF00FF) << 8);
+                return (value >> 16) | (value << 16);
+            }
+
+            /**
+             * Advances a running value (CRC unit domain) of the given mode by bytes.
+             */
+            static uint32_t update(Mode mode, uint32_t crc, const uint8_t *data, uint32_t bytes) {
+                switch (mode) {
+                    case Mode::ZLIB:
+                        return reflect(lsb(reflect(crc), data, bytes));
+
+                    case Mode::WORD:
+                        for (; bytes >= 4; bytes -= 4, data += 4) {
+                            const uint8_t word[4] = {data[3], data[2], data[1], data[0]};
+                            crc = msb(crc, word, 4);
+                        }
+                        return msb(crc, data, bytes);
+
+                    default:
+                        return msb(crc, data, bytes);
+                }
+            }
+
+            /**
+             * @return the checksum of a complete buffer
+             */
+            static uint32_t compute(Mode mode, const void *data, uint32_t bytes) {
+                return finalize(mode, update(mode, initial_value, (const uint8_t *) data, bytes));
+            }
+
+            /**
+             * Converts a running value into the checksum of the given mode.
+             */
+            static uint32_t finalize(Mode mode, uint32_t crc) {
+                return mode == Mode::ZLIB ? ~reflect(crc) : crc;
+            }
+
+            /**
+             * The CRC unit can only be reset to 0xFFFFFFFF. This returns the word that,
+             * written right after a reset, brings it to crc: the 32 shifts are undone
+             * (the polynomial is odd, so each shift is invertible) and the initial value
+             * is XORed away.
+             */
+            static uint32_t loadWord(uint32_t crc) {
+                for (unsigned i = 0; i < 32; i++)
+                    crc = (crc & 1u) ? ((crc ^ polynomial) >> 1) | 0x80000000u : crc >> 1;
+                return crc ^ initial_value;
+            }
+        };
+    }
+}
+
+#endif //CRC_SOFTWARE_HPP
@@ -0,0 +1,677 @@
+#ifndef AES_HPP
+#define AES_HPP
+
+#include "crypto.hpp"
+#include "../dma/dma_request.hpp"
+
+#include <algorithm>
+
+namespace HAL {
+    namespace Crypto {
+        typedef CRYP_TypeDef raw_cryp_t;
+
+        enum class Mode {
+            ECB,
+            CBC,
+            CTR
+        };
+
+        enum class Direction {
+            ENCRYPT,
+            DECRYPT
+        };
+
+        namespace detail {
+            //***************************
+            //* GF(2^8) arithmetic      *
+            //***************************
+
+            constexpr uint8_t xtime(uint8_t a) {
+                return (uint8_t) ((a << 1) ^ ((a & 0x80) ? 0x1B : 0));
+            }
+
+            constexpr uint8_t gmul(uint8_t a, uint8_t b) {
+                return b == 0 ? 0 : (uint8_t) (((b & 1) ? a : 0) ^ gmul(xtime(a), b >> 1));
+            }
+
+            constexpr uint8_t gpow(uint8_t a, unsigned e) {
+                return e == 0 ? 1 : gmul((e & 1) ? a : 1, gpow(gmul(a, a), e >> 1));
+            }
+
+            constexpr uint8_t rotl8(uint8_t x, unsigned k) {
+                return (uint8_t) ((x << k) | (x >> (8 - k)));
+            }
+
+            // Multiplicative inverse (a^254, 0 for 0) followed by the affine transformation
+            constexpr uint8_t affine(uint8_t b) {
+                return (uint8_t) (b ^ rotl8(b, 1) ^ rotl8(b, 2) ^ rotl8(b, 3) ^ rotl8(b, 4) ^ 0x63);
+            }
+
+            constexpr uint8_t sbox(uint8_t x) {
+                return affine(gpow(x, 254));
+            }
+
+            constexpr uint8_t invSbox(uint8_t y) {
+                return gpow((uint8_t) (rotl8(y, 1) ^ rotl8(y, 3) ^ rotl8(y, 6) ^ 0x05), 254);
+            }
+
+            template<unsigned... I>
+            struct Indices {};
+
+            template<unsigned N, unsigned... I>
+            struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+
+            template<unsigned... I>
+            struct MakeIndices<0, I...> {
+                typedef Indices<I...> type;
+            };
+
+            /**
+             * The S-boxes, computed by the compiler from their algebraic definition: no
+             * table is typed in, and there are no T-tables (MixColumns is computed).
+             */
+            template<typename T = typename MakeIndices<256>::type>
+            struct SBoxes;
+
+            template<unsigned... I>
+            struct SBoxes<Indices<I...>> {
+                static constexpr uint8_t forward[256] = {sbox(I)...};
+                static constexpr uint8_t inverse[256] = {invSbox(I)...};
+            };
+
+            template<unsigned... I>
+            constexpr uint8_t SBoxes<Indices<I...>>::forward[256];
+
+            template<unsigned... I>
+            constexpr uint8_t SBoxes<Indices<I...>>::inverse[256];
+
+            // Adds blocks to the 32 bit big endian counter in the last 4 bytes of the block,
+            // as the CRYP processor does in CTR mode
+            inline void incrementCounter(uint8_t *counter, uint32_t blocks) {
+                storeBigEndian(counter + 12, loadBigEndian(counter + 12) + blocks);
+            }
+
+            /**
+             * AesApi (type)
+             *
+             * Blocking operations shared by the AES implementations, built on their
+             * start()/isDone() pair.
+             */
+            template<typename D>
+            class AesApi {
+            public:
+                void encryptEcb(const void *in, void *out, uint32_t bytes) {
+                    run(Mode::ECB, Direction::ENCRYPT, nullptr, in, out, bytes);
+                }
+
+                void decryptEcb(const void *in, void *out, uint32_t bytes) {
+                    run(Mode::ECB, Direction::DECRYPT, nullptr, in, out, bytes);
+                }
+
+                void encryptCbc(uint8_t *iv, const void *in, void *out, uint32_t bytes) {
+                    run(Mode::CBC, Direction::ENCRYPT, iv, in, out, bytes);
+                }
+
+                void decryptCbc(uint8_t *iv, const void *in, void *out, uint32_t bytes) {
+                    run(Mode::CBC, Direction::DECRYPT, iv, in, out, bytes);
+                }
+
+                /**
+                 * CTR encryption and decryption are the same operation.
+                 */
+                void ctr(uint8_t *counter, const void *in, void *out, uint32_t bytes) {
+                    run(Mode::CTR, Direction::ENCRYPT, counter, in, out, bytes);
+                }
+
+            private:
+                void run(Mode mode, Direction direction, uint8_t *iv, const void *in, void *out, uint32_t bytes) {
+                    D& self = static_cast<D&>(*this);
+                    self.start(mode, direction, iv, in, out, bytes);
+                    while (!self.isDone());
+                }
+            };
+        }
+
+        /**
+         * Common API of SoftwareAes and HardwareAes:
+         *
+         *   setKey(key, 16/24/32)          AES-128/192/256, false for other lengths
+         *   start(mode, direction, iv, in, out, bytes); isDone()
+         *   failed()                       true if the last operation was aborted (DMA error)
+         *   encryptEcb/decryptEcb(in, out, bytes)
+         *   encryptCbc/decryptCbc(iv, in, out, bytes)
+         *   ctr(counter, in, out, bytes)
+         *
+         * ECB and CBC process whole 16 byte blocks (bytes is rounded down), CTR any length.
+         * in and out may be the same buffer. The iv/counter block is updated, so that a
+         * long message can be processed in more calls; in CTR the counter is the 32 bit
+         * big endian integer in its last 4 bytes (as NIST SP 800-38A suggests and as the
+         * CRYP processor implements it), and each call starts at a new block.
+         */
+
+        /**
+         * SoftwareAes (type)
+         *
+         * AES on the CPU: byte oriented, no T-tables, the S-boxes generated at compile time.
+         */
+        class SoftwareAes : public detail::AesApi<SoftwareAes> {
+            typedef detail::SBoxes<> sboxes;
+
+            //***************************
+            //* Members                 *
+            //***************************
+        private:
+            uint8_t round_keys[240];
+            unsigned rounds = 0;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            bool setKey(const void *key, unsigned bytes) {
+                static const uint8_t rcon[10] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36};
+
+                if (bytes != 16 && bytes != 24 && bytes != 32)
+                    return false;
+
+                unsigned nk = bytes / 4;
+                rounds = nk + 6;
+                std::copy((const uint8_t *) key, (const uint8_t *) key + bytes, round_keys);
+
+                for (unsigned i = nk; i < 4 * (rounds + 1); i++) {
+                    uint8_t t[4];
+                    std::copy(round_keys + 4 * (i - 1), round_keys + 4 * i, t);
+
+                    if (i % nk == 0) {
+                        uint8_t first = t[0];
+                        t[0] = sboxes::forward[t[1]] ^ rcon[i / nk - 1];
+                        t[1] = sboxes::forward[t[2]];
+                        t[2] = sboxes::forward[t[3]];
+                        t[3] = sboxes::forward[first];
+                    } else if (nk > 6 && i % nk == 4) {
+                        for (unsigned j = 0; j < 4; j++)
+                            t[j] = sboxes::forward[t[j]];
+                    }
+
+                    for (unsigned j = 0; j < 4; j++)
+                        round_keys[4 * i + j] = round_keys[4 * (i - nk) + j] ^ t[j];
+                }
+
+                return true;
+            }
+
+            void encryptBlock(const uint8_t *in, uint8_t *out) const {
+                uint8_t s[16];
+
+                addRoundKey(s, in, 0);
+                for (unsigned round = 1; round <= rounds; round++) {
+                    uint8_t t[16];
+
+                    // SubBytes and ShiftRows: row r rotates left by r
+                    for (unsigned i = 0; i < 16; i++)
+                        t[i] = sboxes::forward[s[(i + 4 * (i & 3)) & 15]];
+
+                    if (round != rounds)
+                        mixColumns(t);
+
+                    addRoundKey(s, t, round);
+                }
+
+                std::copy(s, s + 16, out);
+            }
+
+            void decryptBlock(const uint8_t *in, uint8_t *out) const {
+                uint8_t s[16];
+
+                addRoundKey(s, in, rounds);
+                for (unsigned round = rounds; round-- > 0;) {
+                    uint8_t t[16];
+
+                    // InvShiftRows (row r rotates right by r) and InvSubBytes
+                    for (unsigned i = 0; i < 16; i++)
+                        t[i] = sboxes::inverse[s[(i + 16 - 4 * (i & 3)) & 15]];
+
+                    addRoundKey(s, t, round);
+
+                    if (round != 0)
+                        invMixColumns(s);
+                }
+
+                std::copy(s, s + 16, out);
+            }
+
+            void start(Mode mode, Direction direction, uint8_t *iv, const void *in, void *out, uint32_t bytes) {
+                const uint8_t *src = (const uint8_t *) in;
+                uint8_t *dst = (uint8_t *) out;
+
+                if (mode == Mode::CTR) {
+                    for (; bytes; ) {
+                        uint8_t keystream[16];
+                        uint32_t n = std::min<uint32_t>(bytes, 16);
+
+                        encryptBlock(iv, keystream);
+                        detail::incrementCounter(iv, 1);
+
+                        for (uint32_t i = 0; i < n; i++)
+                            dst[i] = src[i] ^ keystream[i];
+
+                        src += n;
+                        dst += n;
+                        bytes -= n;
+                    }
+                    return;
+                }
+
+                for (; bytes >= 16; bytes -= 16, src += 16, dst += 16) {
+                    uint8_t block[16];
+
+                    if (mode == Mode::ECB) {
+                        if (direction == Direction::ENCRYPT)
+                            encryptBlock(src, dst);
+                        else
+                            decryptBlock(src, dst);
+                    } else if (direction == Direction::ENCRYPT) {
+                        for (unsigned i = 0; i < 16; i++)
+                            block[i] = src[i] ^ iv[i];
+                        encryptBlock(block, dst);
+                        std::copy(dst, dst + 16, iv);
+                    } else {
+                        uint8_t cipher[16];
+                        std::copy(src, src + 16, cipher);
+                        decryptBlock(cipher, block);
+                        for (unsigned i = 0; i < 16; i++)
+                            dst[i] = block[i] ^ iv[i];
+                        std::copy(cipher, cipher + 16, iv);
+                    }
+                }
+            }
+
+            bool isDone() const {
+                return true;
+            }
+
+            bool failed() const {
+                return false;
+            }
+
+        private:
+            void addRoundKey(uint8_t *s, const uint8_t *in, unsigned round) const {
+                for (unsigned i = 0; i < 16; i++)
+                    s[i] = in[i] ^ round_keys[16 * round + i];
+            }
+
+            static void mixColumns(uint8_t *s) {
+                for (unsigned c = 0; c < 16; c += 4) {
+                    uint8_t a0 = s[c], a1 = s[c + 1], a2 = s[c + 2], a3 = s[c + 3];
+                    uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+
+                    s[c] = a0 ^ all ^ detail::xtime(a0 ^ a1);
+                    s[c + 1] = a1 ^ all ^ detail::xtime(a1 ^ a2);
+                    s[c + 2] = a2 ^ all ^ detail::xtime(a2 ^ a3);
+                    s[c + 3] = a3 ^ all ^ detail::xtime(a3 ^ a0);
+                }
+            }
+
+            static void invMixColumns(uint8_t *s) {
+                // Preprocessing step: after it, InvMixColumns is MixColumns
+                for (unsigned c = 0; c < 16; c += 4) {
+                    uint8_t u = detail::xtime(detail::xtime(s[c] ^ s[c + 2]));
+                    uint8_t v = detail::xtime(detail::xtime(s[c + 1] ^ s[c + 3]));
+
+                    s[c] ^= u;
+                    s[c + 1] ^= v;
+                    s[c + 2] ^= u;
+                    s[c + 3] ^= v;
+                }
+
+                mixColumns(s);
+            }
+        };
+
+        /**
+         * HardwareAes (type)
+         *
+         * AES on the CRYP processor (F415/F417 and later). When in and out are word aligned
+         * the blocks are streamed by two DMA2 streams (input: stream 6, output: stream 5,
+         * channel 2) and start() returns immediately: the core is free while the processor
+         * works, and isDone() tells when the output is complete. Unaligned buffers are
+         * processed by the CPU, one block at a time. Buffers can't be in CCM RAM.
+         *
+         * The processor keeps the last key it was given, in its encryption or decryption
+         * form (ECB/CBC decryption needs a key preparation pass): as long as the same object
+         * is used with the same direction, consecutive messages don't reload or prepare
+         * the key again.
+         */
+        class HardwareAes : public detail::AesApi<HardwareAes> {
+            typedef Dma::StreamFor<Peripheral::p_CRYP, Dma::Request::IN> in_request;
+            typedef Dma::StreamFor<Peripheral::p_CRYP, Dma::Request::OUT> out_request;
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_cryp_t* const periph_base = (raw_cryp_t*) Peripheral::p_CRYP::periph_base;
+
+        private:
+            Dma::DmaStream<typename in_request::peripheral> dma_in;
+            Dma::DmaStream<typename out_request::peripheral> dma_out;
+
+            uint32_t key[8];
+            unsigned key_words = 0;
+            uint32_t key_id = 0;
+
+            // Operation in progress
+            Mode mode = Mode::ECB;
+            Direction direction = Direction::ENCRYPT;
+            uint8_t *iv = nullptr;
+            const uint8_t *src = nullptr;
+            uint8_t *dst = nullptr;
+            uint8_t *last_block = nullptr;
+            uint32_t left = 0;
+            uint32_t tail = 0;
+            uint8_t next_iv[16];
+            bool busy = false;
+            bool error = false;
+
+            static constexpr uint32_t dma_errors = Dma::TRANSFER_ERROR | Dma::DIRECT_MODE_ERROR;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        private:
+            // Key currently in the processor: owner id, and whether it was prepared for
+            // decryption. Ids are never reused, so a destroyed object can't alias.
+            static uint32_t& loadedKey() {
+                static uint32_t id = 0;
+                return id;
+            }
+
+            static bool& loadedForDecryption() {
+                static bool prepared = false;
+                return prepared;
+            }
+
+            static uint32_t newKeyId() {
+                static uint32_t last = 0;
+                return ++last;
+            }
+
+        public:
+            HardwareAes() {
+                Peripheral::p_CRYP::enable();
+            }
+
+            bool setKey(const void *key, unsigned bytes) {
+                if (bytes != 16 && bytes != 24 && bytes != 32)
+                    return false;
+
+                key_words = bytes / 4;
+                for (unsigned i = 0; i < key_words; i++)
+                    this->key[i] = loadBigEndian((const uint8_t *) key + 4 * i);
+
+                key_id = newKeyId();
+                return true;
+            }
+
+            void start(Mode mode, Direction direction, uint8_t *iv, const void *in, void *out, uint32_t bytes) {
+                this->mode = mode;
+                this->direction = direction;
+                this->iv = iv;
+                src = (const uint8_t *) in;
+                dst = (uint8_t *) out;
+                left = bytes & ~15u;
+                tail = mode == Mode::CTR ? bytes & 15u : 0;
+                last_block = left ? dst + left - 16 : nullptr;
+
+                // The next IV must be known before in is overwritten (in place operation)
+                if (mode == Mode::CBC && direction == Direction::DECRYPT && left)
+                    std::copy(src + left - 16, src + left, next_iv);
+                else if (mode == Mode::CTR) {
+                    std::copy(iv, iv + 16, next_iv);
+                    detail::incrementCounter(next_iv, (bytes + 15) / 16);
+                }
+
+                setup();
+                busy = true;
+                error = false;
+
+                if ((((__pointer) src | (__pointer) dst) & 3) == 0) {
+                    transfer();
+                } else {
+                    for (; left; left -= 16, src += 16, dst += 16)
+                        block(src, dst);
+                }
+            }
+
+            bool isDone() {
+                if (!busy)
+                    return true;
+
+                if ((dma_in.flags() | dma_out.flags()) & dma_errors) {
+                    // The streams disable themselves on errors: the output is incomplete
+                    dma_in.stop();
+                    dma_out.stop();
+                    dma_in.clearFlags(Dma::ALL_FLAGS);
+                    dma_out.clearFlags(Dma::ALL_FLAGS);
+                    periph_base->DMACR = 0;
+                    periph_base->CR &= ~CRYP_CR_CRYPEN;
+                    error = true;
+                    busy = false;
+                    return true;
+                }
+
+                if (dma_out.is_enabled())
+                    return false;
+
+                if (left) {
+                    transfer();
+                    return false;
+                }
+
+                periph_base->DMACR = 0;
+                finish();
+                busy = false;
+                return true;
+            }
+
+            /**
+             * @return true if the last operation was aborted by a DMA error: out and iv
+             * are then undefined
+             */
+            bool failed() const {
+                return error;
+            }
+
+        private:
+            void setup() {
+                static constexpr uint32_t algomode[] = {
+                        CRYP_CR_ALGOMODE_AES_ECB, CRYP_CR_ALGOMODE_AES_CBC, CRYP_CR_ALGOMODE_AES_CTR
+                };
+
+                bool decrypt = direction == Direction::DECRYPT;
+                bool prepared = decrypt && mode != Mode::CTR;
+                uint32_t keysize = (key_words / 2 - 2) << 8;
+
+                periph_base->CR = 0;
+
+                if (loadedKey() != key_id || loadedForDecryption() != prepared) {
+                    volatile uint32_t *k = &periph_base->K0LR + (8 - key_words);
+                    for (unsigned i = 0; i < key_words; i++)
+                        k[i] = key[i];
+
+                    if (prepared) {
+                        periph_base->CR = keysize | CRYP_CR_ALGOMODE_AES_KEY | CRYP_CR_ALGODIR;
+                        periph_base->CR |= CRYP_CR_CRYPEN;
+                        while (periph_base->SR & CRYP_SR_BUSY);
+                        periph_base->CR = 0;
+                    }
+
+                    loadedKey() = key_id;
+                    loadedForDecryption() = prepared;
+                }
+
+                periph_base->CR = keysize | algomode[static_cast<unsigned>(mode)] | CRYP_CR_DATATYPE_1 |
+                                  (decrypt ? CRYP_CR_ALGODIR : 0);
+
+                if (iv) {
+                    periph_base->IV0LR = loadBigEndian(iv);
+                    periph_base->IV0RR = loadBigEndian(iv + 4);
+                    periph_base->IV1LR = loadBigEndian(iv + 8);
+                    periph_base->IV1RR = loadBigEndian(iv + 12);
+                }
+
+                periph_base->CR |= CRYP_CR_FFLUSH;
+                periph_base->CR |= CRYP_CR_CRYPEN;
+            }
+
+            // The 8 bit data type makes the processor swap the bytes of each word, so memory
+            // words are written and read as they are
+            void block(const uint8_t *in, uint8_t *out) {
+                for (unsigned i = 0; i < 4; i++)
+                    periph_base->DR = loadLittleEndian(in + 4 * i);
+
+                while (!(periph_base->SR & CRYP_SR_OFNE));
+
+                for (unsigned i = 0; i < 4; i++)
+                    storeLittleEndian(out + 4 * i, periph_base->DOUT);
+            }
+
+            void transfer() {
+                if (left == 0)
+                    return;
+
+                uint32_t words = std::min<uint32_t>(left / 4, 0xFFFC);
+
+                // Output first, so that no output word can be missed
+                dma_out.configure(out_request::channel, Dma::Direction::PERIPHERAL_TO_MEMORY, Dma::Size::WORD,
+                                  Dma::Size::WORD, Dma::Priority::VERY_HIGH, Dma::MEMORY_INCREMENT);
+                dma_out.start(&periph_base->DOUT, dst, words);
+
+                dma_in.configure(in_request::channel, Dma::Direction::MEMORY_TO_PERIPHERAL, Dma::Size::WORD,
+                                 Dma::Size::WORD, Dma::Priority::HIGH, Dma::MEMORY_INCREMENT);
+                dma_in.start(&periph_base->DR, src, words);
+
+                periph_base->DMACR = CRYP_DMACR_DIEN | CRYP_DMACR_DOEN;
+
+                src += 4 * words;
+                dst += 4 * words;
+                left -= 4 * words;
+            }
+
+            void finish() {
+                if (tail) {
+                    uint8_t buffer[16] = {0};
+                    std::copy(src, src + tail, buffer);
+                    block(buffer, buffer);
+                    std::copy(buffer, buffer + tail, dst);
+                }
+
+                if (!iv)
+                    return;
+
+                // CBC with no whole block leaves iv untouched, as the software path does
+                if (mode == Mode::CTR)
+                    std::copy(next_iv, next_iv + 16, iv);
+                else if (last_block) {
+                    const uint8_t *next = direction == Direction::DECRYPT ? next_iv : last_block;
+                    std::copy(next, next + 16, iv);
+                }
+            }
+        };
+
+        /**
+         * Aes (type)
+         *
+         * The AES implementation of the target: the CRYP processor when available
+         * (HAL_HAS_CRYPTO), the software one otherwise.
+         */
+#if HAL_HAS_CRYPTO
+        typedef HardwareAes Aes;
+#else
+        typedef SoftwareAes Aes;
+#endif
+
+        /**
+         * Runs the FIPS-197 and NIST SP 800-38A test vectors through an implementation
+         * (ECB with 128 and 256 bit keys, CBC and CTR with 128 bit keys, both directions).
+         * Meant as a power-on self test; the key of aes is overwritten.
+         *
+         * @return true if every vector matches
+         */
+        template<typename AES>
+        bool selfTest(AES& aes) {
+            static const uint8_t fips_key[32] = {
+                    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+                    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+            };
+            static const uint8_t fips_plain[16] = {
+                    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+            };
+            static const uint8_t fips_cipher128[16] = {
+                    0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a
+            };
+            static const uint8_t fips_cipher256[16] = {
+                    0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf, 0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89
+            };
+
+            static const uint8_t nist_key[16] = {
+                    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+            };
+            static const uint8_t nist_plain[32] = {
+                    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+                    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51
+            };
+            static const uint8_t cbc_iv[16] = {
+                    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+            };
+            static const uint8_t cbc_cipher[32] = {
+                    0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46, 0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9, 0x19, 0x7d,
+                    0x50, 0x86, 0xcb, 0x9b, 0x50, 0x72, 0x19, 0xee, 0x95, 0xdb, 0x11, 0x3a, 0x91, 0x76, 0x78, 0xb2
+            };
+            static const uint8_t ctr_counter[16] = {
+                    0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
+            };
+            static const uint8_t ctr_cipher[32] = {
+                    0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+                    0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff
+            };
+
+            uint32_t buffer[8];
+            uint8_t *b = (uint8_t *) buffer;
+            uint8_t iv[16];
+            bool ok = true;
+
+            aes.setKey(fips_key, 16);
+            aes.encryptEcb(fips_plain, b, 16);
+            ok &= std::equal(b, b + 16, fips_cipher128);
+            aes.decryptEcb(b, b, 16);
+            ok &= std::equal(b, b + 16, fips_plain);
+
+            aes.setKey(fips_key, 32);
+            aes.encryptEcb(fips_plain, b, 16);
+            ok &= std::equal(b, b + 16, fips_cipher256);
+            aes.decryptEcb(b, b, 16);
+            ok &= std::equal(b, b + 16, fips_plain);
+
+            aes.setKey(nist_key, 16);
+            std::copy(cbc_iv, cbc_iv + 16, iv);
+            aes.encryptCbc(iv, nist_plain, b, 32);
+            ok &= std::equal(b, b + 32, cbc_cipher) && std::equal(iv, iv + 16, cbc_cipher + 16);
+            std::copy(cbc_iv, cbc_iv + 16, iv);
+            aes.decryptCbc(iv, b, b, 32);
+            ok &= std::equal(b, b + 32, nist_plain);
+
+            // 29 bytes: a partial last block
+            std::copy(ctr_counter, ctr_counter + 16, iv);
+            aes.ctr(iv, nist_plain, b, 29);
+            ok &= std::equal(b, b + 29, ctr_cipher);
+            std::copy(ctr_counter, ctr_counter + 16, iv);
+            aes.ctr(iv, b, b, 29);
+            ok &= std::equal(b, b + 29, nist_plain);
+
+            return ok;
+        }
+    }
+}
+
+#endif //AES_HPP
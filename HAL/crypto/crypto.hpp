@@ -0,0 +1,57 @@
+#ifndef CRYPTO_HPP
+#define CRYPTO_HPP
+
+#include "../peripheral.hpp"
+
+/**
+ * HAL_HAS_CRYPTO
+ *
+ * Set when the device has the CRYP and HASH processors (STM32F415/417/437/439). The
+ * bundled CMSIS header doesn't identify the part number, so it is taken from the usual
+ * device macros, or it can be defined by the build scripts. Without it the crypto
+ * classes fall back to their software implementations, with the same API.
+ */
+#ifndef HAL_HAS_CRYPTO
+#if defined(STM32F415xx) || defined(STM32F417xx) || defined(STM32F437xx) || defined(STM32F439xx) || \
+    defined(STM32F41_43xxx)
+#define HAL_HAS_CRYPTO 1
+#else
+#define HAL_HAS_CRYPTO 0
+#endif
+#endif
+
+namespace HAL {
+    namespace Crypto {
+        /**
+         * Big endian load/store, the byte order of SHA-1, of the hash processor digest
+         * registers and of the CRYP data and key registers.
+         */
+        inline uint32_t loadBigEndian(const uint8_t *p) {
+            return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+        }
+
+        inline void storeBigEndian(uint8_t *p, uint32_t value) {
+            p[0] = value >> 24;
+            p[1] = value >> 16;
+            p[2] = value >> 8;
+            p[3] = value;
+        }
+
+        inline uint32_t loadLittleEndian(const uint8_t *p) {
+            return ((uint32_t) p[3] << 24) | ((uint32_t) p[2] << 16) | ((uint32_t) p[1] << 8) | p[0];
+        }
+
+        inline void storeLittleEndian(uint8_t *p, uint32_t value) {
+            p[0] = value;
+            p[1] = value >> 8;
+            p[2] = value >> 16;
+            p[3] = value >> 24;
+        }
+
+        inline uint32_t rotl(uint32_t x, unsigned k) {
+            return (x << k) | (x >> (32 - k));
+        }
+    }
+}
+
+#endif //CRYPTO_HPP
@@ -0,0 +1,478 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include "crypto.hpp"
+#include "../dma/dma_request.hpp"
+
+#include <algorithm>
+
+namespace HAL {
+    namespace Crypto {
+        typedef HASH_TypeDef raw_hash_t;
+
+        enum class Algorithm {
+            SHA1,
+            MD5
+        };
+
+        namespace detail {
+            /**
+             * SHA-1 compression function (FIPS 180-4).
+             */
+            struct Sha1Core {
+                static constexpr unsigned digest_size = 20;
+                static constexpr bool big_endian = true;
+
+                uint32_t h[5];
+
+                void init() {
+                    h[0] = 0x67452301;
+                    h[1] = 0xEFCDAB89;
+                    h[2] = 0x98BADCFE;
+                    h[3] = 0x10325476;
+                    h[4] = 0xC3D2E1F0;
+                }
+
+                void block(const uint8_t *p) {
+                    uint32_t w[16];
+                    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+
+                    for (unsigned i = 0; i < 16; i++)
+                        w[i] = loadBigEndian(p + 4 * i);
+
+                    // The message schedule is kept in a 16 word circular buffer
+                    for (unsigned i = 0; i < 80; i++) {
+                        if (i >= 16)
+                            w[i & 15] = rotl(w[(i + 13) & 15] ^ w[(i + 8) & 15] ^ w[(i + 2) & 15] ^ w[i & 15], 1);
+
+                        uint32_t f, k;
+                        if (i < 20) {
+                            f = (b & c) | (~b & d);
+                            k = 0x5A827999;
+                        } else if (i < 40) {
+                            f = b ^ c ^ d;
+                            k = 0x6ED9EBA1;
+                        } else if (i < 60) {
+                            f = (b & c) | (b & d) | (c & d);
+                            k = 0x8F1BBCDC;
+                        } else {
+                            f = b ^ c ^ d;
+                            k = 0xCA62C1D6;
+                        }
+
+                        uint32_t t = rotl(a, 5) + f + e + k + w[i & 15];
+                        e = d;
+                        d = c;
+                        c = rotl(b, 30);
+                        b = a;
+                        a = t;
+                    }
+
+                    h[0] += a;
+                    h[1] += b;
+                    h[2] += c;
+                    h[3] += d;
+                    h[4] += e;
+                }
+
+                void output(uint8_t *digest) const {
+                    for (unsigned i = 0; i < 5; i++)
+                        storeBigEndian(digest + 4 * i, h[i]);
+                }
+            };
+
+            /**
+             * MD5 compression function (RFC 1321).
+             */
+            struct Md5Core {
+                static constexpr unsigned digest_size = 16;
+                static constexpr bool big_endian = false;
+
+                uint32_t h[4];
+
+                void init() {
+                    h[0] = 0x67452301;
+                    h[1] = 0xEFCDAB89;
+                    h[2] = 0x98BADCFE;
+                    h[3] = 0x10325476;
+                }
+
+                void block(const uint8_t *p) {
+                    static const uint32_t k[64] = {
+                            0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE, 0xF57C0FAF, 0x4787C62A, 0xA8304613, 0xFD469501,
+                            0x698098D8, 0x8B44F7AF, 0xFFFF5BB1, 0x895CD7BE, 0x6B901122, 0xFD987193, 0xA679438E, 0x49B40821,
+                            0xF61E2562, 0xC040B340, 0x265E5A51, 0xE9B6C7AA, 0xD62F105D, 0x02441453, 0xD8A1E681, 0xE7D3FBC8,
+                            0x21E1CDE6, 0xC33707D6, 0xF4D50D87, 0x455A14ED, 0xA9E3E905, 0xFCEFA3F8, 0x676F02D9, 0x8D2A4C8A,
+                            0xFFFA3942, 0x8771F681, 0x6D9D6122, 0xFDE5380C, 0xA4BEEA44, 0x4BDECFA9, 0xF6BB4B60, 0xBEBFBC70,
+                            0x289B7EC6, 0xEAA127FA, 0xD4EF3085, 0x04881D05, 0xD9D4D039, 0xE6DB99E5, 0x1FA27CF8, 0xC4AC5665,
+                            0xF4292244, 0x432AFF97, 0xAB9423A7, 0xFC93A039, 0x655B59C3, 0x8F0CCC92, 0xFFEFF47D, 0x85845DD1,
+                            0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1, 0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391
+                    };
+                    static const uint8_t r[16] = {7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21};
+
+                    uint32_t w[16];
+                    uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+
+                    for (unsigned i = 0; i < 16; i++)
+                        w[i] = loadLittleEndian(p + 4 * i);
+
+                    for (unsigned i = 0; i < 64; i++) {
+                        uint32_t f;
+                        unsigned g;
+
+                        if (i < 16) {
+                            f = (b & c) | (~b & d);
+                            g = i;
+                        } else if (i < 32) {
+                            f = (d & b) | (~d & c);
+                            g = (5 * i + 1) & 15;
+                        } else if (i < 48) {
+                            f = b ^ c ^ d;
+                            g = (3 * i + 5) & 15;
+                        } else {
+                            f = c ^ (b | ~d);
+                            g = (7 * i) & 15;
+                        }
+
+                        uint32_t t = d;
+                        d = c;
+                        c = b;
+                        b = b + rotl(a + f + k[i] + w[g], r[(i / 16) * 4 + (i & 3)]);
+                        a = t;
+                    }
+
+                    h[0] += a;
+                    h[1] += b;
+                    h[2] += c;
+                    h[3] += d;
+                }
+
+                void output(uint8_t *digest) const {
+                    for (unsigned i = 0; i < 4; i++)
+                        storeLittleEndian(digest + 4 * i, h[i]);
+                }
+            };
+
+            template<Algorithm A>
+            struct CoreFor {
+                typedef Sha1Core type;
+            };
+
+            template<>
+            struct CoreFor<Algorithm::MD5> {
+                typedef Md5Core type;
+            };
+        }
+
+        /**
+         * SoftwareHash (type)
+         *
+         * SHA-1/MD5 and their HMAC on the CPU. Same API as HardwareHash:
+         *
+         *   hash.begin();                  // or hash.beginHmac(key, key_length)
+         *   hash.update(data, length);     // any number of times
+         *   hash.finish(digest);           // or hash.finish(last, length, digest)
+         *
+         * beginHmac() keeps its own copy of the key pads: the key may go right after.
+         */
+        template<Algorithm A>
+        class SoftwareHash {
+            typedef typename detail::CoreFor<A>::type core_t;
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr unsigned digest_size = core_t::digest_size;
+            static constexpr unsigned block_size = 64;
+
+        private:
+            core_t core;
+            uint8_t buffer[block_size];
+            uint32_t buffered = 0;
+            uint64_t length = 0;
+
+            // HMAC outer key pad, kept until finish()
+            uint8_t outer[block_size];
+            bool hmac = false;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            SoftwareHash() {
+                begin();
+            }
+
+            void begin() {
+                core.init();
+                buffered = 0;
+                length = 0;
+                hmac = false;
+            }
+
+            void beginHmac(const void *key, uint32_t key_length) {
+                uint8_t k[block_size] = {0};
+
+                if (key_length > block_size) {
+                    SoftwareHash<A> kh;
+                    kh.update(key, key_length);
+                    kh.finish(k);
+                } else {
+                    std::copy((const uint8_t *) key, (const uint8_t *) key + key_length, k);
+                }
+
+                begin();
+                for (unsigned i = 0; i < block_size; i++) {
+                    outer[i] = k[i] ^ 0x5C;
+                    k[i] ^= 0x36;
+                }
+
+                update(k, block_size);
+                hmac = true;
+            }
+
+            void update(const void *data, uint32_t bytes) {
+                const uint8_t *p = (const uint8_t *) data;
+                length += bytes;
+
+                if (buffered) {
+                    uint32_t n = std::min(bytes, block_size - buffered);
+                    std::copy(p, p + n, buffer + buffered);
+                    buffered += n;
+                    p += n;
+                    bytes -= n;
+
+                    if (buffered < block_size)
+                        return;
+
+                    core.block(buffer);
+                    buffered = 0;
+                }
+
+                for (; bytes >= block_size; bytes -= block_size, p += block_size)
+                    core.block(p);
+
+                std::copy(p, p + bytes, buffer);
+                buffered = bytes;
+            }
+
+            void finish(uint8_t *digest) {
+                uint64_t bits = length * 8;
+                uint8_t pad[block_size + 8] = {0x80};
+                uint32_t pad_length = (buffered < 56 ? 56 : 120) - buffered;
+
+                for (unsigned i = 0; i < 8; i++)
+                    pad[pad_length + i] = core_t::big_endian ? (bits >> (56 - 8 * i)) : (bits >> (8 * i));
+
+                update(pad, pad_length + 8);
+                core.output(digest);
+
+                if (hmac) {
+                    uint8_t inner[digest_size];
+                    std::copy(digest, digest + digest_size, inner);
+
+                    begin();
+                    update(outer, block_size);
+                    update(inner, digest_size);
+                    finish(digest);
+                }
+            }
+
+            void finish(const void *data, uint32_t bytes, uint8_t *digest) {
+                update(data, bytes);
+                finish(digest);
+            }
+        };
+
+        /**
+         * HardwareHash (type)
+         *
+         * SHA-1/MD5 and HMAC computed by the hash processor (F415/F417 and later).
+         * update() writes the data to the processor input FIFO from the CPU: the processor
+         * stalls the writes while it digests a block, so no polling is involved. The last
+         * chunk given to finish(data, length, digest) is instead streamed by DMA2
+         * (stream 7, channel 2), which also triggers the final digest calculation: a signed
+         * image can be verified with a single call, the CPU only waits for the end.
+         *
+         * The processor swaps the bytes of each input word (8 bit data type), so data is
+         * hashed as a byte stream, with any alignment and length.
+         *
+         * HMAC runs entirely in hardware (inner key, message, outer key phases). The key
+         * passed to beginHmac() must stay valid until finish().
+         */
+        template<Algorithm A>
+        class HardwareHash {
+            typedef Dma::StreamFor<Peripheral::p_HASH, Dma::Request::IN> request;
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_hash_t* const periph_base = (raw_hash_t*) Peripheral::p_HASH::periph_base;
+            static constexpr unsigned digest_size = detail::CoreFor<A>::type::digest_size;
+            static constexpr unsigned block_size = 64;
+
+        private:
+            static constexpr uint32_t algorithm = A == Algorithm::MD5 ? HASH_CR_ALGO : 0;
+            static constexpr uint32_t max_dma_bytes = 4 * 0xFFFF;
+
+            Dma::DmaStream<typename request::peripheral> dma;
+
+            // Bytes not yet forming a whole input word
+            uint32_t pending = 0;
+            uint32_t pending_bytes = 0;
+
+            const uint8_t *key = nullptr;
+            uint32_t key_length = 0;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            HardwareHash() {
+                Peripheral::p_HASH::enable();
+                begin();
+            }
+
+            void begin() {
+                periph_base->SR = 0;
+                periph_base->CR = algorithm | HASH_CR_DATATYPE_1 | HASH_CR_INIT;
+                pending = pending_bytes = 0;
+                key = nullptr;
+            }
+
+            void beginHmac(const void *key, uint32_t key_length) {
+                this->key = (const uint8_t *) key;
+                this->key_length = key_length;
+
+                periph_base->SR = 0;
+                periph_base->CR = algorithm | HASH_CR_DATATYPE_1 | HASH_CR_MODE |
+                                  (key_length > block_size ? HASH_CR_LKEY : 0) | HASH_CR_INIT;
+                pending = pending_bytes = 0;
+
+                phase(this->key, key_length);
+            }
+
+            void update(const void *data, uint32_t bytes) {
+                const uint8_t *p = (const uint8_t *) data;
+
+                for (; pending_bytes && bytes; bytes--)
+                    push(*p++);
+
+                if (((__pointer) p & 3) == 0) {
+                    for (const uint32_t *w = (const uint32_t *) p; bytes >= 4; bytes -= 4, p += 4)
+                        periph_base->DIN = *w++;
+                } else {
+                    for (; bytes >= 4; bytes -= 4, p += 4)
+                        periph_base->DIN = loadLittleEndian(p);
+                }
+
+                while (bytes--)
+                    push(*p++);
+            }
+
+            void finish(uint8_t *digest) {
+                if (pending_bytes)
+                    periph_base->DIN = pending;
+
+                digestCalculation(pending_bytes);
+                complete(digest);
+            }
+
+            /**
+             * Hashes the last chunk of data and returns the digest. For plain hashes the
+             * chunk goes through DMA when it is word aligned, a whole number of words long
+             * and no bytes are pending from the previous updates (otherwise through the
+             * CPU, with the same result): the DMA never reads past the end of data. Words of
+             * the chunk beyond the DMA limit of 65535 are written by the CPU first.
+             * data can't be in CCM RAM.
+             */
+            void finish(const void *data, uint32_t bytes, uint8_t *digest) {
+                const uint8_t *p = (const uint8_t *) data;
+
+                if (key || pending_bytes || ((__pointer) p & 3) || (bytes % 4) || bytes == 0) {
+                    update(data, bytes);
+                    finish(digest);
+                    return;
+                }
+
+                // Whole words only: p stays aligned and nothing is left pending
+                uint32_t cpu_bytes = bytes > max_dma_bytes ? bytes - max_dma_bytes : 0;
+                update(p, cpu_bytes);
+                p += cpu_bytes;
+                uint32_t dma_bytes = bytes - cpu_bytes;
+
+                // All bits of the last word valid, then the DMA end triggers the calculation
+                periph_base->STR = 0;
+                periph_base->CR |= HASH_CR_DMAE;
+
+                dma.configure(request::channel, Dma::Direction::MEMORY_TO_PERIPHERAL, Dma::Size::WORD,
+                              Dma::Size::WORD, Dma::Priority::HIGH, Dma::MEMORY_INCREMENT);
+                dma.start(&periph_base->DIN, p, dma_bytes / 4);
+
+                while (dma.is_enabled());
+                while (!(periph_base->SR & HASH_SR_DCIS) || (periph_base->SR & HASH_SR_BUSY));
+
+                periph_base->CR &= ~HASH_CR_DMAE;
+                output(digest);
+            }
+
+        private:
+            void push(uint8_t byte) {
+                pending |= (uint32_t) byte << (8 * pending_bytes);
+                if (++pending_bytes == 4) {
+                    periph_base->DIN = pending;
+                    pending = pending_bytes = 0;
+                }
+            }
+
+            void digestCalculation(uint32_t last_bytes) {
+                periph_base->STR = 8 * (last_bytes % 4);
+                periph_base->STR |= HASH_STR_DCAL;
+                while (periph_base->SR & HASH_SR_BUSY);
+            }
+
+            // Writes a whole HMAC key phase and starts its calculation
+            void phase(const uint8_t *data, uint32_t bytes) {
+                pending = pending_bytes = 0;
+                update(data, bytes);
+                if (pending_bytes)
+                    periph_base->DIN = pending;
+                digestCalculation(pending_bytes);
+                pending = pending_bytes = 0;
+            }
+
+            void complete(uint8_t *digest) {
+                if (key)
+                    phase(key, key_length);
+
+                while (!(periph_base->SR & HASH_SR_DCIS));
+                output(digest);
+                key = nullptr;
+            }
+
+            void output(uint8_t *digest) const {
+                for (unsigned i = 0; i < digest_size / 4; i++)
+                    storeBigEndian(digest + 4 * i, periph_base->HR[i]);
+            }
+        };
+
+        /**
+         * Hash (type)
+         *
+         * The hash implementation of the target: the hash processor when available
+         * (HAL_HAS_CRYPTO), the software one otherwise.
+         */
+#if HAL_HAS_CRYPTO
+        template<Algorithm A> using Hash = HardwareHash<A>;
+#else
+        template<Algorithm A> using Hash = SoftwareHash<A>;
+#endif
+
+        typedef Hash<Algorithm::SHA1> Sha1;
+        typedef Hash<Algorithm::MD5> Md5;
+    }
+}
+
+#endif //HASH_HPP
@@ -0,0 +1,69 @@
+#ifndef CYCLE_COUNTER_HPP
+#define CYCLE_COUNTER_HPP
+
+#include "../util.hpp"
+
+namespace HAL {
+    namespace Debug {
+
+        /**
+         * CycleCounter (type)
+         *
+         * Core clock cycle counter of the Data Watchpoint and Trace unit (DWT CYCCNT), used
+         * to benchmark code. It is a free running 32 bit counter, so intervals up to
+         * 2^32 cycles (~25 s at 168 MHz) can be measured as a plain difference.
+         *
+         * The bundled CMSIS core header has no DWT definitions, so the registers are
+         * accessed through their architectural addresses.
+         */
+        class CycleCounter {
+            //***************************
+            //* Members                 *
+            //***************************
+        private:
+            static constexpr __pointer dwt_ctrl = 0xE0001000;
+            static constexpr __pointer dwt_cyccnt = 0xE0001004;
+            static constexpr uint32_t cyccntena = 0x1;
+
+            uint32_t begin = 0;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        private:
+            static volatile uint32_t& reg(__pointer address) {
+                return *((volatile uint32_t *) address);
+            }
+
+        public:
+            /**
+             * Enables the trace unit and the cycle counter. Harmless if already enabled.
+             */
+            static void enable() {
+                CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+                reg(dwt_ctrl) |= cyccntena;
+            }
+
+            static uint32_t now() {
+                return reg(dwt_cyccnt);
+            }
+
+            CycleCounter() {
+                enable();
+            }
+
+            void start() {
+                begin = now();
+            }
+
+            /**
+             * @return the cycles elapsed since start()
+             */
+            uint32_t elapsed() const {
+                return now() - begin;
+            }
+        };
+    }
+}
+
+#endif //CYCLE_COUNTER_HPP
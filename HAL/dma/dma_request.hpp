@@ -0,0 +1,140 @@
+#ifndef DMA_REQUEST_HPP
+#define DMA_REQUEST_HPP
+
+#include "dma_stream.hpp"
+
+namespace HAL {
+    namespace Dma {
+
+        /**
+         * Peripheral DMA requests. As for Gpio::Af::Signal, the pair (peripheral, request)
+         * identifies the request.
+         */
+        enum class Request : uint8_t {
+            // Timers
+            UP, CH1, CH2, CH3, CH4, TRIG, COM,
+            // Data streams (CRYP, HASH)
+            IN, OUT
+        };
+
+        namespace Requests {
+            struct Entry {
+                __pointer periph;
+                Request request;
+                __pointer stream;
+                uint8_t channel;
+            };
+
+            /**
+             * DMA request mapping, from the DMA1/DMA2 request mapping tables of the
+             * reference manual. When a request is available on more than one stream, the
+             * first entry is the default one.
+             */
+            constexpr Entry table[] = {
+                // DMA1
+                {TIM2_BASE, Request::UP, DMA1_Stream1_BASE, 3},
+                {TIM2_BASE, Request::UP, DMA1_Stream7_BASE, 3},
+                {TIM2_BASE, Request::CH1, DMA1_Stream5_BASE, 3},
+                {TIM2_BASE, Request::CH2, DMA1_Stream6_BASE, 3},
+                {TIM2_BASE, Request::CH3, DMA1_Stream1_BASE, 3},
+                {TIM2_BASE, Request::CH4, DMA1_Stream6_BASE, 3},
+                {TIM2_BASE, Request::CH4, DMA1_Stream7_BASE, 3},
+                {TIM3_BASE, Request::UP, DMA1_Stream2_BASE, 5},
+                {TIM3_BASE, Request::CH1, DMA1_Stream4_BASE, 5},
+                {TIM3_BASE, Request::TRIG, DMA1_Stream4_BASE, 5},
+                {TIM3_BASE, Request::CH2, DMA1_Stream5_BASE, 5},
+                {TIM3_BASE, Request::CH3, DMA1_Stream7_BASE, 5},
+                {TIM3_BASE, Request::CH4, DMA1_Stream2_BASE, 5},
+                {TIM4_BASE, Request::UP, DMA1_Stream6_BASE, 2},
+                {TIM4_BASE, Request::CH1, DMA1_Stream0_BASE, 2},
+                {TIM4_BASE, Request::CH2, DMA1_Stream3_BASE, 2},
+                {TIM4_BASE, Request::CH3, DMA1_Stream7_BASE, 2},
+                {TIM5_BASE, Request::UP, DMA1_Stream0_BASE, 6},
+                {TIM5_BASE, Request::UP, DMA1_Stream6_BASE, 6},
+                {TIM5_BASE, Request::CH1, DMA1_Stream2_BASE, 6},
+                {TIM5_BASE, Request::CH2, DMA1_Stream4_BASE, 6},
+                {TIM5_BASE, Request::CH3, DMA1_Stream0_BASE, 6},
+                {TIM5_BASE, Request::CH4, DMA1_Stream1_BASE, 6},
+                {TIM5_BASE, Request::CH4, DMA1_Stream3_BASE, 6},
+                {TIM5_BASE, Request::TRIG, DMA1_Stream1_BASE, 6},
+                {TIM5_BASE, Request::TRIG, DMA1_Stream3_BASE, 6},
+                {TIM6_BASE, Request::UP, DMA1_Stream1_BASE, 7},
+                {TIM7_BASE, Request::UP, DMA1_Stream2_BASE, 1},
+                {TIM7_BASE, Request::UP, DMA1_Stream4_BASE, 1},
+
+                // DMA2
+                {TIM1_BASE, Request::UP, DMA2_Stream5_BASE, 6},
+                {TIM1_BASE, Request::CH1, DMA2_Stream1_BASE, 6},
+                {TIM1_BASE, Request::CH1, DMA2_Stream3_BASE, 6},
+                {TIM1_BASE, Request::CH1, DMA2_Stream6_BASE, 0},
+                {TIM1_BASE, Request::CH2, DMA2_Stream2_BASE, 6},
+                {TIM1_BASE, Request::CH2, DMA2_Stream6_BASE, 0},
+                {TIM1_BASE, Request::CH3, DMA2_Stream6_BASE, 6},
+                {TIM1_BASE, Request::CH3, DMA2_Stream6_BASE, 0},
+                {TIM1_BASE, Request::CH4, DMA2_Stream4_BASE, 6},
+                {TIM1_BASE, Request::TRIG, DMA2_Stream0_BASE, 6},
+                {TIM1_BASE, Request::TRIG, DMA2_Stream4_BASE, 6},
+                {TIM1_BASE, Request::COM, DMA2_Stream4_BASE, 6},
+                {TIM8_BASE, Request::UP, DMA2_Stream1_BASE, 7},
+                {TIM8_BASE, Request::CH1, DMA2_Stream2_BASE, 7},
+                {TIM8_BASE, Request::CH1, DMA2_Stream2_BASE, 0},
+                {TIM8_BASE, Request::CH2, DMA2_Stream3_BASE, 7},
+                {TIM8_BASE, Request::CH2, DMA2_Stream2_BASE, 0},
+                {TIM8_BASE, Request::CH3, DMA2_Stream4_BASE, 7},
+                {TIM8_BASE, Request::CH3, DMA2_Stream2_BASE, 0},
+                {TIM8_BASE, Request::CH4, DMA2_Stream7_BASE, 7},
+                {TIM8_BASE, Request::TRIG, DMA2_Stream7_BASE, 7},
+                {TIM8_BASE, Request::COM, DMA2_Stream7_BASE, 7},
+                {CRYP_BASE, Request::IN, DMA2_Stream6_BASE, 2},
+                {CRYP_BASE, Request::OUT, DMA2_Stream5_BASE, 2},
+                {HASH_BASE, Request::IN, DMA2_Stream7_BASE, 2}
+            };
+
+            constexpr unsigned table_size = sizeof(table) / sizeof(table[0]);
+
+            constexpr int first(int a, int b) {
+                return a >= 0 ? a : b;
+            }
+
+            /**
+             * @return the index of the first table entry for (periph, request), or -1
+             */
+            constexpr int find(__pointer periph, Request request, unsigned lo = 0, unsigned hi = table_size) {
+                return hi - lo == 1
+                       ? (table[lo].periph == periph && table[lo].request == request ? (int) lo : -1)
+                       : first(find(periph, request, lo, (lo + hi) / 2), find(periph, request, (lo + hi) / 2, hi));
+            }
+        }
+
+        /**
+         * StreamFor (type)
+         *
+         * Compile time lookup of the DMA stream and channel serving request R of
+         * peripheral P. Requesting a peripheral/request pair that has no DMA mapping is
+         * a compile error.
+         *
+         * Example:
+         *     typedef Dma::StreamFor<Peripheral::p_TIM8, Dma::Request::UP> up;
+         *     Dma::DmaStream<up::peripheral> stream;
+         *     stream.configure(up::channel, ...);
+         */
+        template<typename P, Request R>
+        struct StreamFor {
+            static constexpr int index = Requests::find(P::periph_base, R);
+            static_assert(index >= 0, "the peripheral has no DMA mapping for this request");
+
+            static constexpr __pointer stream_base = Requests::table[index >= 0 ? index : 0].stream;
+            static constexpr unsigned channel = Requests::table[index >= 0 ? index : 0].channel;
+            static constexpr bool is_dma2 = (stream_base & ~((__pointer) 0xFF)) == DMA2_BASE;
+
+            // Same type as the matching Peripheral::p_DMAx_StreamY typedef
+            typedef Peripheral::Peripheral<
+                    Bus::b_AHB1,
+                    stream_base,
+                    is_dma2 ? RCC_AHB1ENR_DMA2EN : RCC_AHB1ENR_DMA1EN
+            > peripheral;
+        };
+    }
+}
+
+#endif //DMA_REQUEST_HPP
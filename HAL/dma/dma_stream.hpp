@@ -0,0 +1,299 @@
+#ifndef DMA_STREAM_HPP
+#define DMA_STREAM_HPP
+
+#include "../peripheral.hpp"
+#include "../memory/ccm.hpp"
+
+#include <cassert>
+
+namespace HAL {
+    namespace Dma {
+        typedef DMA_Stream_TypeDef raw_stream_t;
+        typedef DMA_TypeDef raw_dma_t;
+
+        enum class Direction : uint32_t {
+            PERIPHERAL_TO_MEMORY = 0,
+            MEMORY_TO_PERIPHERAL = DMA_SxCR_DIR_0,
+            MEMORY_TO_MEMORY = DMA_SxCR_DIR_1
+        };
+
+        enum class Size : uint32_t {
+            BYTE = 0,
+            HALF_WORD = 1,
+            WORD = 2
+        };
+
+        enum class Priority : uint32_t {
+            LOW = 0,
+            MEDIUM = 1,
+            HIGH = 2,
+            VERY_HIGH = 3
+        };
+
+        /**
+         * Options for DmaStream::configure(), to be OR-ed together. Values are the
+         * corresponding DMA_SxCR bits.
+         */
+        enum Option : uint32_t {
+            MEMORY_INCREMENT = DMA_SxCR_MINC,
+            PERIPHERAL_INCREMENT = DMA_SxCR_PINC,
+            CIRCULAR = DMA_SxCR_CIRC,
+            DOUBLE_BUFFER = DMA_SxCR_DBM,
+            TRANSFER_COMPLETE_IRQ = DMA_SxCR_TCIE,
+            HALF_TRANSFER_IRQ = DMA_SxCR_HTIE,
+            TRANSFER_ERROR_IRQ = DMA_SxCR_TEIE,
+            MEMORY_BURST_4 = DMA_SxCR_MBURST_0,
+            MEMORY_BURST_8 = DMA_SxCR_MBURST_1,
+            MEMORY_BURST_16 = DMA_SxCR_MBURST,
+            PERIPHERAL_BURST_4 = DMA_SxCR_PBURST_0,
+            PERIPHERAL_BURST_8 = DMA_SxCR_PBURST_1,
+            PERIPHERAL_BURST_16 = DMA_SxCR_PBURST
+        };
+
+        /**
+         * Stream event flags, as returned by DmaStream::flags(). They are the flags of
+         * stream 0 in LISR, every stream has the same layout shifted by flag_shift.
+         */
+        enum Flag : uint32_t {
+            FIFO_ERROR = 0x01,
+            DIRECT_MODE_ERROR = 0x04,
+            TRANSFER_ERROR = 0x08,
+            HALF_TRANSFER = 0x10,
+            TRANSFER_COMPLETE = 0x20,
+            ALL_FLAGS = 0x3D
+        };
+
+        enum class FifoThreshold : uint32_t {
+            QUARTER = 0,
+            HALF = 1,
+            THREE_QUARTERS = 2,
+            FULL = 3
+        };
+
+        /**
+         * DmaStream (type)
+         *
+         * This represents one of the eight streams of a DMA controller, identified by its
+         * peripheral (p_DMA1_Stream0..p_DMA2_Stream7).
+         *
+         * Please note that only DMA2 has its peripheral port connected to the AHB bus
+         * matrix: DMA1 can reach APB1 peripherals only, and memory-to-memory transfers
+         * are supported by DMA2 only.
+         *
+         * Please refer to the reference manual (DMA controller chapter) for the request
+         * to stream/channel mapping, or use Dma::StreamFor.
+         */
+        template<typename S>
+        class DmaStream {
+            //***************************
+            //* Subtypes                *
+            //***************************
+        public:
+            typedef S peripheral;
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_stream_t* const periph_base = (raw_stream_t*) S::periph_base;
+            static constexpr __pointer controller_base = S::periph_base & ~((__pointer) 0xFF);
+            static constexpr raw_dma_t* const controller = (raw_dma_t*) controller_base;
+            static constexpr bool is_dma2 = controller_base == DMA2_BASE;
+
+            // Stream number (0..7) and position of its flags inside LISR/HISR
+            static constexpr unsigned stream = (S::periph_base - controller_base - 0x10) / 0x18;
+            static constexpr unsigned flag_shift = (stream & 1) * 6 + ((stream & 2) ? 16 : 0);
+
+            static constexpr IRQn_Type irq = (IRQn_Type) (
+                    is_dma2 ? (stream < 5 ? (int) DMA2_Stream0_IRQn + stream : (int) DMA2_Stream5_IRQn + stream - 5)
+                            : (stream < 7 ? (int) DMA1_Stream0_IRQn + stream : (int) DMA1_Stream7_IRQn));
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            /**
+             * Enables the DMA controller clock. The clock is shared by all the streams of the
+             * controller, so it is never turned off here.
+             */
+            DmaStream() {
+                S::enable();
+            }
+
+            /**
+             * Configures the stream. The stream is stopped first, since its registers are
+             * read-only while enabled.
+             *
+             * @param channel: request channel (0..7) selected by the stream
+             * @param direction: transfer direction
+             * @param peripheral_size: size of each access on the peripheral port
+             * @param memory_size: size of each access on the memory port
+             * @param priority: arbitration priority against the other streams
+             * @param options: OR of Dma::Option values
+             */
+            void configure(unsigned channel, Direction direction, Size peripheral_size, Size memory_size,
+                           Priority priority = Priority::MEDIUM, uint32_t options = 0) {
+                stop();
+
+                periph_base->CR = ((channel & 0x7) << 25) |
+                                  static_cast<uint32_t>(direction) |
+                                  (static_cast<uint32_t>(peripheral_size) << 11) |
+                                  (static_cast<uint32_t>(memory_size) << 13) |
+                                  (static_cast<uint32_t>(priority) << 16) |
+                                  options;
+            }
+
+            /**
+             * Enables the stream FIFO (disables direct mode). Required for bursts and for
+             * different peripheral and memory sizes.
+             */
+            void enableFifo(FifoThreshold threshold = FifoThreshold::FULL) {
+                periph_base->FCR = DMA_SxFCR_DMDIS | static_cast<uint32_t>(threshold);
+            }
+
+            /**
+             * Goes back to direct mode, the reset configuration.
+             */
+            void disableFifo() {
+                periph_base->FCR = 0x21;
+            }
+
+            /**
+             * The DMA has no path to CCM RAM: a raw pointer into it (a HAL_CCM array,
+             * CcmPtr::get(), &Ccm<T>::get()) trips an assertion in debug builds.
+             */
+            void setPeripheralAddress(const volatile void *address) {
+                assert(!Memory::isCcm((__pointer) address));
+                periph_base->PAR = (__pointer) address;
+            }
+
+            void setMemoryAddress(const volatile void *address) {
+                assert(!Memory::isCcm((__pointer) address));
+                periph_base->M0AR = (__pointer) address;
+            }
+
+            /**
+             * Second memory buffer, used in DOUBLE_BUFFER mode.
+             */
+            void setMemory1Address(const volatile void *address) {
+                assert(!Memory::isCcm((__pointer) address));
+                periph_base->M1AR = (__pointer) address;
+            }
+
+            /**
+             * The DMA has no path to CCM RAM: these overloads turn passing a CcmPtr (see
+             * Memory::CcmArena, Memory::Ccm) into a compile error.
+             */
+            template<typename T>
+            void setPeripheralAddress(Memory::CcmPtr<T>) {
+                static_assert(!Memory::is_ccm_pointer<Memory::CcmPtr<T>>::value, "the DMA can't reach CCM RAM");
+            }
+
+            template<typename T>
+            void setMemoryAddress(Memory::CcmPtr<T>) {
+                static_assert(!Memory::is_ccm_pointer<Memory::CcmPtr<T>>::value, "the DMA can't reach CCM RAM");
+            }
+
+            template<typename T>
+            void setMemory1Address(Memory::CcmPtr<T>) {
+                static_assert(!Memory::is_ccm_pointer<Memory::CcmPtr<T>>::value, "the DMA can't reach CCM RAM");
+            }
+
+            /**
+             * @param count: number of transfers, expressed in peripheral_size units
+             */
+            void setCount(uint16_t count) {
+                periph_base->NDTR = count;
+            }
+
+            /**
+             * Clears the stream flags and enables it.
+             */
+            void start() {
+                clearFlags(ALL_FLAGS);
+                periph_base->CR |= DMA_SxCR_EN;
+            }
+
+            /**
+             * Sets addresses and count, then starts the stream.
+             * In memory-to-memory mode the peripheral address is the source.
+             */
+            void start(const volatile void *peripheral_address, const volatile void *memory_address,
+                       uint16_t count) {
+                setPeripheralAddress(peripheral_address);
+                setMemoryAddress(memory_address);
+                setCount(count);
+                start();
+            }
+
+            template<typename T>
+            void start(const volatile void *, Memory::CcmPtr<T>, uint16_t) {
+                static_assert(!Memory::is_ccm_pointer<Memory::CcmPtr<T>>::value, "the DMA can't reach CCM RAM");
+            }
+
+            template<typename T>
+            void start(Memory::CcmPtr<T>, const volatile void *, uint16_t) {
+                static_assert(!Memory::is_ccm_pointer<Memory::CcmPtr<T>>::value, "the DMA can't reach CCM RAM");
+            }
+
+            /**
+             * Disables the stream and waits for the ongoing transfer to complete,
+             * after that the stream can be reconfigured.
+             */
+            void stop() {
+                periph_base->CR &= ~DMA_SxCR_EN;
+                while (periph_base->CR & DMA_SxCR_EN);
+            }
+
+            bool is_enabled() const {
+                return (periph_base->CR & DMA_SxCR_EN) != 0;
+            }
+
+            /**
+             * @return the number of transfers still to be done (NDTR)
+             */
+            uint16_t remaining() const {
+                return periph_base->NDTR;
+            }
+
+            /**
+             * In DOUBLE_BUFFER mode, returns the memory buffer (0 or 1) currently being used.
+             */
+            unsigned currentBuffer() const {
+                return (periph_base->CR & DMA_SxCR_CT) ? 1 : 0;
+            }
+
+            /**
+             * @return the stream flags, as OR of Dma::Flag values
+             */
+            uint32_t flags() const {
+                return ((stream < 4 ? controller->LISR : controller->HISR) >> flag_shift) & ALL_FLAGS;
+            }
+
+            /**
+             * @param mask: OR of Dma::Flag values to be cleared
+             */
+            void clearFlags(uint32_t mask) {
+                if (stream < 4)
+                    controller->LIFCR = (mask & ALL_FLAGS) << flag_shift;
+                else
+                    controller->HIFCR = (mask & ALL_FLAGS) << flag_shift;
+            }
+
+            /**
+             * Checks whether the transfer complete flag is set. If so, it clears the flag
+             * and returns true, otherwise returns false.
+             */
+            bool transfer_complete() {
+                if (flags() & TRANSFER_COMPLETE) {
+                    clearFlags(TRANSFER_COMPLETE);
+                    return true;
+                }
+
+                return false;
+            }
+        };
+    }
+}
+
+#endif //DMA_STREAM_HPP
@@ -0,0 +1,562 @@
+#ifndef ETH_HPP
+#define ETH_HPP
+
+#include "../peripheral.hpp"
+#include "../memory/dma_buffer.hpp"
+
+#include <atomic>
+
+namespace HAL {
+    namespace Eth {
+        typedef ETH_TypeDef raw_eth_t;
+
+        // Largest frame without CRC (1518 with a VLAN tag), rounded to words
+        constexpr uint32_t buffer_size = 1524;
+
+        /**
+         * Enhanced DMA descriptor (DMABMR EDE): the normal four words, the extended
+         * receive status and the IEEE 1588 timestamp.
+         */
+        struct Descriptor {
+            volatile uint32_t status;
+            volatile uint32_t control;
+            volatile uint32_t buffer;
+            volatile uint32_t next;
+            volatile uint32_t extended_status;
+            uint32_t reserved;
+            volatile uint32_t timestamp_low;
+            volatile uint32_t timestamp_high;
+        };
+
+        // Descriptor bits (RM0090, Ethernet DMA descriptors)
+        namespace desc {
+            constexpr uint32_t own = 1u << 31;
+
+            constexpr uint32_t tx_interrupt = 1u << 30;
+            constexpr uint32_t tx_last = 1u << 29;
+            constexpr uint32_t tx_first = 1u << 28;
+            constexpr uint32_t tx_timestamp_enable = 1u << 25;
+            constexpr uint32_t tx_checksum_full = 3u << 22;
+            constexpr uint32_t tx_chained = 1u << 20;
+            constexpr uint32_t tx_timestamp_status = 1u << 17;
+            constexpr uint32_t tx_error = 1u << 15;
+
+            constexpr uint32_t rx_length_shift = 16;
+            constexpr uint32_t rx_length = 0x3FFFu << 16;
+            constexpr uint32_t rx_error = 1u << 15;
+            constexpr uint32_t rx_first = 1u << 9;
+            constexpr uint32_t rx_last = 1u << 8;
+            constexpr uint32_t rx_timestamp_available = 1u << 7;
+            constexpr uint32_t rx_extended_available = 1u << 0;
+            constexpr uint32_t rx_chained = 1u << 14;
+
+            // Extended receive status: IP payload and header checksum errors
+            constexpr uint32_t rx_payload_error = 1u << 4;
+            constexpr uint32_t rx_header_error = 1u << 3;
+        }
+
+        /**
+         * A receive buffer lent to the stack, reference counted like a pbuf: the driver
+         * hands it out with one reference, whoever keeps it calls retain(), and release()
+         * gives it back to the pool when the last reference goes.
+         *
+         * checksum_ok is false if the MAC found an IPv4 header or TCP/UDP/ICMP payload
+         * checksum error. timestamp is the IEEE 1588 receive time, 0 if not captured.
+         */
+        struct Buffer {
+            uint8_t data[buffer_size];
+            uint16_t length;
+            bool checksum_ok;
+            uint64_t timestamp;
+            std::atomic<uint32_t> references;
+
+            void retain() {
+                references.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            void release() {
+                references.fetch_sub(1, std::memory_order_release);
+            }
+
+            // Takes a free buffer
+            bool acquire() {
+                uint32_t free = 0;
+                return references.compare_exchange_strong(free, 1, std::memory_order_acquire);
+            }
+        };
+
+        /**
+         * A piece of a frame to send, in caller memory that the Ethernet DMA can reach
+         * (not CCM) and that must stay untouched until the frame is sent.
+         */
+        struct Segment {
+            const void *data;
+            uint16_t length;
+        };
+
+        enum class Interface {
+            MII,
+            RMII
+        };
+
+        /**
+         * @return the MDC clock range (MACMIIAR CR) for HCLK
+         */
+        constexpr uint32_t mdcRange(uint32_t hclk) {
+            return hclk >= 150000000 ? 4 :
+                   hclk >= 100000000 ? 1 :
+                   hclk >= 60000000 ? 0 :
+                   hclk >= 35000000 ? 3 : 2;
+        }
+
+        /**
+         * Mac (type)
+         *
+         * Ethernet MAC and DMA with enhanced descriptor rings, without copies:
+         * - receive: RX descriptors point at pool buffers; a received frame is handed to
+         *   the stack as the Buffer itself, and the descriptor gets a free one in
+         *   exchange. BUFFERS must exceed RX by the buffers the stack may hold at once;
+         *   if none is free the frame is dropped and the descriptor keeps its buffer.
+         * - transmit: a frame is a chain of TX descriptors pointing straight at the
+         *   caller's segments (e.g. headers and payload); done(context, sent, timestamp)
+         *   is called by reclaim() once the DMA is through with them. timestamp is the
+         *   IEEE 1588 transmit time if send() asked for it (desc::tx_timestamp_enable),
+         *   else 0.
+         * IPv4, TCP, UDP and ICMP checksums are computed by the MAC on transmit (the
+         * checksum fields must be 0) and verified on receive; store and forward is on,
+         * as offload needs it.
+         *
+         * For testing: loopback mode sends every frame back to the receive path inside
+         * the MAC, with or without a PHY; inject() replays a recorded frame through
+         * receive() without any hardware.
+         *
+         * The interrupt must be forwarded and should wake the stack, which calls
+         * receive() and reclaim():
+         *     void ETH_IRQHandler() { eth.onInterrupt(); wake stack; }
+         *
+         * NOTE: receive(), inject(), send() and reclaim() must be called from one
+         *       context (the stack); Buffer::release() from any.
+         */
+        template<unsigned RX = 8, unsigned TX = 16, unsigned BUFFERS = 16>
+        class Mac {
+            static_assert(BUFFERS > RX, "the stack needs buffers beyond the receive ring");
+
+            //***************************
+            //* Subtypes                *
+            //***************************
+        public:
+            typedef void (*Done)(void *context, bool sent, uint64_t timestamp);
+
+        private:
+            struct Pending {
+                Done done;
+                void *context;
+            };
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_eth_t* const periph_base = (raw_eth_t*) Peripheral::p_ETH::periph_base;
+
+            // Polling iterations before a reset or a PHY access is declared stuck
+            static constexpr uint32_t timeout = 0x100000;
+
+            static constexpr unsigned inject_slots = 4;
+
+        private:
+            Descriptor rx_ring[RX] __attribute__((aligned(4)));
+            Descriptor tx_ring[TX] __attribute__((aligned(4)));
+            Buffer *rx_buffers[RX];
+            Pending pending[TX];
+            Buffer pool[BUFFERS] __attribute__((aligned(4)));
+
+            unsigned rx_next = 0;
+            unsigned tx_head = 0;
+            unsigned tx_tail = 0;
+            unsigned tx_used = 0;
+
+            Buffer *injected[inject_slots];
+            unsigned inject_head = 0;
+            unsigned inject_tail = 0;
+
+            uint32_t received_count = 0;
+            uint32_t drop_count = 0;
+            uint32_t error_count = 0;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            Mac() {
+                for (unsigned i = 0; i < BUFFERS; i++)
+                    pool[i].references.store(0, std::memory_order_relaxed);
+                for (unsigned i = 0; i < RX; i++)
+                    rx_buffers[i] = nullptr;
+            }
+
+            /**
+             * Resets and starts MAC and DMA. The PHY must provide its reference clock
+             * (and the pins be in alternate function 11) before this call. A running Mac
+             * is stopped first, so start() can be called again (e.g. on link loss).
+             *
+             * @param mac_address: station address, checked by the receive filter
+             * @param loopback: frames sent come back to the receive path
+             * @return false if the object is in CCM (unreachable by the Ethernet DMA), the
+             *         DMA doesn't leave reset (no PHY clock) or the stack holds too many
+             *         buffers to fill the receive ring
+             */
+            bool start(const uint8_t (&mac_address)[6], Interface interface = Interface::RMII, bool loopback = false) {
+                if (!Memory::reaches(Memory::Master::ETHERNET, Memory::slaveOf((__pointer) this)))
+                    return false;
+
+                stop();
+
+                // The interface is selected while the MAC is in reset
+                Peripheral::p_SYSCFG::enable();
+                SYSCFG->PMC = interface == Interface::RMII ? SYSCFG->PMC | SYSCFG_PMC_MII_RMII_SEL :
+                              SYSCFG->PMC & ~SYSCFG_PMC_MII_RMII_SEL;
+
+                Peripheral::p_ETH::enable();
+                RCC->AHB1RSTR |= RCC_AHB1RSTR_ETHMACRST;
+                RCC->AHB1RSTR &= ~RCC_AHB1RSTR_ETHMACRST;
+
+                periph_base->DMABMR |= ETH_DMABMR_SR;
+                if (!waitFor(periph_base->DMABMR, ETH_DMABMR_SR, 0))
+                    return false;
+
+                periph_base->MACMIIAR = mdcRange(Peripheral::p_ETH::bus::bus_freq()) << 2;
+
+                periph_base->MACA0HR = mac_address[4] | (mac_address[5] << 8);
+                periph_base->MACA0LR = mac_address[0] | (mac_address[1] << 8) | (mac_address[2] << 16) |
+                                       ((uint32_t) mac_address[3] << 24);
+                periph_base->MACFFR = 0;
+                periph_base->MACCR = ETH_MACCR_FES | ETH_MACCR_DM | ETH_MACCR_IPCO |
+                                     (loopback ? ETH_MACCR_LM : 0);
+
+                if (!initRings())
+                    return false;
+
+                // Enhanced descriptors, 32 beat bursts, fixed and address aligned
+                periph_base->DMABMR = ETH_DMABMR_AAB | ETH_DMABMR_USP | (32 << 17) | ETH_DMABMR_FB | (32 << 8) |
+                                      ETH_DMABMR_EDE;
+                periph_base->DMARDLAR = (uint32_t) rx_ring;
+                periph_base->DMATDLAR = (uint32_t) tx_ring;
+                periph_base->DMAOMR = ETH_DMAOMR_RSF | ETH_DMAOMR_TSF;
+
+                periph_base->DMASR = ~0u;
+                periph_base->DMAIER = ETH_DMAIER_NISE | ETH_DMAIER_RIE | ETH_DMAIER_TIE | ETH_DMAIER_AISE |
+                                      ETH_DMAIER_RBUIE;
+                NVIC_ClearPendingIRQ(ETH_IRQn);
+                NVIC_EnableIRQ(ETH_IRQn);
+
+                periph_base->MACCR |= ETH_MACCR_TE;
+                periph_base->DMAOMR |= ETH_DMAOMR_FTF;
+                waitFor(periph_base->DMAOMR, ETH_DMAOMR_FTF, 0);
+                periph_base->DMAOMR |= ETH_DMAOMR_ST | ETH_DMAOMR_SR;
+                periph_base->MACCR |= ETH_MACCR_RE;
+                return true;
+            }
+
+            /**
+             * Stops MAC and DMA. The receive ring gives its buffers back to the pool, and
+             * the frames still queued complete: done(context, false, 0) for those not sent.
+             */
+            void stop() {
+                periph_base->DMAOMR &= ~(ETH_DMAOMR_ST | ETH_DMAOMR_SR);
+                periph_base->MACCR &= ~(ETH_MACCR_TE | ETH_MACCR_RE);
+                NVIC_DisableIRQ(ETH_IRQn);
+
+                // The DMA finishes the frame in progress before it stops
+                waitFor(periph_base->DMASR, ETH_DMASR_TPS | ETH_DMASR_RPS, 0);
+
+                reclaim();
+                while (tx_used > 0) {
+                    Pending p = pending[tx_tail];
+                    if (p.done)
+                        p.done(p.context, false, 0);
+                    tx_tail = (tx_tail + 1) % TX;
+                    tx_used--;
+                }
+
+                releaseRing();
+            }
+
+            /**
+             * Speed and duplex, as negotiated by the PHY.
+             */
+            void setLink(bool fast, bool full_duplex) {
+                periph_base->MACCR = (periph_base->MACCR & ~(ETH_MACCR_FES | ETH_MACCR_DM)) |
+                                     (fast ? ETH_MACCR_FES : 0) | (full_duplex ? ETH_MACCR_DM : 0);
+            }
+
+            void setPromiscuous(bool promiscuous) {
+                periph_base->MACFFR = (periph_base->MACFFR & ~ETH_MACFFR_PM) | (promiscuous ? ETH_MACFFR_PM : 0);
+            }
+
+            /**
+             * @return false if the access doesn't complete
+             */
+            static bool phyRead(uint32_t phy, uint32_t reg, uint16_t& value) {
+                periph_base->MACMIIAR = (periph_base->MACMIIAR & ETH_MACMIIAR_CR) | (phy << 11) | (reg << 6) |
+                                        ETH_MACMIIAR_MB;
+                if (!waitFor(periph_base->MACMIIAR, ETH_MACMIIAR_MB, 0))
+                    return false;
+                value = periph_base->MACMIIDR;
+                return true;
+            }
+
+            static bool phyWrite(uint32_t phy, uint32_t reg, uint16_t value) {
+                periph_base->MACMIIDR = value;
+                periph_base->MACMIIAR = (periph_base->MACMIIAR & ETH_MACMIIAR_CR) | (phy << 11) | (reg << 6) |
+                                        ETH_MACMIIAR_MW | ETH_MACMIIAR_MB;
+                return waitFor(periph_base->MACMIIAR, ETH_MACMIIAR_MB, 0);
+            }
+
+            /**
+             * Interrupt: acknowledges the DMA events.
+             *
+             * @return the DMASR flags acknowledged
+             */
+            uint32_t onInterrupt() {
+                uint32_t status = periph_base->DMASR;
+                periph_base->DMASR = status & (ETH_DMASR_NIS | ETH_DMASR_AIS | ETH_DMASR_RS | ETH_DMASR_TS |
+                                               ETH_DMASR_RBUS | ETH_DMASR_TBUS | ETH_DMASR_ROS | ETH_DMASR_TUS |
+                                               ETH_DMASR_FBES | ETH_DMASR_ERS | ETH_DMASR_ETS);
+                return status;
+            }
+
+            /**
+             * Takes the next received frame, injected frames first.
+             *
+             * @return the buffer holding it, with one reference, nullptr if none
+             */
+            Buffer *receive() {
+                if (inject_tail != inject_head)
+                    return injected[inject_tail++ % inject_slots];
+
+                while (!(rx_ring[rx_next].status & desc::own)) {
+                    Descriptor& d = rx_ring[rx_next];
+                    uint32_t status = d.status;
+                    unsigned index = rx_next;
+                    rx_next = (rx_next + 1) % RX;
+
+                    bool whole = (status & (desc::rx_first | desc::rx_last)) == (desc::rx_first | desc::rx_last);
+                    Buffer *replacement = whole && !(status & desc::rx_error) ? allocate() : nullptr;
+                    if (!replacement) {
+                        if (whole && !(status & desc::rx_error))
+                            drop_count++;
+                        else
+                            error_count++;
+                        giveBack(d);
+                        continue;
+                    }
+
+                    Buffer *frame = rx_buffers[index];
+                    uint32_t length = (status & desc::rx_length) >> desc::rx_length_shift;
+                    frame->length = length >= 4 ? length - 4 : 0;
+                    frame->checksum_ok = !(status & desc::rx_extended_available) ||
+                                         !(d.extended_status & (desc::rx_payload_error | desc::rx_header_error));
+                    frame->timestamp = status & desc::rx_timestamp_available ?
+                                       ((uint64_t) d.timestamp_high << 32) | d.timestamp_low : 0;
+
+                    rx_buffers[index] = replacement;
+                    d.buffer = (uint32_t) replacement->data;
+                    giveBack(d);
+
+                    received_count++;
+                    return frame;
+                }
+
+                return nullptr;
+            }
+
+            /**
+             * Queues a recorded frame for receive(), as if it came from the wire.
+             *
+             * @return false if no buffer or slot is free, or the frame is too long
+             */
+            bool inject(const uint8_t *frame, uint16_t length) {
+                if (length > buffer_size || inject_head - inject_tail >= inject_slots)
+                    return false;
+
+                Buffer *buffer = allocate();
+                if (!buffer)
+                    return false;
+
+                for (uint16_t i = 0; i < length; i++)
+                    buffer->data[i] = frame[i];
+                buffer->length = length;
+                buffer->checksum_ok = true;
+                buffer->timestamp = 0;
+
+                injected[inject_head++ % inject_slots] = buffer;
+                return true;
+            }
+
+            /**
+             * Queues a frame made of segments, without copying them. The MAC fills in the
+             * IP and TCP/UDP/ICMP checksums and the CRC.
+             *
+             * @param done: called by reclaim() once the segments may be reused
+             * @param flags: further TDES0 bits of the first descriptor
+             * @return false if the TX ring lacks count free descriptors
+             */
+            bool send(const Segment *segments, unsigned count, Done done = nullptr, void *context = nullptr,
+                      uint32_t flags = 0) {
+                if (count == 0 || count > TX - tx_used)
+                    return false;
+
+                unsigned first = tx_head;
+                for (unsigned i = 0; i < count; i++) {
+                    Descriptor& d = tx_ring[tx_head];
+                    bool last = i == count - 1;
+
+                    d.buffer = (uint32_t) segments[i].data;
+                    d.control = segments[i].length & 0x1FFF;
+                    d.status = desc::tx_chained | desc::tx_checksum_full | (i == 0 ? desc::tx_first | flags : 0) |
+                               (last ? desc::tx_last | desc::tx_interrupt : 0) | (i == 0 ? 0 : desc::own);
+
+                    pending[tx_head] = last ? Pending{done, context} : Pending{nullptr, nullptr};
+                    tx_head = (tx_head + 1) % TX;
+                }
+                tx_used += count;
+
+                // The first descriptor last, so the DMA never sees a partial frame
+                __DMB();
+                tx_ring[first].status |= desc::own;
+                __DSB();
+                periph_base->DMATPDR = 0;
+                return true;
+            }
+
+            /**
+             * Sends a pool buffer (e.g. a received frame, edited in place) and releases it
+             * when sent.
+             */
+            bool send(Buffer *buffer) {
+                Segment segment = {buffer->data, buffer->length};
+                return send(&segment, 1, releaseBuffer, buffer);
+            }
+
+            /**
+             * Completes the frames the DMA is through with, calling their done callbacks.
+             *
+             * @return the frames completed
+             */
+            unsigned reclaim() {
+                unsigned frames = 0;
+                while (tx_used > 0 && !(tx_ring[tx_tail].status & desc::own)) {
+                    Descriptor& d = tx_ring[tx_tail];
+                    Pending p = pending[tx_tail];
+
+                    if (d.status & desc::tx_last) {
+                        bool sent = !(d.status & desc::tx_error);
+                        if (!sent)
+                            error_count++;
+                        if (p.done)
+                            p.done(p.context, sent, d.status & desc::tx_timestamp_status ?
+                                                    ((uint64_t) d.timestamp_high << 32) | d.timestamp_low : 0);
+                        frames++;
+                    }
+
+                    tx_tail = (tx_tail + 1) % TX;
+                    tx_used--;
+                }
+                return frames;
+            }
+
+            /**
+             * @return the free TX descriptors (segments that send() can take)
+             */
+            unsigned txFree() const {
+                return TX - tx_used;
+            }
+
+            uint32_t received() const {
+                return received_count;
+            }
+
+            /**
+             * @return the frames dropped because no buffer was free
+             */
+            uint32_t drops() const {
+                return drop_count;
+            }
+
+            /**
+             * @return the frames received or sent with errors
+             */
+            uint32_t errors() const {
+                return error_count;
+            }
+
+        private:
+            static bool waitFor(volatile uint32_t& reg, uint32_t mask, uint32_t value) {
+                for (uint32_t i = 0; i < timeout; i++)
+                    if ((reg & mask) == value)
+                        return true;
+                return false;
+            }
+
+            static void releaseBuffer(void *context, bool sent, uint64_t timestamp) {
+                (void) sent;
+                (void) timestamp;
+                ((Buffer *) context)->release();
+            }
+
+            Buffer *allocate() {
+                for (unsigned i = 0; i < BUFFERS; i++)
+                    if (pool[i].acquire())
+                        return &pool[i];
+                return nullptr;
+            }
+
+            void giveBack(Descriptor& d) {
+                d.control = desc::rx_chained | buffer_size;
+                __DMB();
+                d.status = desc::own;
+
+                // Resume a DMA suspended for lack of descriptors
+                if (periph_base->DMASR & ETH_DMASR_RBUS) {
+                    periph_base->DMASR = ETH_DMASR_RBUS;
+                    periph_base->DMARPDR = 0;
+                }
+            }
+
+            // false if the pool can't fill the receive ring
+            bool initRings() {
+                for (unsigned i = 0; i < RX; i++) {
+                    rx_buffers[i] = allocate();
+                    if (!rx_buffers[i]) {
+                        releaseRing();
+                        return false;
+                    }
+                    rx_ring[i].buffer = (uint32_t) rx_buffers[i]->data;
+                    rx_ring[i].next = (uint32_t) &rx_ring[(i + 1) % RX];
+                    rx_ring[i].extended_status = 0;
+                    giveBack(rx_ring[i]);
+                }
+                rx_next = 0;
+
+                for (unsigned i = 0; i < TX; i++) {
+                    tx_ring[i].status = desc::tx_chained;
+                    tx_ring[i].next = (uint32_t) &tx_ring[(i + 1) % TX];
+                    pending[i] = Pending{nullptr, nullptr};
+                }
+                tx_head = tx_tail = tx_used = 0;
+                return true;
+            }
+
+            void releaseRing() {
+                for (unsigned i = 0; i < RX; i++) {
+                    if (rx_buffers[i])
+                        rx_buffers[i]->release();
+                    rx_buffers[i] = nullptr;
+                }
+            }
+        };
+    }
+}
+
+#endif //ETH_HPP
@@ -0,0 +1,569 @@
+#ifndef PTP_HPP
+#define PTP_HPP
+
+#include "eth.hpp"
+#include "../timers/timer.hpp"
+
+namespace HAL {
+    namespace Eth {
+
+        // One second in PTP sub-second units (binary rollover: 2^-31 s, about 0.47 ns)
+        constexpr uint64_t subsecond_rollover = 1ull << 31;
+        constexpr int64_t nanoseconds_per_second = 1000000000;
+
+        /**
+         * @return a raw timestamp (seconds << 32 | sub-seconds), as in the descriptors and
+         * Buffer::timestamp, in nanoseconds
+         */
+        constexpr int64_t toNanoseconds(uint64_t raw) {
+            return (int64_t) (raw >> 32) * nanoseconds_per_second +
+                   (int64_t) (((raw & 0x7FFFFFFF) * nanoseconds_per_second) >> 31);
+        }
+
+        /**
+         * @return nanoseconds as a raw timestamp (positive only)
+         */
+        constexpr uint64_t fromNanoseconds(int64_t ns) {
+            return ((uint64_t) (ns / nanoseconds_per_second) << 32) |
+                   ((uint64_t) (ns % nanoseconds_per_second) * subsecond_rollover / nanoseconds_per_second);
+        }
+
+        static_assert(toNanoseconds(fromNanoseconds(1500000000)) == 1500000000, "timestamp conversion");
+
+        /**
+         * Ptp (type)
+         *
+         * IEEE 1588 system time of the MAC. It runs from HCLK with fine correction: an
+         * accumulator adds the addend register to itself every HCLK cycle and advances
+         * the time by SSINC sub-seconds at each overflow, so the clock rate is tuned in
+         * steps below 1 ppb by rewriting the addend, without discontinuities.
+         *
+         * The time stamps the frames in hardware, at the MII: the receive time of every
+         * PTP event message (Buffer::timestamp) and the transmit time of the frames sent
+         * with desc::tx_timestamp_enable (the Done callback). The protocol itself (the
+         * Sync / Delay_Req exchange computing the offset from the master) is left to
+         * the stack; its offsets feed a Servo.
+         *
+         * The pulse per second output (ETH_PPS_OUT, PB5 or PG8 in alternate function 11)
+         * marks the start of each PTP second, or of each 1/2^n second.
+         *
+         * Usage: after Mac::start(), which resets this block too:
+         *     Eth::Ptp::start();
+         *     Eth::Ptp::setTime(seconds);
+         *     Eth::Ptp::setPps(0);
+         *
+         * NOTE: HCLK must not change while the clock runs, or start() must be called
+         *       again.
+         */
+        class Ptp {
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_eth_t* const periph_base = (raw_eth_t*) Peripheral::p_ETH::periph_base;
+
+            // PTPTSCR snapshot bits. NOTE: CMSIS lists them under PTPTSSR, their STM32F107
+            // location; on this part they are in PTPTSCR, at the same positions
+            static constexpr uint32_t snapshot_all = ETH_PTPTSSR_TSSARFE;
+            static constexpr uint32_t snapshot_ptp_v2 = ETH_PTPTSSR_TSPTPPSV2E;
+            static constexpr uint32_t snapshot_ethernet = ETH_PTPTSSR_TSSPTPOEFE;
+            static constexpr uint32_t snapshot_ipv4 = ETH_PTPTSSR_TSSIPV4FE;
+            static constexpr uint32_t snapshot_events = ETH_PTPTSSR_TSSEME;
+            static constexpr uint32_t snapshot_master = ETH_PTPTSSR_TSSMRME;
+
+            // Largest frequency correction accepted by adjustFrequency()
+            static constexpr int32_t max_ppb = 500000;
+
+            // Polling iterations before an update is declared stuck
+            static constexpr uint32_t timeout = 0x100000;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            /**
+             * Starts the system time at 0 with fine correction, at the nominal rate.
+             *
+             * @param master: timestamp the messages a master receives (Delay_Req) rather
+             *        than those a slave does (Sync)
+             * @param all_frames: timestamp every received frame, not only PTP event
+             *        messages
+             * @return false if the addend or the time can't be loaded
+             */
+            static bool start(bool master = false, bool all_frames = false) {
+                Peripheral::p_ETH_PTP::enable();
+
+                // PTP multicasts (01-1B-19-00-00-00, 224.0.1.129) pass the receive filter
+                periph_base->MACFFR |= ETH_MACFFR_PAM;
+
+                // The time stamp trigger raises no MAC interrupt: TIM2 catches it (Timebase)
+                periph_base->MACIMR |= ETH_MACIMR_TSTIM;
+
+                periph_base->PTPTSCR = ETH_PTPTSCR_TSE | snapshot_ptp_v2 | snapshot_ethernet | snapshot_ipv4 |
+                                       snapshot_events | (master ? snapshot_master : 0) |
+                                       (all_frames ? snapshot_all : 0);
+
+                // Accumulator overflows at about HCLK / 2, each worth SSINC sub-seconds
+                uint32_t hclk = hclkFreq();
+                uint32_t ssinc = (uint32_t) ((2 * subsecond_rollover + hclk - 1) / hclk);
+                if (ssinc > ETH_PTPSSIR_STSSI)
+                    return false;
+                periph_base->PTPSSIR = ssinc;
+
+                baseAddend() = (uint32_t) ((1ull << 63) / ((uint64_t) ssinc * hclk));
+                frequency() = 0;
+                if (!writeAddend(baseAddend()) || !waitFor(ETH_PTPTSCR_TSARU))
+                    return false;
+                periph_base->PTPTSCR |= ETH_PTPTSCR_TSFCU;
+
+                return setTime(0);
+            }
+
+            static void stop() {
+                periph_base->PTPTSCR = 0;
+                Peripheral::p_ETH_PTP::disable();
+            }
+
+            /**
+             * Loads the time.
+             *
+             * @param nanoseconds: sub-second part
+             */
+            static bool setTime(uint32_t seconds, uint32_t nanoseconds = 0) {
+                if (!waitFor(ETH_PTPTSCR_TSSTI | ETH_PTPTSCR_TSSTU))
+                    return false;
+
+                periph_base->PTPTSHUR = seconds;
+                periph_base->PTPTSLUR = (uint32_t) ((uint64_t) nanoseconds * subsecond_rollover /
+                                                    nanoseconds_per_second);
+                periph_base->PTPTSCR |= ETH_PTPTSCR_TSSTI;
+                return waitFor(ETH_PTPTSCR_TSSTI);
+            }
+
+            /**
+             * @return the time, raw (seconds << 32 | sub-seconds)
+             */
+            static uint64_t raw() {
+                uint32_t seconds, subseconds;
+                do {
+                    seconds = periph_base->PTPTSHR;
+                    subseconds = periph_base->PTPTSLR;
+                } while (seconds != periph_base->PTPTSHR);
+                return ((uint64_t) seconds << 32) | (subseconds & 0x7FFFFFFF);
+            }
+
+            /**
+             * @return the time in nanoseconds
+             */
+            static int64_t now() {
+                return toNanoseconds(raw());
+            }
+
+            /**
+             * Moves the time by offset_ns at once. For offsets the servo can't slew.
+             * A Timebase must be resynced afterwards, as after setTime().
+             */
+            static bool step(int64_t offset_ns) {
+                if (!waitFor(ETH_PTPTSCR_TSSTI | ETH_PTPTSCR_TSSTU))
+                    return false;
+
+                uint64_t magnitude = offset_ns < 0 ? (uint64_t) -offset_ns : (uint64_t) offset_ns;
+                periph_base->PTPTSHUR = (uint32_t) (magnitude / nanoseconds_per_second);
+                periph_base->PTPTSLUR = (offset_ns < 0 ? ETH_PTPTSLUR_TSUPNS : 0) |
+                                        (uint32_t) (magnitude % nanoseconds_per_second * subsecond_rollover /
+                                                    nanoseconds_per_second);
+                periph_base->PTPTSCR |= ETH_PTPTSCR_TSSTU;
+                return waitFor(ETH_PTPTSCR_TSSTU);
+            }
+
+            /**
+             * Sets the clock rate relative to nominal, through the addend register.
+             *
+             * @param ppb: parts per billion, faster if positive, clipped to max_ppb
+             * @return false if the previous update is still pending
+             */
+            static bool adjustFrequency(int32_t ppb) {
+                ppb = ppb > max_ppb ? max_ppb : ppb < -max_ppb ? -max_ppb : ppb;
+
+                int64_t base = baseAddend();
+                if (!writeAddend((uint32_t) (base + base * ppb / nanoseconds_per_second)))
+                    return false;
+                frequency() = ppb;
+                return true;
+            }
+
+            /**
+             * @return the correction applied by adjustFrequency(), in ppb
+             */
+            static int32_t getFrequency() {
+                return frequency();
+            }
+
+            /**
+             * Pulse per second output rate.
+             *
+             * @param log2_hz: 2^log2_hz pulses per second, up to 15 (32768 Hz); the pulse
+             *        of 1 Hz is 125 ms long, the faster ones half their period
+             */
+            static void setPps(uint8_t log2_hz) {
+                ppsControl() = log2_hz & 0xF;
+            }
+
+            /**
+             * Arms the time stamp trigger: at the given time the MAC pulses the PTP
+             * trigger output, routed to TIM2 ITR1 (Timebase).
+             *
+             * @return false if the previous trigger hasn't fired yet
+             */
+            static bool setTarget(uint32_t seconds, uint32_t subseconds = 0) {
+                if (periph_base->PTPTSCR & ETH_PTPTSCR_TSITE)
+                    return false;
+
+                periph_base->PTPTTHR = seconds;
+                periph_base->PTPTTLR = subseconds;
+                periph_base->PTPTSCR |= ETH_PTPTSCR_TSITE;
+                return true;
+            }
+
+            /**
+             * Disarms the time stamp trigger, if it hasn't fired yet.
+             */
+            static void cancelTarget() {
+                periph_base->PTPTSCR &= ~ETH_PTPTSCR_TSITE;
+            }
+
+        private:
+            static uint32_t hclkFreq() {
+                return Peripheral::p_ETH_PTP::bus::bus_freq();
+            }
+
+            // PTPPPSCR: past the end of the CMSIS register block
+            static volatile uint32_t& ppsControl() {
+                return *(volatile uint32_t *) (Peripheral::p_ETH_PTP::periph_base + 0x2C);
+            }
+
+            // Addend of the nominal rate, computed by start()
+            static uint32_t& baseAddend() {
+                static uint32_t value = 0;
+                return value;
+            }
+
+            static int32_t& frequency() {
+                static int32_t value = 0;
+                return value;
+            }
+
+            static bool writeAddend(uint32_t addend) {
+                if (!waitFor(ETH_PTPTSCR_TSARU))
+                    return false;
+
+                periph_base->PTPTSAR = addend;
+                periph_base->PTPTSCR |= ETH_PTPTSCR_TSARU;
+                return true;
+            }
+
+            // Waits for PTPTSCR self-clearing bits
+            static bool waitFor(uint32_t mask) {
+                for (uint32_t i = 0; i < timeout; i++)
+                    if (!(periph_base->PTPTSCR & mask))
+                        return true;
+                return false;
+            }
+        };
+
+        class Timebase;
+
+        /**
+         * Servo (type)
+         *
+         * PI controller disciplining the Ptp clock to a master. Each update() takes the
+         * offset measured by the protocol (local time minus master time, e.g.
+         * ((t2 - t1) - (t4 - t3)) / 2 from a Sync / Delay_Req exchange) and the time
+         * since the previous one: the proportional term removes the offset over the next
+         * interval, the integral term learns the frequency error of the oscillator.
+         *
+         * Offsets beyond step_threshold_ns (and the first one) are removed with a step
+         * of the clock instead; the integral term is kept. A Timebase given to attach()
+         * is resynced after each step.
+         */
+        class Servo {
+            //***************************
+            //* Members                 *
+            //***************************
+        private:
+            int32_t kp_permille;
+            int32_t ki_permille;
+            int64_t step_threshold_ns;
+
+            int64_t drift_ppb;
+            int64_t last_offset = 0;
+            bool stepped = false;
+            Timebase *timebase = nullptr;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            /**
+             * @param kp_permille, ki_permille: gains, in thousandths
+             * @param step_threshold_ns: offsets stepped rather than slewed
+             * @param drift_ppb: initial frequency correction (e.g. saved from a previous run)
+             */
+            Servo(int32_t kp_permille = 700, int32_t ki_permille = 300, int64_t step_threshold_ns = 1000000,
+                  int32_t drift_ppb = 0) :
+                    kp_permille(kp_permille), ki_permille(ki_permille), step_threshold_ns(step_threshold_ns),
+                    drift_ppb(drift_ppb) {}
+
+            /**
+             * New measure.
+             *
+             * @param offset_ns: local time minus master time
+             * @param interval_ms: time since the previous measure
+             * @return the frequency correction applied, in ppb
+             */
+            int32_t update(int64_t offset_ns, uint32_t interval_ms);
+
+            /**
+             * Resyncs timebase after each step of the clock.
+             */
+            void attach(Timebase& timebase) {
+                this->timebase = &timebase;
+            }
+
+            /**
+             * Forgets the lock: the next measure steps the clock again.
+             */
+            void reset() {
+                stepped = false;
+            }
+
+            /**
+             * @return the last offset measured, in ns
+             */
+            int64_t offset() const {
+                return last_offset;
+            }
+
+            /**
+             * @return the frequency error learnt, in ppb
+             */
+            int32_t drift() const {
+                return (int32_t) drift_ppb;
+            }
+
+        private:
+            static int64_t clamp(int64_t ppb) {
+                return ppb > Ptp::max_ppb ? Ptp::max_ppb : ppb < -Ptp::max_ppb ? -Ptp::max_ppb : ppb;
+            }
+        };
+
+        /**
+         * Timebase (type)
+         *
+         * Correlates TIM2 with the PTP time, so that timer events (input captures,
+         * compare outputs starting conversions...) can be placed on the common time of
+         * the nodes. TIM2 free runs on its 32 bit counter; at each PTP second the time
+         * stamp trigger captures the counter in CCR1, through the internal ITR1 line
+         * (TIM2_OR ITR1_RMP = PTP trigger output), with no interrupt latency in the
+         * measure. The last two captures give the TIM2 count of a PTP second and the
+         * rate of TIM2 in PTP time, so conversions follow the servo's corrections.
+         *
+         * The interrupt must be forwarded:
+         *     void TIM2_IRQHandler() { timebase.onCapture(); }
+         *
+         * After the PTP time jumps (Ptp::setTime(), Ptp::step()) the captures no longer
+         * match it and the armed second may be far off: resync() drops them and rearms
+         * the trigger. A Servo does it for its steps once attach()ed to the Timebase.
+         *
+         * NOTE: TIM2 is taken over; Ptp must be started. At 84 MHz the counter wraps
+         *       every 51 s: counts converted must be within 25 s of the last capture.
+         */
+        class Timebase : public Timer::TimerBase<Peripheral::p_TIM2> {
+            //***************************
+            //* Members                 *
+            //***************************
+        private:
+            // Count and PTP second of the last capture
+            volatile uint32_t count = 0;
+            volatile uint32_t second = 0;
+            // PTP second the trigger is armed for
+            volatile uint32_t target = 0;
+            // TIM2 ticks per PTP second, 0 until two captures are in
+            volatile uint32_t rate = 0;
+            volatile uint32_t capture_count = 0;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            /**
+             * Starts TIM2 and arms the trigger for the next PTP second.
+             *
+             * @return false if the trigger can't be armed
+             */
+            bool start() {
+                // Through disable(), so that the enable() below isn't skipped on a restart
+                disable();
+                periph_base->CR1 = 0;
+                periph_base->PSC = 0;
+                periph_base->ARR = 0xFFFFFFFF;
+                periph_base->OR = (periph_base->OR & ~TIM_OR_ITR1_RMP) | TIM_OR_ITR1_RMP_0;
+
+                // IC1 on TRC, the ITR1 trigger, rising edge
+                periph_base->SMCR = TIM_SMCR_TS_0;
+                periph_base->CCMR1 = (periph_base->CCMR1 & ~0xFF) | TIM_CCMR1_CC1S;
+                periph_base->CCER = (periph_base->CCER & ~0xF) | TIM_CCER_CC1E;
+                periph_base->EGR = TIM_EGR_UG;
+                periph_base->SR = 0;
+                periph_base->DIER |= TIM_DIER_CC1IE;
+                enable();
+
+                return resync();
+            }
+
+            void stop() {
+                NVIC_DisableIRQ(TIM2_IRQn);
+                periph_base->DIER &= ~TIM_DIER_CC1IE;
+                disable();
+            }
+
+            /**
+             * Forgets the captures and rearms the trigger for the next PTP second: to be
+             * called after the PTP time jumps. ready() is false until two new captures
+             * are in.
+             *
+             * @return false if the trigger can't be armed
+             */
+            bool resync() {
+                NVIC_DisableIRQ(TIM2_IRQn);
+
+                // A trigger armed or fired on the old time is stale
+                Ptp::cancelTarget();
+                periph_base->SR = ~(TIM_SR_CC1IF | TIM_SR_CC1OF);
+                NVIC_ClearPendingIRQ(TIM2_IRQn);
+
+                rate = 0;
+                capture_count = 0;
+                bool armed = arm((uint32_t) (Ptp::raw() >> 32) + 1);
+
+                NVIC_EnableIRQ(TIM2_IRQn);
+                return armed;
+            }
+
+            /**
+             * Capture interrupt: records the second and arms the next one.
+             */
+            void onCapture() {
+                if (!(periph_base->SR & TIM_SR_CC1IF))
+                    return;
+
+                uint32_t captured = periph_base->CCR1;
+                periph_base->SR = ~(TIM_SR_CC1IF | TIM_SR_CC1OF);
+
+                uint32_t at = target;
+                if (capture_count > 0 && at != second)
+                    rate = (captured - count) / (at - second);
+                count = captured;
+                second = at;
+                capture_count = capture_count + 1;
+
+                // Normally the next second; later if this interrupt came late
+                uint32_t now = (uint32_t) (Ptp::raw() >> 32);
+                arm(now >= at ? now + 1 : at + 1);
+            }
+
+            /**
+             * @return true once the rate is known
+             */
+            bool ready() const {
+                return rate != 0;
+            }
+
+            /**
+             * @return TIM2 ticks per PTP second
+             */
+            uint32_t ticksPerSecond() const {
+                return rate;
+            }
+
+            /**
+             * @return TIM2 count now
+             */
+            static uint32_t counter() {
+                return periph_base->CNT;
+            }
+
+            /**
+             * @return the PTP time, in ns, of a TIM2 count (e.g. a CCRx capture)
+             */
+            int64_t toPtp(uint32_t tim2) const {
+                uint32_t base, at, ticks;
+                snapshot(base, at, ticks);
+                int64_t delta = (int32_t) (tim2 - base);
+                return (int64_t) at * nanoseconds_per_second + delta * nanoseconds_per_second / ticks;
+            }
+
+            /**
+             * @return the TIM2 count at a PTP time, in ns (e.g. for a CCRx compare)
+             */
+            uint32_t fromPtp(int64_t ns) const {
+                uint32_t base, at, ticks;
+                snapshot(base, at, ticks);
+                int64_t delta = ns - (int64_t) at * nanoseconds_per_second;
+                return base + (uint32_t) (delta * ticks / nanoseconds_per_second);
+            }
+
+        private:
+            // target changes only once the trigger is armed for it
+            bool arm(uint32_t seconds) {
+                if (!Ptp::setTarget(seconds))
+                    return false;
+                target = seconds;
+                return true;
+            }
+
+            // Consistent copy of the last capture, against onCapture()
+            void snapshot(uint32_t& base, uint32_t& at, uint32_t& ticks) const {
+                uint32_t captures;
+                do {
+                    captures = capture_count;
+                    base = count;
+                    at = second;
+                    ticks = rate ? rate : Peripheral::p_TIM2::bus::timer_freq();
+                } while (captures != capture_count);
+            }
+        };
+
+        inline int32_t Servo::update(int64_t offset_ns, uint32_t interval_ms) {
+            last_offset = offset_ns;
+
+            if (!stepped || offset_ns > step_threshold_ns || offset_ns < -step_threshold_ns) {
+                // A step that doesn't happen (the previous update still pending) is
+                // retried by the next measure
+                if (Ptp::step(-offset_ns)) {
+                    stepped = true;
+                    if (timebase)
+                        timebase->resync();
+                }
+                Ptp::adjustFrequency((int32_t) drift_ppb);
+                return (int32_t) drift_ppb;
+            }
+
+            if (interval_ms == 0)
+                interval_ms = 1;
+
+            // Offset gained per second: the rate error it shows, in ppb
+            int64_t rate = offset_ns * 1000 / interval_ms;
+
+            // Anti windup: the integral stays within the range the addend can apply
+            drift_ppb -= rate * ki_permille / 1000;
+            drift_ppb = clamp(drift_ppb);
+
+            int32_t ppb = (int32_t) clamp(drift_ppb - rate * kp_permille / 1000);
+            Ptp::adjustFrequency(ppb);
+            return ppb;
+        }
+    }
+}
+
+#endif //PTP_HPP
@@ -0,0 +1,447 @@
+#ifndef EXTI_HPP
+#define EXTI_HPP
+
+#include "../peripheral.hpp"
+#include "../gpio/gpio.hpp"
+#include "../timers/timer.hpp"
+
+#include <type_traits>
+
+namespace HAL {
+    namespace Exti {
+        typedef EXTI_TypeDef raw_exti_t;
+        typedef SYSCFG_TypeDef raw_syscfg_t;
+
+        static constexpr raw_exti_t* const exti_base = (raw_exti_t*) EXTI_BASE;
+        static constexpr raw_syscfg_t* const syscfg_base = (raw_syscfg_t*) SYSCFG_BASE;
+
+        /**
+         * Edges a line is sensitive to, as bit 0 (RTSR) and bit 1 (FTSR).
+         */
+        enum class Edge : uint32_t {
+            RISING = 1,
+            FALLING = 2,
+            BOTH = 3
+        };
+
+        /**
+         * @return the interrupt vector serving EXTI line n. Lines 5..9 and 10..15 share
+         * a single vector each.
+         */
+        static constexpr IRQn_Type lineIrq(unsigned n) {
+            return n < 5 ? (IRQn_Type) (EXTI0_IRQn + n) : (n < 10 ? EXTI9_5_IRQn : EXTI15_10_IRQn);
+        }
+
+        /**
+         * Line (type)
+         *
+         * This represents the EXTI line connected to pin PIN (line n serves pin n of
+         * one port, selected through SYSCFG). All the methods are static.
+         *
+         * NOTE: route(), enable() and disable() are read-modify-write operations on shared
+         *       registers, they are thread-safe ONLY inside miosix environment.
+         */
+        template<typename PIN>
+        class Line {
+            //***************************
+            //* Subtypes                *
+            //***************************
+        public:
+            typedef PIN pin;
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr unsigned number = PIN::number;
+            static constexpr uint32_t mask = PIN::mask;
+            static constexpr IRQn_Type irq = lineIrq(PIN::number);
+
+            // Position of the line port field in SYSCFG EXTICR registers
+            static constexpr unsigned exticr_index = PIN::number / 4;
+            static constexpr uint32_t exticr_shift = 4 * (PIN::number % 4);
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            /**
+             * Connects the line to the pin's port. SYSCFG clock must be enabled.
+             */
+            static void route() {
+                modify(syscfg_base->EXTICR[exticr_index], 0xFu << exticr_shift,
+                       PIN::port_index << exticr_shift);
+            }
+
+            /**
+             * Selects the sensitive edges and unmasks the line interrupt.
+             */
+            static void enable(Edge edge) {
+                uint32_t e = static_cast<uint32_t>(edge);
+
+                modify(exti_base->RTSR, mask, (e & 1) ? mask : 0);
+                modify(exti_base->FTSR, mask, (e & 2) ? mask : 0);
+                clearPending();
+                modify(exti_base->IMR, mask, mask);
+            }
+
+            /**
+             * Masks the line interrupt. Edges are still recorded in the pending register.
+             */
+            static void disable() {
+                modify(exti_base->IMR, mask, 0);
+            }
+
+            static bool is_pending() {
+                return (exti_base->PR & mask) != 0;
+            }
+
+            static void clearPending() {
+                exti_base->PR = mask;
+            }
+
+            /**
+             * Raises the line interrupt by software.
+             */
+            static void trigger() {
+                exti_base->SWIER = mask;
+            }
+
+        private:
+#ifdef _MIOSIX
+            static void modify(volatile uint32_t& reg, uint32_t clear_mask, uint32_t value) {
+                miosix::FastInterruptDisableLock dLock;
+                reg = (reg & ~clear_mask) | value;
+            }
+#else
+            static void modify(volatile uint32_t& reg, uint32_t clear_mask, uint32_t value) {
+                reg = (reg & ~clear_mask) | value;
+            }
+#endif
+        };
+
+        /**
+         * DebounceTimer (type)
+         *
+         * A free running 16 bit timer (TIM2..TIM5) counting at tick_freq, shared by the
+         * debounced handlers of a Dispatcher. Each debounced line owns one of its four
+         * compare channels: an edge masks the line and arms the channel, the compare
+         * interrupt samples the pin once the bouncing is over. No CPU time is spent
+         * waiting, neither in the EXTI interrupt nor in the timer one.
+         */
+        template<typename TIM, uint32_t TICK_FREQ = 10000>
+        struct DebounceTimer {
+            typedef TIM peripheral;
+
+            static constexpr uint32_t tick_freq = TICK_FREQ;
+            static constexpr Timer::raw_timer_t* const periph_base = (Timer::raw_timer_t*) TIM::periph_base;
+            static constexpr IRQn_Type irq =
+                    TIM::periph_base == TIM2_BASE ? TIM2_IRQn :
+                    TIM::periph_base == TIM3_BASE ? TIM3_IRQn :
+                    TIM::periph_base == TIM4_BASE ? TIM4_IRQn : TIM5_IRQn;
+
+            static_assert(TIM::periph_base == TIM2_BASE || TIM::periph_base == TIM3_BASE ||
+                          TIM::periph_base == TIM4_BASE || TIM::periph_base == TIM5_BASE,
+                          "debounce timer must be one of TIM2..TIM5 (own interrupt vector, four channels)");
+
+            /**
+             * Starts the timer, free running over the whole 16 bit range.
+             */
+            static void start() {
+                TIM::enable();
+
+                periph_base->CR1 = 0;
+                periph_base->PSC = Timer::TimerBase<TIM>::bus_freq() / tick_freq - 1;
+                periph_base->ARR = 0xFFFF;
+                periph_base->DIER = 0;
+                periph_base->EGR = TIM_EGR_UG;
+                periph_base->SR = 0;
+                periph_base->CR1 = TIM_CR1_CEN;
+
+                NVIC_ClearPendingIRQ(irq);
+                NVIC_EnableIRQ(irq);
+            }
+
+            /**
+             * Arms compare channel (1..4) to fire ticks from now.
+             */
+            static void arm(unsigned channel, uint16_t ticks) {
+                volatile uint32_t *ccr = &periph_base->CCR1 + (channel - 1);
+                uint16_t flag = TIM_SR_CC1IF << (channel - 1);
+
+                *ccr = (uint16_t) (periph_base->CNT + ticks);
+                periph_base->SR = (uint16_t) ~flag;
+                periph_base->DIER |= flag;
+            }
+
+            static void disarm(unsigned channel) {
+                periph_base->DIER &= ~(TIM_DIER_CC1IE << (channel - 1));
+            }
+        };
+
+        /**
+         * Handler (type)
+         *
+         * Calls F on every EDGE of pin PIN. The function is a template argument, so the
+         * dispatcher calls it directly (and can inline it): there are no function pointers
+         * to follow at interrupt time.
+         */
+        template<typename PIN, Edge EDGE, void (*F)()>
+        struct Handler {
+            typedef Line<PIN> line;
+            typedef void timer;
+
+            static constexpr Edge edge = EDGE;
+            static constexpr uint32_t flag = 0;
+
+            static void onEdge() {
+                F();
+            }
+
+            static void onTimer(uint32_t) {}
+        };
+
+        /**
+         * Debounced (type)
+         *
+         * Calls F when pin PIN reaches the level of EDGE and stays there for at least
+         * delay_us microseconds. The first edge masks the line and arms compare channel
+         * CHANNEL of TIMER (a DebounceTimer); when it fires the pin is sampled, F is called
+         * if the level is the expected one (always, for Edge::BOTH: F can read the pin) and
+         * the line is unmasked again, discarding the bounces seen in between.
+         *
+         * Every debounced line needs its own channel of the timer.
+         */
+        template<typename PIN, Edge EDGE, void (*F)(), typename TIMER, unsigned CHANNEL, uint32_t DELAY_US = 5000>
+        struct Debounced {
+            static_assert(CHANNEL >= 1 && CHANNEL <= 4, "timer channel must be between 1 and 4");
+
+            typedef Line<PIN> line;
+            typedef TIMER timer;
+
+            static constexpr Edge edge = EDGE;
+            static constexpr unsigned channel = CHANNEL;
+            static constexpr uint32_t ticks = (uint64_t) DELAY_US * TIMER::tick_freq / 1000000;
+            static constexpr uint32_t flag = TIM_SR_CC1IF << (CHANNEL - 1);
+
+            static_assert(ticks > 0 && ticks < 0x10000, "debounce delay out of the timer range");
+
+            static void onEdge() {
+                line::disable();
+                TIMER::arm(CHANNEL, ticks);
+            }
+
+            static void onTimer(uint32_t sr) {
+                if (!(sr & flag))
+                    return;
+
+                TIMER::disarm(CHANNEL);
+
+                bool level = PIN::read();
+                if (EDGE == Edge::BOTH || level == (EDGE == Edge::RISING))
+                    F();
+
+                // Discards the bounces recorded meanwhile and unmasks the line
+                line::enable(EDGE);
+            }
+        };
+
+        namespace detail {
+            template<typename... H>
+            struct HandlerMerge {
+                static constexpr uint32_t lines = 0;
+                static constexpr uint32_t rising = 0;
+                static constexpr uint32_t falling = 0;
+                static constexpr uint32_t vectors = 0;
+
+                static constexpr uint32_t exticrMask(unsigned) {
+                    return 0;
+                }
+
+                static constexpr uint32_t exticrValue(unsigned) {
+                    return 0;
+                }
+
+                static void dispatch(uint32_t) {}
+
+                template<typename TIMER>
+                static void dispatchTimer(uint32_t) {}
+
+                template<typename TIMER>
+                static constexpr uint32_t timerFlags() {
+                    return 0;
+                }
+            };
+
+            template<typename H, typename... T>
+            struct HandlerMerge<H, T...> {
+                typedef HandlerMerge<T...> rest;
+                typedef typename H::line line;
+
+                static_assert(!(rest::lines & line::mask), "two handlers on the same EXTI line");
+
+                static constexpr uint32_t lines = line::mask | rest::lines;
+                static constexpr uint32_t rising = ((static_cast<uint32_t>(H::edge) & 1) ? line::mask : 0) | rest::rising;
+                static constexpr uint32_t falling = ((static_cast<uint32_t>(H::edge) & 2) ? line::mask : 0) | rest::falling;
+
+                // One bit per vector: 0..4 for EXTI0..EXTI4, 5 for EXTI9_5, 6 for EXTI15_10
+                static constexpr uint32_t vectors =
+                        (1u << (line::number < 5 ? line::number : (line::number < 10 ? 5 : 6))) | rest::vectors;
+
+                static constexpr uint32_t exticrMask(unsigned i) {
+                    return (line::exticr_index == i ? (0xFu << line::exticr_shift) : 0) | rest::exticrMask(i);
+                }
+
+                static constexpr uint32_t exticrValue(unsigned i) {
+                    return (line::exticr_index == i ? (H::line::pin::port_index << line::exticr_shift) : 0) |
+                           rest::exticrValue(i);
+                }
+
+                static void dispatch(uint32_t pending) {
+                    if (pending & line::mask)
+                        H::onEdge();
+                    rest::dispatch(pending);
+                }
+
+                template<typename TIMER>
+                static void dispatchTimer(uint32_t sr) {
+                    if (std::is_same<typename H::timer, TIMER>::value)
+                        H::onTimer(sr);
+                    rest::template dispatchTimer<TIMER>(sr);
+                }
+
+                template<typename TIMER>
+                static constexpr uint32_t timerFlags() {
+                    return (std::is_same<typename H::timer, TIMER>::value ? H::flag : 0) |
+                           rest::template timerFlags<TIMER>();
+                }
+            };
+        }
+
+        /**
+         * Dispatcher (type)
+         *
+         * Static dispatch table for a set of Handler/Debounced types. The whole table is
+         * resolved at compile time:
+         *  - configure() routes all the lines through SYSCFG with one write per touched
+         *    EXTICR register, programs RTSR/FTSR/IMR with one write each and enables the
+         *    needed interrupt vectors
+         *  - the serve functions, to be called from the corresponding interrupt handlers,
+         *    clear the pending lines with a single write and test only the lines that
+         *    actually belong to the vector, calling the handlers directly
+         *
+         * Example:
+         *   typedef Exti::DebounceTimer<Peripheral::p_TIM5> debounce;
+         *   typedef Exti::Dispatcher<
+         *           Exti::Handler<Gpio::PB<6>, Exti::Edge::RISING, &encoderStep>,
+         *           Exti::Debounced<Gpio::PC<13>, Exti::Edge::FALLING, &buttonPressed, debounce, 1>
+         *   > exti;
+         *
+         *   void EXTI9_5_IRQHandler() { exti::serve9_5(); }
+         *   void EXTI15_10_IRQHandler() { exti::serve15_10(); }
+         *   void TIM5_IRQHandler() { exti::serveTimer<debounce>(); }
+         *
+         * The timer and EXTI interrupts of a dispatcher must have the same NVIC priority,
+         * since both of them modify IMR and the timer DIER.
+         */
+        template<typename... H>
+        class Dispatcher {
+            typedef detail::HandlerMerge<H...> merge;
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr uint32_t lines = merge::lines;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        private:
+            template<unsigned FIRST, unsigned LAST>
+            static void serve() {
+                constexpr uint32_t range = ((0xFFFFu >> (15 - LAST)) >> FIRST) << FIRST;
+                constexpr uint32_t served = range & lines;
+
+                uint32_t pending = exti_base->PR & served;
+                exti_base->PR = pending;
+
+                merge::dispatch(pending);
+            }
+
+            static void setup(volatile uint32_t& reg, uint32_t clear_mask, uint32_t value) {
+                if (clear_mask)
+                    reg = (reg & ~clear_mask) | value;
+            }
+
+            static void enableVector(unsigned vector) {
+                if (merge::vectors & (1u << vector)) {
+                    IRQn_Type irq = lineIrq(vector < 5 ? vector : (vector == 5 ? 5 : 10));
+                    NVIC_ClearPendingIRQ(irq);
+                    NVIC_EnableIRQ(irq);
+                }
+            }
+
+        public:
+            /**
+             * Routes the lines, selects their edges, unmasks them and enables their vectors.
+             * Debounce timers must be started separately (DebounceTimer::start()).
+             *
+             * NOTE: this function is thread-safe ONLY inside miosix environment,
+             *       in other environments you have to ensure it other ways.
+             */
+            static void configure() {
+                Peripheral::p_SYSCFG::enable();
+
+                {
+#ifdef _MIOSIX
+                    miosix::FastInterruptDisableLock dLock;
+#endif
+                    for (unsigned i = 0; i < 4; i++)
+                        setup(syscfg_base->EXTICR[i], merge::exticrMask(i), merge::exticrValue(i));
+
+                    setup(exti_base->RTSR, lines, merge::rising);
+                    setup(exti_base->FTSR, lines, merge::falling);
+                    exti_base->PR = lines;
+                    setup(exti_base->IMR, lines, lines);
+                }
+
+                for (unsigned v = 0; v < 7; v++)
+                    enableVector(v);
+            }
+
+            /**
+             * Masks all the lines of the dispatcher.
+             */
+            static void disable() {
+#ifdef _MIOSIX
+                miosix::FastInterruptDisableLock dLock;
+#endif
+                exti_base->IMR &= ~lines;
+            }
+
+            static void serve0() { serve<0, 0>(); }
+            static void serve1() { serve<1, 1>(); }
+            static void serve2() { serve<2, 2>(); }
+            static void serve3() { serve<3, 3>(); }
+            static void serve4() { serve<4, 4>(); }
+            static void serve9_5() { serve<5, 9>(); }
+            static void serve15_10() { serve<10, 15>(); }
+
+            /**
+             * Serves the compare interrupts of a DebounceTimer used by the handlers.
+             */
+            template<typename TIMER>
+            static void serveTimer() {
+                constexpr uint32_t served = merge::template timerFlags<TIMER>();
+
+                uint32_t sr = TIMER::periph_base->SR & TIMER::periph_base->DIER & served;
+                TIMER::periph_base->SR = (uint16_t) ~sr;
+
+                merge::template dispatchTimer<TIMER>(sr);
+            }
+        };
+    }
+}
+
+#endif //EXTI_HPP
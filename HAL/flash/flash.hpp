@@ -0,0 +1,266 @@
+#ifndef FLASH_HPP
+#define FLASH_HPP
+
+#include "flash_acr.hpp"
+
+namespace HAL {
+    namespace Flash {
+
+        /**
+         * Program/erase parallelism (FLASH_CR PSIZE): bits written per operation. It is
+         * bound to the supply voltage: X8 works from 1.8 V, X16 from 2.1 V, X32 from
+         * 2.7 V, X64 needs the external VPP supply.
+         */
+        enum class Parallelism : uint32_t {
+            X8 = 0,
+            X16 = FLASH_CR_PSIZE_0,
+            X32 = FLASH_CR_PSIZE_1,
+            X64 = FLASH_CR_PSIZE_0 | FLASH_CR_PSIZE_1
+        };
+
+        /**
+         * @return the bytes written by a single program operation
+         */
+        constexpr uint32_t programUnit(Parallelism parallelism) {
+            return parallelism == Parallelism::X8 ? 1 :
+                   parallelism == Parallelism::X16 ? 2 :
+                   parallelism == Parallelism::X32 ? 4 : 8;
+        }
+
+        //***************************
+        //* Sector geometry         *
+        //***************************
+
+        // 1 MB single bank: 4 x 16 KB, 1 x 64 KB, 7 x 128 KB
+        constexpr unsigned sector_count = 12;
+
+        constexpr uint32_t sectorSize(unsigned sector) {
+            return sector < 4 ? 0x4000 : sector == 4 ? 0x10000 : 0x20000;
+        }
+
+        constexpr __pointer sectorAddress(unsigned sector) {
+            return sector <= 4 ? FLASH_BASE + sector * 0x4000 : FLASH_BASE + (sector - 4) * 0x20000;
+        }
+
+        /**
+         * @return the sector holding address, or -1 if address is not in main flash
+         */
+        constexpr int sectorOf(__pointer address, unsigned sector = 0) {
+            return sector >= sector_count ? -1 :
+                   address >= sectorAddress(sector) && address - sectorAddress(sector) < sectorSize(sector)
+                   ? (int) sector : sectorOf(address, sector + 1);
+        }
+
+        /**
+         * Controller (type)
+         *
+         * Program/erase controller of the internal flash (FLASH_R registers). Operations
+         * block until done: a 128 KB sector erase takes 1-2 s. Code and data fetches
+         * from flash stall while it is busy, so interrupts keep working only if their
+         * handlers and vectors are in RAM.
+         *
+         * The controller must be unlocked to program or erase; data cache lines holding
+         * modified flash are invalidated after each operation.
+         *
+         * NOTE: the controller is a single resource, serialize its users.
+         */
+        class Controller {
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_flash_t* const periph_base = (raw_flash_t*) Peripheral::p_FLASH_R::periph_base;
+
+            static constexpr uint32_t error_mask = FLASH_SR_WRPERR | FLASH_SR_PGAERR | FLASH_SR_PGPERR |
+                                                   FLASH_SR_PGSERR;
+
+        private:
+            static constexpr uint32_t key1 = 0x45670123;
+            static constexpr uint32_t key2 = 0xCDEF89AB;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        private:
+            static uint32_t& errorBits() {
+                static uint32_t errors = 0;
+                return errors;
+            }
+
+            static void wait() {
+                while (periph_base->SR & FLASH_SR_BSY);
+            }
+
+            static void clearErrors() {
+                periph_base->SR = FLASH_SR_EOP | error_mask;
+            }
+
+            static bool checkErrors() {
+                errorBits() = periph_base->SR & error_mask;
+                return errorBits() == 0;
+            }
+
+        public:
+            static bool is_locked() {
+                return (periph_base->CR & FLASH_CR_LOCK) != 0;
+            }
+
+            /**
+             * Unlocks programming and erasing until lock() or reset. A wrong sequence
+             * locks the controller until reset.
+             *
+             * @return true if the controller is unlocked
+             */
+            static bool unlock() {
+                if (is_locked()) {
+                    periph_base->KEYR = key1;
+                    periph_base->KEYR = key2;
+                }
+                return !is_locked();
+            }
+
+            static void lock() {
+                wait();
+                periph_base->CR |= FLASH_CR_LOCK;
+            }
+
+            /**
+             * @return the error flags (FLASH_SR) of the last failed operation
+             */
+            static uint32_t errors() {
+                return errorBits();
+            }
+
+            /**
+             * Erases a sector to 0xFF.
+             *
+             * @return false on error (locked, write protected, ...), see errors()
+             */
+            static bool eraseSector(unsigned sector, Parallelism parallelism = Parallelism::X32) {
+                if (sector >= sector_count || is_locked())
+                    return false;
+
+                wait();
+                clearErrors();
+
+                periph_base->CR = static_cast<uint32_t>(parallelism) | FLASH_CR_SER | (sector * FLASH_CR_SNB_0);
+                periph_base->CR |= FLASH_CR_STRT;
+                wait();
+                periph_base->CR &= ~(FLASH_CR_SER | FLASH_CR_SNB_0 * 0xF);
+
+                Acr::resetDataCache();
+                return checkErrors();
+            }
+
+            /**
+             * Programs bytes at address. Flash bits can only go from 1 to 0, so the target
+             * must be erased. address and bytes must be multiples of the program unit of
+             * the parallelism; data can have any alignment.
+             *
+             * @return false on error, see errors(); the operation stops at the first one
+             */
+            static bool program(__pointer address, const void *data, uint32_t bytes,
+                                Parallelism parallelism = Parallelism::X32) {
+                const uint8_t *src = (const uint8_t *) data;
+                uint32_t unit = programUnit(parallelism);
+
+                if (((address | bytes) & (unit - 1)) || is_locked())
+                    return false;
+
+                wait();
+                clearErrors();
+                periph_base->CR = static_cast<uint32_t>(parallelism) | FLASH_CR_PG;
+
+                bool ok = true;
+                for (uint32_t i = 0; i < bytes && ok; i += unit) {
+                    switch (parallelism) {
+                        case Parallelism::X8:
+                            *(volatile uint8_t *) (address + i) = src[i];
+                            break;
+
+                        case Parallelism::X16:
+                            *(volatile uint16_t *) (address + i) = (uint16_t) (src[i] | (src[i + 1] << 8));
+                            break;
+
+                        case Parallelism::X32:
+                            *(volatile uint32_t *) (address + i) = load32(src + i);
+                            break;
+
+                        case Parallelism::X64:
+                            *(volatile uint32_t *) (address + i) = load32(src + i);
+                            *(volatile uint32_t *) (address + i + 4) = load32(src + i + 4);
+                            break;
+                    }
+
+                    wait();
+                    ok = checkErrors();
+                }
+
+                periph_base->CR &= ~FLASH_CR_PG;
+
+                Acr::resetDataCache();
+                return ok;
+            }
+
+        private:
+            static uint32_t load32(const uint8_t *p) {
+                return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+            }
+        };
+
+        namespace detail {
+            constexpr bool sameSize(unsigned first, unsigned count) {
+                return count <= 1 || (sectorSize(first) == sectorSize(first + 1) && sameSize(first + 1, count - 1));
+            }
+        }
+
+        /**
+         * SectorRegion (type)
+         *
+         * COUNT consecutive internal flash sectors of the same size, starting at FIRST,
+         * seen as an array of sectors. It is the storage interface of KvStore (RamFlash
+         * is the RAM model with the same interface):
+         *
+         *   sector_count, sector_size, program_unit
+         *   const uint8_t *sectorData(i)                   memory mapped content
+         *   bool erase(i)
+         *   bool program(i, offset, data, bytes)            offset/bytes multiple of program_unit
+         *
+         * The controller is unlocked only for the duration of each operation.
+         */
+        template<unsigned FIRST, unsigned COUNT, Parallelism P = Parallelism::X32>
+        class SectorRegion {
+            static_assert(COUNT >= 1 && FIRST + COUNT <= Flash::sector_count, "sectors out of range");
+            static_assert(detail::sameSize(FIRST, COUNT), "the sectors of a region must have the same size");
+
+        public:
+            static constexpr unsigned sector_count = COUNT;
+            static constexpr uint32_t sector_size = sectorSize(FIRST);
+            static constexpr uint32_t program_unit = programUnit(P);
+
+            const uint8_t *sectorData(unsigned sector) const {
+                return (const uint8_t *) sectorAddress(FIRST + sector);
+            }
+
+            bool erase(unsigned sector) {
+                if (sector >= COUNT || !Controller::unlock())
+                    return false;
+
+                bool ok = Controller::eraseSector(FIRST + sector, P);
+                Controller::lock();
+                return ok;
+            }
+
+            bool program(unsigned sector, uint32_t offset, const void *data, uint32_t bytes) {
+                if (sector >= COUNT || offset + bytes > sector_size || !Controller::unlock())
+                    return false;
+
+                bool ok = Controller::program(sectorAddress(FIRST + sector) + offset, data, bytes, P);
+                Controller::lock();
+                return ok;
+            }
+        };
+    }
+}
+
+#endif //FLASH_HPP
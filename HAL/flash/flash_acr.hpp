@@ -0,0 +1,280 @@
+#ifndef FLASH_ACR_HPP
+#define FLASH_ACR_HPP
+
+#include "../peripheral.hpp"
+
+namespace HAL {
+    namespace Flash {
+        typedef FLASH_TypeDef raw_flash_t;
+
+        /**
+         * Supply voltage range of the device (VDD), named after its lower bound. It sets
+         * how many HCLK MHz each flash wait state covers (RM0090, "Number of wait states
+         * according to CPU clock frequency").
+         */
+        enum class Supply {
+            V2_7,   // 2.7 - 3.6 V
+            V2_4,   // 2.4 - 2.7 V
+            V2_1,   // 2.1 - 2.4 V
+            V1_8    // 1.8 - 2.1 V, prefetch not allowed
+        };
+
+        /**
+         * @return the highest HCLK frequency served by each wait state in the range
+         */
+        constexpr uint32_t frequencyPerWaitState(Supply supply) {
+            return supply == Supply::V2_7 ? 30000000 :
+                   supply == Supply::V2_4 ? 24000000 :
+                   supply == Supply::V2_1 ? 22000000 : 20000000;
+        }
+
+        constexpr uint32_t max_wait_states = FLASH_ACR_LATENCY;
+
+        /**
+         * @return the minimum number of wait states for HCLK = hclk; values above
+         * max_wait_states mean the frequency is too high for the supply range
+         */
+        constexpr uint32_t waitStates(uint32_t hclk, Supply supply = Supply::V2_7) {
+            return hclk == 0 ? 0 : (hclk - 1) / frequencyPerWaitState(supply);
+        }
+
+        /**
+         * Content of the access control register that matters for performance.
+         */
+        struct AcrConfig {
+            uint32_t latency;
+            bool prefetch;
+            bool instruction_cache;
+            bool data_cache;
+        };
+
+        /**
+         * Acr (type)
+         *
+         * Flash access control register: wait states and ART accelerator (prefetch buffer,
+         * 64 x 128 bit instruction cache, 8 x 128 bit data cache).
+         *
+         * The wait states must always cover the current HCLK, so they are raised BEFORE the
+         * clock goes up and lowered AFTER it goes down: beforeClockChange() and
+         * afterClockChange() do exactly that around any change of SYSCLK, AHB prescaler or
+         * supply range. Too many wait states are safe but slow (each one costs a cycle on
+         * every cache miss); too few make the core read garbage.
+         *
+         * A cache is reset only while disabled, so resetCaches() disables, resets and
+         * re-enables what was enabled. Reset the data cache after programming or erasing
+         * flash that may be cached.
+         *
+         * NOTE: the read-modify-write functions are thread-safe ONLY inside miosix
+         *       environment, in other environments you have to ensure it other ways.
+         */
+        class Acr {
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_flash_t* const periph_base = (raw_flash_t*) Peripheral::p_FLASH_R::periph_base;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        private:
+            static Supply& supplyRange() {
+                static Supply supply = Supply::V2_7;
+                return supply;
+            }
+
+#ifdef _MIOSIX
+            static void modify(uint32_t clear_mask, uint32_t value) {
+                miosix::FastInterruptDisableLock dLock;
+                periph_base->ACR = (periph_base->ACR & ~clear_mask) | value;
+            }
+#else
+            static void modify(uint32_t clear_mask, uint32_t value) {
+                periph_base->ACR = (periph_base->ACR & ~clear_mask) | value;
+            }
+#endif
+
+        public:
+            /**
+             * Declares the supply range used by the functions that take a frequency.
+             * The default is 2.7 - 3.6 V. Below 2.1 V the prefetch buffer is turned off.
+             */
+            static void setSupply(Supply supply) {
+                supplyRange() = supply;
+                if (supply == Supply::V1_8)
+                    disablePrefetch();
+            }
+
+            static Supply getSupply() {
+                return supplyRange();
+            }
+
+            static uint32_t getLatency() {
+                return periph_base->ACR & FLASH_ACR_LATENCY;
+            }
+
+            /**
+             * Sets the wait states and waits until the flash interface uses them, as the
+             * reference manual requires before changing the clock.
+             */
+            static void setLatency(uint32_t wait_states) {
+                modify(FLASH_ACR_LATENCY, wait_states & FLASH_ACR_LATENCY);
+                while (getLatency() != (wait_states & FLASH_ACR_LATENCY));
+            }
+
+            /**
+             * Sets the minimum wait states for hclk in the current supply range.
+             *
+             * @return false (and nothing changes) if hclk is too high for the range
+             */
+            static bool setLatencyFor(uint32_t hclk) {
+                uint32_t wait_states = waitStates(hclk, supplyRange());
+                if (wait_states > max_wait_states)
+                    return false;
+
+                setLatency(wait_states);
+                return true;
+            }
+
+            /**
+             * Call before switching HCLK to new_hclk: raises the wait states if needed.
+             *
+             * @return false if new_hclk is too high for the supply range: don't switch
+             */
+            static bool beforeClockChange(uint32_t new_hclk) {
+                uint32_t wait_states = waitStates(new_hclk, supplyRange());
+                if (wait_states > max_wait_states)
+                    return false;
+
+                if (wait_states > getLatency())
+                    setLatency(wait_states);
+                return true;
+            }
+
+            /**
+             * Call after HCLK has switched to hclk: lowers the wait states if possible.
+             */
+            static void afterClockChange(uint32_t hclk) {
+                uint32_t wait_states = waitStates(hclk, supplyRange());
+                if (wait_states < getLatency())
+                    setLatency(wait_states);
+            }
+
+            /**
+             * @return true if the wait states are the minimum for hclk: fewer would be
+             * unsafe, more would waste cycles
+             */
+            static bool isOptimal(uint32_t hclk) {
+                return getLatency() == waitStates(hclk, supplyRange());
+            }
+
+            static void enablePrefetch() {
+                if (supplyRange() != Supply::V1_8)
+                    modify(0, FLASH_ACR_PRFTEN);
+            }
+
+            static void disablePrefetch() {
+                modify(FLASH_ACR_PRFTEN, 0);
+            }
+
+            /**
+             * Enables the instruction cache, resetting it first if it was disabled: its
+             * content may be stale.
+             */
+            static void enableInstructionCache() {
+                if (periph_base->ACR & FLASH_ACR_ICEN)
+                    return;
+
+                modify(0, FLASH_ACR_ICRST);
+                modify(FLASH_ACR_ICRST, FLASH_ACR_ICEN);
+            }
+
+            static void disableInstructionCache() {
+                modify(FLASH_ACR_ICEN, 0);
+            }
+
+            /**
+             * Enables the data cache, resetting it first if it was disabled.
+             */
+            static void enableDataCache() {
+                if (periph_base->ACR & FLASH_ACR_DCEN)
+                    return;
+
+                modify(0, FLASH_ACR_DCRST);
+                modify(FLASH_ACR_DCRST, FLASH_ACR_DCEN);
+            }
+
+            static void disableDataCache() {
+                modify(FLASH_ACR_DCEN, 0);
+            }
+
+            /**
+             * Invalidates both caches, keeping their enable state.
+             */
+            static void resetCaches() {
+                uint32_t enabled = periph_base->ACR & (FLASH_ACR_ICEN | FLASH_ACR_DCEN);
+
+                modify(FLASH_ACR_ICEN | FLASH_ACR_DCEN, 0);
+                modify(0, FLASH_ACR_ICRST | FLASH_ACR_DCRST);
+                modify(FLASH_ACR_ICRST | FLASH_ACR_DCRST, enabled);
+            }
+
+            /**
+             * Invalidates the data cache only, e.g. after programming or erasing flash.
+             */
+            static void resetDataCache() {
+                uint32_t enabled = periph_base->ACR & FLASH_ACR_DCEN;
+
+                modify(FLASH_ACR_DCEN, 0);
+                modify(0, FLASH_ACR_DCRST);
+                modify(FLASH_ACR_DCRST, enabled);
+            }
+
+            static AcrConfig getConfig() {
+                uint32_t acr = periph_base->ACR;
+                return AcrConfig{acr & FLASH_ACR_LATENCY, (acr & FLASH_ACR_PRFTEN) != 0,
+                                 (acr & FLASH_ACR_ICEN) != 0, (acr & FLASH_ACR_DCEN) != 0};
+            }
+
+            /**
+             * Applies a whole configuration. Caches being turned on are reset first.
+             * The caller is responsible for config.latency covering the current HCLK.
+             */
+            static void setConfig(const AcrConfig& config) {
+                setLatency(config.latency);
+
+                if (config.prefetch)
+                    enablePrefetch();
+                else
+                    disablePrefetch();
+
+                if (config.instruction_cache)
+                    enableInstructionCache();
+                else
+                    disableInstructionCache();
+
+                if (config.data_cache)
+                    enableDataCache();
+                else
+                    disableDataCache();
+            }
+
+            /**
+             * Fastest setting for hclk: minimum wait states, prefetch (when the supply
+             * allows it) and both caches. It replaces what SetSysClock() writes at boot.
+             *
+             * @return false (and nothing changes) if hclk is too high for the range
+             */
+            static bool configure(uint32_t hclk) {
+                uint32_t wait_states = waitStates(hclk, supplyRange());
+                if (wait_states > max_wait_states)
+                    return false;
+
+                setConfig(AcrConfig{wait_states, supplyRange() != Supply::V1_8, true, true});
+                return true;
+            }
+        };
+    }
+}
+
+#endif //FLASH_ACR_HPP
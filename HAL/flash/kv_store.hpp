@@ -0,0 +1,558 @@
+#ifndef KV_STORE_HPP
+#define KV_STORE_HPP
+
+#include "../crc/crc_software.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+namespace HAL {
+    namespace Flash {
+
+        /**
+         * KvStore (type)
+         *
+         * Log structured key-value store on the sectors of STORAGE (SectorRegion for the
+         * internal flash, RamFlash for host tests), for settings and other small values
+         * that change now and then.
+         *
+         * Values are never updated in place: every write appends a record to the head
+         * sector, and a RAM index (open addressing hash table of MAX_KEYS slots) maps each
+         * key to its latest record, so lookups cost O(1) and read straight from flash.
+         * The index is rebuilt by mount() at boot, replaying the sectors in the order they
+         * were filled.
+         *
+         * When the head sector is full the next erased sector is opened, round robin, so
+         * that all sectors wear evenly. One erased sector is always kept spare: when it is
+         * the last one left, the oldest sector is compacted into the head (and the spare,
+         * if needed) by copying its live records, then erased. A sector is erased once
+         * per sector_size bytes written, instead of once per write.
+         *
+         * Power loss safety: records carry a CRC-32 and are written header first, so a
+         * torn record is skipped at mount; compaction erases the old sector only after
+         * the copies are complete, and duplicates are resolved by log order.
+         *
+         * Layout: each sector starts with a 16 byte header (magic, generation, ~generation),
+         * then records: key (16 bit), length (15 bit, bit 15 = deleted), CRC-32 of key,
+         * length and value, the value padded to the program unit (at least 4 bytes).
+         *
+         * NOTE: the store is not thread-safe, serialize its users.
+         */
+        template<typename STORAGE, unsigned MAX_KEYS = 64>
+        class KvStore {
+            static_assert(STORAGE::sector_count >= 2, "the store needs at least two sectors, one is spare");
+            static_assert(STORAGE::sector_count <= 255, "too many sectors");
+            static_assert(MAX_KEYS >= 2 && (MAX_KEYS & (MAX_KEYS - 1)) == 0, "the index size must be a power of two");
+
+            //***************************
+            //* Subtypes                *
+            //***************************
+        private:
+            struct SectorHeader {
+                uint32_t magic;
+                uint32_t generation;
+                uint32_t check;
+                uint32_t reserved;
+            };
+
+            struct RecordHeader {
+                uint16_t key;
+                uint16_t length;
+                uint32_t crc;
+            };
+
+            struct Slot {
+                uint16_t key;
+                uint8_t sector;
+                bool deleted;
+                uint32_t offset;
+            };
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr uint16_t invalid_key = 0xFFFF;
+            static constexpr unsigned sector_count = STORAGE::sector_count;
+            static constexpr uint32_t sector_size = STORAGE::sector_size;
+            static constexpr uint32_t align = STORAGE::program_unit < 4 ? 4 : STORAGE::program_unit;
+            static constexpr uint32_t max_value_size =
+                    sector_size - sizeof(SectorHeader) - sizeof(RecordHeader) < 0x7FFF
+                    ? (sector_size - sizeof(SectorHeader) - sizeof(RecordHeader)) & ~(align - 1)
+                    : 0x7FFF;
+
+        private:
+            static constexpr uint32_t magic = 0x3153564B;     // "KVS1"
+            static constexpr uint16_t deleted_flag = 0x8000;
+            static constexpr uint16_t length_mask = 0x7FFF;
+
+            STORAGE& flash;
+
+            Slot slots[MAX_KEYS];
+            uint32_t keys = 0;
+
+            // Generation of each sector, 0 = free
+            uint32_t generation[STORAGE::sector_count];
+            uint32_t last_generation = 0;
+
+            unsigned head = 0;
+            uint32_t head_offset = 0;
+            bool mounted = false;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            explicit KvStore(STORAGE& flash) : flash(flash) {
+                clearIndex();
+                for (unsigned i = 0; i < sector_count; i++)
+                    generation[i] = 0;
+            }
+
+            /**
+             * Rebuilds the index from flash. A flash without any valid sector is
+             * formatted.
+             *
+             * @return false if the stored keys don't fit the index, or on flash errors
+             */
+            bool mount() {
+                mounted = false;
+                clearIndex();
+                last_generation = 0;
+
+                bool any = false;
+                for (unsigned s = 0; s < sector_count; s++) {
+                    SectorHeader header;
+                    memcpy(&header, flash.sectorData(s), sizeof(header));
+
+                    bool valid = header.magic == magic && header.check == ~header.generation && header.generation != 0;
+                    generation[s] = valid ? header.generation : 0;
+
+                    if (valid && header.generation > last_generation)
+                        last_generation = header.generation;
+                    any |= valid;
+                }
+
+                if (!any)
+                    return format();
+
+                // Replay in log order: a record shadows the older ones with the same key
+                for (uint32_t done = 0;;) {
+                    int next = -1;
+                    for (unsigned s = 0; s < sector_count; s++)
+                        if (generation[s] > done && (next < 0 || generation[s] < generation[next]))
+                            next = s;
+
+                    if (next < 0)
+                        break;
+
+                    done = generation[next];
+                    head = next;
+                    if (!scan(next, head_offset))
+                        return false;
+                }
+
+                mounted = true;
+                return true;
+            }
+
+            /**
+             * Erases the store.
+             */
+            bool format() {
+                mounted = false;
+                clearIndex();
+                last_generation = 0;
+
+                for (unsigned s = 0; s < sector_count; s++) {
+                    generation[s] = 0;
+                    if (!isBlank(s) && !flash.erase(s))
+                        return false;
+                }
+
+                mounted = openSector(0);
+                return mounted;
+            }
+
+            /**
+             * Zero copy lookup.
+             *
+             * @param length: set to the value length
+             * @return the value in flash, nullptr if key is not stored
+             */
+            const uint8_t *find(uint16_t key, uint32_t& length) const {
+                int i = lookup(key);
+                if (i < 0 || slots[i].deleted)
+                    return nullptr;
+
+                RecordHeader header;
+                const uint8_t *record = flash.sectorData(slots[i].sector) + slots[i].offset;
+                memcpy(&header, record, sizeof(header));
+
+                length = header.length & length_mask;
+                return record + sizeof(RecordHeader);
+            }
+
+            /**
+             * Copies a value.
+             *
+             * @return the value length (bytes beyond size are not copied), -1 if key is
+             * not stored
+             */
+            int32_t read(uint16_t key, void *buffer, uint32_t size) const {
+                uint32_t length;
+                const uint8_t *value = find(key, length);
+                if (!value)
+                    return -1;
+
+                memcpy(buffer, value, length < size ? length : size);
+                return (int32_t) length;
+            }
+
+            bool contains(uint16_t key) const {
+                int i = lookup(key);
+                return i >= 0 && !slots[i].deleted;
+            }
+
+            /**
+             * Stores a value. Writing the value already stored costs nothing.
+             *
+             * @return false if key is invalid, the value too long, the index or the store
+             * full, or on flash errors
+             */
+            bool write(uint16_t key, const void *data, uint32_t length) {
+                if (!mounted || key == invalid_key || length > max_value_size)
+                    return false;
+
+                int i = lookup(key);
+                if (i >= 0 && !slots[i].deleted) {
+                    uint32_t old_length = 0;
+                    const uint8_t *old = find(key, old_length);
+                    if (old_length == length && memcmp(old, data, length) == 0)
+                        return true;
+                }
+
+                if (i < 0 && keys >= MAX_KEYS - 1)
+                    return false;
+
+                return append(key, (uint16_t) length, (const uint8_t *) data, length);
+            }
+
+            /**
+             * Deletes a key (appends a deletion record).
+             */
+            bool remove(uint16_t key) {
+                if (!mounted)
+                    return false;
+
+                int i = lookup(key);
+                if (i < 0 || slots[i].deleted)
+                    return true;
+
+                return append(key, deleted_flag, nullptr, 0);
+            }
+
+            /**
+             * Compacts every sector, so that only live records are left. It is done
+             * automatically when needed; calling it at idle times moves the cost away
+             * from write().
+             */
+            bool compact() {
+                unsigned used = 0;
+                for (unsigned s = 0; s < sector_count; s++)
+                    used += generation[s] != 0;
+
+                for (unsigned i = 0; i < used; i++)
+                    if (!collect())
+                        return false;
+                return true;
+            }
+
+            /**
+             * @return the number of stored keys
+             */
+            uint32_t size() const {
+                uint32_t count = 0;
+                for (unsigned i = 0; i < MAX_KEYS; i++)
+                    count += slots[i].key != invalid_key && !slots[i].deleted;
+                return count;
+            }
+
+            /**
+             * @return the bytes that can be appended before the next compaction
+             */
+            uint32_t freeBytes() const {
+                unsigned free = freeSectors();
+                return sector_size - head_offset + (free > 1 ? (free - 1) * (sector_size - sizeof(SectorHeader)) : 0);
+            }
+
+        private:
+            static uint32_t padded(uint32_t bytes) {
+                return (bytes + align - 1) & ~(align - 1);
+            }
+
+            static uint32_t recordSize(uint32_t length) {
+                return sizeof(RecordHeader) + padded(length);
+            }
+
+            static uint32_t checksum(uint16_t key, uint16_t length, const uint8_t *data, uint32_t bytes) {
+                const uint8_t prefix[4] = {(uint8_t) key, (uint8_t) (key >> 8), (uint8_t) length, (uint8_t) (length >> 8)};
+
+                uint32_t crc = Crc::Software::update(Crc::Mode::ZLIB, Crc::initial_value, prefix, 4);
+                crc = Crc::Software::update(Crc::Mode::ZLIB, crc, data, bytes);
+                return Crc::Software::finalize(Crc::Mode::ZLIB, crc);
+            }
+
+            //***************************
+            //* Sectors                 *
+            //***************************
+
+            bool isBlank(unsigned sector) const {
+                const uint8_t *data = flash.sectorData(sector);
+                for (uint32_t i = 0; i < sector_size; i++)
+                    if (data[i] != 0xFF)
+                        return false;
+                return true;
+            }
+
+            unsigned freeSectors() const {
+                unsigned free = 0;
+                for (unsigned s = 0; s < sector_count; s++)
+                    free += generation[s] == 0;
+                return free;
+            }
+
+            // First free sector after the head, round robin
+            int nextFree() const {
+                for (unsigned i = 1; i <= sector_count; i++) {
+                    unsigned s = (head + i) % sector_count;
+                    if (generation[s] == 0)
+                        return s;
+                }
+                return -1;
+            }
+
+            int oldest() const {
+                int sector = -1;
+                for (unsigned s = 0; s < sector_count; s++)
+                    if (generation[s] && (sector < 0 || generation[s] < generation[sector]))
+                        sector = s;
+                return sector;
+            }
+
+            // Makes a free sector the head. A half erased sector (power loss) is erased again.
+            bool openSector(int sector) {
+                if (sector < 0 || (!isBlank(sector) && !flash.erase(sector)))
+                    return false;
+
+                SectorHeader header = {magic, ++last_generation, ~last_generation, 0xFFFFFFFF};
+                generation[sector] = last_generation;
+                head = sector;
+                head_offset = sizeof(SectorHeader);
+
+                return flash.program(sector, 0, &header, sizeof(header));
+            }
+
+            // Replays the records of a sector into the index, end is where the log stops
+            bool scan(unsigned sector, uint32_t& end) {
+                const uint8_t *data = flash.sectorData(sector);
+                uint32_t offset = sizeof(SectorHeader);
+
+                while (offset + sizeof(RecordHeader) <= sector_size) {
+                    RecordHeader header;
+                    memcpy(&header, data + offset, sizeof(header));
+
+                    if (header.key == invalid_key && header.length == 0xFFFF && header.crc == 0xFFFFFFFF)
+                        break;
+
+                    uint32_t length = header.length & length_mask;
+                    if (length > max_value_size || offset + recordSize(length) > sector_size) {
+                        // Torn header: nothing after it can be trusted, the sector is closed
+                        offset = sector_size;
+                        break;
+                    }
+
+                    if (header.key != invalid_key &&
+                        header.crc == checksum(header.key, header.length, data + offset + sizeof(RecordHeader), length)) {
+                        bool deleted = header.length & deleted_flag;
+
+                        // A deletion matters only if it hides an older record
+                        if ((!deleted || lookup(header.key) >= 0) && !set(header.key, sector, offset, deleted))
+                            return false;
+                    }
+
+                    offset += recordSize(length);
+                }
+
+                end = offset;
+                return true;
+            }
+
+            // Programs bytes at offset of the head, the last partial unit padded with 0xFF
+            bool programData(uint32_t offset, const uint8_t *data, uint32_t bytes) {
+                uint32_t unit = STORAGE::program_unit;
+                uint32_t whole = bytes - bytes % unit;
+
+                if (whole && !flash.program(head, offset, data, whole))
+                    return false;
+
+                if (whole < bytes) {
+                    uint8_t last[8];
+                    memset(last, 0xFF, sizeof(last));
+                    memcpy(last, data + whole, bytes - whole);
+                    return flash.program(head, offset + whole, last, unit);
+                }
+
+                return true;
+            }
+
+            // Makes room for size bytes in the head, compacting if the spare would be used
+            bool reserve(uint32_t size) {
+                for (unsigned attempt = 0; head_offset + size > sector_size; attempt++) {
+                    if (attempt > 2 * sector_count)
+                        return false;
+
+                    if (freeSectors() > 1) {
+                        if (!openSector(nextFree()))
+                            return false;
+                    } else if (!collect())
+                        return false;
+                }
+
+                return true;
+            }
+
+            bool append(uint16_t key, uint16_t length_field, const uint8_t *data, uint32_t length) {
+                uint32_t size = recordSize(length);
+                if (!reserve(size))
+                    return false;
+
+                RecordHeader header = {key, length_field, checksum(key, length_field, data, length)};
+                uint32_t offset = head_offset;
+
+                // Advanced even on failure: the space may be dirty
+                head_offset += size;
+
+                if (!flash.program(head, offset, &header, sizeof(header)) ||
+                    !programData(offset + sizeof(RecordHeader), data, length))
+                    return false;
+
+                return set(key, head, offset, length_field & deleted_flag);
+            }
+
+            // Copies the live records of the oldest sector to the head, then erases it
+            bool collect() {
+                int victim = oldest();
+                if (victim < 0)
+                    return false;
+
+                if ((unsigned) victim == head && !openSector(nextFree()))
+                    return false;
+
+                const uint8_t *data = flash.sectorData(victim);
+
+                for (unsigned i = 0; i < MAX_KEYS;) {
+                    Slot& slot = slots[i];
+
+                    if (slot.key == invalid_key || slot.sector != victim) {
+                        i++;
+                        continue;
+                    }
+
+                    // Nothing older than the oldest sector: deletion records can go
+                    if (slot.deleted) {
+                        removeSlot(i);
+                        continue;
+                    }
+
+                    RecordHeader header;
+                    memcpy(&header, data + slot.offset, sizeof(header));
+                    uint32_t length = header.length & length_mask;
+                    uint32_t size = recordSize(length);
+
+                    if (head_offset + size > sector_size && !openSector(nextFree()))
+                        return false;
+
+                    uint32_t offset = head_offset;
+                    head_offset += size;
+
+                    if (!flash.program(head, offset, &header, sizeof(header)) ||
+                        !programData(offset + sizeof(RecordHeader), data + slot.offset + sizeof(RecordHeader), length))
+                        return false;
+
+                    slot.sector = head;
+                    slot.offset = offset;
+                    i++;
+                }
+
+                // Freed even if the erase fails: openSector() erases it again
+                generation[victim] = 0;
+                flash.erase(victim);
+                return true;
+            }
+
+            //***************************
+            //* Index                   *
+            //***************************
+
+            static unsigned home(uint16_t key) {
+                return ((key * 2654435761u) >> 16) & (MAX_KEYS - 1);
+            }
+
+            void clearIndex() {
+                for (unsigned i = 0; i < MAX_KEYS; i++)
+                    slots[i].key = invalid_key;
+                keys = 0;
+            }
+
+            // At least one slot is always empty, so probing ends
+            int lookup(uint16_t key) const {
+                for (unsigned i = home(key);; i = (i + 1) & (MAX_KEYS - 1)) {
+                    if (slots[i].key == key)
+                        return i;
+                    if (slots[i].key == invalid_key)
+                        return -1;
+                }
+            }
+
+            bool set(uint16_t key, unsigned sector, uint32_t offset, bool deleted) {
+                int i = lookup(key);
+
+                if (i < 0) {
+                    if (keys >= MAX_KEYS - 1)
+                        return false;
+
+                    for (i = home(key); slots[i].key != invalid_key; i = (i + 1) & (MAX_KEYS - 1));
+                    slots[i].key = key;
+                    keys++;
+                }
+
+                slots[i].sector = sector;
+                slots[i].offset = offset;
+                slots[i].deleted = deleted;
+                return true;
+            }
+
+            // Linear probing deletion: later entries of the cluster are shifted back
+            void removeSlot(unsigned i) {
+                for (unsigned j = i;;) {
+                    j = (j + 1) & (MAX_KEYS - 1);
+                    if (slots[j].key == invalid_key)
+                        break;
+
+                    unsigned k = home(slots[j].key);
+                    bool movable = j > i ? (k <= i || k > j) : (k <= i && k > j);
+                    if (movable) {
+                        slots[i] = slots[j];
+                        i = j;
+                    }
+                }
+
+                slots[i].key = invalid_key;
+                keys--;
+            }
+        };
+    }
+}
+
+#endif //KV_STORE_HPP
@@ -0,0 +1,107 @@
+#ifndef RAM_FLASH_HPP
+#define RAM_FLASH_HPP
+
+#include <cstdint>
+#include <cstring>
+
+namespace HAL {
+    namespace Flash {
+
+        /**
+         * RamFlash (type)
+         *
+         * RAM model of COUNT flash sectors of SECTOR_SIZE bytes, with the storage
+         * interface of SectorRegion, to run flash based code (e.g. KvStore) on a host or
+         * out of RAM. It behaves like NOR flash: erasing sets every byte to 0xFF,
+         * programming can only clear bits, offsets and lengths must be multiples of
+         * UNIT.
+         *
+         * Erases are counted per sector, to check wear levelling, and a power cut can be
+         * simulated: after cutPowerAfter(n) the n-th programmed byte is the last one
+         * written, and every operation fails from then on (an erase in progress leaves
+         * its sector half erased), until restorePower().
+         */
+        template<uint32_t SECTOR_SIZE, unsigned COUNT, uint32_t UNIT = 4>
+        class RamFlash {
+            static_assert(UNIT == 1 || UNIT == 2 || UNIT == 4 || UNIT == 8, "the program unit is 1, 2, 4 or 8 bytes");
+            static_assert(SECTOR_SIZE % UNIT == 0, "the sector size must be a multiple of the program unit");
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr unsigned sector_count = COUNT;
+            static constexpr uint32_t sector_size = SECTOR_SIZE;
+            static constexpr uint32_t program_unit = UNIT;
+
+        private:
+            uint8_t memory[COUNT][SECTOR_SIZE];
+            uint32_t erases[COUNT];
+
+            // Bytes that can still be written before the simulated power cut, -1 = no cut
+            int32_t budget = -1;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            RamFlash() {
+                memset(memory, 0xFF, sizeof(memory));
+                memset(erases, 0, sizeof(erases));
+            }
+
+            const uint8_t *sectorData(unsigned sector) const {
+                return memory[sector];
+            }
+
+            bool erase(unsigned sector) {
+                if (sector >= COUNT || budget == 0)
+                    return false;
+
+                if (budget > 0 && (uint32_t) budget < SECTOR_SIZE) {
+                    memset(memory[sector], 0xFF, SECTOR_SIZE / 2);
+                    budget = 0;
+                    return false;
+                }
+
+                memset(memory[sector], 0xFF, SECTOR_SIZE);
+                erases[sector]++;
+                if (budget > 0)
+                    budget -= SECTOR_SIZE;
+                return true;
+            }
+
+            bool program(unsigned sector, uint32_t offset, const void *data, uint32_t bytes) {
+                const uint8_t *src = (const uint8_t *) data;
+
+                if (sector >= COUNT || ((offset | bytes) % UNIT) || offset + bytes > SECTOR_SIZE)
+                    return false;
+
+                for (uint32_t i = 0; i < bytes; i++) {
+                    if (budget == 0)
+                        return false;
+
+                    memory[sector][offset + i] &= src[i];
+                    if (budget > 0)
+                        budget--;
+                }
+
+                return true;
+            }
+
+            uint32_t eraseCount(unsigned sector) const {
+                return erases[sector];
+            }
+
+            void cutPowerAfter(uint32_t bytes) {
+                budget = (int32_t) bytes;
+            }
+
+            void restorePower() {
+                budget = -1;
+            }
+        };
+    }
+}
+
+#endif //RAM_FLASH_HPP
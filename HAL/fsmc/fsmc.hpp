@@ -0,0 +1,323 @@
+#ifndef FSMC_HPP
+#define FSMC_HPP
+
+#include "../peripheral.hpp"
+#include "../dma/dma_stream.hpp"
+
+namespace HAL {
+    namespace Fsmc {
+        typedef FSMC_Bank1_TypeDef raw_norsram_t;
+        typedef FSMC_Bank1E_TypeDef raw_extended_t;
+
+        enum class MemoryType : uint32_t {
+            SRAM = 0,
+            PSRAM = FSMC_BCR1_MTYP_0,
+            NOR = FSMC_BCR1_MTYP_1 | FSMC_BCR1_FACCEN
+        };
+
+        enum class Width : uint32_t {
+            BITS_8 = 0,
+            BITS_16 = FSMC_BCR1_MWID_0
+        };
+
+        /**
+         * Extended access modes (FSMC_BTR ACCMOD), used when read and write timings differ.
+         * A: SRAM/PSRAM with NOE toggling, B: NOR, C: NOR with NOE toggling, D: address
+         * hold phase, also for non multiplexed devices.
+         */
+        enum class AccessMode : uint32_t {
+            A = 0,
+            B = FSMC_BTR1_ACCMOD_0,
+            C = FSMC_BTR1_ACCMOD_1,
+            D = FSMC_BTR1_ACCMOD
+        };
+
+        /**
+         * Options for NorSramBank::configure(), to be OR-ed together. Values are the
+         * corresponding FSMC_BCR bits.
+         */
+        enum Option : uint32_t {
+            MULTIPLEXED = FSMC_BCR1_MUXEN,
+            WAIT_SIGNAL = FSMC_BCR1_WAITEN,
+            WAIT_POLARITY_HIGH = FSMC_BCR1_WAITPOL,
+            ASYNCHRONOUS_WAIT = FSMC_BCR1_ASYNCWAIT
+        };
+
+        //***************************
+        //* Timing solver           *
+        //***************************
+
+        /**
+         * Asynchronous timing of a device, in ns, from its datasheet (0 if not specified).
+         *
+         * address_setup_ns:  address valid to NOE/NWE active (tAS)
+         * address_hold_ns:   address hold after NADV, multiplexed devices only
+         * access_ns:         address valid to data valid on read (tAA, tACC)
+         * write_pulse_ns:    NWE active width (tWP); for 8080 LCDs, the WR low time
+         * cycle_ns:          minimum read/write cycle (tRC, tWC)
+         * turnaround_ns:     bus release / recovery between accesses (tHZ, tCHZ)
+         */
+        struct DeviceTiming {
+            uint32_t address_setup_ns;
+            uint32_t address_hold_ns;
+            uint32_t access_ns;
+            uint32_t write_pulse_ns;
+            uint32_t cycle_ns;
+            uint32_t turnaround_ns;
+        };
+
+        /**
+         * FSMC timing, in HCLK cycles, as computed by solve(). feasible is false if the
+         * device is too slow for the register ranges at that HCLK.
+         */
+        struct Timing {
+            uint32_t address_setup;
+            uint32_t address_hold;
+            uint32_t data_setup;
+            uint32_t bus_turnaround;
+            bool feasible;
+
+            /**
+             * @return the FSMC_BTR/FSMC_BWTR value
+             */
+            constexpr uint32_t value(AccessMode mode = AccessMode::A) const {
+                return address_setup | (address_hold << 4) | (data_setup << 8) | (bus_turnaround << 16) |
+                       static_cast<uint32_t>(mode);
+            }
+        };
+
+        namespace detail {
+            // FSMC data input setup time plus a margin for the board traces
+            constexpr uint32_t input_setup_ns = 5;
+
+            constexpr uint32_t cycles(uint32_t ns, uint32_t hclk) {
+                return (uint32_t) (((uint64_t) ns * hclk + 999999999ull) / 1000000000ull);
+            }
+
+            constexpr uint32_t maxOf(uint32_t a, uint32_t b) {
+                return a > b ? a : b;
+            }
+
+            constexpr uint32_t minOf(uint32_t a, uint32_t b) {
+                return a < b ? a : b;
+            }
+
+            constexpr uint32_t minus(uint32_t a, uint32_t b) {
+                return a > b ? a - b : 0;
+            }
+
+            // Data phase: covers the write pulse, the read access after the address phase
+            // and, with the address phase, the whole cycle ((ADDSET + 1) + (DATAST + 1))
+            constexpr uint32_t dataSetup(const DeviceTiming& device, uint32_t hclk, uint32_t address_setup) {
+                return maxOf(1, maxOf(cycles(device.write_pulse_ns, hclk),
+                                      maxOf(minus(cycles(device.access_ns + input_setup_ns, hclk), address_setup),
+                                            minus(cycles(device.cycle_ns, hclk), address_setup + 2))));
+            }
+
+            constexpr Timing makeTiming(const DeviceTiming& device, uint32_t hclk, uint32_t address_setup,
+                                        uint32_t data_setup, uint32_t bus_turnaround) {
+                return Timing{
+                        minOf(address_setup, 15),
+                        minOf(maxOf(1, cycles(device.address_hold_ns, hclk)), 15),
+                        minOf(data_setup, 255),
+                        minOf(bus_turnaround, 15),
+                        address_setup <= 15 && data_setup <= 255 && bus_turnaround <= 15 &&
+                        cycles(device.address_hold_ns, hclk) <= 15
+                };
+            }
+        }
+
+        /**
+         * Computes the shortest FSMC timing that meets the device timing at HCLK = hclk
+         * (ST AN2784 method). It is constexpr, so a static_assert can check feasibility.
+         *
+         * Example:
+         *     constexpr Fsmc::DeviceTiming is61wv = {0, 0, 10, 8, 10, 4};
+         *     constexpr Fsmc::Timing timing = Fsmc::solve(is61wv, 168000000);
+         *     static_assert(timing.feasible, "...");
+         */
+        constexpr Timing solve(const DeviceTiming& device, uint32_t hclk) {
+            return detail::makeTiming(device, hclk, detail::cycles(device.address_setup_ns, hclk),
+                                      detail::dataSetup(device, hclk, detail::cycles(device.address_setup_ns, hclk)),
+                                      detail::cycles(device.turnaround_ns, hclk));
+        }
+
+        /**
+         * @return the duration of a read or write access with timing, in HCLK cycles
+         */
+        constexpr uint32_t accessCycles(const Timing& timing) {
+            return timing.address_setup + 1 + timing.data_setup + 1 + timing.bus_turnaround;
+        }
+
+        /**
+         * NorSramBank (type)
+         *
+         * One of the four NOR/PSRAM/SRAM sub-banks of FSMC bank 1, selected by chip select
+         * NE1..NE4 (BANK = 1..4) and mapped at 0x60000000 + (BANK - 1) * 64 MB.
+         *
+         * Once configured, the device is plain memory: the core and both DMA controllers
+         * (memory port, and DMA2 peripheral port too) access it through pointers, so DMA
+         * buffers, memcpy and the linker can all use it. Accesses wider than the bus are
+         * split by the FSMC; byte writes to 16 bit devices need the NBL0/NBL1 lanes.
+         *
+         * The pins are configured apart, e.g.
+         *     Gpio::AfPin<Peripheral::p_FSMC, Gpio::Af::Signal::D0, Gpio::PD<14>>
+         */
+        template<unsigned BANK>
+        class NorSramBank {
+            static_assert(BANK >= 1 && BANK <= 4, "FSMC bank 1 has sub-banks 1 to 4 (NE1..NE4)");
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_norsram_t* const periph_base = (raw_norsram_t*) FSMC_Bank1_R_BASE;
+            static constexpr raw_extended_t* const extended_base = (raw_extended_t*) FSMC_Bank1E_R_BASE;
+
+            static constexpr __pointer base = 0x60000000 + (BANK - 1) * 0x04000000;
+            static constexpr uint32_t size = 0x04000000;
+
+        private:
+            static constexpr unsigned index = 2 * (BANK - 1);
+
+            // Reserved bit 7 must be kept at its reset value
+            static constexpr uint32_t reserved = 0x80;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            /**
+             * Configures the bank with the same read and write timing (mode 1 for SRAM and
+             * PSRAM, mode 2 for NOR) and enables it.
+             */
+            static void configure(MemoryType type, Width width, const Timing& timing, uint32_t options = 0) {
+                Peripheral::p_FSMC::enable();
+
+                periph_base->BTCR[index] = reserved;
+                periph_base->BTCR[index + 1] = timing.value();
+                periph_base->BTCR[index] = reserved | static_cast<uint32_t>(type) | static_cast<uint32_t>(width) |
+                                     FSMC_BCR1_WREN | options | FSMC_BCR1_MBKEN;
+            }
+
+            /**
+             * Configures the bank with separate read and write timing (extended mode)
+             * and enables it.
+             */
+            static void configure(MemoryType type, Width width, const Timing& read, const Timing& write,
+                                  AccessMode mode, uint32_t options = 0) {
+                Peripheral::p_FSMC::enable();
+
+                periph_base->BTCR[index] = reserved;
+                periph_base->BTCR[index + 1] = read.value(mode);
+                extended_base->BWTR[index] = write.value(mode);
+                periph_base->BTCR[index] = reserved | static_cast<uint32_t>(type) | static_cast<uint32_t>(width) |
+                                     FSMC_BCR1_WREN | FSMC_BCR1_EXTMOD | options | FSMC_BCR1_MBKEN;
+            }
+
+            static void disable() {
+                periph_base->BTCR[index] &= ~FSMC_BCR1_MBKEN;
+            }
+
+            static bool is_enabled() {
+                return (periph_base->BTCR[index] & FSMC_BCR1_MBKEN) != 0;
+            }
+
+            /**
+             * @return a pointer to the device memory at offset
+             */
+            template<typename T>
+            static T *memory(uint32_t offset = 0) {
+                return (T *) (base + offset);
+            }
+        };
+
+        /**
+         * Lcd8080 (type)
+         *
+         * Parallel LCD controller on an Intel 8080 16 bit bus (ILI9341, SSD1963, ...),
+         * wired as an SRAM: chip select on NE<BANK>, RD on NOE, WR on NWE, and the
+         * command/data (RS, D/C) line on address line A<RS_LINE>. Commands are written at
+         * the bank base, data at the address where A<RS_LINE> is high (HADDR bit
+         * RS_LINE + 1 on a 16 bit bus).
+         *
+         * Reads are much slower than writes on these controllers, so the bank runs in
+         * extended mode A with separate timings. Pixels can be streamed by the DMA:
+         * startDma() copies a buffer to the data register, at full bus speed, while the
+         * core is free.
+         */
+        template<unsigned BANK, unsigned RS_LINE>
+        class Lcd8080 {
+            // On a 16 bit bus A<n> carries HADDR bit n + 1: A25 would need bit 26, past the 64 MB bank
+            static_assert(RS_LINE <= 24, "on a 16 bit bus the FSMC drives address lines A0..A24");
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            typedef NorSramBank<BANK> bank;
+
+            static constexpr __pointer command_address = bank::base;
+            static constexpr __pointer data_address = bank::base + (2u << RS_LINE);
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            static void configure(const Timing& read, const Timing& write) {
+                bank::configure(MemoryType::SRAM, Width::BITS_16, read, write, AccessMode::A);
+            }
+
+            static volatile uint16_t *commandRegister() {
+                return (volatile uint16_t *) command_address;
+            }
+
+            static volatile uint16_t *dataRegister() {
+                return (volatile uint16_t *) data_address;
+            }
+
+            static void command(uint16_t command) {
+                *commandRegister() = command;
+            }
+
+            static void data(uint16_t data) {
+                *dataRegister() = data;
+            }
+
+            static uint16_t read() {
+                return *dataRegister();
+            }
+
+            static void write(const uint16_t *pixels, uint32_t count) {
+                volatile uint16_t *reg = dataRegister();
+                for (uint32_t i = 0; i < count; i++)
+                    *reg = pixels[i];
+            }
+
+            static void fill(uint16_t color, uint32_t count) {
+                volatile uint16_t *reg = dataRegister();
+                for (uint32_t i = 0; i < count; i++)
+                    *reg = color;
+            }
+
+            /**
+             * Starts a DMA2 memory-to-memory copy of count pixels to the data register:
+             * the source is on the peripheral port (incremented), the data register on the
+             * memory port (fixed). Wait for the stream to stop before the next transfer.
+             *
+             * @param count: pixels, up to 65535
+             */
+            template<typename S>
+            static void startDma(Dma::DmaStream<S>& dma, const uint16_t *pixels, uint16_t count) {
+                static_assert(Dma::DmaStream<S>::is_dma2, "memory-to-memory transfers are supported by DMA2 only");
+
+                dma.configure(0, Dma::Direction::MEMORY_TO_MEMORY, Dma::Size::HALF_WORD, Dma::Size::HALF_WORD,
+                              Dma::Priority::HIGH, Dma::PERIPHERAL_INCREMENT);
+                dma.enableFifo();
+                dma.start(pixels, dataRegister(), count);
+            }
+        };
+    }
+}
+
+#endif //FSMC_HPP
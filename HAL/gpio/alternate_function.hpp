@@ -0,0 +1,489 @@
+#ifndef ALTERNATE_FUNCTION_HPP
+#define ALTERNATE_FUNCTION_HPP
+
+#include "gpio.hpp"
+
+namespace HAL {
+    namespace Gpio {
+        namespace Af {
+
+            /**
+             * Peripheral signals that can be routed to a pin. The same name is shared by
+             * peripherals of the same kind (e.g. TX is USART TX and CAN TX): the pair
+             * (peripheral, signal) is what identifies the function.
+             */
+            enum class Signal : uint8_t {
+                // Timers
+                CH1, CH2, CH3, CH4, CH1N, CH2N, CH3N, ETR, BKIN,
+                // I2C
+                SCL, SDA, SMBA,
+                // SPI / I2S
+                NSS, SCK, MISO, MOSI, MCK, EXT_SD,
+                // USART / UART / CAN
+                TX, RX, CK, CTS, RTS,
+                // Ethernet (MII / RMII), REF_CLK is also MII_RX_CLK and CRS_DV is also MII_RX_DV
+                MDC, MDIO, REF_CLK, CRS_DV, RXD0, RXD1, RXD2, RXD3, RX_ER,
+                TX_EN, TXD0, TXD1, TXD2, TXD3, TX_CLK, CRS, COL, PPS_OUT,
+                // FSMC / SDIO data and address lines
+                D0, D1, D2, D3, D4, D5, D6, D7, D8, D9, D10, D11, D12, D13, D14, D15,
+                A0, A1, A2, A3, A4, A5, A6, A7, A8, A9, A10, A11, A12,
+                A13, A14, A15, A16, A17, A18, A19, A20, A21, A22, A23, A24, A25,
+                // FSMC control lines
+                NOE, NWE, NWAIT, NE1, NE2, NE3, NE4, NL, NBL0, NBL1, CLK,
+                // SDIO
+                CMD,
+                // System (keyed by RCC)
+                MCO1, MCO2
+            };
+
+            enum : uint8_t {
+                PORT_A = 0, PORT_B, PORT_C, PORT_D, PORT_E, PORT_F, PORT_G, PORT_H, PORT_I
+            };
+
+            struct Entry {
+                __pointer periph;
+                Signal signal;
+                uint8_t port;
+                uint8_t pin;
+                uint8_t af;
+            };
+
+            /**
+             * Alternate function mapping of the STM32F405xx/07xx/15xx/17xx, from the
+             * "Alternate function mapping" table of the datasheet. Peripherals are
+             * identified by their base address, pins by port index and number.
+             */
+            constexpr Entry table[] = {
+                // Timers
+                {TIM1_BASE, Signal::CH1, PORT_A, 8, 1},
+                {TIM1_BASE, Signal::CH1, PORT_E, 9, 1},
+                {TIM1_BASE, Signal::CH2, PORT_A, 9, 1},
+                {TIM1_BASE, Signal::CH2, PORT_E, 11, 1},
+                {TIM1_BASE, Signal::CH3, PORT_A, 10, 1},
+                {TIM1_BASE, Signal::CH3, PORT_E, 13, 1},
+                {TIM1_BASE, Signal::CH4, PORT_A, 11, 1},
+                {TIM1_BASE, Signal::CH4, PORT_E, 14, 1},
+                {TIM1_BASE, Signal::CH1N, PORT_A, 7, 1},
+                {TIM1_BASE, Signal::CH1N, PORT_B, 13, 1},
+                {TIM1_BASE, Signal::CH1N, PORT_E, 8, 1},
+                {TIM1_BASE, Signal::CH2N, PORT_B, 0, 1},
+                {TIM1_BASE, Signal::CH2N, PORT_B, 14, 1},
+                {TIM1_BASE, Signal::CH2N, PORT_E, 10, 1},
+                {TIM1_BASE, Signal::CH3N, PORT_B, 1, 1},
+                {TIM1_BASE, Signal::CH3N, PORT_B, 15, 1},
+                {TIM1_BASE, Signal::CH3N, PORT_E, 12, 1},
+                {TIM1_BASE, Signal::ETR, PORT_A, 12, 1},
+                {TIM1_BASE, Signal::ETR, PORT_E, 7, 1},
+                {TIM1_BASE, Signal::BKIN, PORT_A, 6, 1},
+                {TIM1_BASE, Signal::BKIN, PORT_B, 12, 1},
+                {TIM1_BASE, Signal::BKIN, PORT_E, 15, 1},
+                {TIM2_BASE, Signal::CH1, PORT_A, 0, 1},
+                {TIM2_BASE, Signal::CH1, PORT_A, 5, 1},
+                {TIM2_BASE, Signal::CH1, PORT_A, 15, 1},
+                {TIM2_BASE, Signal::ETR, PORT_A, 0, 1},
+                {TIM2_BASE, Signal::ETR, PORT_A, 5, 1},
+                {TIM2_BASE, Signal::ETR, PORT_A, 15, 1},
+                {TIM2_BASE, Signal::CH2, PORT_A, 1, 1},
+                {TIM2_BASE, Signal::CH2, PORT_B, 3, 1},
+                {TIM2_BASE, Signal::CH3, PORT_A, 2, 1},
+                {TIM2_BASE, Signal::CH3, PORT_B, 10, 1},
+                {TIM2_BASE, Signal::CH4, PORT_A, 3, 1},
+                {TIM2_BASE, Signal::CH4, PORT_B, 11, 1},
+                {TIM3_BASE, Signal::CH1, PORT_A, 6, 2},
+                {TIM3_BASE, Signal::CH1, PORT_B, 4, 2},
+                {TIM3_BASE, Signal::CH1, PORT_C, 6, 2},
+                {TIM3_BASE, Signal::CH2, PORT_A, 7, 2},
+                {TIM3_BASE, Signal::CH2, PORT_B, 5, 2},
+                {TIM3_BASE, Signal::CH2, PORT_C, 7, 2},
+                {TIM3_BASE, Signal::CH3, PORT_B, 0, 2},
+                {TIM3_BASE, Signal::CH3, PORT_C, 8, 2},
+                {TIM3_BASE, Signal::CH4, PORT_B, 1, 2},
+                {TIM3_BASE, Signal::CH4, PORT_C, 9, 2},
+                {TIM3_BASE, Signal::ETR, PORT_D, 2, 2},
+                {TIM4_BASE, Signal::CH1, PORT_B, 6, 2},
+                {TIM4_BASE, Signal::CH1, PORT_D, 12, 2},
+                {TIM4_BASE, Signal::CH2, PORT_B, 7, 2},
+                {TIM4_BASE, Signal::CH2, PORT_D, 13, 2},
+                {TIM4_BASE, Signal::CH3, PORT_B, 8, 2},
+                {TIM4_BASE, Signal::CH3, PORT_D, 14, 2},
+                {TIM4_BASE, Signal::CH4, PORT_B, 9, 2},
+                {TIM4_BASE, Signal::CH4, PORT_D, 15, 2},
+                {TIM4_BASE, Signal::ETR, PORT_E, 0, 2},
+                {TIM5_BASE, Signal::CH1, PORT_A, 0, 2},
+                {TIM5_BASE, Signal::CH1, PORT_H, 10, 2},
+                {TIM5_BASE, Signal::CH2, PORT_A, 1, 2},
+                {TIM5_BASE, Signal::CH2, PORT_H, 11, 2},
+                {TIM5_BASE, Signal::CH3, PORT_A, 2, 2},
+                {TIM5_BASE, Signal::CH3, PORT_H, 12, 2},
+                {TIM5_BASE, Signal::CH4, PORT_A, 3, 2},
+                {TIM5_BASE, Signal::CH4, PORT_I, 0, 2},
+                {TIM8_BASE, Signal::CH1, PORT_C, 6, 3},
+                {TIM8_BASE, Signal::CH1, PORT_I, 5, 3},
+                {TIM8_BASE, Signal::CH2, PORT_C, 7, 3},
+                {TIM8_BASE, Signal::CH2, PORT_I, 6, 3},
+                {TIM8_BASE, Signal::CH3, PORT_C, 8, 3},
+                {TIM8_BASE, Signal::CH3, PORT_I, 7, 3},
+                {TIM8_BASE, Signal::CH4, PORT_C, 9, 3},
+                {TIM8_BASE, Signal::CH4, PORT_I, 2, 3},
+                {TIM8_BASE, Signal::CH1N, PORT_A, 5, 3},
+                {TIM8_BASE, Signal::CH1N, PORT_A, 7, 3},
+                {TIM8_BASE, Signal::CH1N, PORT_H, 13, 3},
+                {TIM8_BASE, Signal::CH2N, PORT_B, 0, 3},
+                {TIM8_BASE, Signal::CH2N, PORT_B, 14, 3},
+                {TIM8_BASE, Signal::CH2N, PORT_H, 14, 3},
+                {TIM8_BASE, Signal::CH3N, PORT_B, 1, 3},
+                {TIM8_BASE, Signal::CH3N, PORT_B, 15, 3},
+                {TIM8_BASE, Signal::CH3N, PORT_H, 15, 3},
+                {TIM8_BASE, Signal::ETR, PORT_A, 0, 3},
+                {TIM8_BASE, Signal::ETR, PORT_I, 3, 3},
+                {TIM8_BASE, Signal::BKIN, PORT_A, 6, 3},
+                {TIM8_BASE, Signal::BKIN, PORT_I, 4, 3},
+                {TIM9_BASE, Signal::CH1, PORT_A, 2, 3},
+                {TIM9_BASE, Signal::CH1, PORT_E, 5, 3},
+                {TIM9_BASE, Signal::CH2, PORT_A, 3, 3},
+                {TIM9_BASE, Signal::CH2, PORT_E, 6, 3},
+                {TIM10_BASE, Signal::CH1, PORT_B, 8, 3},
+                {TIM10_BASE, Signal::CH1, PORT_F, 6, 3},
+                {TIM11_BASE, Signal::CH1, PORT_B, 9, 3},
+                {TIM11_BASE, Signal::CH1, PORT_F, 7, 3},
+                {TIM12_BASE, Signal::CH1, PORT_B, 14, 9},
+                {TIM12_BASE, Signal::CH1, PORT_H, 6, 9},
+                {TIM12_BASE, Signal::CH2, PORT_B, 15, 9},
+                {TIM12_BASE, Signal::CH2, PORT_H, 9, 9},
+                {TIM13_BASE, Signal::CH1, PORT_A, 6, 9},
+                {TIM13_BASE, Signal::CH1, PORT_F, 8, 9},
+                {TIM14_BASE, Signal::CH1, PORT_A, 7, 9},
+                {TIM14_BASE, Signal::CH1, PORT_F, 9, 9},
+
+                // I2C
+                {I2C1_BASE, Signal::SCL, PORT_B, 6, 4},
+                {I2C1_BASE, Signal::SCL, PORT_B, 8, 4},
+                {I2C1_BASE, Signal::SDA, PORT_B, 7, 4},
+                {I2C1_BASE, Signal::SDA, PORT_B, 9, 4},
+                {I2C1_BASE, Signal::SMBA, PORT_B, 5, 4},
+                {I2C2_BASE, Signal::SCL, PORT_B, 10, 4},
+                {I2C2_BASE, Signal::SCL, PORT_F, 1, 4},
+                {I2C2_BASE, Signal::SCL, PORT_H, 4, 4},
+                {I2C2_BASE, Signal::SDA, PORT_B, 11, 4},
+                {I2C2_BASE, Signal::SDA, PORT_F, 0, 4},
+                {I2C2_BASE, Signal::SDA, PORT_H, 5, 4},
+                {I2C2_BASE, Signal::SMBA, PORT_B, 12, 4},
+                {I2C2_BASE, Signal::SMBA, PORT_F, 2, 4},
+                {I2C2_BASE, Signal::SMBA, PORT_H, 6, 4},
+                {I2C3_BASE, Signal::SCL, PORT_A, 8, 4},
+                {I2C3_BASE, Signal::SCL, PORT_H, 7, 4},
+                {I2C3_BASE, Signal::SDA, PORT_C, 9, 4},
+                {I2C3_BASE, Signal::SDA, PORT_H, 8, 4},
+                {I2C3_BASE, Signal::SMBA, PORT_A, 9, 4},
+                {I2C3_BASE, Signal::SMBA, PORT_H, 9, 4},
+
+                // SPI / I2S
+                {SPI1_BASE, Signal::NSS, PORT_A, 4, 5},
+                {SPI1_BASE, Signal::NSS, PORT_A, 15, 5},
+                {SPI1_BASE, Signal::SCK, PORT_A, 5, 5},
+                {SPI1_BASE, Signal::SCK, PORT_B, 3, 5},
+                {SPI1_BASE, Signal::MISO, PORT_A, 6, 5},
+                {SPI1_BASE, Signal::MISO, PORT_B, 4, 5},
+                {SPI1_BASE, Signal::MOSI, PORT_A, 7, 5},
+                {SPI1_BASE, Signal::MOSI, PORT_B, 5, 5},
+                {SPI2_BASE, Signal::NSS, PORT_B, 9, 5},
+                {SPI2_BASE, Signal::NSS, PORT_B, 12, 5},
+                {SPI2_BASE, Signal::NSS, PORT_I, 0, 5},
+                {SPI2_BASE, Signal::SCK, PORT_B, 10, 5},
+                {SPI2_BASE, Signal::SCK, PORT_B, 13, 5},
+                {SPI2_BASE, Signal::SCK, PORT_I, 1, 5},
+                {SPI2_BASE, Signal::MISO, PORT_B, 14, 5},
+                {SPI2_BASE, Signal::MISO, PORT_C, 2, 5},
+                {SPI2_BASE, Signal::MISO, PORT_I, 2, 5},
+                {SPI2_BASE, Signal::MOSI, PORT_B, 15, 5},
+                {SPI2_BASE, Signal::MOSI, PORT_C, 3, 5},
+                {SPI2_BASE, Signal::MOSI, PORT_I, 3, 5},
+                {SPI2_BASE, Signal::MCK, PORT_C, 6, 5},
+                {I2S2ext_BASE, Signal::EXT_SD, PORT_B, 14, 6},
+                {I2S2ext_BASE, Signal::EXT_SD, PORT_C, 2, 6},
+                {I2S2ext_BASE, Signal::EXT_SD, PORT_I, 2, 6},
+                {SPI3_BASE, Signal::NSS, PORT_A, 4, 6},
+                {SPI3_BASE, Signal::NSS, PORT_A, 15, 6},
+                {SPI3_BASE, Signal::SCK, PORT_B, 3, 6},
+                {SPI3_BASE, Signal::SCK, PORT_C, 10, 6},
+                {SPI3_BASE, Signal::MISO, PORT_B, 4, 6},
+                {SPI3_BASE, Signal::MISO, PORT_C, 11, 6},
+                {SPI3_BASE, Signal::MOSI, PORT_B, 5, 6},
+                {SPI3_BASE, Signal::MOSI, PORT_C, 12, 6},
+                {SPI3_BASE, Signal::MCK, PORT_C, 7, 6},
+                {I2S3ext_BASE, Signal::EXT_SD, PORT_B, 4, 7},
+                {I2S3ext_BASE, Signal::EXT_SD, PORT_C, 11, 5},
+
+                // USART / UART
+                {USART1_BASE, Signal::TX, PORT_A, 9, 7},
+                {USART1_BASE, Signal::TX, PORT_B, 6, 7},
+                {USART1_BASE, Signal::RX, PORT_A, 10, 7},
+                {USART1_BASE, Signal::RX, PORT_B, 7, 7},
+                {USART1_BASE, Signal::CK, PORT_A, 8, 7},
+                {USART1_BASE, Signal::CTS, PORT_A, 11, 7},
+                {USART1_BASE, Signal::RTS, PORT_A, 12, 7},
+                {USART2_BASE, Signal::TX, PORT_A, 2, 7},
+                {USART2_BASE, Signal::TX, PORT_D, 5, 7},
+                {USART2_BASE, Signal::RX, PORT_A, 3, 7},
+                {USART2_BASE, Signal::RX, PORT_D, 6, 7},
+                {USART2_BASE, Signal::CK, PORT_A, 4, 7},
+                {USART2_BASE, Signal::CK, PORT_D, 7, 7},
+                {USART2_BASE, Signal::CTS, PORT_A, 0, 7},
+                {USART2_BASE, Signal::CTS, PORT_D, 3, 7},
+                {USART2_BASE, Signal::RTS, PORT_A, 1, 7},
+                {USART2_BASE, Signal::RTS, PORT_D, 4, 7},
+                {USART3_BASE, Signal::TX, PORT_B, 10, 7},
+                {USART3_BASE, Signal::TX, PORT_C, 10, 7},
+                {USART3_BASE, Signal::TX, PORT_D, 8, 7},
+                {USART3_BASE, Signal::RX, PORT_B, 11, 7},
+                {USART3_BASE, Signal::RX, PORT_C, 11, 7},
+                {USART3_BASE, Signal::RX, PORT_D, 9, 7},
+                {USART3_BASE, Signal::CK, PORT_B, 12, 7},
+                {USART3_BASE, Signal::CK, PORT_C, 12, 7},
+                {USART3_BASE, Signal::CK, PORT_D, 10, 7},
+                {USART3_BASE, Signal::CTS, PORT_B, 13, 7},
+                {USART3_BASE, Signal::CTS, PORT_D, 11, 7},
+                {USART3_BASE, Signal::RTS, PORT_B, 14, 7},
+                {USART3_BASE, Signal::RTS, PORT_D, 12, 7},
+                {UART4_BASE, Signal::TX, PORT_A, 0, 8},
+                {UART4_BASE, Signal::TX, PORT_C, 10, 8},
+                {UART4_BASE, Signal::RX, PORT_A, 1, 8},
+                {UART4_BASE, Signal::RX, PORT_C, 11, 8},
+                {UART5_BASE, Signal::TX, PORT_C, 12, 8},
+                {UART5_BASE, Signal::RX, PORT_D, 2, 8},
+                {USART6_BASE, Signal::TX, PORT_C, 6, 8},
+                {USART6_BASE, Signal::TX, PORT_G, 14, 8},
+                {USART6_BASE, Signal::RX, PORT_C, 7, 8},
+                {USART6_BASE, Signal::RX, PORT_G, 9, 8},
+                {USART6_BASE, Signal::CK, PORT_C, 8, 8},
+                {USART6_BASE, Signal::CK, PORT_G, 7, 8},
+                {USART6_BASE, Signal::CTS, PORT_G, 13, 8},
+                {USART6_BASE, Signal::CTS, PORT_G, 15, 8},
+                {USART6_BASE, Signal::RTS, PORT_G, 8, 8},
+                {USART6_BASE, Signal::RTS, PORT_G, 12, 8},
+
+                // CAN
+                {CAN1_BASE, Signal::RX, PORT_A, 11, 9},
+                {CAN1_BASE, Signal::RX, PORT_B, 8, 9},
+                {CAN1_BASE, Signal::RX, PORT_D, 0, 9},
+                {CAN1_BASE, Signal::RX, PORT_I, 9, 9},
+                {CAN1_BASE, Signal::TX, PORT_A, 12, 9},
+                {CAN1_BASE, Signal::TX, PORT_B, 9, 9},
+                {CAN1_BASE, Signal::TX, PORT_D, 1, 9},
+                {CAN1_BASE, Signal::TX, PORT_H, 13, 9},
+                {CAN2_BASE, Signal::RX, PORT_B, 5, 9},
+                {CAN2_BASE, Signal::RX, PORT_B, 12, 9},
+                {CAN2_BASE, Signal::TX, PORT_B, 6, 9},
+                {CAN2_BASE, Signal::TX, PORT_B, 13, 9},
+
+                // Ethernet
+                {ETH_BASE, Signal::MDC, PORT_C, 1, 11},
+                {ETH_BASE, Signal::MDIO, PORT_A, 2, 11},
+                {ETH_BASE, Signal::REF_CLK, PORT_A, 1, 11},
+                {ETH_BASE, Signal::CRS_DV, PORT_A, 7, 11},
+                {ETH_BASE, Signal::RXD0, PORT_C, 4, 11},
+                {ETH_BASE, Signal::RXD1, PORT_C, 5, 11},
+                {ETH_BASE, Signal::RXD2, PORT_B, 0, 11},
+                {ETH_BASE, Signal::RXD2, PORT_H, 6, 11},
+                {ETH_BASE, Signal::RXD3, PORT_B, 1, 11},
+                {ETH_BASE, Signal::RXD3, PORT_H, 7, 11},
+                {ETH_BASE, Signal::RX_ER, PORT_B, 10, 11},
+                {ETH_BASE, Signal::RX_ER, PORT_I, 10, 11},
+                {ETH_BASE, Signal::TX_EN, PORT_B, 11, 11},
+                {ETH_BASE, Signal::TX_EN, PORT_G, 11, 11},
+                {ETH_BASE, Signal::TXD0, PORT_B, 12, 11},
+                {ETH_BASE, Signal::TXD0, PORT_G, 13, 11},
+                {ETH_BASE, Signal::TXD1, PORT_B, 13, 11},
+                {ETH_BASE, Signal::TXD1, PORT_G, 14, 11},
+                {ETH_BASE, Signal::TXD2, PORT_C, 2, 11},
+                {ETH_BASE, Signal::TXD3, PORT_B, 8, 11},
+                {ETH_BASE, Signal::TXD3, PORT_E, 2, 11},
+                {ETH_BASE, Signal::TX_CLK, PORT_C, 3, 11},
+                {ETH_BASE, Signal::CRS, PORT_A, 0, 11},
+                {ETH_BASE, Signal::CRS, PORT_H, 2, 11},
+                {ETH_BASE, Signal::COL, PORT_A, 3, 11},
+                {ETH_BASE, Signal::COL, PORT_H, 3, 11},
+                {ETH_BASE, Signal::PPS_OUT, PORT_B, 5, 11},
+                {ETH_BASE, Signal::PPS_OUT, PORT_G, 8, 11},
+
+                // FSMC
+                {FSMC_R_BASE, Signal::D0, PORT_D, 14, 12},
+                {FSMC_R_BASE, Signal::D1, PORT_D, 15, 12},
+                {FSMC_R_BASE, Signal::D2, PORT_D, 0, 12},
+                {FSMC_R_BASE, Signal::D3, PORT_D, 1, 12},
+                {FSMC_R_BASE, Signal::D4, PORT_E, 7, 12},
+                {FSMC_R_BASE, Signal::D5, PORT_E, 8, 12},
+                {FSMC_R_BASE, Signal::D6, PORT_E, 9, 12},
+                {FSMC_R_BASE, Signal::D7, PORT_E, 10, 12},
+                {FSMC_R_BASE, Signal::D8, PORT_E, 11, 12},
+                {FSMC_R_BASE, Signal::D9, PORT_E, 12, 12},
+                {FSMC_R_BASE, Signal::D10, PORT_E, 13, 12},
+                {FSMC_R_BASE, Signal::D11, PORT_E, 14, 12},
+                {FSMC_R_BASE, Signal::D12, PORT_E, 15, 12},
+                {FSMC_R_BASE, Signal::D13, PORT_D, 8, 12},
+                {FSMC_R_BASE, Signal::D14, PORT_D, 9, 12},
+                {FSMC_R_BASE, Signal::D15, PORT_D, 10, 12},
+                {FSMC_R_BASE, Signal::A0, PORT_F, 0, 12},
+                {FSMC_R_BASE, Signal::A1, PORT_F, 1, 12},
+                {FSMC_R_BASE, Signal::A2, PORT_F, 2, 12},
+                {FSMC_R_BASE, Signal::A3, PORT_F, 3, 12},
+                {FSMC_R_BASE, Signal::A4, PORT_F, 4, 12},
+                {FSMC_R_BASE, Signal::A5, PORT_F, 5, 12},
+                {FSMC_R_BASE, Signal::A6, PORT_F, 12, 12},
+                {FSMC_R_BASE, Signal::A7, PORT_F, 13, 12},
+                {FSMC_R_BASE, Signal::A8, PORT_F, 14, 12},
+                {FSMC_R_BASE, Signal::A9, PORT_F, 15, 12},
+                {FSMC_R_BASE, Signal::A10, PORT_G, 0, 12},
+                {FSMC_R_BASE, Signal::A11, PORT_G, 1, 12},
+                {FSMC_R_BASE, Signal::A12, PORT_G, 2, 12},
+                {FSMC_R_BASE, Signal::A13, PORT_G, 3, 12},
+                {FSMC_R_BASE, Signal::A14, PORT_G, 4, 12},
+                {FSMC_R_BASE, Signal::A15, PORT_G, 5, 12},
+                {FSMC_R_BASE, Signal::A16, PORT_D, 11, 12},
+                {FSMC_R_BASE, Signal::A17, PORT_D, 12, 12},
+                {FSMC_R_BASE, Signal::A18, PORT_D, 13, 12},
+                {FSMC_R_BASE, Signal::A19, PORT_E, 3, 12},
+                {FSMC_R_BASE, Signal::A20, PORT_E, 4, 12},
+                {FSMC_R_BASE, Signal::A21, PORT_E, 5, 12},
+                {FSMC_R_BASE, Signal::A22, PORT_E, 6, 12},
+                {FSMC_R_BASE, Signal::A23, PORT_E, 2, 12},
+                {FSMC_R_BASE, Signal::A24, PORT_G, 13, 12},
+                {FSMC_R_BASE, Signal::A25, PORT_G, 14, 12},
+                {FSMC_R_BASE, Signal::NOE, PORT_D, 4, 12},
+                {FSMC_R_BASE, Signal::NWE, PORT_D, 5, 12},
+                {FSMC_R_BASE, Signal::NWAIT, PORT_D, 6, 12},
+                {FSMC_R_BASE, Signal::NE1, PORT_D, 7, 12},
+                {FSMC_R_BASE, Signal::NE2, PORT_G, 9, 12},
+                {FSMC_R_BASE, Signal::NE3, PORT_G, 10, 12},
+                {FSMC_R_BASE, Signal::NE4, PORT_G, 12, 12},
+                {FSMC_R_BASE, Signal::NL, PORT_B, 7, 12},
+                {FSMC_R_BASE, Signal::NBL0, PORT_E, 0, 12},
+                {FSMC_R_BASE, Signal::NBL1, PORT_E, 1, 12},
+                {FSMC_R_BASE, Signal::CLK, PORT_D, 3, 12},
+
+                // SDIO
+                {SDIO_BASE, Signal::D0, PORT_C, 8, 12},
+                {SDIO_BASE, Signal::D1, PORT_C, 9, 12},
+                {SDIO_BASE, Signal::D2, PORT_C, 10, 12},
+                {SDIO_BASE, Signal::D3, PORT_C, 11, 12},
+                {SDIO_BASE, Signal::D4, PORT_B, 8, 12},
+                {SDIO_BASE, Signal::D5, PORT_B, 9, 12},
+                {SDIO_BASE, Signal::D6, PORT_C, 6, 12},
+                {SDIO_BASE, Signal::D7, PORT_C, 7, 12},
+                {SDIO_BASE, Signal::CK, PORT_C, 12, 12},
+                {SDIO_BASE, Signal::CMD, PORT_D, 2, 12},
+
+                // System
+                {RCC_BASE, Signal::MCO1, PORT_A, 8, 0},
+                {RCC_BASE, Signal::MCO2, PORT_C, 9, 0}
+            };
+
+            constexpr unsigned table_size = sizeof(table) / sizeof(table[0]);
+
+            //***************************
+            //* Lookup                  *
+            //***************************
+
+            // The table is searched splitting it in halves, so that the constexpr
+            // recursion depth stays logarithmic in the table size
+
+            constexpr int first(int a, int b) {
+                return a >= 0 ? a : b;
+            }
+
+            constexpr bool matches(const Entry& e, __pointer periph, Signal signal, unsigned port, unsigned pin) {
+                return e.periph == periph && e.signal == signal && e.port == port && e.pin == pin;
+            }
+
+            constexpr int find(__pointer periph, Signal signal, unsigned port, unsigned pin,
+                               unsigned lo = 0, unsigned hi = table_size) {
+                return hi - lo == 1
+                       ? (matches(table[lo], periph, signal, port, pin) ? table[lo].af : -1)
+                       : first(find(periph, signal, port, pin, lo, (lo + hi) / 2),
+                               find(periph, signal, port, pin, (lo + hi) / 2, hi));
+            }
+
+            constexpr int findAny(__pointer periph, unsigned port, unsigned pin,
+                                  unsigned lo = 0, unsigned hi = table_size) {
+                return hi - lo == 1
+                       ? (table[lo].periph == periph && table[lo].port == port && table[lo].pin == pin
+                          ? table[lo].af : -1)
+                       : first(findAny(periph, port, pin, lo, (lo + hi) / 2),
+                               findAny(periph, port, pin, (lo + hi) / 2, hi));
+            }
+
+            constexpr int findPeripheral(__pointer periph, unsigned lo = 0, unsigned hi = table_size) {
+                return hi - lo == 1
+                       ? (table[lo].periph == periph ? table[lo].af : -1)
+                       : first(findPeripheral(periph, lo, (lo + hi) / 2),
+                               findPeripheral(periph, (lo + hi) / 2, hi));
+            }
+
+            /**
+             * @return the alternate function number that routes signal of periph to the
+             * given pin, or -1 if the pin can't carry that signal
+             */
+            constexpr int lookup(__pointer periph, Signal signal, unsigned port, unsigned pin) {
+                return find(periph, signal, port, pin);
+            }
+
+            /**
+             * @return the alternate function number that routes any signal of periph to
+             * the given pin, or -1 if the pin isn't connected to periph at all
+             */
+            constexpr int lookup(__pointer periph, unsigned port, unsigned pin) {
+                return findAny(periph, port, pin);
+            }
+
+            /**
+             * @return the alternate function number used by periph on its first mapped pin,
+             * or -1 if periph has no pins. Most peripherals use the same number on all their
+             * pins (notable exceptions are SPI3 and I2S3ext), prefer the per-pin lookup.
+             */
+            constexpr int lookup(__pointer periph) {
+                return findPeripheral(periph);
+            }
+        }
+
+        /**
+         * AlternateFunction (type)
+         *
+         * Compile time lookup of the alternate function number that connects signal S of
+         * peripheral P to PIN. An invalid (peripheral, signal, pin) combination is a
+         * compile error instead of a silently unconnected pin.
+         */
+        template<typename P, Af::Signal S, typename PIN>
+        struct AlternateFunction {
+            static constexpr int found = Af::lookup(P::periph_base, S, PIN::port_index, PIN::number);
+            static_assert(found >= 0, "the requested peripheral signal is not available on this pin");
+
+            static constexpr unsigned value = found >= 0 ? found : 0;
+        };
+
+        /**
+         * AfPin (type)
+         *
+         * PinConfig of a pin in alternate mode connected to signal S of peripheral P.
+         * A driver lists all its AfPin in a single Configuration, so that its whole pin
+         * setup is merged into the minimum number of MODER/OTYPER/OSPEEDR/PUPDR/AFR writes.
+         *
+         * Example:
+         *     Gpio::Configuration<
+         *             Gpio::AfPin<Peripheral::p_USART1, Gpio::Af::Signal::TX, Gpio::PA<9>>,
+         *             Gpio::AfPin<Peripheral::p_USART1, Gpio::Af::Signal::RX, Gpio::PA<10>, Gpio::Speed::HIGH, Gpio::Pull::UP>
+         *     >::apply();
+         */
+        template<
+                typename P,
+                Af::Signal S,
+                typename PIN,
+                Speed SP = Speed::HIGH,
+                Pull PU = Pull::NONE,
+                Type T = Type::PUSH_PULL
+        >
+        struct AfPin : public PinConfig<PIN, Mode::ALTERNATE, SP, PU, T, AlternateFunction<P, S, PIN>::value> {
+        };
+    }
+}
+
+#endif //ALTERNATE_FUNCTION_HPP
@@ -0,0 +1,540 @@
+#ifndef GPIO_HPP
+#define GPIO_HPP
+
+#include "../peripheral.hpp"
+
+namespace HAL {
+    namespace Gpio {
+        typedef GPIO_TypeDef raw_port_t;
+
+        /**
+         * Pin configuration values, encoded as the 2-bit (or 1-bit) fields of the
+         * corresponding port registers (MODER, OSPEEDR, PUPDR, OTYPER).
+         */
+        enum class Mode : uint32_t {
+            INPUT = 0,
+            OUTPUT = 1,
+            ALTERNATE = 2,
+            ANALOG = 3
+        };
+
+        enum class Speed : uint32_t {
+            LOW = 0,
+            MEDIUM = 1,
+            FAST = 2,
+            HIGH = 3
+        };
+
+        enum class Pull : uint32_t {
+            NONE = 0,
+            UP = 1,
+            DOWN = 2
+        };
+
+        enum class Type : uint32_t {
+            PUSH_PULL = 0,
+            OPEN_DRAIN = 1
+        };
+
+        // Offset of the 32 bit BSRR register inside the port. Some CMSIS versions split it in
+        // BSRRL/BSRRH halves, so it is accessed through its address to get a single store.
+        static constexpr __pointer bsrr_offset = 0x18;
+
+        // Distance between two consecutive GPIO ports in the AHB1 address space
+        static constexpr __pointer port_stride = GPIOB_BASE - GPIOA_BASE;
+
+        /**
+         * Pin (type)
+         *
+         * This represents a single GPIO pin, identified at compile time by its port
+         * peripheral (p_GPIOA..p_GPIOI) and its number (0..15).
+         * All the methods are static: a Pin has no state, so using it costs exactly
+         * the register accesses it performs.
+         *
+         * set(), clear(), toggle() and write() use a single store to BSRR, so they are
+         * atomic with respect to any other pin of the same port and don't need locking.
+         * mode(), speed(), pull(), type() and alternateFunction() are read-modify-write
+         * operations on shared registers; to configure several pins at once prefer
+         * Configuration, that merges them into the minimum number of writes.
+         */
+        template<typename P, unsigned N>
+        class Pin {
+            static_assert(N < 16, "GPIO pin number must be between 0 and 15");
+
+            //***************************
+            //* Subtypes                *
+            //***************************
+        public:
+            typedef P peripheral;
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr unsigned number = N;
+            static constexpr uint32_t mask = 1u << N;
+            static constexpr unsigned port_index = (P::periph_base - GPIOA_BASE) / port_stride;
+            static constexpr raw_port_t* const periph_base = (raw_port_t*) P::periph_base;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        private:
+            static volatile uint32_t& bsrr() {
+                return *((volatile uint32_t *) (P::periph_base + bsrr_offset));
+            }
+
+        public:
+            /**
+             * Enables the clock of the pin's port.
+             */
+            static void enable() {
+                P::enable();
+            }
+
+            /**
+             * Drives the pin high (single BSRR store).
+             */
+            static void set() {
+                bsrr() = mask;
+            }
+
+            /**
+             * Drives the pin low (single BSRR store).
+             */
+            static void clear() {
+                bsrr() = mask << 16;
+            }
+
+            /**
+             * Inverts the pin output: ODR is read once and the new level is written
+             * through BSRR, so other pins of the port can't be corrupted.
+             */
+            static void toggle() {
+                uint32_t odr = periph_base->ODR;
+                bsrr() = ((odr & mask) << 16) | (~odr & mask);
+            }
+
+            /**
+             * @param value: level the pin is driven to
+             */
+            static void write(bool value) {
+                bsrr() = value ? mask : (mask << 16);
+            }
+
+            /**
+             * @return the level sampled on the pin (IDR)
+             */
+            static bool read() {
+                return (periph_base->IDR & mask) != 0;
+            }
+
+            /**
+             * @return the level the pin is currently driven to (ODR)
+             */
+            static bool readOutput() {
+                return (periph_base->ODR & mask) != 0;
+            }
+
+            /**
+             * Runtime configuration of a single field of the pin.
+             *
+             * NOTE: these functions are thread-safe ONLY inside miosix environment,
+             *       in other environments you have to ensure it other ways.
+             */
+            static void mode(Mode m) {
+                modify(periph_base->MODER, 3u << (2 * N), static_cast<uint32_t>(m) << (2 * N));
+            }
+
+            static void speed(Speed s) {
+                modify(periph_base->OSPEEDR, 3u << (2 * N), static_cast<uint32_t>(s) << (2 * N));
+            }
+
+            static void pull(Pull p) {
+                modify(periph_base->PUPDR, 3u << (2 * N), static_cast<uint32_t>(p) << (2 * N));
+            }
+
+            static void type(Type t) {
+                modify(periph_base->OTYPER, mask, static_cast<uint32_t>(t) << N);
+            }
+
+            static void alternateFunction(unsigned af) {
+                modify(periph_base->AFR[N / 8], 0xFu << (4 * (N % 8)), (af & 0xF) << (4 * (N % 8)));
+            }
+
+#ifdef _MIOSIX
+            /**
+             * @return the equivalent miosix pin, to interoperate with code using miosix::GpioPin
+             */
+            static miosix::GpioPin getGpioPin() {
+                return miosix::GpioPin(P::periph_base, N);
+            }
+#endif
+
+        private:
+#ifdef _MIOSIX
+            static void modify(volatile uint32_t& reg, uint32_t clear_mask, uint32_t value) {
+                miosix::FastInterruptDisableLock dLock;
+                reg = (reg & ~clear_mask) | value;
+            }
+#else
+            static void modify(volatile uint32_t& reg, uint32_t clear_mask, uint32_t value) {
+                reg = (reg & ~clear_mask) | value;
+            }
+#endif
+        };
+
+        // Shorthands, e.g. Gpio::PA<5> is pin 5 of port A
+        template<unsigned N> using PA = Pin<Peripheral::p_GPIOA, N>;
+        template<unsigned N> using PB = Pin<Peripheral::p_GPIOB, N>;
+        template<unsigned N> using PC = Pin<Peripheral::p_GPIOC, N>;
+        template<unsigned N> using PD = Pin<Peripheral::p_GPIOD, N>;
+        template<unsigned N> using PE = Pin<Peripheral::p_GPIOE, N>;
+        template<unsigned N> using PF = Pin<Peripheral::p_GPIOF, N>;
+        template<unsigned N> using PG = Pin<Peripheral::p_GPIOG, N>;
+        template<unsigned N> using PH = Pin<Peripheral::p_GPIOH, N>;
+        template<unsigned N> using PI = Pin<Peripheral::p_GPIOI, N>;
+
+
+        //****************************************************************
+        //* PIN GROUPS                                                   *
+        //****************************************************************
+
+        namespace detail {
+            template<typename... Pins>
+            struct GroupInfo;
+
+            template<>
+            struct GroupInfo<> {
+                static constexpr uint32_t mask = 0;
+                static constexpr bool contiguous = true;
+
+                static constexpr uint32_t spread(uint32_t, unsigned) {
+                    return 0;
+                }
+
+                static constexpr uint32_t gather(uint32_t, unsigned) {
+                    return 0;
+                }
+            };
+
+            template<typename H, typename... T>
+            struct GroupInfo<H, T...> {
+                typedef GroupInfo<T...> rest;
+
+                static_assert(!(rest::mask & H::mask), "the same pin appears twice in a PinGroup");
+
+                static constexpr uint32_t mask = H::mask | rest::mask;
+
+                // True if the pins are consecutive and in ascending order, so that the
+                // group value can be shifted in place instead of spread bit by bit
+                static constexpr bool contiguous = rest::contiguous &&
+                        (sizeof...(T) == 0 || (H::mask << 1) == (rest::mask & -rest::mask));
+
+                // Maps bit i of value to the pin in position i of the group
+                static constexpr uint32_t spread(uint32_t value, unsigned i) {
+                    return (((value >> i) & 1u) << H::number) | rest::spread(value, i + 1);
+                }
+
+                // Maps the pin in position i of the group to bit i of the result
+                static constexpr uint32_t gather(uint32_t port, unsigned i) {
+                    return (((port >> H::number) & 1u) << i) | rest::gather(port, i + 1);
+                }
+            };
+
+            template<typename H, typename... T>
+            struct SamePort {
+                static constexpr bool value = true;
+            };
+
+            template<typename H, typename N, typename... T>
+            struct SamePort<H, N, T...> {
+                static constexpr bool value = H::port_index == N::port_index && SamePort<N, T...>::value;
+            };
+        }
+
+        /**
+         * PinGroup (type)
+         *
+         * This represents a set of pins of the same port that are driven together, e.g. a
+         * parallel data bus. Any write to the group is a single BSRR store, no matter how many
+         * pins it changes, so it is atomic and glitch-free across the whole group.
+         *
+         * The value written/read by write()/read() has bit i mapped to the i-th pin in the
+         * template argument list. If the pins are consecutive and ascending the mapping is a
+         * plain shift, otherwise it is resolved bit by bit.
+         */
+        template<typename First, typename... Others>
+        class PinGroup {
+            static_assert(detail::SamePort<First, Others...>::value,
+                          "all the pins of a PinGroup must belong to the same port");
+
+            typedef detail::GroupInfo<First, Others...> info;
+
+            //***************************
+            //* Subtypes                *
+            //***************************
+        public:
+            typedef typename First::peripheral peripheral;
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr unsigned size = 1 + sizeof...(Others);
+            static constexpr uint32_t mask = info::mask;
+            static constexpr raw_port_t* const periph_base = (raw_port_t*) peripheral::periph_base;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        private:
+            static volatile uint32_t& bsrr() {
+                return *((volatile uint32_t *) (peripheral::periph_base + bsrr_offset));
+            }
+
+            static uint32_t spread(uint32_t value) {
+                return info::contiguous ? ((value << First::number) & mask) : info::spread(value, 0);
+            }
+
+            static uint32_t gather(uint32_t port) {
+                return info::contiguous ? ((port & mask) >> First::number) : info::gather(port, 0);
+            }
+
+        public:
+            static void enable() {
+                peripheral::enable();
+            }
+
+            /**
+             * Drives all the pins of the group high.
+             */
+            static void set() {
+                bsrr() = mask;
+            }
+
+            /**
+             * Drives all the pins of the group low.
+             */
+            static void clear() {
+                bsrr() = mask << 16;
+            }
+
+            /**
+             * Inverts all the pins of the group.
+             */
+            static void toggle() {
+                uint32_t odr = periph_base->ODR;
+                bsrr() = ((odr & mask) << 16) | (~odr & mask);
+            }
+
+            /**
+             * Drives the whole group to value in a single store.
+             *
+             * @param value: bit i is the level of the i-th pin of the group
+             */
+            static void write(uint32_t value) {
+                uint32_t high = spread(value);
+                bsrr() = high | ((mask & ~high) << 16);
+            }
+
+            /**
+             * @return the levels sampled on the group, bit i is the i-th pin
+             */
+            static uint32_t read() {
+                return gather(periph_base->IDR);
+            }
+
+            /**
+             * Computes the BSRR word that drives the group to value. This can be stored in
+             * tables and written later (e.g. by a DMA) to the port BSRR.
+             */
+            static uint32_t bsrrValue(uint32_t value) {
+                uint32_t high = spread(value);
+                return high | ((mask & ~high) << 16);
+            }
+        };
+
+
+        //****************************************************************
+        //* COMPILE TIME CONFIGURATION                                   *
+        //****************************************************************
+
+        /**
+         * PinConfig (type)
+         *
+         * Compile time description of a pin configuration, to be used with Configuration.
+         *
+         * @param PIN: the pin being configured
+         * @param M: pin mode
+         * @param S: output speed
+         * @param PU: pull-up/pull-down resistor
+         * @param T: output type
+         * @param AF: alternate function number, only meaningful with Mode::ALTERNATE
+         */
+        template<
+                typename PIN,
+                Mode M,
+                Speed S = Speed::LOW,
+                Pull PU = Pull::NONE,
+                Type T = Type::PUSH_PULL,
+                unsigned AF = 0
+        >
+        struct PinConfig {
+            static_assert(AF < 16, "alternate function number must be between 0 and 15");
+
+            typedef PIN pin;
+
+            // Speed and output type only matter for driven pins, alternate function
+            // only for alternate pins: the other fields are left untouched
+            static constexpr bool driven = M == Mode::OUTPUT || M == Mode::ALTERNATE;
+            static constexpr bool alternate = M == Mode::ALTERNATE;
+
+            static constexpr uint32_t field2 = 3u << (2 * PIN::number);
+            static constexpr uint32_t field4 = 0xFu << (4 * (PIN::number % 8));
+
+            static constexpr uint32_t moder = static_cast<uint32_t>(M) << (2 * PIN::number);
+            static constexpr uint32_t ospeedr = static_cast<uint32_t>(S) << (2 * PIN::number);
+            static constexpr uint32_t pupdr = static_cast<uint32_t>(PU) << (2 * PIN::number);
+            static constexpr uint32_t otyper = static_cast<uint32_t>(T) << PIN::number;
+            static constexpr uint32_t afr = AF << (4 * (PIN::number % 8));
+            static constexpr unsigned afr_index = PIN::number / 8;
+        };
+
+        namespace detail {
+            /**
+             * Accumulates the register masks and values of all the configurations
+             * belonging to the port with index Port.
+             */
+            template<unsigned Port, typename... C>
+            struct PortMerge {
+                static constexpr uint32_t pins = 0;
+                static constexpr uint32_t field2 = 0;
+                static constexpr uint32_t moder = 0;
+                static constexpr uint32_t pupdr = 0;
+                static constexpr uint32_t driven_pins = 0;
+                static constexpr uint32_t driven_field2 = 0;
+                static constexpr uint32_t ospeedr = 0;
+                static constexpr uint32_t otyper = 0;
+                static constexpr uint32_t afrl_mask = 0;
+                static constexpr uint32_t afrl = 0;
+                static constexpr uint32_t afrh_mask = 0;
+                static constexpr uint32_t afrh = 0;
+                static constexpr uint32_t clock = 0;
+            };
+
+            template<unsigned Port, typename H, typename... T>
+            struct PortMerge<Port, H, T...> {
+                typedef PortMerge<Port, T...> rest;
+                static constexpr bool here = H::pin::port_index == Port;
+
+                static_assert(!here || !(rest::pins & H::pin::mask), "the same pin is configured twice");
+
+                static constexpr uint32_t pins = (here ? H::pin::mask : 0) | rest::pins;
+                static constexpr uint32_t field2 = (here ? H::field2 : 0) | rest::field2;
+                static constexpr uint32_t moder = (here ? H::moder : 0) | rest::moder;
+                static constexpr uint32_t pupdr = (here ? H::pupdr : 0) | rest::pupdr;
+
+                static constexpr bool driven = here && H::driven;
+                static constexpr uint32_t driven_pins = (driven ? H::pin::mask : 0) | rest::driven_pins;
+                static constexpr uint32_t driven_field2 = (driven ? H::field2 : 0) | rest::driven_field2;
+                static constexpr uint32_t ospeedr = (driven ? H::ospeedr : 0) | rest::ospeedr;
+                static constexpr uint32_t otyper = (driven ? H::otyper : 0) | rest::otyper;
+
+                static constexpr bool low = here && H::alternate && H::afr_index == 0;
+                static constexpr bool high = here && H::alternate && H::afr_index == 1;
+                static constexpr uint32_t afrl_mask = (low ? H::field4 : 0) | rest::afrl_mask;
+                static constexpr uint32_t afrl = (low ? H::afr : 0) | rest::afrl;
+                static constexpr uint32_t afrh_mask = (high ? H::field4 : 0) | rest::afrh_mask;
+                static constexpr uint32_t afrh = (high ? H::afr : 0) | rest::afrh;
+                static constexpr uint32_t clock = (here ? H::pin::peripheral::enable_bit : 0) | rest::clock;
+            };
+
+            template<unsigned Port, typename... C>
+            struct PortWriter {
+                typedef PortMerge<Port, C...> m;
+
+                static void apply() {
+                    if (m::pins == 0)
+                        return;
+
+                    auto port = (raw_port_t *) (GPIOA_BASE + Port * port_stride);
+
+                    // Everything but the mode is written first, so that a pin switching to
+                    // output or alternate mode is already configured when it starts driving
+                    if (m::afrl_mask)
+                        port->AFR[0] = (port->AFR[0] & ~m::afrl_mask) | m::afrl;
+                    if (m::afrh_mask)
+                        port->AFR[1] = (port->AFR[1] & ~m::afrh_mask) | m::afrh;
+                    if (m::driven_pins)
+                        port->OTYPER = (port->OTYPER & ~m::driven_pins) | m::otyper;
+                    if (m::driven_pins)
+                        port->OSPEEDR = (port->OSPEEDR & ~m::driven_field2) | m::ospeedr;
+                    port->PUPDR = (port->PUPDR & ~m::field2) | m::pupdr;
+                    port->MODER = (port->MODER & ~m::field2) | m::moder;
+                }
+            };
+
+            template<typename... C>
+            struct ClockMerge {
+                static constexpr uint32_t value =
+                        PortMerge<0, C...>::clock | PortMerge<1, C...>::clock | PortMerge<2, C...>::clock |
+                        PortMerge<3, C...>::clock | PortMerge<4, C...>::clock | PortMerge<5, C...>::clock |
+                        PortMerge<6, C...>::clock | PortMerge<7, C...>::clock | PortMerge<8, C...>::clock;
+            };
+        }
+
+        /**
+         * Configuration (type)
+         *
+         * Applies a list of PinConfig at once. All the fields belonging to the same port
+         * are merged at compile time, so each port register (MODER, OTYPER, OSPEEDR,
+         * PUPDR, AFR[0], AFR[1]) is written at most once per port, and all the port
+         * clocks are enabled with a single write to RCC->AHB1ENR. Registers that no pin
+         * of the configuration touches aren't accessed at all.
+         *
+         * Example:
+         *     Gpio::Configuration<
+         *             Gpio::PinConfig<Gpio::PD<12>, Gpio::Mode::OUTPUT>,
+         *             Gpio::PinConfig<Gpio::PD<13>, Gpio::Mode::OUTPUT, Gpio::Speed::HIGH>
+         *     >::apply();
+         *
+         * NOTE: this function is thread-safe ONLY inside miosix environment,
+         *       in other environments you have to ensure it other ways.
+         */
+        template<typename... C>
+        struct Configuration {
+            static constexpr uint32_t clock = detail::ClockMerge<C...>::value;
+
+#ifdef _MIOSIX
+            static void apply() {
+                miosix::FastInterruptDisableLock dLock;
+
+                RCC->AHB1ENR |= clock;
+                RCC_SYNC();
+                write();
+            }
+#else
+            static void apply() {
+                RCC->AHB1ENR |= clock;
+                write();
+            }
+#endif
+
+        private:
+            static void write() {
+                detail::PortWriter<0, C...>::apply();
+                detail::PortWriter<1, C...>::apply();
+                detail::PortWriter<2, C...>::apply();
+                detail::PortWriter<3, C...>::apply();
+                detail::PortWriter<4, C...>::apply();
+                detail::PortWriter<5, C...>::apply();
+                detail::PortWriter<6, C...>::apply();
+                detail::PortWriter<7, C...>::apply();
+                detail::PortWriter<8, C...>::apply();
+            }
+        };
+    }
+}
+
+#endif //GPIO_HPP
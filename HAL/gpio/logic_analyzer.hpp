@@ -0,0 +1,369 @@
+#ifndef LOGIC_ANALYZER_HPP
+#define LOGIC_ANALYZER_HPP
+
+#include "gpio.hpp"
+#include "../dma/dma_request.hpp"
+#include "../timers/basic_timer.hpp"
+
+namespace HAL {
+    namespace Gpio {
+
+        namespace detail {
+            /**
+             * Pairs a sampling timer with the gate timer that counts its update events
+             * and stops it after the post-trigger samples. Each timer is a slave of the
+             * other one through the internal trigger connections (ITR) of the
+             * reference manual:
+             *  - TIM8 is gated by TIM5 (TIM8 ITR3), TIM5 counts TIM8 updates (TIM5 ITR3)
+             *  - TIM1 is gated by TIM4 (TIM1 ITR3), TIM4 counts TIM1 updates (TIM4 ITR0)
+             */
+            template<typename TIM>
+            struct SampleGate;
+
+            template<>
+            struct SampleGate<Peripheral::p_TIM8> {
+                typedef Peripheral::p_TIM5 gate;
+                static constexpr uint16_t sampler_itr = 3;
+                static constexpr uint16_t gate_itr = 3;
+            };
+
+            template<>
+            struct SampleGate<Peripheral::p_TIM1> {
+                typedef Peripheral::p_TIM4 gate;
+                static constexpr uint16_t sampler_itr = 3;
+                static constexpr uint16_t gate_itr = 0;
+            };
+        }
+
+        /**
+         * LogicAnalyzer (type)
+         *
+         * Samples the input data register (IDR) of port PORT into a RAM ring buffer, one
+         * 16 bit sample per update event of timer TIM, through the timer's update DMA
+         * request. Sampling runs without CPU intervention up to ~20 MHz.
+         *
+         * Capture has pre-trigger and post-trigger samples: after arm() the ring is filled
+         * continuously; trigger() (to be called from an EXTI or timer compare interrupt)
+         * marks the trigger sample and starts counting the post-trigger samples. The count
+         * is done in hardware by a gate timer (TIM5 for TIM8, TIM4 for TIM1) that is
+         * clocked by the sampling timer and gates it off after exactly post samples, so
+         * no interrupt latency is involved in stopping the capture.
+         *
+         * The trigger point itself is taken in software, so it lands late by the interrupt
+         * latency plus the time to reach trigger(): at high sample frequencies that is
+         * several samples (e.g. ~30 CPU cycles, 3-4 samples at 20 MHz with a 168 MHz core,
+         * more with other interrupts in the way or flash wait states). The gate timer can't
+         * be started by the event in hardware instead, since it is already a slave clocked
+         * by the sampler. The marked sample and the post-trigger count stay consistent with
+         * each other; when the exact edge matters, put the trigger signal on the sampled
+         * port and look for it in the samples just before getTriggerPosition().
+         *
+         * The capture can be exported in a compact run-length encoded format with
+         * exportRle(); tools/la2vcd.cpp converts it to VCD on the host.
+         *
+         * Only DMA2 can access the GPIO ports, so TIM must be TIM1 or TIM8.
+         */
+        template<typename TIM, typename PORT>
+        class LogicAnalyzer {
+            typedef Dma::StreamFor<TIM, Dma::Request::UP> request;
+            typedef typename detail::SampleGate<TIM>::gate gate_peripheral;
+
+            static_assert(request::is_dma2, "GPIO ports are reachable only by DMA2: use TIM1 or TIM8");
+
+            //***************************
+            //* Subtypes                *
+            //***************************
+        public:
+            enum State {
+                IDLE,
+                ARMED,
+                TRIGGERED,
+                DONE
+            };
+
+            //***************************
+            //* Members                 *
+            //***************************
+        private:
+            Timer::BasicTimer<TIM> timer;
+            Timer::TimerBase<gate_peripheral> gate;
+            Dma::DmaStream<typename request::peripheral> dma;
+
+            uint16_t *buffer;
+            uint16_t size;
+            uint16_t post = 0;
+
+            volatile State state = IDLE;
+            volatile uint16_t trigger_index = 0;
+
+            // Window of the completed capture: first (oldest) sample and number of samples
+            uint16_t start_index = 0;
+            uint16_t length = 0;
+
+            static constexpr Timer::raw_timer_t* const sampler_base = (Timer::raw_timer_t*) TIM::periph_base;
+            static constexpr Timer::raw_timer_t* const gate_base = (Timer::raw_timer_t*) gate_peripheral::periph_base;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            /**
+             * @param sample_freq: samples per second; if setSampleFrequency() rejects it the
+             *        sampling runs at the timer clock / 65536 until a valid one is set
+             * @param buffer: ring buffer the samples are stored in. It must stay valid while
+             * capturing, and it can't be in CCM RAM.
+             * @param size: number of samples of the ring buffer, i.e. of a capture
+             */
+            LogicAnalyzer(uint32_t sample_freq, uint16_t *buffer, uint16_t size) :
+                    timer(Timer::TimerBase<TIM>::bus_freq()), buffer(buffer), size(size)
+            {
+                PORT::enable();
+                setSampleFrequency(sample_freq);
+
+                // The sampler update event is its trigger output (TRGO)
+                sampler_base->CR2 = (sampler_base->CR2 & ~TIM_CR2_MMS) | TIM_CR2_MMS_1;
+
+                // Gate counts sampler updates (external clock mode 1 on ITRx) and its
+                // OC1REF is its trigger output
+                gate_base->SMCR = (detail::SampleGate<TIM>::gate_itr << 4) | TIM_SMCR_SMS;
+                gate_base->CR2 = (gate_base->CR2 & ~TIM_CR2_MMS) | TIM_CR2_MMS_2;
+                gate_base->ARR = 0xFFFF;
+
+                // Sampler counts only while the gate OC1REF is high (gated mode on ITRx)
+                sampler_base->SMCR = (detail::SampleGate<TIM>::sampler_itr << 4) | TIM_SMCR_SMS_2 | TIM_SMCR_SMS_0;
+            }
+
+            ~LogicAnalyzer()
+            {
+                stop();
+            }
+
+            /**
+             * Sets the sample frequency.
+             * This function must be called with the capture stopped.
+             *
+             * The rate is kept across clock changes made through Clock::Control, see
+             * retimeFailed().
+             *
+             * @param freq: samples per second
+             * @return false if freq is 0 or above half the timer clock (nothing is changed)
+             */
+            bool setSampleFrequency(uint32_t freq)
+            {
+                if (!timer.setUpdateFrequency(freq))
+                    return false;
+
+                sampler_base->EGR = TIM_EGR_UG;
+                sampler_base->SR = 0;
+                return true;
+            }
+
+            /**
+             * @return the actual sample frequency, after rounding to the timer resolution
+             */
+            uint32_t getSampleFrequency() const
+            {
+                return timer.getUpdateFrequency();
+            }
+
+            /**
+             * @return true if the last clock change couldn't keep the sample frequency:
+             * the capture is sampled at the nearest one, getSampleFrequency()
+             */
+            bool retimeFailed() const
+            {
+                return timer.retimeFailed();
+            }
+
+            /**
+             * Starts sampling continuously into the ring buffer, waiting for trigger().
+             *
+             * @param pre_samples: samples to keep before the trigger, the rest of the
+             * buffer is filled after the trigger
+             */
+            void arm(uint16_t pre_samples)
+            {
+                stop();
+
+                post = size - std::min(pre_samples, size);
+                if (post == 0)
+                    post = 1;
+
+                dma.configure(request::channel, Dma::Direction::PERIPHERAL_TO_MEMORY, Dma::Size::HALF_WORD,
+                              Dma::Size::HALF_WORD, Dma::Priority::VERY_HIGH, Dma::MEMORY_INCREMENT | Dma::CIRCULAR);
+                dma.start(&((raw_port_t *) PORT::periph_base)->IDR, buffer, size);
+
+                // Gate open until the trigger: OC1REF forced high
+                gate_base->CCMR1 = (gate_base->CCMR1 & ~(TIM_CCMR1_OC1M | TIM_CCMR1_CC1S)) |
+                                   TIM_CCMR1_OC1M_2 | TIM_CCMR1_OC1M_0;
+                gate_base->CNT = 0;
+                gate_base->SR = 0;
+                gate.enable();
+
+                state = ARMED;
+                timer.clear();
+                sampler_base->DIER |= TIM_DIER_UDE;
+                timer.start();
+            }
+
+            /**
+             * Marks the current sample as the trigger and lets the capture run for the
+             * post-trigger samples. Meant to be called from an EXTI or compare interrupt, as
+             * early as possible in the handler: the marked sample is the one being taken when
+             * this runs, not the one of the event (see the class description). Calls after
+             * the first one are ignored.
+             */
+            void trigger()
+            {
+                if (state != ARMED)
+                    return;
+
+                // From now on the gate counts exactly post sampler updates, then OC1REF
+                // (PWM mode 1: high while CNT < CCR1) goes low and stops the sampler
+                gate_base->CNT = 0;
+                trigger_index = (size - dma.remaining()) % size;
+                gate_base->CCR1 = post;
+                gate_base->CCMR1 = (gate_base->CCMR1 & ~TIM_CCMR1_OC1M) | TIM_CCMR1_OC1M_2 | TIM_CCMR1_OC1M_1;
+
+                state = TRIGGERED;
+            }
+
+            /**
+             * @return true when the post-trigger samples have been captured. The first call
+             * that returns true also stops the DMA and freezes the capture window.
+             */
+            bool isDone()
+            {
+                if (state == TRIGGERED && gate_base->CNT >= post) {
+                    finish();
+                    state = DONE;
+                }
+
+                return state == DONE;
+            }
+
+            State getState() const
+            {
+                return state;
+            }
+
+            /**
+             * Aborts the capture.
+             */
+            void stop()
+            {
+                timer.stop();
+                sampler_base->DIER &= ~TIM_DIER_UDE;
+                gate.disable();
+                dma.stop();
+
+                if (state != DONE)
+                    state = IDLE;
+            }
+
+            /**
+             * @return number of samples of the completed capture
+             */
+            uint16_t getLength() const
+            {
+                return length;
+            }
+
+            /**
+             * @return position of the trigger sample inside the completed capture
+             */
+            uint16_t getTriggerPosition() const
+            {
+                return (trigger_index + size - start_index) % size;
+            }
+
+            /**
+             * @return the i-th sample of the completed capture, oldest first
+             */
+            uint16_t sample(uint16_t i) const
+            {
+                return buffer[(start_index + i) % size];
+            }
+
+            /**
+             * Exports the completed capture as run-length encoded data, little endian:
+             *  - header: "LARL", version (1 byte), channel mask (2 bytes),
+             *    sample frequency (4 bytes), samples (4 bytes), trigger position (4 bytes)
+             *  - runs: run length as LEB128 varint, followed by the sample value
+             *    (2 bytes, already masked with the channel mask)
+             *
+             * @param out: output buffer
+             * @param max: output buffer size
+             * @param mask: channels (port pins) to be exported
+             * @return number of bytes written, or 0 if out is too small
+             */
+            uint32_t exportRle(uint8_t *out, uint32_t max, uint16_t mask = 0xFFFF) const
+            {
+                uint32_t pos = 0;
+
+                if (max < rle_header_size)
+                    return 0;
+
+                out[pos++] = 'L';
+                out[pos++] = 'A';
+                out[pos++] = 'R';
+                out[pos++] = 'L';
+                out[pos++] = rle_version;
+                pos = put(out, pos, mask, 2);
+                pos = put(out, pos, getSampleFrequency(), 4);
+                pos = put(out, pos, length, 4);
+                pos = put(out, pos, getTriggerPosition(), 4);
+
+                uint32_t i = 0;
+                while (i < length) {
+                    uint16_t value = sample(i) & mask;
+                    uint32_t run = 1;
+                    while (i + run < length && (sample(i + run) & mask) == value)
+                        run++;
+                    i += run;
+
+                    // Worst case: 3 bytes of varint (runs are at most 65535) and 2 of value
+                    if (pos + 5 > max)
+                        return 0;
+
+                    while (run >= 0x80) {
+                        out[pos++] = (run & 0x7F) | 0x80;
+                        run >>= 7;
+                    }
+                    out[pos++] = run;
+                    pos = put(out, pos, value, 2);
+                }
+
+                return pos;
+            }
+
+            static constexpr uint32_t rle_header_size = 19;
+            static constexpr uint8_t rle_version = 1;
+
+        private:
+            void finish()
+            {
+                timer.stop();
+                sampler_base->DIER &= ~TIM_DIER_UDE;
+                gate.disable();
+
+                bool wrapped = (dma.flags() & Dma::TRANSFER_COMPLETE) != 0;
+                uint16_t end = (size - dma.remaining()) % size;
+                dma.stop();
+
+                // If the ring has never wrapped the capture starts at the buffer beginning
+                start_index = wrapped ? end : 0;
+                length = wrapped ? size : end;
+            }
+
+            static uint32_t put(uint8_t *out, uint32_t pos, uint32_t value, unsigned bytes)
+            {
+                for (unsigned b = 0; b < bytes; b++)
+                    out[pos++] = (value >> (8 * b)) & 0xFF;
+                return pos;
+            }
+        };
+    }
+}
+
+#endif //LOGIC_ANALYZER_HPP
@@ -0,0 +1,259 @@
+#ifndef PATTERN_GENERATOR_HPP
+#define PATTERN_GENERATOR_HPP
+
+#include "gpio.hpp"
+#include "../dma/dma_request.hpp"
+#include "../timers/basic_timer.hpp"
+
+namespace HAL {
+    namespace Gpio {
+
+        /**
+         * A level change of a single pin, at a given step of a pattern.
+         *
+         * @param step: index of the pattern step the change happens at
+         * @param pin: pin number (0..15) inside the port
+         * @param level: level the pin is driven to
+         */
+        struct Edge {
+            uint32_t step;
+            uint8_t pin;
+            bool level;
+        };
+
+        /**
+         * The waveform of a single pin, one character per pattern step:
+         * '1' or 'H' drives the pin high, '0' or 'L' drives it low, any other
+         * character (e.g. '-' or '.') leaves the pin as it is.
+         *
+         * Example: {5, "0011--00"}
+         */
+        struct Track {
+            uint8_t pin;
+            const char *wave;
+        };
+
+        /**
+         * PatternCompiler (type)
+         *
+         * Converts a pin timeline into a table of BSRR words, one per pattern step, that
+         * can be streamed to a port by PatternGenerator. A zero word leaves the port as it
+         * is, so only the pins actually mentioned in the timeline are ever touched.
+         * The compiler has no hardware dependency: tables can be built at boot or
+         * precomputed on the host.
+         */
+        class PatternCompiler {
+        public:
+            /**
+             * Compiles a list of edges. When more edges of the same pin fall in the same
+             * step, the last one in the list wins.
+             *
+             * @param edges: the pin level changes, in any order
+             * @param count: number of edges
+             * @param table: output BSRR table, of at least length words
+             * @param length: number of steps of the pattern, edges beyond it are ignored
+             * @return the number of steps actually needed (last edge step + 1)
+             */
+            static uint32_t compile(const Edge *edges, unsigned count, uint32_t *table, uint32_t length) {
+                uint32_t used = 0;
+
+                for (uint32_t i = 0; i < length; i++)
+                    table[i] = 0;
+
+                for (unsigned i = 0; i < count; i++) {
+                    const Edge& e = edges[i];
+                    if (e.step >= length || e.pin > 15)
+                        continue;
+
+                    drive(table[e.step], e.pin, e.level);
+                    used = std::max(used, e.step + 1);
+                }
+
+                return used;
+            }
+
+            /**
+             * Compiles a list of tracks.
+             *
+             * @param tracks: one waveform per pin
+             * @param count: number of tracks
+             * @param table: output BSRR table, of at least length words
+             * @param length: number of steps of the pattern, longer waveforms are truncated
+             * @return the number of steps actually needed (longest waveform)
+             */
+            static uint32_t compile(const Track *tracks, unsigned count, uint32_t *table, uint32_t length) {
+                uint32_t used = 0;
+
+                for (uint32_t i = 0; i < length; i++)
+                    table[i] = 0;
+
+                for (unsigned i = 0; i < count; i++) {
+                    const Track& t = tracks[i];
+                    if (t.pin > 15)
+                        continue;
+
+                    uint32_t step = 0;
+                    for (const char *c = t.wave; *c && step < length; c++, step++) {
+                        if (*c == '1' || *c == 'H')
+                            drive(table[step], t.pin, true);
+                        else if (*c == '0' || *c == 'L')
+                            drive(table[step], t.pin, false);
+                    }
+
+                    used = std::max(used, step);
+                }
+
+                return used;
+            }
+
+            /**
+             * Compiles a sequence of port snapshots: at each step the pins in mask are
+             * driven to the corresponding bit of levels, the other pins are left as they are.
+             *
+             * @param levels: desired port output, one value per step
+             * @param length: number of steps
+             * @param mask: pins controlled by the pattern
+             * @param table: output BSRR table, of at least length words
+             */
+            static void compile(const uint16_t *levels, uint32_t length, uint16_t mask, uint32_t *table) {
+                for (uint32_t i = 0; i < length; i++)
+                    table[i] = (levels[i] & mask) | ((uint32_t) (~levels[i] & mask) << 16);
+            }
+
+        private:
+            static void drive(uint32_t& word, unsigned pin, bool level) {
+                uint32_t set = 1u << pin;
+                uint32_t reset = 1u << (pin + 16);
+
+                word = level ? ((word & ~reset) | set) : ((word & ~set) | reset);
+            }
+        };
+
+        /**
+         * PatternGenerator (type)
+         *
+         * Streams a table of BSRR words to a GPIO port, one word per update event of the
+         * timer TIM, through the timer's update DMA request. Once started the waveform is
+         * generated without any CPU intervention, with the timing accuracy of the timer.
+         *
+         * Only DMA2 can access the GPIO ports, so the timer must be TIM1 or TIM8 (their
+         * update request is served by DMA2). Any other timer is a compile error.
+         * Step frequencies of several MHz are possible; the upper bound depends on the
+         * bus matrix load, since each step is a DMA2 transfer on AHB1.
+         *
+         * Please refer to MCU's reference manual (DMA and timer chapters)
+         * for further informations.
+         */
+        template<typename TIM, typename PORT>
+        class PatternGenerator {
+            typedef Dma::StreamFor<TIM, Dma::Request::UP> request;
+
+            static_assert(request::is_dma2, "GPIO ports are reachable only by DMA2: use TIM1 or TIM8");
+
+            //***************************
+            //* Members                 *
+            //***************************
+        private:
+            Timer::BasicTimer<TIM> timer;
+            Dma::DmaStream<typename request::peripheral> dma;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            /**
+             * @param step_freq: pattern steps per second; if setStepFrequency() rejects it
+             *        the pattern steps at the timer clock / 65536 until a valid one is set
+             */
+            PatternGenerator(uint32_t step_freq) : timer(Timer::TimerBase<TIM>::bus_freq())
+            {
+                PORT::enable();
+                setStepFrequency(step_freq);
+            }
+
+            ~PatternGenerator()
+            {
+                stop();
+            }
+
+            /**
+             * Sets the pattern step frequency. The timer runs unprescaled as long as
+             * possible, so that the step period is as accurate as possible.
+             * This function must be called with the pattern stopped. The rate is kept
+             * across clock changes made through Clock::Control, see retimeFailed().
+             *
+             * @param step_freq: pattern steps per second
+             * @return false if step_freq is 0 or above half the timer clock (nothing is
+             * changed)
+             */
+            bool setStepFrequency(uint32_t step_freq)
+            {
+                if (!timer.setUpdateFrequency(step_freq))
+                    return false;
+
+                // Load the prescaler now: UDE is still off, so no DMA request is generated
+                Timer::TimerBase<TIM>::periph_base->EGR = TIM_EGR_UG;
+                Timer::TimerBase<TIM>::periph_base->SR = 0;
+                return true;
+            }
+
+            /**
+             * @return true if the last clock change couldn't keep the step frequency: the
+             * pattern steps at the nearest one the timer could produce
+             */
+            bool retimeFailed() const
+            {
+                return timer.retimeFailed();
+            }
+
+            /**
+             * Starts streaming table to the port BSRR, one word per step.
+             *
+             * @param table: BSRR words, e.g. built by PatternCompiler. It must stay valid
+             * until the pattern is stopped, and it can't be in CCM RAM.
+             * @param length: number of steps
+             * @param loop: if true the table is repeated until stop() is called
+             */
+            void play(const uint32_t *table, uint16_t length, bool loop = false)
+            {
+                stop();
+
+                dma.configure(request::channel, Dma::Direction::MEMORY_TO_PERIPHERAL, Dma::Size::WORD, Dma::Size::WORD,
+                              Dma::Priority::VERY_HIGH, Dma::MEMORY_INCREMENT | (loop ? (uint32_t) Dma::CIRCULAR : 0));
+                dma.start((volatile void *) (PORT::periph_base + bsrr_offset), table, length);
+
+                timer.clear();
+                Timer::TimerBase<TIM>::periph_base->DIER |= TIM_DIER_UDE;
+                timer.start();
+            }
+
+            /**
+             * Stops the pattern, leaving the pins at their current level.
+             */
+            void stop()
+            {
+                timer.stop();
+                Timer::TimerBase<TIM>::periph_base->DIER &= ~TIM_DIER_UDE;
+                dma.stop();
+            }
+
+            /**
+             * @return true when a non looping pattern has been completely output
+             */
+            bool isDone() const
+            {
+                return !dma.is_enabled();
+            }
+
+            /**
+             * @return the number of steps still to be output in the current table pass
+             */
+            uint16_t remaining() const
+            {
+                return dma.remaining();
+            }
+        };
+    }
+}
+
+#endif //PATTERN_GENERATOR_HPP
@@ -0,0 +1,93 @@
+#ifndef BUS_BENCHMARK_HPP
+#define BUS_BENCHMARK_HPP
+
+#include "dma_buffer.hpp"
+#include "../dma/dma_stream.hpp"
+#include "../debug/cycle_counter.hpp"
+
+namespace HAL {
+    namespace Memory {
+
+        /**
+         * Core cycles spent on the same SRAM1 workload with no DMA traffic, with a DMA2
+         * memory-to-memory copy running on SRAM1 (shared slave) and on SRAM2 (separate
+         * slave). dma_blocks counts the copies completed meanwhile, to check the DMA load
+         * was comparable.
+         */
+        struct ContentionResult {
+            uint32_t idle;
+            uint32_t dma_on_sram1;
+            uint32_t dma_on_sram2;
+            uint32_t dma_blocks_sram1;
+            uint32_t dma_blocks_sram2;
+        };
+
+        namespace detail {
+            template<typename S>
+            uint32_t contendedRun(Dma::DmaStream<S>& dma, volatile uint32_t *work, uint32_t work_words,
+                                  uint32_t *dma_buffer, uint32_t dma_words, uint32_t rounds, uint32_t& blocks) {
+                Debug::CycleCounter counter;
+                blocks = 0;
+
+                if (dma_buffer)
+                    dma.start(dma_buffer, dma_buffer + dma_words, dma_words);
+
+                counter.start();
+                for (uint32_t r = 0; r < rounds; r++) {
+                    for (uint32_t i = 0; i < work_words; i++)
+                        work[i] = work[i] + i;
+
+                    // Same check in every run, so that only the contention differs
+                    if (dma_buffer && !dma.is_enabled()) {
+                        blocks++;
+                        dma.start(dma_buffer, dma_buffer + dma_words, dma_words);
+                    }
+                }
+                uint32_t cycles = counter.elapsed();
+
+                dma.stop();
+                return cycles;
+            }
+        }
+
+        /**
+         * Measures the stalls the core suffers from DMA traffic on the slave it works on.
+         * The DMA copies the first half of a buffer over the second one in INCR4 bursts of
+         * words, restarting whenever done, while the core read-modify-writes work.
+         * Run it with interrupts disabled for repeatable figures.
+         *
+         * @param work: core workload buffer, in SRAM1
+         * @param sram1_buffer: 2 * dma_words words in SRAM1, 16 byte aligned
+         * @param sram2_buffer: 2 * dma_words words in SRAM2, 16 byte aligned (e.g. from
+         *        DmaBufferAllocator)
+         * @param dma_words: words per copy, up to 65535
+         * @param rounds: passes of the core over work
+         */
+        template<typename S>
+        ContentionResult contentionBenchmark(volatile uint32_t *work, uint32_t work_words,
+                                             uint32_t *sram1_buffer, uint32_t *sram2_buffer,
+                                             uint16_t dma_words, uint32_t rounds = 100) {
+            static_assert(Dma::DmaStream<S>::is_dma2, "memory-to-memory transfers are supported by DMA2 only");
+
+            Dma::DmaStream<S> dma;
+            ContentionResult result;
+            uint32_t blocks;
+
+            dma.configure(0, Dma::Direction::MEMORY_TO_MEMORY, Dma::Size::WORD, Dma::Size::WORD,
+                          Dma::Priority::VERY_HIGH, Dma::MEMORY_INCREMENT | Dma::PERIPHERAL_INCREMENT |
+                                                    Dma::MEMORY_BURST_4 | Dma::PERIPHERAL_BURST_4);
+            dma.enableFifo();
+
+            result.idle = detail::contendedRun(dma, work, work_words, nullptr, dma_words, rounds, blocks);
+            result.dma_on_sram1 = detail::contendedRun(dma, work, work_words, sram1_buffer, dma_words, rounds,
+                                                       result.dma_blocks_sram1);
+            result.dma_on_sram2 = detail::contendedRun(dma, work, work_words, sram2_buffer, dma_words, rounds,
+                                                       result.dma_blocks_sram2);
+
+            dma.disableFifo();
+            return result;
+        }
+    }
+}
+
+#endif //BUS_BENCHMARK_HPP
@@ -0,0 +1,349 @@
+#ifndef CCM_HPP
+#define CCM_HPP
+
+#include "../util.hpp"
+
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * HAL_CCM
+ *
+ * Places a static object in CCM RAM (64 KB at 0x10000000, zero wait states, reachable by
+ * the core data bus only): the place for hot state that the DMA never touches, such as
+ * control loop state, filter histories, lookup tables built at boot and thread stacks.
+ * Keeping it off SRAM1 also keeps the core off the bus matrix paths used by the DMAs
+ * and Ethernet.
+ *
+ * The linker script must map the .ccmram output section to CCM. It is usually NOLOAD,
+ * i.e. neither zeroed nor initialized by the startup code: give the objects their values
+ * at run time.
+ *
+ * Example:
+ *     static Memory::Ccm<int32_t[64]> history HAL_CCM;
+ */
+#define HAL_CCM __attribute__((section(".ccmram")))
+
+namespace HAL {
+    namespace Memory {
+        constexpr __pointer ccm_base = CCMDATARAM_BASE;
+        constexpr uint32_t ccm_size = 0x10000;
+
+        constexpr bool isCcm(__pointer address) {
+            return address >= ccm_base && address - ccm_base < ccm_size;
+        }
+
+        /**
+         * CcmPtr (type)
+         *
+         * Pointer to an object in CCM RAM. It works as a T* for the core, but it doesn't
+         * convert to one, so it can't reach the DMA APIs by mistake: DmaStream rejects it
+         * at compile time. get() is the explicit way out, for code that only the core runs.
+         */
+        template<typename T>
+        class CcmPtr {
+            //***************************
+            //* Members                 *
+            //***************************
+        private:
+            T *pointer;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            CcmPtr() : pointer(nullptr) {}
+
+            /**
+             * @param pointer: an address inside CCM RAM, e.g. of a HAL_CCM object
+             */
+            explicit CcmPtr(T *pointer) : pointer(pointer) {}
+
+            T *get() const {
+                return pointer;
+            }
+
+            T& operator*() const {
+                return *pointer;
+            }
+
+            T *operator->() const {
+                return pointer;
+            }
+
+            T& operator[](uint32_t i) const {
+                return pointer[i];
+            }
+
+            CcmPtr operator+(uint32_t i) const {
+                return CcmPtr(pointer + i);
+            }
+
+            explicit operator bool() const {
+                return pointer != nullptr;
+            }
+
+            bool operator==(const CcmPtr& other) const {
+                return pointer == other.pointer;
+            }
+
+            bool operator!=(const CcmPtr& other) const {
+                return pointer != other.pointer;
+            }
+        };
+
+        template<typename T>
+        struct is_ccm_pointer : std::false_type {};
+
+        template<typename T>
+        struct is_ccm_pointer<CcmPtr<T>> : std::true_type {};
+
+        /**
+         * Ccm (type)
+         *
+         * Wrapper of a HAL_CCM static object: taking its address gives a CcmPtr, so the
+         * type system knows where it lives.
+         */
+        template<typename T>
+        class Ccm {
+            T value;
+
+        public:
+            T& get() {
+                return value;
+            }
+
+            const T& get() const {
+                return value;
+            }
+
+            CcmPtr<T> operator&() {
+                return CcmPtr<T>(&value);
+            }
+
+            /**
+             * Element access and decay to a CcmPtr for arrays.
+             */
+            template<typename I>
+            auto operator[](I i) -> decltype(value[i]) {
+                return value[i];
+            }
+
+            CcmPtr<typename std::remove_extent<T>::type> data() {
+                return CcmPtr<typename std::remove_extent<T>::type>((typename std::remove_extent<T>::type *) &value);
+            }
+        };
+
+        /**
+         * CcmArena (type)
+         *
+         * Bump allocator over a range of CCM RAM, for objects that live until reset (or
+         * until reset() of the whole arena). Allocation is O(1) and has no per-object
+         * overhead. When HAL_CCM statics exist, give the arena the range the linker left
+         * free after them.
+         *
+         * NOTE: allocate() is thread-safe ONLY inside miosix environment,
+         *       in other environments you have to ensure it other ways.
+         */
+        class CcmArena {
+            //***************************
+            //* Members                 *
+            //***************************
+        private:
+            __pointer begin;
+            __pointer end;
+            __pointer next;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            /**
+             * @param base: start of the range, inside CCM RAM
+             * @param size: bytes of the range, it is clipped to the end of CCM RAM
+             */
+            explicit CcmArena(__pointer base = ccm_base, uint32_t size = ccm_size) :
+                    begin(isCcm(base) ? base : ccm_base),
+                    end(begin + size <= ccm_base + ccm_size ? begin + size : ccm_base + ccm_size),
+                    next(begin) {}
+
+            /**
+             * Allocates and default constructs count objects.
+             *
+             * @return the first object, a null CcmPtr if the arena is exhausted
+             */
+            template<typename T>
+            CcmPtr<T> allocate(uint32_t count = 1) {
+                __pointer address = reserve(sizeof(T) * count, alignof(T));
+                if (!address)
+                    return CcmPtr<T>();
+
+                T *objects = (T *) address;
+                for (uint32_t i = 0; i < count; i++)
+                    new(objects + i) T();
+                return CcmPtr<T>(objects);
+            }
+
+            /**
+             * Raw memory, e.g. for a thread stack (alignment: a power of two).
+             */
+            CcmPtr<uint8_t> allocateBytes(uint32_t bytes, uint32_t alignment = 8) {
+                return CcmPtr<uint8_t>((uint8_t *) reserve(bytes, alignment));
+            }
+
+            /**
+             * Frees everything at once. Objects are not destroyed.
+             */
+            void reset() {
+                next = begin;
+            }
+
+            uint32_t used() const {
+                return next - begin;
+            }
+
+            uint32_t available() const {
+                return end - next;
+            }
+
+        private:
+#ifdef _MIOSIX
+            __pointer reserve(uint32_t bytes, uint32_t alignment) {
+                miosix::FastInterruptDisableLock dLock;
+                return bump(bytes, alignment);
+            }
+#else
+            __pointer reserve(uint32_t bytes, uint32_t alignment) {
+                return bump(bytes, alignment);
+            }
+#endif
+
+            __pointer bump(uint32_t bytes, uint32_t alignment) {
+                __pointer address = (next + alignment - 1) & ~(alignment - 1);
+                if (address > end || end - address < bytes)
+                    return 0;
+
+                next = address + bytes;
+                return address;
+            }
+        };
+
+        /**
+         * CcmPool (type)
+         *
+         * N blocks for objects of type T, taken from a CcmArena, with O(1) create() and
+         * destroy() through a free list: for objects that come and go, such as messages
+         * or per-connection state.
+         *
+         * NOTE: create() and destroy() are thread-safe ONLY inside miosix environment,
+         *       in other environments you have to ensure it other ways.
+         */
+        template<typename T, unsigned N>
+        class CcmPool {
+            //***************************
+            //* Subtypes                *
+            //***************************
+        private:
+            union Block {
+                Block *next;
+                typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+            };
+
+            //***************************
+            //* Members                 *
+            //***************************
+        private:
+            Block *blocks;
+            Block *free_list = nullptr;
+            uint32_t free_blocks = 0;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            explicit CcmPool(CcmArena& arena) {
+                CcmPtr<Block> memory = arena.allocate<Block>(N);
+                blocks = memory.get();
+
+                if (blocks) {
+                    for (unsigned i = 0; i < N; i++)
+                        blocks[i].next = i + 1 < N ? &blocks[i + 1] : nullptr;
+                    free_list = blocks;
+                    free_blocks = N;
+                }
+            }
+
+            /**
+             * @return false if the arena had no room for the pool
+             */
+            bool valid() const {
+                return blocks != nullptr;
+            }
+
+            uint32_t available() const {
+                return free_blocks;
+            }
+
+            /**
+             * Constructs an object with args.
+             *
+             * @return a null CcmPtr if the pool is empty
+             */
+            template<typename... A>
+            CcmPtr<T> create(A&&... args) {
+                Block *block = pop();
+                if (!block)
+                    return CcmPtr<T>();
+
+                return CcmPtr<T>(new(&block->storage) T(std::forward<A>(args)...));
+            }
+
+            void destroy(CcmPtr<T> object) {
+                if (!object)
+                    return;
+
+                object->~T();
+                push((Block *) object.get());
+            }
+
+        private:
+#ifdef _MIOSIX
+            Block *pop() {
+                miosix::FastInterruptDisableLock dLock;
+                return unlink();
+            }
+
+            void push(Block *block) {
+                miosix::FastInterruptDisableLock dLock;
+                link(block);
+            }
+#else
+            Block *pop() {
+                return unlink();
+            }
+
+            void push(Block *block) {
+                link(block);
+            }
+#endif
+
+            Block *unlink() {
+                Block *block = free_list;
+                if (block) {
+                    free_list = block->next;
+                    free_blocks--;
+                }
+                return block;
+            }
+
+            void link(Block *block) {
+                block->next = free_list;
+                free_list = block;
+                free_blocks++;
+            }
+        };
+    }
+}
+
+#endif //CCM_HPP
@@ -0,0 +1,241 @@
+#ifndef DMA_BUFFER_HPP
+#define DMA_BUFFER_HPP
+
+#include "ccm.hpp"
+
+/**
+ * HAL_SRAM2
+ *
+ * Places a static object in SRAM2 (16 KB at 0x2001C000), a bus matrix slave of its own:
+ * DMA traffic there doesn't stall the core working on SRAM1. The linker script must map
+ * the .sram2 output section to SRAM2 (and keep .data, .bss, heap and stacks out of it).
+ *
+ * Example:
+ *     static uint8_t dma_pool[8192] HAL_SRAM2 __attribute__((aligned(16)));
+ */
+#define HAL_SRAM2 __attribute__((section(".sram2")))
+
+namespace HAL {
+    namespace Memory {
+        constexpr __pointer sram1_base = SRAM1_BASE;
+        constexpr uint32_t sram1_size = SRAM2_BASE - SRAM1_BASE;
+        constexpr __pointer sram2_base = SRAM2_BASE;
+        constexpr uint32_t sram2_size = 0x4000;
+
+        /**
+         * Bus matrix masters that access memory. The core reaches SRAM through its S-bus.
+         */
+        enum class Master : uint8_t {
+            CPU,
+            DMA1_MEMORY,
+            DMA2_MEMORY,
+            DMA2_PERIPHERAL,
+            ETHERNET,
+            USB_HS
+        };
+
+        constexpr unsigned master_count = 6;
+
+        /**
+         * Memories, as bus matrix slaves (CCM is not one: only the core D-bus reaches it).
+         */
+        enum class Slave : uint8_t {
+            SRAM1,
+            SRAM2,
+            CCM,
+            OTHER
+        };
+
+        constexpr unsigned slave_count = 4;
+
+        constexpr Slave slaveOf(__pointer address) {
+            return address >= sram1_base && address - sram1_base < sram1_size ? Slave::SRAM1 :
+                   address >= sram2_base && address - sram2_base < sram2_size ? Slave::SRAM2 :
+                   isCcm(address) ? Slave::CCM : Slave::OTHER;
+        }
+
+        /**
+         * @return true if master has a bus matrix path to slave
+         */
+        constexpr bool reaches(Master master, Slave slave) {
+            return slave == Slave::CCM ? master == Master::CPU : true;
+        }
+
+        /**
+         * Who uses which slave, collected by DmaBufferAllocator: bytes[master][slave]
+         * placed there, and for each slave the mask (bit = Master) of its users. Two or
+         * more users of the same slave contend for it: the bus matrix arbitrates them
+         * round robin, and each one may stall the others for a whole burst.
+         */
+        struct SharingReport {
+            uint32_t bytes[master_count][slave_count];
+            uint8_t masters[slave_count];
+            uint32_t fallbacks;
+
+            bool shared(Slave slave) const {
+                uint8_t m = masters[static_cast<unsigned>(slave)];
+                return m & (m - 1);
+            }
+
+            bool uses(Master master, Slave slave) const {
+                return masters[static_cast<unsigned>(slave)] & (1u << static_cast<unsigned>(master));
+            }
+        };
+
+        /**
+         * DmaBufferAllocator (type)
+         *
+         * Allocates DMA buffers from two pools, one in SRAM1 and one in SRAM2, choosing
+         * the pool from a per-master policy. The default policy keeps every DMA master
+         * on SRAM2 and leaves SRAM1 to the core (stacks, heap, .data, .bss): when SRAM2
+         * is exhausted the buffer falls back to SRAM1, and the fallback is counted.
+         *
+         * Buffers are aligned to 16 bytes by default, so that INCR4 bursts of words never
+         * straddle the 1 KB boundary a burst must not cross; use 32 or 64 for INCR8/INCR16
+         * bursts of words.
+         *
+         * The allocator records who uses which slave; external buffers (e.g. Ethernet
+         * descriptors in .bss) and the core itself can be declared with declare(), and
+         * report() tells which slaves are shared.
+         *
+         * NOTE: allocate() is thread-safe ONLY inside miosix environment,
+         *       in other environments you have to ensure it other ways.
+         */
+        class DmaBufferAllocator {
+            //***************************
+            //* Subtypes                *
+            //***************************
+        private:
+            struct Pool {
+                __pointer next;
+                __pointer end;
+            };
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr uint32_t burst_alignment = 16;
+
+        private:
+            Pool pools[2];
+            Slave policy[master_count];
+            SharingReport usage;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            /**
+             * The core is declared as user of SRAM1, where the default linker scripts put
+             * its data and stacks.
+             *
+             * @param sram1_pool: memory for SRAM1 buffers (may be null)
+             * @param sram2_pool: memory for SRAM2 buffers, e.g. a HAL_SRAM2 array
+             */
+            DmaBufferAllocator(void *sram1_pool, uint32_t sram1_bytes, void *sram2_pool, uint32_t sram2_bytes) {
+                pools[0] = Pool{(__pointer) sram1_pool, (__pointer) sram1_pool + sram1_bytes};
+                pools[1] = Pool{(__pointer) sram2_pool, (__pointer) sram2_pool + sram2_bytes};
+
+                for (unsigned m = 0; m < master_count; m++) {
+                    policy[m] = m == static_cast<unsigned>(Master::CPU) ? Slave::SRAM1 : Slave::SRAM2;
+                    for (unsigned s = 0; s < slave_count; s++)
+                        usage.bytes[m][s] = 0;
+                }
+
+                for (unsigned s = 0; s < slave_count; s++)
+                    usage.masters[s] = 0;
+                usage.fallbacks = 0;
+
+                declare(Master::CPU, Slave::SRAM1, 0);
+            }
+
+            /**
+             * Sets where the buffers of master go (SRAM1 or SRAM2).
+             */
+            void setPolicy(Master master, Slave slave) {
+                if (slave == Slave::SRAM1 || slave == Slave::SRAM2)
+                    policy[static_cast<unsigned>(master)] = slave;
+            }
+
+            Slave getPolicy(Master master) const {
+                return policy[static_cast<unsigned>(master)];
+            }
+
+            /**
+             * Allocates an uninitialized buffer for master, in the slave of its policy or
+             * in the other SRAM if that is full.
+             *
+             * @param alignment: a power of two, at least burst_alignment is used
+             * @return nullptr if both pools are exhausted
+             */
+            void *allocate(Master master, uint32_t bytes, uint32_t alignment = burst_alignment) {
+                Slave preferred = policy[static_cast<unsigned>(master)];
+                unsigned first = preferred == Slave::SRAM1 ? 0 : 1;
+
+                if (alignment < burst_alignment)
+                    alignment = burst_alignment;
+
+                __pointer address = reserve(pools[first], bytes, alignment);
+                if (!address) {
+                    address = reserve(pools[1 - first], bytes, alignment);
+                    if (!address)
+                        return nullptr;
+                    usage.fallbacks++;
+                }
+
+                declare(master, slaveOf(address), bytes);
+                return (void *) address;
+            }
+
+            template<typename T>
+            T *allocate(Master master, uint32_t count, uint32_t alignment = burst_alignment) {
+                return (T *) allocate(master, sizeof(T) * count, alignment < alignof(T) ? alignof(T) : alignment);
+            }
+
+            /**
+             * Records that master uses bytes of slave, for memory not allocated here.
+             */
+            void declare(Master master, Slave slave, uint32_t bytes) {
+                usage.bytes[static_cast<unsigned>(master)][static_cast<unsigned>(slave)] += bytes;
+                usage.masters[static_cast<unsigned>(slave)] |= 1u << static_cast<unsigned>(master);
+            }
+
+            void declare(Master master, const volatile void *buffer, uint32_t bytes) {
+                declare(master, slaveOf((__pointer) buffer), bytes);
+            }
+
+            const SharingReport& report() const {
+                return usage;
+            }
+
+            uint32_t available(Slave slave) const {
+                const Pool& pool = pools[slave == Slave::SRAM1 ? 0 : 1];
+                return pool.end - pool.next;
+            }
+
+        private:
+#ifdef _MIOSIX
+            static __pointer reserve(Pool& pool, uint32_t bytes, uint32_t alignment) {
+                miosix::FastInterruptDisableLock dLock;
+                return bump(pool, bytes, alignment);
+            }
+#else
+            static __pointer reserve(Pool& pool, uint32_t bytes, uint32_t alignment) {
+                return bump(pool, bytes, alignment);
+            }
+#endif
+
+            static __pointer bump(Pool& pool, uint32_t bytes, uint32_t alignment) {
+                __pointer address = (pool.next + alignment - 1) & ~(alignment - 1);
+                if (!pool.next || address > pool.end || pool.end - address < bytes)
+                    return 0;
+
+                pool.next = address + bytes;
+                return address;
+            }
+        };
+    }
+}
+
+#endif //DMA_BUFFER_HPP
@@ -144,6 +144,7 @@ namespace HAL {
         typedef Peripheral<Bus::b_AHB1, (__pointer) (GPIOI_BASE), RCC_AHB1ENR_GPIOIEN> p_GPIOI;
         typedef Peripheral<Bus::b_AHB1, (__pointer) (CRC_BASE), RCC_AHB1ENR_CRCEN> p_CRC;
         typedef Peripheral<Bus::b_AHB1, (__pointer) (FLASH_R_BASE), 0x0> p_FLASH_R;
+        typedef Peripheral<Bus::b_AHB1, (__pointer) (BKPSRAM_BASE), RCC_AHB1ENR_BKPSRAMEN> p_BKPSRAM;
         typedef Peripheral<Bus::b_AHB1, (__pointer) (DMA1_BASE), RCC_AHB1ENR_DMA1EN> p_DMA1;
         typedef Peripheral<Bus::b_AHB1, (__pointer) (DMA1_Stream0_BASE), RCC_AHB1ENR_DMA1EN> p_DMA1_Stream0;
         typedef Peripheral<Bus::b_AHB1, (__pointer) (DMA1_Stream1_BASE), RCC_AHB1ENR_DMA1EN> p_DMA1_Stream1;
@@ -162,17 +163,20 @@ namespace HAL {
         typedef Peripheral<Bus::b_AHB1, (__pointer) (DMA2_Stream5_BASE), RCC_AHB1ENR_DMA2EN> p_DMA2_Stream5;
         typedef Peripheral<Bus::b_AHB1, (__pointer) (DMA2_Stream6_BASE), RCC_AHB1ENR_DMA2EN> p_DMA2_Stream6;
         typedef Peripheral<Bus::b_AHB1, (__pointer) (DMA2_Stream7_BASE), RCC_AHB1ENR_DMA2EN> p_DMA2_Stream7;
-        typedef Peripheral<Bus::b_AHB1, (__pointer) (ETH_BASE), 0x0> p_ETH;
-        typedef Peripheral<Bus::b_AHB1, (__pointer) (ETH_MAC_BASE), 0x0> p_ETH_MAC;
+        typedef Peripheral<Bus::b_AHB1, (__pointer) (ETH_BASE), RCC_AHB1ENR_ETHMACEN | RCC_AHB1ENR_ETHMACTXEN | RCC_AHB1ENR_ETHMACRXEN> p_ETH;
+        typedef Peripheral<Bus::b_AHB1, (__pointer) (ETH_MAC_BASE), RCC_AHB1ENR_ETHMACEN> p_ETH_MAC;
         typedef Peripheral<Bus::b_AHB1, (__pointer) (ETH_MMC_BASE), 0x0> p_ETH_MMC;
-        typedef Peripheral<Bus::b_AHB1, (__pointer) (ETH_PTP_BASE), 0x0> p_ETH_PTP;
+        typedef Peripheral<Bus::b_AHB1, (__pointer) (ETH_PTP_BASE), RCC_AHB1ENR_ETHMACPTPEN> p_ETH_PTP;
         typedef Peripheral<Bus::b_AHB1, (__pointer) (ETH_DMA_BASE), 0x0> p_ETH_DMA;
 
         // AHB2 peripherals
         typedef Peripheral<Bus::b_AHB2, (__pointer) (DCMI_BASE), RCC_AHB2ENR_DCMIEN> p_DCMI;
-//         typedef Peripheral<Bus::b_AHB2, (__pointer) (CRYP_BASE), RCC_AHB2ENR_CRYPEN> p_CRYP;
-//         typedef Peripheral<Bus::b_AHB2, (__pointer) (HASH_BASE), RCC_AHB2ENR_HASHEN> p_HASH;
+        typedef Peripheral<Bus::b_AHB2, (__pointer) (CRYP_BASE), RCC_AHB2ENR_CRYPEN> p_CRYP;
+        typedef Peripheral<Bus::b_AHB2, (__pointer) (HASH_BASE), RCC_AHB2ENR_HASHEN> p_HASH;
         typedef Peripheral<Bus::b_AHB2, (__pointer) (RNG_BASE), RCC_AHB2ENR_RNGEN> p_RNG;
+
+        // AHB3 peripherals
+        typedef Peripheral<Bus::b_AHB3, (__pointer) (FSMC_R_BASE), RCC_AHB3ENR_FSMCEN> p_FSMC;
     }
 }
 
@@ -0,0 +1,191 @@
+#ifndef IDLE_HPP
+#define IDLE_HPP
+
+#include "../clock/clock.hpp"
+#include "../rtc/rtc.hpp"
+
+namespace HAL {
+    namespace Power {
+        typedef PWR_TypeDef raw_pwr_t;
+
+        /**
+         * Low power mode chosen by IdleManager::idle().
+         */
+        enum class Mode {
+            SLEEP,
+            STOP
+        };
+
+        /**
+         * IdleManager (type)
+         *
+         * Tickless idle on a Timer::TimerService. idle() reads the next deadline and:
+         * - if it is near (under stop_threshold_us), sleeps with WFI: the core stops, the
+         *   timer keeps counting and its interrupt wakes the core on time;
+         * - otherwise it enters STOP mode (all clocks off but LSE/LSI, regulator in low
+         *   power): the service is suspended, the RTC wakeup timer is set to wake the core
+         *   wakeup_latency_us before the deadline, and on exit the clocks are restored and
+         *   the time slept, measured by the RTC sub-second counter, is added to the
+         *   service time.
+         * Any enabled interrupt wakes the core earlier; the time is compensated all the
+         * same.
+         *
+         * The RTC must have been enabled (Rtc::Controller::enable()). RTC_WKUP_IRQn is
+         * enabled in the NVIC, to wake the core, but it never runs: its flags are cleared
+         * before the interrupts are enabled again.
+         *
+         * Example:
+         *     void idleThread() { for (;;) idle.idle(); }
+         *
+         * NOTE: the compensation is as fine as the RTC sub-second tick (see
+         *       Rtc::Controller::enable()); STOP exits with HSE and PLL restarted, which
+         *       takes up to a few ms with a crystal: account for it in wakeup_latency_us.
+         */
+        template<typename SERVICE>
+        class IdleManager {
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_pwr_t* const pwr_base = (raw_pwr_t*) Peripheral::p_PWR::periph_base;
+
+        private:
+            SERVICE& service;
+            uint32_t stop_threshold_us;
+            uint32_t wakeup_latency_us;
+            bool stop_allowed = true;
+
+            uint32_t sleep_count = 0;
+            uint32_t stop_count = 0;
+            uint64_t stopped_ticks = 0;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            /**
+             * @param stop_threshold_us: shortest idle time worth STOP mode
+             * @param wakeup_latency_us: STOP exit and clock restart time
+             */
+            IdleManager(SERVICE& service, uint32_t stop_threshold_us = 5000, uint32_t wakeup_latency_us = 2500) :
+                    service(service), stop_threshold_us(stop_threshold_us), wakeup_latency_us(wakeup_latency_us) {
+                Peripheral::p_PWR::enable();
+                NVIC_ClearPendingIRQ(RTC_WKUP_IRQn);
+                NVIC_EnableIRQ(RTC_WKUP_IRQn);
+            }
+
+            /**
+             * Allows or forbids STOP mode, e.g. while a peripheral that needs its clock
+             * (USB, a UART receiving) is active.
+             */
+            void allowStop(bool allow) {
+                stop_allowed = allow;
+            }
+
+            /**
+             * @return the mode idle() would use now
+             */
+            Mode decide() const {
+                uint64_t next = service.nextDeadline();
+                uint64_t time = service.now();
+
+                if (!stop_allowed)
+                    return Mode::SLEEP;
+                if (next == SERVICE::never)
+                    return Mode::STOP;
+
+                uint64_t remaining = next > time ? next - time : 0;
+                uint64_t threshold = (uint64_t) (stop_threshold_us + wakeup_latency_us) * SERVICE::tick_freq / 1000000;
+                return remaining >= threshold ? Mode::STOP : Mode::SLEEP;
+            }
+
+            /**
+             * Sleeps until the next interrupt, in the mode decide() chooses.
+             *
+             * @return the mode used
+             */
+            Mode idle() {
+                __disable_irq();
+
+                Mode mode = decide();
+                if (mode == Mode::STOP && !stop())
+                    mode = Mode::SLEEP;
+
+                if (mode == Mode::SLEEP) {
+                    SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+                    __DSB();
+                    __WFI();
+                    sleep_count++;
+                }
+
+                __enable_irq();
+                return mode;
+            }
+
+            uint32_t sleeps() const {
+                return sleep_count;
+            }
+
+            uint32_t stops() const {
+                return stop_count;
+            }
+
+            /**
+             * @return the service ticks spent in STOP mode, added to its time
+             */
+            uint64_t stoppedTicks() const {
+                return stopped_ticks;
+            }
+
+        private:
+            uint32_t wakeupDelay() const {
+                uint64_t next = service.nextDeadline();
+                uint64_t time = service.now();
+
+                // Without deadlines, wake up once in a while all the same
+                uint64_t us = next == SERVICE::never ? 3600000000ull :
+                              next > time ? (next - time) * 1000000 / SERVICE::tick_freq : 0;
+                us = us > wakeup_latency_us ? us - wakeup_latency_us : 0;
+                return us > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t) us;
+            }
+
+            bool stop() {
+                uint32_t delay = wakeupDelay();
+                if (delay == 0)
+                    return false;
+
+                service.suspend();
+                uint32_t before = Rtc::Controller::counter();
+
+                if (!Rtc::Controller::startWakeup(delay)) {
+                    service.resume(0);
+                    return false;
+                }
+
+                Clock::Snapshot clocks = Clock::Control::snapshot();
+
+                // STOP with the regulator in low power mode
+                pwr_base->CR = (pwr_base->CR & ~PWR_CR_PDDS) | PWR_CR_LPDS | PWR_CR_CWUF;
+                SCB->SCR |= SCB_SCR_SLEEPDEEP_Msk;
+                __DSB();
+                __WFI();
+                SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+
+                Clock::Control::restore(clocks);
+                Rtc::Controller::stopWakeup();
+                NVIC_ClearPendingIRQ(RTC_WKUP_IRQn);
+
+                Rtc::Controller::synchronize();
+                uint32_t ticks = Rtc::Controller::elapsed(before, Rtc::Controller::counter());
+                uint64_t slept = Rtc::Controller::toMicroseconds(ticks) * SERVICE::tick_freq / 1000000;
+
+                service.resume(slept);
+                stop_count++;
+                stopped_ticks += slept;
+                return true;
+            }
+        };
+    }
+}
+
+#endif //IDLE_HPP
@@ -0,0 +1,336 @@
+#ifndef RNG_HPP
+#define RNG_HPP
+
+#include "../peripheral.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+namespace HAL {
+    namespace Rng {
+        typedef RNG_TypeDef raw_rng_t;
+
+        /**
+         * EntropyPool (type)
+         *
+         * Ring of N random words filled by the RNG data ready interrupt, so that readers
+         * never wait for the generator (~40 cycles per word): get() and fill() take what
+         * is in the pool and return immediately.
+         *
+         * The pool is lock-free. The interrupt is the only producer; any number of readers
+         * (threads or interrupts) can consume concurrently, each one copies the words first
+         * and then claims them with a compare-and-swap, retrying if another reader was
+         * faster. When the pool is full the interrupt is turned off, and turned on again by
+         * the first read, so a full pool costs no CPU time.
+         *
+         * Errors are checked as the reference manual requires: a seed error restarts the
+         * generator and discards the pending word, a clock error (48 MHz clock too slow) is
+         * counted, and each word is compared with the previous one (FIPS PUB 140-2
+         * continuous test), dropping repetitions.
+         *
+         * serveInterrupt() must be called from HASH_RNG_IRQHandler.
+         */
+        template<unsigned N = 64>
+        class EntropyPool {
+            static_assert(N >= 2 && (N & (N - 1)) == 0, "pool size must be a power of two");
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_rng_t* const periph_base = (raw_rng_t*) Peripheral::p_RNG::periph_base;
+            static constexpr unsigned size = N;
+
+        private:
+            uint32_t pool[N];
+
+            // Free running indexes: the pool holds head - tail words
+            std::atomic<uint32_t> head;
+            std::atomic<uint32_t> tail;
+
+            uint32_t previous = 0;
+            bool first = true;
+
+            volatile uint32_t seed_errors = 0;
+            volatile uint32_t clock_errors = 0;
+            volatile uint32_t repetitions = 0;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            EntropyPool() : head(0), tail(0) {}
+
+            ~EntropyPool() {
+                stop();
+            }
+
+            /**
+             * Starts the generator and its interrupt. The 48 MHz PLL output must be running.
+             */
+            void start() {
+                Peripheral::p_RNG::enable();
+
+                first = true;
+                periph_base->CR = RNG_CR_RNGEN | RNG_CR_IE;
+
+                NVIC_ClearPendingIRQ(HASH_RNG_IRQn);
+                NVIC_EnableIRQ(HASH_RNG_IRQn);
+            }
+
+            /**
+             * Stops the generator. Words already in the pool can still be read.
+             * The interrupt vector is shared with HASH, so it is left enabled.
+             */
+            void stop() {
+                periph_base->CR = 0;
+            }
+
+            void serveInterrupt() {
+                uint32_t sr = periph_base->SR;
+
+                if (sr & RNG_SR_SEIS) {
+                    // Seed error: clear it, restart the generator and discard the output
+                    seed_errors = seed_errors + 1;
+                    periph_base->SR = ~RNG_SR_SEIS;
+                    periph_base->CR = 0;
+                    periph_base->CR = RNG_CR_RNGEN | RNG_CR_IE;
+                    first = true;
+                    return;
+                }
+
+                if (sr & RNG_SR_CEIS) {
+                    clock_errors = clock_errors + 1;
+                    periph_base->SR = ~RNG_SR_CEIS;
+                }
+
+                if (!(sr & RNG_SR_DRDY))
+                    return;
+
+                uint32_t h = head.load(std::memory_order_relaxed);
+                if (h - tail.load(std::memory_order_acquire) >= N) {
+                    // Full: sleep until a reader makes room
+                    periph_base->CR = RNG_CR_RNGEN;
+                    return;
+                }
+
+                uint32_t word = periph_base->DR;
+
+                // The first word after enabling is only kept for comparison
+                if (first || word == previous) {
+                    if (!first)
+                        repetitions = repetitions + 1;
+                    first = false;
+                    previous = word;
+                    return;
+                }
+
+                previous = word;
+                pool[h % N] = word;
+                head.store(h + 1, std::memory_order_release);
+            }
+
+            /**
+             * @return the number of random words currently in the pool
+             */
+            uint32_t available() const {
+                return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+            }
+
+            /**
+             * Takes a word from the pool, without waiting.
+             *
+             * @return false if the pool is empty
+             */
+            bool get(uint32_t& word) {
+                return read(&word, 1) == 1;
+            }
+
+            /**
+             * Copies random bytes from the pool, without waiting.
+             *
+             * @param buffer: destination
+             * @param bytes: number of bytes requested
+             * @return the number of bytes actually copied, less than bytes if the pool
+             * holds less
+             */
+            uint32_t fill(void *buffer, uint32_t bytes) {
+                uint8_t *out = (uint8_t *) buffer;
+                uint32_t done = 0;
+
+                // Whole words first, through a temporary if out is not aligned
+                while (bytes - done >= 4) {
+                    uint32_t chunk[8];
+                    uint32_t want = std::min<uint32_t>((bytes - done) / 4, 8);
+                    uint32_t got = read(chunk, want);
+
+                    for (uint32_t i = 0; i < 4 * got; i++)
+                        out[done + i] = ((uint8_t *) chunk)[i];
+                    done += 4 * got;
+
+                    if (got < want)
+                        return done;
+                }
+
+                if (done < bytes) {
+                    uint32_t word;
+                    if (!get(word))
+                        return done;
+
+                    for (; done < bytes; done++, word >>= 8)
+                        out[done] = word & 0xFF;
+                }
+
+                return done;
+            }
+
+            uint32_t seedErrors() const {
+                return seed_errors;
+            }
+
+            uint32_t clockErrors() const {
+                return clock_errors;
+            }
+
+            uint32_t repeatedWords() const {
+                return repetitions;
+            }
+
+            /**
+             * @return true if the generator is running and no error condition is active
+             */
+            bool healthy() const {
+                return (periph_base->CR & RNG_CR_RNGEN) && !(periph_base->SR & (RNG_SR_SECS | RNG_SR_CECS));
+            }
+
+        private:
+            // Copies up to count words, then claims them; retries if another reader won
+            uint32_t read(uint32_t *out, uint32_t count) {
+                uint32_t t = tail.load(std::memory_order_relaxed);
+                uint32_t n;
+
+                do {
+                    uint32_t h = head.load(std::memory_order_acquire);
+                    n = std::min(count, h - t);
+
+                    for (uint32_t i = 0; i < n; i++)
+                        out[i] = pool[(t + i) % N];
+                } while (n && !tail.compare_exchange_weak(t, t + n, std::memory_order_acq_rel,
+                                                          std::memory_order_relaxed));
+
+                // Room was made: wake up the producer (a single store, no read-modify-write)
+                if (n && (periph_base->CR & RNG_CR_RNGEN))
+                    periph_base->CR = RNG_CR_RNGEN | RNG_CR_IE;
+
+                return n;
+            }
+        };
+
+        /**
+         * Xoshiro128 (type)
+         *
+         * xoshiro128** pseudo random generator (Blackman, Vigna): 128 bit state, period
+         * 2^128 - 1, a few cycles per word. It is NOT cryptographically secure: use it for
+         * jitter, simulations, test data and the like, and take keys and nonces from
+         * EntropyPool directly.
+         *
+         * It satisfies the UniformRandomBitGenerator requirements, so it can drive the
+         * <random> distributions.
+         */
+        class Xoshiro128 {
+            //***************************
+            //* Subtypes                *
+            //***************************
+        public:
+            typedef uint32_t result_type;
+
+            //***************************
+            //* Members                 *
+            //***************************
+        private:
+            uint32_t s[4];
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        private:
+            static uint32_t rotl(uint32_t x, unsigned k) {
+                return (x << k) | (x >> (32 - k));
+            }
+
+        public:
+            /**
+             * @param seed: any value, expanded to the whole state with splitmix32
+             */
+            explicit Xoshiro128(uint32_t seed = 0x9E3779B9) {
+                this->seed(seed);
+            }
+
+            void seed(uint32_t seed) {
+                for (unsigned i = 0; i < 4; i++) {
+                    uint32_t z = (seed += 0x9E3779B9);
+                    z = (z ^ (z >> 16)) * 0x85EBCA6B;
+                    z = (z ^ (z >> 13)) * 0xC2B2AE35;
+                    s[i] = z ^ (z >> 16);
+                }
+            }
+
+            /**
+             * Seeds the generator from the entropy pool.
+             *
+             * @return false if the pool didn't hold enough words, the state is unchanged
+             */
+            template<unsigned N>
+            bool seed(EntropyPool<N>& pool) {
+                uint32_t state[4];
+
+                if (pool.fill(state, sizeof(state)) != sizeof(state) ||
+                    (state[0] | state[1] | state[2] | state[3]) == 0)
+                    return false;
+
+                for (unsigned i = 0; i < 4; i++)
+                    s[i] = state[i];
+                return true;
+            }
+
+            uint32_t next() {
+                uint32_t result = rotl(s[1] * 5, 7) * 9;
+                uint32_t t = s[1] << 9;
+
+                s[2] ^= s[0];
+                s[3] ^= s[1];
+                s[1] ^= s[2];
+                s[0] ^= s[3];
+                s[2] ^= t;
+                s[3] = rotl(s[3], 11);
+
+                return result;
+            }
+
+            uint32_t operator()() {
+                return next();
+            }
+
+            void fill(void *buffer, uint32_t bytes) {
+                uint8_t *out = (uint8_t *) buffer;
+
+                while (bytes) {
+                    uint32_t word = next();
+                    for (unsigned i = 0; i < 4 && bytes; i++, bytes--, word >>= 8)
+                        *out++ = word & 0xFF;
+                }
+            }
+
+            static constexpr uint32_t min() {
+                return 0;
+            }
+
+            static constexpr uint32_t max() {
+                return std::numeric_limits<uint32_t>::max();
+            }
+        };
+    }
+}
+
+#endif //RNG_HPP
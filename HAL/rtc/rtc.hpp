@@ -0,0 +1,601 @@
+#ifndef RTC_HPP
+#define RTC_HPP
+
+#include "../peripheral.hpp"
+#include "../backup/backup_sram.hpp"
+
+namespace HAL {
+    namespace Rtc {
+        typedef RTC_TypeDef raw_rtc_t;
+
+        constexpr uint32_t lse_freq = 32768;
+        constexpr uint32_t lsi_freq = 32000;
+
+        /**
+         * RTC clock source. The RTC and the LSE keep running in STOP and STANDBY modes and,
+         * with the LSE, on VBAT.
+         */
+        enum class Source {
+            LSE,
+            LSI
+        };
+
+        /**
+         * Calendar date and time, 24 hour format. The year counts from 2000 (0-99),
+         * weekday is 1 (Monday) to 7, subseconds are sub-second ticks since the start of
+         * the second (see Controller::ticksPerSecond()).
+         */
+        struct DateTime {
+            uint8_t year;
+            uint8_t month;
+            uint8_t day;
+            uint8_t weekday;
+            uint8_t hours;
+            uint8_t minutes;
+            uint8_t seconds;
+            uint32_t subseconds;
+        };
+
+        enum class Alarm {
+            A,
+            B
+        };
+
+        // Alarm fields compared by Controller::setAlarm(), the others are ignored
+        constexpr uint32_t match_seconds = 0x1;
+        constexpr uint32_t match_minutes = 0x2;
+        constexpr uint32_t match_hours = 0x4;
+        constexpr uint32_t match_day = 0x8;
+        constexpr uint32_t match_time = match_seconds | match_minutes | match_hours;
+
+        namespace detail {
+            constexpr uint32_t bcd(uint32_t value) {
+                return (value >> 4) * 10 + (value & 0xF);
+            }
+
+            constexpr uint32_t toBcd(uint32_t value) {
+                return ((value / 10) << 4) | (value % 10);
+            }
+
+            constexpr uint32_t secondsOfDay(uint32_t tr) {
+                return bcd((tr >> 16) & 0x3F) * 3600 + bcd((tr >> 8) & 0x7F) * 60 + bcd(tr & 0x7F);
+            }
+
+            constexpr uint32_t tr(const DateTime& time) {
+                return (toBcd(time.hours) << 16) | (toBcd(time.minutes) << 8) | toBcd(time.seconds);
+            }
+
+            constexpr uint32_t dr(const DateTime& time) {
+                return (toBcd(time.year) << 16) | (time.weekday << 13) | (toBcd(time.month) << 8) | toBcd(time.day);
+            }
+
+            // Days of the months before month (1-12) in a common year
+            constexpr uint32_t daysBefore(uint32_t month) {
+                return (367 * month - 362) / 12 - (month > 2 ? 2 : 0);
+            }
+
+            // Days since 2000-01-01; every year divisible by 4 in 2000-2099 is a leap year
+            constexpr uint32_t days(uint32_t year, uint32_t month, uint32_t day) {
+                return 365 * year + (year + 3) / 4 + daysBefore(month) + (year % 4 == 0 && month > 2 ? 1 : 0) +
+                       day - 1;
+            }
+
+            static_assert(days(0, 3, 1) == 60, "2000 is a leap year");
+            static_assert(days(24, 1, 1) == 8766, "days since 2000-01-01");
+        }
+
+        /**
+         * Controller (type)
+         *
+         * Real time clock in the backup domain: clock source and prescalers, sub-second
+         * counter and wakeup timer. The asynchronous prescaler divides the source down to
+         * the sub-second tick (ck_apre), the synchronous one down to 1 Hz: a small
+         * asynchronous prescaler gives finer sub-seconds, a large one draws less current.
+         *
+         * The wakeup timer raises EXTI line 22, the alarms line 17 and the timestamp line
+         * 21: all of them wake the core from STOP mode.
+         *
+         * The calendar reads (counter(), now(), microseconds()) are consistent and cheap
+         * enough to stamp every log record: with the shadow registers, reading SSR freezes
+         * TR and DR until DR is read, but after STOP mode they are stale until synchronize();
+         * with setShadowBypass(true) the counters are read directly, twice if a tick falls
+         * in between, and no synchronization is ever needed.
+         *
+         * The RTC has no clock gate of its own in p_RTC: enable() sets RTCEN in the backup
+         * domain control register.
+         *
+         * NOTE: these functions are thread-safe ONLY inside miosix environment,
+         *       in other environments you have to ensure it other ways.
+         */
+        class Controller {
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_rtc_t* const periph_base = (raw_rtc_t*) Peripheral::p_RTC::periph_base;
+
+            // EXTI lines of the wakeup timer, the alarms and the timestamp
+            static constexpr uint32_t wakeup_line = 1u << 22;
+            static constexpr uint32_t alarm_line = 1u << 17;
+            static constexpr uint32_t timestamp_line = 1u << 21;
+
+            // Smooth calibration range, in ppm (+512 and -511 pulses every 2^20)
+            static constexpr int32_t max_calibration_ppm = 488;
+            static constexpr int32_t min_calibration_ppm = -487;
+
+            // Polling iterations before the LSE, the LSI or an RTC flag is declared dead
+            static constexpr uint32_t timeout = 0x400000;
+
+        private:
+            static uint32_t& sourceFrequency() {
+                static uint32_t frequency = lse_freq;
+                return frequency;
+            }
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        private:
+#ifdef _MIOSIX
+            static void modify(volatile uint32_t& reg, uint32_t clear_mask, uint32_t value) {
+                miosix::FastInterruptDisableLock dLock;
+                reg = (reg & ~clear_mask) | value;
+            }
+#else
+            static void modify(volatile uint32_t& reg, uint32_t clear_mask, uint32_t value) {
+                reg = (reg & ~clear_mask) | value;
+            }
+#endif
+
+            static bool waitFor(volatile uint32_t& reg, uint32_t mask, uint32_t value) {
+                for (uint32_t i = 0; i < timeout; i++)
+                    if ((reg & mask) == value)
+                        return true;
+                return false;
+            }
+
+            static void unlock() {
+                periph_base->WPR = 0xCA;
+                periph_base->WPR = 0x53;
+            }
+
+            static void lock() {
+                periph_base->WPR = 0xFF;
+            }
+
+            // Clears rc_w0 flags of ISR without touching INIT
+            static void clearFlags(uint32_t flags) {
+                periph_base->ISR = ~(flags | RTC_ISR_INIT) | (periph_base->ISR & RTC_ISR_INIT);
+            }
+
+            static bool enterInit() {
+                periph_base->ISR |= RTC_ISR_INIT;
+                return waitFor(periph_base->ISR, RTC_ISR_INITF, RTC_ISR_INITF);
+            }
+
+            static void exitInit() {
+                periph_base->ISR &= ~RTC_ISR_INIT;
+            }
+
+            // Consistent SSR, TR and DR, with or without the shadow registers
+            static void read(uint32_t& ssr, uint32_t& tr, uint32_t& dr) {
+                bool bypass = periph_base->CR & RTC_CR_BYPSHAD;
+                do {
+                    // With the shadow registers, reading SSR freezes TR and DR until DR is read
+                    ssr = periph_base->SSR;
+                    tr = periph_base->TR;
+                    dr = periph_base->DR;
+                } while (bypass && (ssr != periph_base->SSR || tr != periph_base->TR));
+            }
+
+            static DateTime decode(uint32_t ssr, uint32_t tr, uint32_t dr) {
+                return DateTime{(uint8_t) detail::bcd((dr >> 16) & 0xFF), (uint8_t) detail::bcd((dr >> 8) & 0x1F),
+                                (uint8_t) detail::bcd(dr & 0x3F), (uint8_t) ((dr >> 13) & 0x7),
+                                (uint8_t) detail::bcd((tr >> 16) & 0x3F), (uint8_t) detail::bcd((tr >> 8) & 0x7F),
+                                (uint8_t) detail::bcd(tr & 0x7F),
+                                (periph_base->PRER & RTC_PRER_PREDIV_S) - (ssr & RTC_PRER_PREDIV_S)};
+            }
+
+            static uint32_t alarmEnable(Alarm alarm) {
+                return alarm == Alarm::A ? RTC_CR_ALRAE | RTC_CR_ALRAIE : RTC_CR_ALRBE | RTC_CR_ALRBIE;
+            }
+
+            static uint32_t alarmFlag(Alarm alarm) {
+                return alarm == Alarm::A ? RTC_ISR_ALRAF : RTC_ISR_ALRBF;
+            }
+
+        public:
+            /**
+             * Starts the source oscillator and the RTC. The calendar keeps running if it
+             * already was: the prescalers are written only if they differ.
+             *
+             * @param async_prescaler: 1 to 128, the sub-second tick is source / async_prescaler;
+             *        it must divide the source frequency
+             * @return false if the oscillator doesn't start, or if the RTC already runs
+             *         on another source (only a backup domain reset can change it)
+             */
+            static bool enable(Source source = Source::LSE, uint32_t async_prescaler = 8) {
+                Backup::Domain::enableWrites();
+
+                if (source == Source::LSE) {
+                    if (!(RCC->BDCR & RCC_BDCR_LSERDY)) {
+                        modify(RCC->BDCR, 0, RCC_BDCR_LSEON);
+                        if (!waitFor(RCC->BDCR, RCC_BDCR_LSERDY, RCC_BDCR_LSERDY))
+                            return false;
+                    }
+                } else {
+                    modify(RCC->CSR, 0, RCC_CSR_LSION);
+                    if (!waitFor(RCC->CSR, RCC_CSR_LSIRDY, RCC_CSR_LSIRDY))
+                        return false;
+                }
+
+                uint32_t select = source == Source::LSE ? RCC_BDCR_RTCSEL_0 : RCC_BDCR_RTCSEL_1;
+                uint32_t current = RCC->BDCR & RCC_BDCR_RTCSEL;
+                if (current && current != select)
+                    return false;
+
+                modify(RCC->BDCR, 0, select | RCC_BDCR_RTCEN);
+                sourceFrequency() = source == Source::LSE ? lse_freq : lsi_freq;
+
+                uint32_t sync_prescaler = sourceFrequency() / async_prescaler;
+                uint32_t prer = ((async_prescaler - 1) << 16) | (sync_prescaler - 1);
+
+                if (periph_base->PRER != prer || !(periph_base->ISR & RTC_ISR_INITS)) {
+                    unlock();
+                    if (!enterInit()) {
+                        lock();
+                        return false;
+                    }
+
+                    // Two separate writes, synchronous prescaler first
+                    periph_base->PRER = sync_prescaler - 1;
+                    periph_base->PRER = prer;
+                    exitInit();
+                    lock();
+                }
+
+                return true;
+            }
+
+            /**
+             * Source frequency the tick conversions use: the nominal LSE/LSI one, or a
+             * measured one (e.g. the LSI calibrated against the HSE).
+             */
+            static void setSourceFrequency(uint32_t frequency) {
+                sourceFrequency() = frequency;
+            }
+
+            static uint32_t getSourceFrequency() {
+                return sourceFrequency();
+            }
+
+            /**
+             * @return the sub-second ticks in a second (synchronous prescaler)
+             */
+            static uint32_t ticksPerSecond() {
+                return (periph_base->PRER & RTC_PRER_PREDIV_S) + 1;
+            }
+
+            /**
+             * @return the real duration of ticks sub-second ticks, from the source frequency
+             */
+            static uint64_t toMicroseconds(uint64_t ticks) {
+                uint32_t async_prescaler = ((periph_base->PRER & RTC_PRER_PREDIV_A) >> 16) + 1;
+                return ticks * async_prescaler * 1000000 / sourceFrequency();
+            }
+
+            /**
+             * @return the sub-second ticks in a day, the period of counter()
+             */
+            static uint32_t ticksPerDay() {
+                return 86400 * ticksPerSecond();
+            }
+
+            /**
+             * Waits for the calendar shadow registers to be updated: needed after a wakeup
+             * from STOP mode, during which they are frozen.
+             */
+            static bool synchronize() {
+                if (periph_base->CR & RTC_CR_BYPSHAD)
+                    return true;
+
+                unlock();
+                clearFlags(RTC_ISR_RSF);
+                lock();
+                return waitFor(periph_base->ISR, RTC_ISR_RSF, RTC_ISR_RSF);
+            }
+
+            /**
+             * @return sub-second ticks since midnight
+             */
+            static uint32_t counter() {
+                uint32_t ssr, tr, dr;
+                read(ssr, tr, dr);
+
+                uint32_t prediv_s = periph_base->PRER & RTC_PRER_PREDIV_S;
+                return detail::secondsOfDay(tr) * (prediv_s + 1) + (prediv_s - ssr);
+            }
+
+            /**
+             * @return the ticks from counter() value from to counter() value to, across
+             * midnight
+             */
+            static uint32_t elapsed(uint32_t from, uint32_t to) {
+                return to >= from ? to - from : ticksPerDay() - from + to;
+            }
+
+            /**
+             * Reads the calendar directly from the counters (BYPSHAD) rather than from the
+             * shadow registers: no synchronize() after STOP mode, at the cost of an
+             * occasional second read.
+             */
+            static void setShadowBypass(bool bypass) {
+                unlock();
+                periph_base->CR = bypass ? periph_base->CR | RTC_CR_BYPSHAD : periph_base->CR & ~RTC_CR_BYPSHAD;
+                lock();
+            }
+
+            /**
+             * Sets date and time; the sub-seconds restart from 0.
+             */
+            static bool setDateTime(const DateTime& time) {
+                unlock();
+                if (!enterInit()) {
+                    lock();
+                    return false;
+                }
+
+                periph_base->TR = detail::tr(time);
+                periph_base->DR = detail::dr(time);
+                exitInit();
+                lock();
+                return true;
+            }
+
+            static DateTime now() {
+                uint32_t ssr, tr, dr;
+                read(ssr, tr, dr);
+                return decode(ssr, tr, dr);
+            }
+
+            /**
+             * @return the microseconds since 2000-01-01 00:00:00 of a DateTime
+             */
+            static uint64_t microseconds(const DateTime& time) {
+                uint64_t seconds = (uint64_t) detail::days(time.year, time.month, time.day) * 86400 +
+                                   time.hours * 3600 + time.minutes * 60 + time.seconds;
+                return seconds * 1000000 + (uint64_t) time.subseconds * 1000000 / ticksPerSecond();
+            }
+
+            /**
+             * Wall-clock time, which keeps running in STOP mode: a few register reads and
+             * some arithmetic, suitable for stamping log records.
+             *
+             * @return the microseconds since 2000-01-01 00:00:00
+             */
+            static uint64_t microseconds() {
+                return microseconds(now());
+            }
+
+            /**
+             * Sets an alarm, which sets its flag and EXTI line 17 (rising edge, interrupt
+             * unmasked) when the fields in match equal time's; day matches the day of the
+             * month. subsecond_bits (0-15) low bits of the sub-second counter are compared
+             * too: with match 0, the alarm fires every 2^subsecond_bits ticks.
+             */
+            static bool setAlarm(Alarm alarm, const DateTime& time, uint32_t match = match_time,
+                                 uint32_t subsecond_bits = 0) {
+                uint32_t alrmar = detail::tr(time) | (detail::toBcd(time.day) << 24);
+                if (!(match & match_seconds))
+                    alrmar |= RTC_ALRMAR_MSK1;
+                if (!(match & match_minutes))
+                    alrmar |= RTC_ALRMAR_MSK2;
+                if (!(match & match_hours))
+                    alrmar |= RTC_ALRMAR_MSK3;
+                if (!(match & match_day))
+                    alrmar |= RTC_ALRMAR_MSK4;
+
+                uint32_t prediv_s = periph_base->PRER & RTC_PRER_PREDIV_S;
+                uint32_t ss = (prediv_s - time.subseconds) & RTC_ALRMASSR_SS;
+                uint32_t alrmassr = ((subsecond_bits > 15 ? 15 : subsecond_bits) << 24) | ss;
+
+                unlock();
+                periph_base->CR &= ~alarmEnable(alarm);
+                uint32_t writable = alarm == Alarm::A ? RTC_ISR_ALRAWF : RTC_ISR_ALRBWF;
+                if (!waitFor(periph_base->ISR, writable, writable)) {
+                    lock();
+                    return false;
+                }
+
+                if (alarm == Alarm::A) {
+                    periph_base->ALRMAR = alrmar;
+                    periph_base->ALRMASSR = alrmassr;
+                } else {
+                    periph_base->ALRMBR = alrmar;
+                    periph_base->ALRMBSSR = alrmassr;
+                }
+                clearAlarm(alarm);
+
+                modify(EXTI->RTSR, 0, alarm_line);
+                modify(EXTI->IMR, 0, alarm_line);
+
+                periph_base->CR |= alarmEnable(alarm);
+                lock();
+                return true;
+            }
+
+            static void stopAlarm(Alarm alarm) {
+                unlock();
+                periph_base->CR &= ~alarmEnable(alarm);
+                lock();
+                clearAlarm(alarm);
+            }
+
+            static bool alarmPending(Alarm alarm) {
+                return (periph_base->ISR & alarmFlag(alarm)) != 0;
+            }
+
+            /**
+             * Clears an alarm flag and line 17: call it from RTC_Alarm_IRQHandler().
+             */
+            static void clearAlarm(Alarm alarm) {
+                clearFlags(alarmFlag(alarm));
+                EXTI->PR = alarm_line;
+            }
+
+            /**
+             * Smooth digital calibration: adds or masks source pulses evenly over 32 s
+             * (2^20 pulses at 32768 Hz), in steps of 0.954 ppm.
+             *
+             * @param ppm: correction, positive if the source is slow
+             * @return false out of range (min_calibration_ppm to max_calibration_ppm) or if
+             *         the asynchronous prescaler is below 4, which +ppm needs
+             */
+            static bool setCalibration(int32_t ppm) {
+                if (ppm < min_calibration_ppm || ppm > max_calibration_ppm)
+                    return false;
+
+                int32_t pulses = (int32_t) (((int64_t) ppm * (1 << 20) + (ppm >= 0 ? 500000 : -500000)) / 1000000);
+                uint32_t calr = pulses > 0 ? RTC_CALR_CALP | (512 - pulses) : (uint32_t) -pulses;
+                if (pulses > 0 && ((periph_base->PRER & RTC_PRER_PREDIV_A) >> 16) < 3)
+                    return false;
+
+                unlock();
+                if (!waitFor(periph_base->ISR, RTC_ISR_RECALPF, 0)) {
+                    lock();
+                    return false;
+                }
+                periph_base->CALR = calr;
+                lock();
+                return true;
+            }
+
+            /**
+             * @return the correction in use, in ppm
+             */
+            static int32_t getCalibration() {
+                uint32_t calr = periph_base->CALR;
+                int32_t pulses = (calr & RTC_CALR_CALP ? 512 : 0) - (int32_t) (calr & RTC_CALR_CALM);
+                return (int32_t) ((int64_t) pulses * 1000000 / (1 << 20));
+            }
+
+            /**
+             * Starts timestamping: an edge on RTC_AF1 (PC13, in input mode) latches the
+             * calendar and sets the timestamp flag and EXTI line 21 (rising edge, interrupt
+             * unmasked).
+             */
+            static void enableTimestamp(bool falling_edge = false) {
+                unlock();
+                periph_base->CR &= ~(RTC_CR_TSE | RTC_CR_TSIE);
+                clearFlags(RTC_ISR_TSF | RTC_ISR_TSOVF);
+                periph_base->CR = (periph_base->CR & ~RTC_CR_TSEDGE) | (falling_edge ? RTC_CR_TSEDGE : 0);
+
+                modify(EXTI->RTSR, 0, timestamp_line);
+                modify(EXTI->IMR, 0, timestamp_line);
+
+                periph_base->CR |= RTC_CR_TSE | RTC_CR_TSIE;
+                lock();
+                EXTI->PR = timestamp_line;
+            }
+
+            static void disableTimestamp() {
+                unlock();
+                periph_base->CR &= ~(RTC_CR_TSE | RTC_CR_TSIE);
+                lock();
+                clearFlags(RTC_ISR_TSF | RTC_ISR_TSOVF);
+                EXTI->PR = timestamp_line;
+            }
+
+            /**
+             * Reads and clears the last timestamp: call it from TAMP_STAMP_IRQHandler().
+             * The timestamp has no year, the current one is used.
+             *
+             * @param overflow: set if further events came before this read and were lost
+             * @return false if no event was timestamped
+             */
+            static bool readTimestamp(DateTime& time, bool& overflow) {
+                if (!(periph_base->ISR & RTC_ISR_TSF))
+                    return false;
+
+                uint32_t year = now().year;
+                time = decode(periph_base->TSSSR, periph_base->TSTR, periph_base->TSDR | (detail::toBcd(year) << 16));
+                overflow = periph_base->ISR & RTC_ISR_TSOVF;
+
+                clearFlags(RTC_ISR_TSF | RTC_ISR_TSOVF);
+                EXTI->PR = timestamp_line;
+                return true;
+            }
+
+            /**
+             * Starts the wakeup timer, which sets its flag and EXTI line 22 (rising edge,
+             * interrupt unmasked) after us microseconds, then again every us.
+             *
+             * @return the period programmed, in us (rounded down to the timer resolution:
+             *         61 us up to 4 s, 488 us up to 32 s, then 1 s), 0 on failure
+             */
+            static uint32_t startWakeup(uint32_t us) {
+                uint32_t fast = sourceFrequency() / 2;
+                uint32_t slow = sourceFrequency() / 16;
+
+                uint32_t select;
+                uint32_t counts;
+                uint32_t period;
+                if ((uint64_t) us * fast / 1000000 <= 0x10000) {
+                    select = RTC_CR_WUCKSEL_1 | RTC_CR_WUCKSEL_0;
+                    counts = (uint64_t) us * fast / 1000000;
+                    period = (uint64_t) counts * 1000000 / fast;
+                } else if ((uint64_t) us * slow / 1000000 <= 0x10000) {
+                    select = 0;
+                    counts = (uint64_t) us * slow / 1000000;
+                    period = (uint64_t) counts * 1000000 / slow;
+                } else {
+                    select = RTC_CR_WUCKSEL_2;
+                    counts = us / 1000000 > 0x10000 ? 0x10000 : us / 1000000;
+                    period = counts * 1000000;
+                }
+
+                if (counts == 0)
+                    return 0;
+
+                unlock();
+                periph_base->CR &= ~(RTC_CR_WUTE | RTC_CR_WUTIE);
+                if (!waitFor(periph_base->ISR, RTC_ISR_WUTWF, RTC_ISR_WUTWF)) {
+                    lock();
+                    return 0;
+                }
+
+                periph_base->WUTR = counts - 1;
+                periph_base->CR = (periph_base->CR & ~RTC_CR_WUCKSEL) | select;
+                clearWakeup();
+
+                modify(EXTI->RTSR, 0, wakeup_line);
+                modify(EXTI->IMR, 0, wakeup_line);
+
+                periph_base->CR |= RTC_CR_WUTE | RTC_CR_WUTIE;
+                lock();
+                return period;
+            }
+
+            static void stopWakeup() {
+                unlock();
+                periph_base->CR &= ~(RTC_CR_WUTE | RTC_CR_WUTIE);
+                lock();
+                clearWakeup();
+            }
+
+            static bool wakeupFlag() {
+                return (periph_base->ISR & RTC_ISR_WUTF) != 0;
+            }
+
+            /**
+             * Clears the wakeup flag and its EXTI line: call it from RTC_WKUP_IRQHandler().
+             */
+            static void clearWakeup() {
+                clearFlags(RTC_ISR_WUTF);
+                EXTI->PR = wakeup_line;
+            }
+        };
+    }
+}
+
+#endif //RTC_HPP
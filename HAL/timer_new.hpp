@@ -2,6 +2,7 @@
 #define TIMER_NEW_HPP
 
 #include "peripheral.hpp"
+#include "gpio/alternate_function.hpp"
 #include <cmath>
 #include <algorithm>
 
@@ -9,6 +10,15 @@ namespace HAL {
     namespace Timer {
         typedef TIM_TypeDef raw_timer_t;
 
+        /**
+         * @return the alternate function signal of a timer channel (1 to 4)
+         */
+        constexpr Gpio::Af::Signal channelSignal(unsigned channel) {
+            return channel == 1 ? Gpio::Af::Signal::CH1 :
+                   channel == 2 ? Gpio::Af::Signal::CH2 :
+                   channel == 3 ? Gpio::Af::Signal::CH3 : Gpio::Af::Signal::CH4;
+        }
+
         /**
          * TimerBase (type)
          *
@@ -32,8 +42,11 @@ namespace HAL {
 
         public:
             static constexpr raw_timer_t* const periph_base = (raw_timer_t*) P::periph_base;
-            static constexpr uint32_t bus_freq() {
-                return P::bus::bus_freq();
+            /**
+             * @return the counter clock before the prescaler (the timer kernel clock)
+             */
+            static uint32_t bus_freq() {
+                return P::bus::timer_freq();
             }
 
             //***************************
@@ -56,26 +69,38 @@ namespace HAL {
             void enable() {
                 if (!is_enabled()) {
                     periph_base->CR1 |= TIM_CR1_CEN;
+                    enabled = true;
                 }
             }
 
             void disable() {
                 if (is_enabled()) {
                     periph_base->CR1 &= ~TIM_CR1_CEN;
+                    enabled = false;
                 }
             }
             
+            /**
+             * @return the alternate function number of the timer's pins, or -1 if the
+             * timer has no pins (TIM6, TIM7). See Gpio::Af for the complete table.
+             */
             static constexpr int mapAlternateFunction()
             {
-                return P::periph_base == Peripheral::p_TIM1::periph_base? 1 :
-                       P::periph_base == Peripheral::p_TIM2::periph_base? 1 :
-                       P::periph_base == Peripheral::p_TIM3::periph_base? 2 :
-                       P::periph_base == Peripheral::p_TIM4::periph_base? 2 :
-                       P::periph_base == Peripheral::p_TIM5::periph_base? 2 :
-                       P::periph_base == Peripheral::p_TIM8::periph_base? 3 :
-                       P::periph_base == Peripheral::p_TIM9::periph_base? 3 :
-                       P::periph_base == Peripheral::p_TIM10::periph_base? 3 :
-                       P::periph_base == Peripheral::p_TIM11::periph_base? 3 : 0;  
+                return Gpio::Af::lookup(P::periph_base);
+            }
+            
+            /**
+             * @return the alternate function number connecting signal S of the timer
+             * (e.g. channelSignal(2)) to PIN. Using a pin that doesn't carry that signal
+             * is a compile error, even if it carries another one of the same timer.
+             */
+            template<Gpio::Af::Signal S, typename PIN>
+            static constexpr unsigned mapAlternateFunction()
+            {
+                static_assert(Gpio::Af::lookup(P::periph_base, S, PIN::port_index, PIN::number) >= 0,
+                              "the pin doesn't carry this signal of the timer");
+                
+                return Gpio::Af::lookup(P::periph_base, S, PIN::port_index, PIN::number);
             }
         };   
         
@@ -255,9 +280,9 @@ namespace HAL {
             
             bool checkReloadEvent()
             {
-                if(periph_base->TIM_SR & TIM_SR_UIF)
+                if(periph_base->SR & TIM_SR_UIF)
                 {
-                    periph_base->TIM_SR &= ~TIM_SR_UIF;
+                    periph_base->SR = ~TIM_SR_UIF;
                     return true;
                 }
                 
@@ -432,6 +457,34 @@ namespace HAL {
                 }
             }
 
+            /**
+             * Enables a channel and configures its output pin. The pin is switched to
+             * alternate mode and mapped to the timer, so no other initialization is needed.
+             * This function must be called with timer stopped.
+             * 
+             * @param PIN: the Gpio::Pin the channel is routed to, it must carry that
+             * channel (a compile error otherwise)
+             * @param CHANNEL: the channel number, between 1 and 4. Please note that not all
+             * the timers have four channels!!
+             * 
+             * TODO: make this function thread safe
+             */
+            
+            template<typename PIN, uint8_t CHANNEL>
+            void enable()
+            {
+                if(TimerBase<P>::is_enabled())
+                    return;
+                
+                Gpio::Configuration<
+                        Gpio::PinConfig<PIN, Gpio::Mode::ALTERNATE, Gpio::Speed::HIGH, Gpio::Pull::NONE,
+                                        Gpio::Type::PUSH_PULL,
+                                        TimerBase<P>::template mapAlternateFunction<channelSignal(CHANNEL), PIN>()>
+                >::apply();
+                
+                enable(CHANNEL);
+            }
+
 #ifdef _MIOSIX            
             /**
              * Enables a channel. Calling this function will "connect" the channel to the
@@ -15,17 +15,25 @@ namespace HAL {
          * and it has a 16 bit programmable prescaler to divide the counter's input clock frequency.
          * Counter's original (not divided by prescaler) clock frequency can be get calling the bus_freq() method
          * 
+         * The counter frequency is kept across clock changes made through Clock::Control:
+         * the prescaler is recomputed, and the new one is loaded at the next update event.
+         * After setUpdateFrequency() the update rate is kept instead: prescaler and auto
+         * reload are recomputed together, and retimeFailed() tells when the new clock
+         * can't produce that rate (to the Hz).
+         * 
          * refer to programming manual for further informations
          * 
          */
         template<typename P>
-        class BasicTimer : public TimerBase<P> {
+        class BasicTimer : public TimerBase<P>, private Clock::Listener {
             //***************************
             //* Members                 *
             //***************************
         private:
-//             uint32_t counter_freq;
-//             uint16_t reload_val;
+            uint32_t counter_freq;
+            // Update events per second kept across clock changes, 0 to keep counter_freq
+            uint32_t update_freq = 0;
+            bool retime_failed = false;
 
             //***************************
             //* Methods                 *
@@ -43,11 +51,11 @@ namespace HAL {
              * 
              */
 
-            BasicTimer(uint32_t counter_freq, uint16_t reload_val = 65535) /* :
-                    counter_freq(counter_freq), reload_val(reload_val) */
+            BasicTimer(uint32_t counter_freq, uint16_t reload_val = 65535) :
+                    Clock::Listener(retime), counter_freq(counter_freq)
             {
                 // Set counter frequency through prescaler
-                periph_base->PSC = (bus_freq() / counter_freq) - 1;
+                periph_base->PSC = TimerBase<P>::prescalerFor(counter_freq);
                 
                 // Set counter's auto reload value
                 periph_base->ARR = reload_val;
@@ -136,6 +144,7 @@ namespace HAL {
             void setPrescaler(uint16_t value)
             {
                 periph_base->PSC = value;
+                counter_freq = bus_freq() / (value + 1);
             }
             
             /**
@@ -182,14 +191,75 @@ namespace HAL {
             
             bool checkReloadEvent()
             {
-                if(periph_base->TIM_SR & TIM_SR_UIF)
+                if(periph_base->SR & TIM_SR_UIF)
                 {
-                    periph_base->TIM_SR &= ~TIM_SR_UIF;
+                    periph_base->SR = ~TIM_SR_UIF;
                     return true;
                 }
                 
                 return false;
             }
+
+            /**
+             * Sets prescaler and auto reload for freq update events per second. The timer
+             * runs unprescaled as long as possible, so that the period is as accurate as
+             * possible. From now on clock changes keep this rate, rather than the counter
+             * frequency. The new values are loaded at the next update event.
+             *
+             * @param freq: update events per second
+             * @return false if freq is 0 or above half the timer clock (the counter
+             * doesn't run with a null auto reload): nothing is changed
+             */
+            bool setUpdateFrequency(uint32_t freq)
+            {
+                if (freq == 0 || freq > bus_freq() / 2)
+                    return false;
+
+                program(freq);
+                update_freq = getUpdateFrequency();
+                retime_failed = false;
+                return true;
+            }
+
+            /**
+             * @return update events per second, from the current prescaler and auto reload
+             */
+            uint32_t getUpdateFrequency() const
+            {
+                return bus_freq() / ((periph_base->PSC + 1) * (periph_base->ARR + 1));
+            }
+
+            /**
+             * @return true if the last clock change couldn't keep the rate set by
+             * setUpdateFrequency(): the timer runs at the nearest one it could produce
+             */
+            bool retimeFailed() const
+            {
+                return retime_failed;
+            }
+
+        private:
+            // Closest prescaler and auto reload for freq at the current clock, ticks >= 2
+            void program(uint32_t freq)
+            {
+                uint32_t ticks = std::max<uint32_t>(bus_freq() / freq, 2);
+                uint32_t prescaler = std::min<uint32_t>((ticks - 1) / 65536, 0xFFFF);
+
+                setPrescaler(prescaler);
+                setAutoReload(std::min<uint32_t>(ticks / (prescaler + 1), 0x10000) - 1);
+            }
+
+            static void retime(Clock::Listener& listener)
+            {
+                BasicTimer& timer = static_cast<BasicTimer&>(listener);
+                if (timer.update_freq == 0) {
+                    periph_base->PSC = TimerBase<P>::prescalerFor(timer.counter_freq);
+                    return;
+                }
+
+                timer.program(timer.update_freq);
+                timer.retime_failed = timer.getUpdateFrequency() != timer.update_freq;
+            }
         };
     }
 }
@@ -17,17 +17,21 @@ namespace HAL {
          * In order to make this class as general as possible actually only edge-aligned, pwm mode 1
          * signal generation is covered
          * 
+         * The counter frequency, and so the pwm frequency, is kept across clock changes made
+         * through Clock::Control: the prescaler is recomputed, and the new one is loaded at the
+         * end of the current period, without glitches on the outputs.
+         * 
          * Please refer to MCU's datasheet and programming manual
          * for further informations.
          * 
          */
         template<typename P>
-        class PwmGenerator : public TimerBase<P> {
+        class PwmGenerator : public TimerBase<P>, private Clock::Listener {
             //***************************
             //* Members                 *
             //***************************
         private:
-//             uint32_t counter_freq;
+            uint32_t counter_freq;
             uint32_t period;
 
 #ifdef _MIOSIX           
@@ -47,10 +51,11 @@ namespace HAL {
              * @param isAdvanced: set it to true if you are using advanced control timers (TIM1 & TIM8)
              */
 
-            PwmGenerator(uint32_t counter_freq, uint32_t period, bool isAdvanced = false) : /* counter_freq(counter_freq),*/ period(period)
+            PwmGenerator(uint32_t counter_freq, uint32_t period, bool isAdvanced = false) :
+                    Clock::Listener(retime), counter_freq(counter_freq), period(period)
             {
                 // Set counter frequency through prescaler
-                periph_base->PSC = (bus_freq() / counter_freq) - 1;
+                periph_base->PSC = TimerBase<P>::prescalerFor(counter_freq);
                 
                 // Set pwm period through reload register value
                 periph_base->ARR = period;
@@ -80,12 +85,11 @@ namespace HAL {
              * @param sigFreq: the generated pwm signal's frequency expressed in hertz
              * @param isAdvanced: set it to true if you are using advanced control timers (TIM1 & TIM8)
              */
-            PwmGenerator(uint32_t sigFreq, bool isAdvanced = false)
+            PwmGenerator(uint32_t sigFreq, bool isAdvanced = false) :
+                    Clock::Listener(retime), counter_freq(0xFFFF * sigFreq), period(0xFFFF)
             {
-                period(0xFFFF);
-                
                 // Set counter frequency through prescaler
-                periph_base->PSC = (bus_freq() / (0xFFFF * sigFreq)) - 1;
+                periph_base->PSC = TimerBase<P>::prescalerFor(counter_freq);
                 
                 // Set pwm period through reload register value
                 periph_base->ARR = 0xFFFF;
@@ -174,6 +178,34 @@ namespace HAL {
                 }
             }
 
+            /**
+             * Enables a channel and configures its output pin. The pin is switched to
+             * alternate mode and mapped to the timer, so no other initialization is needed.
+             * This function must be called with timer stopped.
+             * 
+             * @param PIN: the Gpio::Pin the channel is routed to, it must carry that
+             * channel (a compile error otherwise)
+             * @param CHANNEL: the channel number, between 1 and 4. Please note that not all
+             * the timers have four channels!!
+             * 
+             * TODO: make this function thread safe
+             */
+            
+            template<typename PIN, uint8_t CHANNEL>
+            void chEnable()
+            {
+                if(TimerBase<P>::is_enabled())
+                    return;
+                
+                Gpio::Configuration<
+                        Gpio::PinConfig<PIN, Gpio::Mode::ALTERNATE, Gpio::Speed::HIGH, Gpio::Pull::NONE,
+                                        Gpio::Type::PUSH_PULL,
+                                        TimerBase<P>::template mapAlternateFunction<channelSignal(CHANNEL), PIN>()>
+                >::apply();
+                
+                chEnable(CHANNEL);
+            }
+
 #ifdef _MIOSIX            
             /**
              * Enables a channel. Calling this function will "connect" the channel to the
@@ -358,7 +390,13 @@ namespace HAL {
                 
                 setOnPeriod(channel, duty*period);                
             }
-            
+
+        private:
+            static void retime(Clock::Listener& listener)
+            {
+                PwmGenerator& generator = static_cast<PwmGenerator&>(listener);
+                periph_base->PSC = TimerBase<P>::prescalerFor(generator.counter_freq);
+            }
         };
     }
 }
@@ -16,11 +16,14 @@ namespace HAL {
          * Both of them are expressed in terms of number of counter ticks
          * (one counter tick in seconds = 1/counter_freq)
          * 
+         * The counter frequency is kept across clock changes made through Clock::Control:
+         * the measure in progress when the clock changes may be wrong.
+         * 
          * Please refer to MCU's datasheet and programming manual
          * for further informations.
          */
         template<typename P>
-        class PwmMeasure : public TimerBase<P> {
+        class PwmMeasure : public TimerBase<P>, private Clock::Listener {
             //***************************
             //* Members                 *
             //***************************
@@ -41,10 +44,10 @@ namespace HAL {
              * otherwise the counter will incur in a rollover, leading to wrong measurements
              */
             
-            PwmMeasure(uint32_t counter_freq) : counter_freq(counter_freq)
+            PwmMeasure(uint32_t counter_freq) : Clock::Listener(retime), counter_freq(counter_freq)
             {
                 // Set count frequency
-                periph_base->PSC = (bus_freq() / counter_freq) - 1;
+                periph_base->PSC = TimerBase<P>::prescalerFor(counter_freq);
 
                 // IC1 mapped on TI1
                 periph_base->CCMR1 |= TIM_CCMR1_CC1S_0;
@@ -126,6 +129,13 @@ namespace HAL {
             {
                 return periph_base->CCR1;
             }
+
+        private:
+            static void retime(Clock::Listener& listener)
+            {
+                PwmMeasure& measure = static_cast<PwmMeasure&>(listener);
+                periph_base->PSC = TimerBase<P>::prescalerFor(measure.counter_freq);
+            }
         };        
     }    
 }
@@ -2,6 +2,8 @@
 #define TIMER_HPP
 
 #include "../peripheral.hpp"
+#include "../clock/clock.hpp"
+#include "../gpio/alternate_function.hpp"
 
 #include <cmath>
 #include <algorithm>
@@ -10,6 +12,15 @@ namespace HAL {
     namespace Timer {
         typedef TIM_TypeDef raw_timer_t;
 
+        /**
+         * @return the alternate function signal of a timer channel (1 to 4)
+         */
+        constexpr Gpio::Af::Signal channelSignal(unsigned channel) {
+            return channel == 1 ? Gpio::Af::Signal::CH1 :
+                   channel == 2 ? Gpio::Af::Signal::CH2 :
+                   channel == 3 ? Gpio::Af::Signal::CH3 : Gpio::Af::Signal::CH4;
+        }
+
         /**
          * TimerBase (type)
          *
@@ -33,13 +44,26 @@ namespace HAL {
 
         public:
             static constexpr raw_timer_t* const periph_base = (raw_timer_t*) P::periph_base;
-            static constexpr uint32_t bus_freq() {
-                return P::bus::bus_freq();
+            /**
+             * @return the counter clock before the prescaler (the timer kernel clock)
+             */
+            static uint32_t bus_freq() {
+                return P::bus::timer_freq();
             }
 
             //***************************
             //* Methods                 *
             //***************************
+        protected:
+            /**
+             * @return the PSC value closest to a counter_freq tick at the current clock,
+             * clipped to the 16 bit range
+             */
+            static uint32_t prescalerFor(uint32_t counter_freq) {
+                uint32_t ratio = bus_freq() / counter_freq;
+                return ratio == 0 ? 0 : ratio > 0x10000 ? 0xFFFF : ratio - 1;
+            }
+
         public:
             TimerBase() {
                 P::enable();
@@ -57,26 +81,38 @@ namespace HAL {
             void enable() {
                 if (!is_enabled()) {
                     periph_base->CR1 |= TIM_CR1_CEN;
+                    enabled = true;
                 }
             }
 
             void disable() {
                 if (is_enabled()) {
                     periph_base->CR1 &= ~TIM_CR1_CEN;
+                    enabled = false;
                 }
             }
             
+            /**
+             * @return the alternate function number of the timer's pins, or -1 if the
+             * timer has no pins (TIM6, TIM7). See Gpio::Af for the complete table.
+             */
             static constexpr int mapAlternateFunction()
             {
-                return P::periph_base == Peripheral::p_TIM1::periph_base? 1 :
-                       P::periph_base == Peripheral::p_TIM2::periph_base? 1 :
-                       P::periph_base == Peripheral::p_TIM3::periph_base? 2 :
-                       P::periph_base == Peripheral::p_TIM4::periph_base? 2 :
-                       P::periph_base == Peripheral::p_TIM5::periph_base? 2 :
-                       P::periph_base == Peripheral::p_TIM8::periph_base? 3 :
-                       P::periph_base == Peripheral::p_TIM9::periph_base? 3 :
-                       P::periph_base == Peripheral::p_TIM10::periph_base? 3 :
-                       P::periph_base == Peripheral::p_TIM11::periph_base? 3 : 0;  
+                return Gpio::Af::lookup(P::periph_base);
+            }
+            
+            /**
+             * @return the alternate function number connecting signal S of the timer
+             * (e.g. channelSignal(2)) to PIN. Using a pin that doesn't carry that signal
+             * is a compile error, even if it carries another one of the same timer.
+             */
+            template<Gpio::Af::Signal S, typename PIN>
+            static constexpr unsigned mapAlternateFunction()
+            {
+                static_assert(Gpio::Af::lookup(P::periph_base, S, PIN::port_index, PIN::number) >= 0,
+                              "the pin doesn't carry this signal of the timer");
+                
+                return Gpio::Af::lookup(P::periph_base, S, PIN::port_index, PIN::number);
             }
         };   
     }
@@ -0,0 +1,308 @@
+#ifndef TIMER_SERVICE_HPP
+#define TIMER_SERVICE_HPP
+
+#include "basic_timer.hpp"
+
+namespace HAL {
+    namespace Timer {
+
+        /**
+         * @return the update interrupt of a timer with a vector of its own (TIM2-TIM7)
+         */
+        constexpr IRQn_Type updateIrq(__pointer base) {
+            return base == TIM2_BASE ? TIM2_IRQn :
+                   base == TIM3_BASE ? TIM3_IRQn :
+                   base == TIM4_BASE ? TIM4_IRQn :
+                   base == TIM5_BASE ? TIM5_IRQn :
+                   base == TIM6_BASE ? TIM6_DAC_IRQn : TIM7_IRQn;
+        }
+
+        constexpr bool hasUpdateIrq(__pointer base) {
+            return base == TIM2_BASE || base == TIM3_BASE || base == TIM4_BASE || base == TIM5_BASE ||
+                   base == TIM6_BASE || base == TIM7_BASE;
+        }
+
+        /**
+         * @return the largest auto-reload value: TIM2 and TIM5 are 32 bit timers
+         */
+        constexpr uint32_t maxReload(__pointer base) {
+            return base == TIM2_BASE || base == TIM5_BASE ? 0xFFFFFFFF : 0xFFFF;
+        }
+
+        /**
+         * TimerService (type)
+         *
+         * Monotonic 64 bit time, in ticks of TICK_HZ, and up to SLOTS one-shot timeouts
+         * on one timer, without a periodic tick: the auto-reload register is moved to the
+         * next deadline, so the update interrupt fires only when a timeout is due or the
+         * counter reaches its end (every 65536 ticks on 16 bit timers). Between them the
+         * core can sleep; nextDeadline() tells the idle loop for how long.
+         *
+         * Callbacks run in the update interrupt, which must be forwarded:
+         *     void TIM7_IRQHandler() { service.onInterrupt(); }
+         *
+         * schedule() and cancel() mask the timer interrupt while they run, so they can be
+         * used from threads and from other interrupts; now() is lock-free.
+         *
+         * On clock changes made through Clock::Control the ticks counted so far are
+         * folded into the time and the new prescaler is loaded at once, so now() and the
+         * deadlines keep their rate.
+         */
+        template<typename P, uint32_t TICK_HZ = 1000000, unsigned SLOTS = 16>
+        class TimerService : private Clock::Listener {
+            static_assert(hasUpdateIrq(P::periph_base), "the timer service needs TIM2-TIM7");
+
+            //***************************
+            //* Subtypes                *
+            //***************************
+        public:
+            typedef void (*Callback)(void *context);
+
+        private:
+            struct Slot {
+                uint64_t deadline;
+                Callback callback;
+                void *context;
+            };
+
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_timer_t* const periph_base = (raw_timer_t*) P::periph_base;
+            static constexpr IRQn_Type irq = updateIrq(P::periph_base);
+            static constexpr uint32_t max_reload = maxReload(P::periph_base);
+            static constexpr uint32_t tick_freq = TICK_HZ;
+            static constexpr uint64_t never = ~0ull;
+
+            // Ticks the next update is normally kept ahead of the counter; program()
+            // repairs the period if the counter got past it all the same
+            static constexpr uint32_t margin = 2;
+
+        private:
+            BasicTimer<P> timer;
+            Slot slots[SLOTS];
+
+            // Ticks at the start of the current counter period, and its change counter
+            volatile uint64_t base = 0;
+            volatile uint32_t sequence = 0;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            TimerService() : Clock::Listener(retime), timer(TICK_HZ) {
+                for (unsigned i = 0; i < SLOTS; i++)
+                    slots[i].callback = nullptr;
+
+                // Immediate auto-reload writes, update events from overflows only
+                periph_base->CR1 = (periph_base->CR1 & ~TIM_CR1_ARPE) | TIM_CR1_URS;
+                periph_base->ARR = max_reload;
+                periph_base->EGR = TIM_EGR_UG;
+                periph_base->SR = 0;
+                periph_base->DIER |= TIM_DIER_UIE;
+
+                NVIC_ClearPendingIRQ(irq);
+                NVIC_EnableIRQ(irq);
+                timer.start();
+            }
+
+            ~TimerService() {
+                NVIC_DisableIRQ(irq);
+                periph_base->DIER &= ~TIM_DIER_UIE;
+            }
+
+            /**
+             * @return the ticks elapsed since construction
+             */
+            uint64_t now() const {
+                uint32_t seen;
+                uint64_t start;
+                uint64_t count;
+                bool wrapped;
+
+                do {
+                    seen = sequence;
+                    start = base;
+                    count = periph_base->CNT;
+                    wrapped = periph_base->SR & TIM_SR_UIF;
+                    if (wrapped)
+                        count = (uint64_t) periph_base->ARR + 1 + periph_base->CNT;
+                } while (seen != sequence);
+
+                return start + count;
+            }
+
+            /**
+             * Calls callback(context) from the timer interrupt once now() >= deadline.
+             *
+             * @return a handle for cancel(), -1 if all the slots are taken
+             */
+            int scheduleAt(uint64_t deadline, Callback callback, void *context = nullptr) {
+                int handle = -1;
+
+                NVIC_DisableIRQ(irq);
+                for (unsigned i = 0; i < SLOTS; i++) {
+                    if (!slots[i].callback) {
+                        slots[i] = Slot{deadline, callback, context};
+                        handle = i;
+                        break;
+                    }
+                }
+                if (handle >= 0)
+                    program();
+                NVIC_EnableIRQ(irq);
+
+                return handle;
+            }
+
+            int schedule(uint64_t delay, Callback callback, void *context = nullptr) {
+                return scheduleAt(now() + delay, callback, context);
+            }
+
+            /**
+             * Cancels a timeout that hasn't fired yet. A handle is reused once its timeout
+             * fires or is cancelled.
+             */
+            void cancel(int handle) {
+                if (handle < 0 || handle >= (int) SLOTS)
+                    return;
+
+                NVIC_DisableIRQ(irq);
+                slots[handle].callback = nullptr;
+                program();
+                NVIC_EnableIRQ(irq);
+            }
+
+            /**
+             * @return the earliest deadline, never if there is none
+             */
+            uint64_t nextDeadline() const {
+                uint64_t next = never;
+                for (unsigned i = 0; i < SLOTS; i++)
+                    if (slots[i].callback && slots[i].deadline < next)
+                        next = slots[i].deadline;
+                return next;
+            }
+
+            /**
+             * Update interrupt: advances the time and runs the timeouts that are due.
+             */
+            void onInterrupt() {
+                if (!(periph_base->SR & TIM_SR_UIF))
+                    return;
+
+                sequence++;
+                periph_base->SR = ~TIM_SR_UIF;
+                base += (uint64_t) periph_base->ARR + 1;
+                sequence++;
+
+                dispatch();
+            }
+
+            /**
+             * Freezes the time before a low power mode that stops the timer clock (STOP):
+             * the interrupts must be disabled until resume().
+             */
+            void suspend() {
+                timer.stop();
+            }
+
+            /**
+             * Restarts the time after suspend(), adding the ticks slept (measured by a
+             * clock that kept running, e.g. the RTC). Timeouts due meanwhile fire as soon
+             * as the interrupts are enabled again.
+             */
+            void resume(uint64_t slept) {
+                sequence++;
+                base += slept;
+                sequence++;
+
+                timer.start();
+                if (!(periph_base->SR & TIM_SR_UIF))
+                    program();
+            }
+
+        private:
+            // The counter and prescaler now at the new clock: the inherited BasicTimer
+            // re-timing would only load the prescaler at the next update, possibly far
+            static void retime(Clock::Listener& listener) {
+                TimerService& service = static_cast<TimerService&>(listener);
+
+                NVIC_DisableIRQ(irq);
+                service.sequence++;
+                if (periph_base->SR & TIM_SR_UIF) {
+                    // The update due runs from program() below
+                    periph_base->SR = ~TIM_SR_UIF;
+                    service.base += (uint64_t) periph_base->ARR + 1;
+                }
+                service.base += periph_base->CNT;
+                periph_base->PSC = prescaler();
+                periph_base->EGR = TIM_EGR_UG;
+                service.sequence++;
+
+                service.program();
+                NVIC_EnableIRQ(irq);
+            }
+
+            static uint32_t prescaler() {
+                uint32_t ratio = P::bus::timer_freq() / TICK_HZ;
+                return ratio == 0 ? 0 : ratio > 0x10000 ? 0xFFFF : ratio - 1;
+            }
+
+            void dispatch() {
+                bool fired = true;
+                while (fired) {
+                    fired = false;
+                    uint64_t time = now();
+
+                    for (unsigned i = 0; i < SLOTS; i++) {
+                        if (slots[i].callback && slots[i].deadline <= time) {
+                            Slot slot = slots[i];
+                            slots[i].callback = nullptr;
+                            slot.callback(slot.context);
+                            fired = true;
+                        }
+                    }
+                }
+
+                program();
+            }
+
+            // Moves the end of the current period to the next deadline. The caller
+            // keeps the update interrupt from running.
+            void program() {
+                for (;;) {
+                    if (periph_base->SR & TIM_SR_UIF)
+                        return; // the interrupt will reprogram
+
+                    uint64_t next = nextDeadline();
+                    uint32_t count = periph_base->CNT;
+
+                    uint64_t reload = next == never ? max_reload :
+                                      next <= base ? 0 :
+                                      next - base - 1 > max_reload ? max_reload : next - base - 1;
+                    if (reload < (uint64_t) count + margin)
+                        reload = (uint64_t) count + margin > max_reload ? max_reload : count + margin;
+
+                    periph_base->ARR = (uint32_t) reload;
+
+                    // A higher priority interrupt between the read and the write may have
+                    // let the counter past the new end, where it would run to the top of
+                    // the counter before updating: the period is closed here instead.
+                    // At the end itself the update comes normally
+                    uint32_t after = periph_base->CNT;
+                    if (after <= reload || (periph_base->SR & TIM_SR_UIF))
+                        return;
+
+                    sequence++;
+                    base += after;
+                    periph_base->EGR = TIM_EGR_UG;
+                    sequence++;
+                }
+            }
+        };
+    }
+}
+
+#endif //TIMER_SERVICE_HPP
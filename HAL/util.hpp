@@ -9,6 +9,11 @@
 #include "miosix.h"
 #endif
 
+// The bundled CMSIS header names the timer counter enable bit CCR1_CEN
+#if !defined(TIM_CR1_CEN) && defined(CCR1_CEN)
+#define TIM_CR1_CEN CCR1_CEN
+#endif
+
 namespace HAL {
     /**
      * __pointer (type)
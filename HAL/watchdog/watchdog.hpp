@@ -0,0 +1,331 @@
+#ifndef WATCHDOG_HPP
+#define WATCHDOG_HPP
+
+#include "../peripheral.hpp"
+#include "../rtc/rtc.hpp"
+#include "../backup/backup_sram.hpp"
+
+namespace HAL {
+    namespace Watchdog {
+        typedef IWDG_TypeDef raw_iwdg_t;
+        typedef WWDG_TypeDef raw_wwdg_t;
+
+        /**
+         * Independent (type)
+         *
+         * Independent watchdog, clocked by the LSI: it keeps running whatever happens to
+         * the main clocks, and can't be stopped once started.
+         */
+        class Independent {
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_iwdg_t* const periph_base = (raw_iwdg_t*) Peripheral::p_IWDG::periph_base;
+
+            static constexpr uint32_t max_reload = 0x1000;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            /**
+             * Starts the watchdog (and the LSI).
+             *
+             * @param timeout_us: time without kick() before the reset, up to 32 s
+             * @param lsi_freq: the LSI frequency, nominal or measured
+             *        (Clock::Calibration::measureLsi()): it is 17-47 kHz
+             * @return the timeout programmed, in us, 0 if too long
+             */
+            static uint32_t start(uint32_t timeout_us, uint32_t lsi_freq = Rtc::lsi_freq) {
+                uint64_t counts = (uint64_t) timeout_us * lsi_freq / 1000000;
+
+                // Prescaler 4 << pr
+                uint32_t pr = 0;
+                while (pr < 6 && counts > (uint64_t) max_reload << (pr + 2))
+                    pr++;
+
+                uint64_t reload = counts >> (pr + 2);
+                if (reload > max_reload)
+                    return 0;
+                if (reload == 0)
+                    reload = 1;
+
+                periph_base->KR = 0xCCCC;
+                periph_base->KR = 0x5555;
+                periph_base->PR = pr;
+                periph_base->RLR = reload - 1;
+                while (periph_base->SR & (IWDG_SR_PVU | IWDG_SR_RVU));
+                kick();
+
+                return (uint32_t) ((reload << (pr + 2)) * 1000000 / lsi_freq);
+            }
+
+            static void kick() {
+                periph_base->KR = 0xAAAA;
+            }
+        };
+
+        /**
+         * Window (type)
+         *
+         * Window watchdog, clocked by PCLK1 / 4096: it resets the core when it isn't
+         * kicked within the timeout, and also when it is kicked too early, before the
+         * window opens. One tick before the reset it raises the early wakeup interrupt
+         * (WWDG_IRQn), the last chance to save a diagnosis.
+         */
+        class Window {
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr raw_wwdg_t* const periph_base = (raw_wwdg_t*) Peripheral::p_WWDG::periph_base;
+
+            // The reset comes when the counter drops below this
+            static constexpr uint32_t min_counter = 0x40;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            /**
+             * Starts the watchdog. At 42 MHz PCLK1 the timeout is at most 49.9 ms.
+             *
+             * @param timeout_us: time after a kick before the reset
+             * @param min_period_us: time after a kick before the next one is allowed
+             * @param early_wakeup: enables the early wakeup interrupt
+             * @return false if timeout_us is out of range
+             */
+            static bool start(uint32_t timeout_us, uint32_t min_period_us, bool early_wakeup = true) {
+                uint32_t pclk = Peripheral::p_WWDG::bus::bus_freq();
+
+                // Ticks of 4096 << wdgtb PCLK1 periods
+                uint32_t wdgtb = 0;
+                uint64_t ticks = 0;
+                for (; wdgtb < 4; wdgtb++) {
+                    ticks = (uint64_t) timeout_us * pclk / (4096ull << wdgtb) / 1000000;
+                    if (ticks <= 64)
+                        break;
+                }
+                if (wdgtb == 4 || ticks == 0)
+                    return false;
+
+                uint64_t closed = (uint64_t) min_period_us * pclk / (4096ull << wdgtb) / 1000000;
+                uint32_t window = closed >= ticks ? min_counter : (uint32_t) (min_counter - 1 + ticks - closed);
+
+                reloadValue() = min_counter - 1 + ticks;
+                Peripheral::p_WWDG::enable();
+                periph_base->CFR = (wdgtb * WWDG_CFR_WDGTB0) | window | (early_wakeup ? WWDG_CFR_EWI : 0);
+                periph_base->SR = 0;
+                periph_base->CR = WWDG_CR_WDGA | reloadValue();
+
+                if (early_wakeup) {
+                    NVIC_ClearPendingIRQ(WWDG_IRQn);
+                    NVIC_EnableIRQ(WWDG_IRQn);
+                }
+                return true;
+            }
+
+            /**
+             * @return true if kick() now would reset the core
+             */
+            static bool early() {
+                return (periph_base->CR & WWDG_CR_T) > (periph_base->CFR & WWDG_CFR_W);
+            }
+
+            static void kick() {
+                periph_base->CR = WWDG_CR_WDGA | reloadValue();
+            }
+
+            /**
+             * Clears the early wakeup flag: call it from WWDG_IRQHandler().
+             */
+            static void clearEarlyWakeup() {
+                periph_base->SR = 0;
+            }
+
+        private:
+            // Counter value programmed by start()
+            static uint32_t& reloadValue() {
+                static uint32_t value = WWDG_CR_T;
+                return value;
+            }
+        };
+
+        /**
+         * Why the supervisor let the watchdogs reset the core.
+         */
+        enum class Fault : uint32_t {
+            STARVED,
+            EARLY_KICK
+        };
+
+        /**
+         * Diagnosis saved in backup SRAM before a watchdog reset.
+         *
+         * task: the first task found starving, Supervisor::aggregator if poll() itself
+         *       stopped running
+         * missed: the aggregator rounds it missed
+         */
+        struct Report {
+            Fault fault;
+            uint32_t task;
+            uint32_t missed;
+        };
+
+        // Default place of the report: the end of the backup SRAM
+        constexpr uint32_t report_offset = Backup::sram_size - Backup::detail::recordSize<Report>();
+
+        /**
+         * Supervisor (type)
+         *
+         * Kicks the watchdogs only while every registered task or interrupt handler is
+         * alive. Each one checks in with checkIn(), a single word store, at least once
+         * every max_rounds rounds of the aggregator, poll(), called periodically from a
+         * low priority context (e.g. a timer callback or the idle thread).
+         *
+         * poll() consumes the heartbeats and kicks the independent watchdog and, if used, the
+         * window one. When a task misses its rounds, poll() saves a Report in backup SRAM
+         * and stops kicking, so the watchdog resets the core; the window watchdog also
+         * resets it if poll() runs too early (a runaway loop) and, through onEarlyWakeup(),
+         * saves a report if poll() stops running altogether. previousFault() reads it
+         * back after the reset.
+         *
+         * Example:
+         *     Watchdog::Supervisor<4> supervisor;
+         *     int control = supervisor.add(2);
+         *     Watchdog::Independent::start(100000);
+         *     Watchdog::Window::start(40000, 10000);
+         *     void controlLoop() { ...; supervisor.checkIn(control); }
+         *     void every20ms() { supervisor.poll(); }
+         *     void WWDG_IRQHandler() { supervisor.onEarlyWakeup(); }
+         *
+         * Backup::Domain::enable() must have been called.
+         */
+        template<unsigned N, typename RECORD = Backup::Record<Report, report_offset>>
+        class Supervisor {
+            //***************************
+            //* Members                 *
+            //***************************
+        public:
+            static constexpr uint32_t aggregator = 0xFFFFFFFF;
+
+        private:
+            volatile uint32_t beats[N];
+            uint16_t allowed[N];
+            uint16_t missed[N];
+            unsigned count = 0;
+            int starving = -1;
+            bool window;
+            bool reported = false;
+            RECORD record;
+
+            //***************************
+            //* Methods                 *
+            //***************************
+        public:
+            /**
+             * @param window: also kick the window watchdog, started with Window::start()
+             */
+            Supervisor(bool window = true) : window(window) {
+                for (unsigned i = 0; i < N; i++) {
+                    beats[i] = 0;
+                    missed[i] = 0;
+                }
+            }
+
+            /**
+             * Registers a task, before the watchdogs start.
+             *
+             * @param max_rounds: aggregator rounds the task may miss in a row
+             * @return the task handle for checkIn(), -1 if N tasks are registered
+             */
+            int add(uint16_t max_rounds = 1) {
+                if (count >= N)
+                    return -1;
+
+                allowed[count] = max_rounds;
+                beats[count] = 1;
+                return count++;
+            }
+
+            /**
+             * Heartbeat: safe from any thread or interrupt.
+             */
+            void checkIn(int task) {
+                beats[task] = 1;
+            }
+
+            /**
+             * Aggregator round.
+             *
+             * @return true if the watchdogs were kicked
+             */
+            bool poll() {
+                if (starving >= 0)
+                    return false;
+
+                for (unsigned i = 0; i < count; i++) {
+                    // Read and clear in one go (LDREX/STREX): a check-in can't slip between
+                    // the two and be lost
+                    if (__atomic_exchange_n(&beats[i], 0, __ATOMIC_RELAXED)) {
+                        missed[i] = 0;
+                    } else if (++missed[i] > allowed[i]) {
+                        starving = i;
+                        save(Fault::STARVED, i, missed[i]);
+                        return false;
+                    }
+                }
+
+                if (window) {
+                    if (Window::early())
+                        save(Fault::EARLY_KICK, aggregator, 0);
+                    Window::kick();
+                }
+                Independent::kick();
+                return true;
+            }
+
+            /**
+             * Window watchdog early wakeup: call it from WWDG_IRQHandler(). The reset
+             * follows within one watchdog tick.
+             */
+            void onEarlyWakeup() {
+                Window::clearEarlyWakeup();
+                save(Fault::STARVED, aggregator, 0);
+            }
+
+            /**
+             * @return the starving task, -1 while all are alive
+             */
+            int starvingTask() const {
+                return starving;
+            }
+
+            /**
+             * Reads (and discards) the report saved before the last reset, if that was a
+             * watchdog reset.
+             */
+            bool previousFault(Report& report) {
+                Backup::ResetCause cause = Backup::Domain::resetCause(false);
+                if (cause != Backup::ResetCause::INDEPENDENT_WATCHDOG && cause != Backup::ResetCause::WINDOW_WATCHDOG)
+                    return false;
+
+                bool valid = record.load(report);
+                record.invalidate();
+                return valid;
+            }
+
+        private:
+            void save(Fault fault, uint32_t task, uint32_t rounds) {
+                if (reported)
+                    return;
+
+                reported = true;
+                record.store(Report{fault, task, rounds});
+            }
+        };
+    }
+}
+
+#endif //WATCHDOG_HPP
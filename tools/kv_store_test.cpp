@@ -0,0 +1,218 @@
+/**
+ * kv_store_test
+ *
+ * Host test of Flash::KvStore on a Flash::RamFlash model:
+ * - random writes and removes checked against a reference map, remounting the
+ *   store now and then as after a reset;
+ * - power cuts: every operation of a random sequence is replayed with the power cut
+ *   after each programmed byte in turn (so at every program and erase step, inside
+ *   compactions too); after each cut the store is remounted and must hold either
+ *   the state before the operation or the one after it.
+ *
+ * Build: g++ -std=c++11 -O2 -I../HAL -o kv_store_test kv_store_test.cpp
+ * Usage: kv_store_test [seed]
+ */
+
+#include "flash/kv_store.hpp"
+#include "flash/ram_flash.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+using namespace HAL;
+
+typedef Flash::RamFlash<1024, 4> Storage;
+typedef Flash::KvStore<Storage, 64> Store;
+typedef std::map<uint16_t, std::vector<uint8_t>> Reference;
+
+static const unsigned key_count = 24;
+static const unsigned max_length = 40;
+
+struct Operation {
+    bool remove;
+    uint16_t key;
+    std::vector<uint8_t> value;
+};
+
+static uint32_t random_state;
+
+static uint32_t randomNumber()
+{
+    // xorshift32
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static Operation randomOperation()
+{
+    Operation op;
+    op.remove = randomNumber() % 5 == 0;
+    op.key = randomNumber() % key_count;
+    if (!op.remove) {
+        op.value.resize(randomNumber() % (max_length + 1));
+        for (size_t i = 0; i < op.value.size(); i++)
+            op.value[i] = randomNumber();
+    }
+    return op;
+}
+
+static bool applyTo(Store& store, const Operation& op)
+{
+    return op.remove ? store.remove(op.key) : store.write(op.key, op.value.data(), op.value.size());
+}
+
+static void applyTo(Reference& reference, const Operation& op)
+{
+    if (op.remove)
+        reference.erase(op.key);
+    else
+        reference[op.key] = op.value;
+}
+
+// The store holds exactly the keys and values of reference
+static bool matches(const Store& store, const Reference& reference)
+{
+    if (store.size() != reference.size())
+        return false;
+
+    for (uint16_t key = 0; key < key_count; key++) {
+        Reference::const_iterator it = reference.find(key);
+        uint32_t length = 0;
+        const uint8_t *value = store.find(key, length);
+
+        if (it == reference.end()) {
+            if (value)
+                return false;
+        } else if (!value || length != it->second.size() || memcmp(value, it->second.data(), length) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool randomOperations(unsigned count)
+{
+    static Storage flash;
+    Reference reference;
+    Store *store = new Store(flash);
+
+    if (!store->format()) {
+        printf("random: format failed\n");
+        return false;
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        Operation op = randomOperation();
+        if (!applyTo(*store, op)) {
+            printf("random: operation %u failed\n", i);
+            return false;
+        }
+        applyTo(reference, op);
+
+        // Reset now and then: the index is rebuilt from flash
+        if (randomNumber() % 50 == 0) {
+            delete store;
+            store = new Store(flash);
+            if (!store->mount()) {
+                printf("random: mount failed after operation %u\n", i);
+                return false;
+            }
+        }
+
+        if (!matches(*store, reference)) {
+            printf("random: mismatch after operation %u\n", i);
+            return false;
+        }
+    }
+
+    uint32_t least = ~0u, most = 0;
+    for (unsigned s = 0; s < Storage::sector_count; s++) {
+        least = flash.eraseCount(s) < least ? flash.eraseCount(s) : least;
+        most = flash.eraseCount(s) > most ? flash.eraseCount(s) : most;
+    }
+    printf("random: %u operations, sector erases %u to %u\n", count, least, most);
+
+    delete store;
+    return true;
+}
+
+static bool powerCuts(unsigned count)
+{
+    static Storage flash;
+    static Storage before;
+    Reference reference;
+    unsigned cuts = 0;
+
+    {
+        Store store(flash);
+        if (!store.format()) {
+            printf("power: format failed\n");
+            return false;
+        }
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        Operation op = randomOperation();
+        Reference after = reference;
+        applyTo(after, op);
+        before = flash;
+
+        // The power goes after 0, 1, 2... bytes, until the operation completes
+        for (uint32_t budget = 0;; budget++) {
+            flash = before;
+
+            bool done;
+            {
+                Store store(flash);
+                if (!store.mount()) {
+                    printf("power: mount failed before operation %u\n", i);
+                    return false;
+                }
+                flash.cutPowerAfter(budget);
+                done = applyTo(store, op);
+                flash.restorePower();
+            }
+
+            Store store(flash);
+            if (!store.mount()) {
+                printf("power: mount failed, operation %u cut after %u bytes\n", i, budget);
+                return false;
+            }
+
+            bool old_state = matches(store, reference);
+            bool new_state = matches(store, after);
+            if (!old_state && !new_state) {
+                printf("power: corrupted store, operation %u cut after %u bytes\n", i, budget);
+                return false;
+            }
+            if (done && !new_state) {
+                printf("power: operation %u reported done but lost, cut after %u bytes\n", i, budget);
+                return false;
+            }
+
+            if (done)
+                break;
+            cuts++;
+        }
+
+        reference = after;
+    }
+
+    printf("power: %u operations, %u power cuts\n", count, cuts);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    random_state = argc > 1 ? (uint32_t) strtoul(argv[1], nullptr, 0) : 0x2545F491;
+    if (random_state == 0)
+        random_state = 1;
+
+    bool ok = randomOperations(20000) && powerCuts(1000);
+    printf(ok ? "PASS\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+/**
+ * la2vcd
+ *
+ * Converts a capture exported by Gpio::LogicAnalyzer::exportRle() into a Value
+ * Change Dump file, readable by GTKWave, PulseView and most waveform viewers.
+ * Each channel of the capture mask becomes a wire named after the port pin, and
+ * the trigger sample is marked by a one-sample pulse on the "trigger" wire.
+ *
+ * Build: g++ -std=c++11 -O2 -o la2vcd la2vcd.cpp
+ * Usage: la2vcd capture.bin [capture.vcd] [port letter]
+ */
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+static uint32_t get(const std::vector<uint8_t>& data, size_t pos, unsigned bytes)
+{
+    uint32_t value = 0;
+    for (unsigned b = 0; b < bytes; b++)
+        value |= (uint32_t) data[pos + b] << (8 * b);
+    return value;
+}
+
+// One VCD identifier per channel, plus '~' for the trigger
+static char identifier(unsigned channel)
+{
+    return '!' + channel;
+}
+
+struct TriggerEdge {
+    uint64_t time;
+    char level;
+};
+
+// Writes the trigger edges that come strictly before sample
+static void flushTrigger(FILE *out, const TriggerEdge *edges, unsigned& next, uint64_t sample, uint64_t period)
+{
+    while (next < 2 && edges[next].time < sample) {
+        fprintf(out, "#%llu\n%c~\n", (unsigned long long) (edges[next].time * period), edges[next].level);
+        next++;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s capture.bin [capture.vcd] [port letter]\n", argv[0]);
+        return 1;
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (!in) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    std::vector<uint8_t> data;
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0)
+        data.insert(data.end(), chunk, chunk + n);
+    fclose(in);
+
+    const size_t header_size = 19;
+    if (data.size() < header_size || memcmp(&data[0], "LARL", 4) != 0 || data[4] != 1) {
+        fprintf(stderr, "%s: not a logic analyzer capture (or unsupported version)\n", argv[1]);
+        return 1;
+    }
+
+    uint16_t mask = get(data, 5, 2);
+    uint32_t sample_freq = get(data, 7, 4);
+    uint32_t samples = get(data, 11, 4);
+    uint32_t trigger = get(data, 15, 4);
+
+    if (sample_freq == 0) {
+        fprintf(stderr, "%s: invalid sample frequency\n", argv[1]);
+        return 1;
+    }
+
+    FILE *out = argc > 2 ? fopen(argv[2], "w") : stdout;
+    if (!out) {
+        perror(argv[2]);
+        return 1;
+    }
+    char port = argc > 3 ? argv[3][0] : 'x';
+
+    // One timestamp unit per sample: express the period in the finest unit
+    // that keeps it integer, down to picoseconds
+    static const char *units[] = {"s", "ms", "us", "ns", "ps"};
+    unsigned unit = 0;
+    uint64_t scale = 1;
+    while (unit < 4 && scale % sample_freq != 0) {
+        scale *= 1000;
+        unit++;
+    }
+    uint64_t period = scale / sample_freq;
+    if (period == 0)
+        period = 1;
+
+    fprintf(out, "$comment %u samples at %u Hz, trigger at sample %u $end\n", samples, sample_freq, trigger);
+    fprintf(out, "$timescale 1 %s $end\n", units[unit]);
+    fprintf(out, "$scope module P%c $end\n", port);
+    for (unsigned channel = 0; channel < 16; channel++)
+        if (mask & (1u << channel))
+            fprintf(out, "$var wire 1 %c P%c%u $end\n", identifier(channel), port, channel);
+    fprintf(out, "$var wire 1 ~ trigger $end\n");
+    fprintf(out, "$upscope $end\n$enddefinitions $end\n");
+
+    size_t pos = header_size;
+    uint32_t sample = 0;
+    bool first = true;
+    uint16_t last = 0;
+
+    // Rising and falling edge of the trigger pulse
+    TriggerEdge edges[2] = {{trigger, '1'}, {trigger + 1, '0'}};
+    unsigned next_edge = 0;
+
+    while (pos < data.size() && sample < samples) {
+        uint32_t run = 0;
+        unsigned shift = 0;
+        while (pos < data.size() && (data[pos] & 0x80)) {
+            run |= (uint32_t) (data[pos++] & 0x7F) << shift;
+            shift += 7;
+        }
+        if (pos + 3 > data.size()) {
+            fprintf(stderr, "%s: truncated capture\n", argv[1]);
+            break;
+        }
+        run |= (uint32_t) data[pos++] << shift;
+        uint16_t value = get(data, pos, 2);
+        pos += 2;
+
+        // Trigger pulse edges falling inside the previous run
+        flushTrigger(out, edges, next_edge, sample, period);
+
+        fprintf(out, "#%llu\n", (unsigned long long) (sample * period));
+        if (next_edge < 2 && edges[next_edge].time == sample)
+            fprintf(out, "%c~\n", edges[next_edge++].level);
+        else if (first)
+            fprintf(out, "0~\n");
+
+        for (unsigned channel = 0; channel < 16; channel++) {
+            uint16_t bit = 1u << channel;
+            if ((mask & bit) && (first || ((value ^ last) & bit)))
+                fprintf(out, "%c%c\n", (value & bit) ? '1' : '0', identifier(channel));
+        }
+
+        first = false;
+        last = value;
+        sample += run;
+    }
+
+    flushTrigger(out, edges, next_edge, sample, period);
+    fprintf(out, "#%llu\n", (unsigned long long) (sample * period));
+
+    if (out != stdout)
+        fclose(out);
+
+    return 0;
+}